@@ -0,0 +1,187 @@
+//
+// Micro-benchmarks for the ettus_core hot path. Every kernel reports
+// items_per_second, where an item is one complex sample (per channel).
+//
+//   ./bench_core --benchmark_filter=convert
+//
+
+#include "block_buffer.hpp"
+#include "convert.hpp"
+#include "file_sink.hpp"
+#include "sample_layout.hpp"
+#include "wavetable.hpp"
+#include <benchmark/benchmark.h>
+#include <complex>
+#include <vector>
+
+/***********************************************************************
+ * Wave table fill (transmit_worker)
+ **********************************************************************/
+static void BM_wave_table_fill(benchmark::State& state)
+{
+    const wave_table_class wave_table("SINE", 0.3f);
+    block_buffer<std::complex<float>> buff(1, state.range(0));
+    size_t index = 0;
+    for (auto _ : state) {
+        index = wave_table.fill(buff[0], buff.samps_per_buff(), index, 3);
+        benchmark::DoNotOptimize(buff[0]);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_wave_table_fill)->Arg(2000)->Arg(1 << 16);
+
+/***********************************************************************
+ * Format converters
+ **********************************************************************/
+template <typename in_type,
+    typename out_type,
+    void (*convert)(const in_type*, out_type*, size_t)>
+static void BM_convert(benchmark::State& state)
+{
+    const size_t n = state.range(0);
+    block_buffer<in_type> in(1, n);
+    block_buffer<out_type> out(1, n);
+    for (size_t i = 0; i < n; i++) {
+        in[0][i] = in_type(i % 1000, -(i % 777));
+    }
+    for (auto _ : state) {
+        convert(in[0], out[0], n);
+        benchmark::DoNotOptimize(out[0]);
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+    state.SetBytesProcessed(state.iterations() * n * sizeof(in_type));
+}
+BENCHMARK_TEMPLATE(BM_convert,
+    std::complex<short>,
+    std::complex<float>,
+    convert_sc16_to_fc32)
+    ->Name("BM_convert_sc16_to_fc32")
+    ->Arg(1 << 16);
+BENCHMARK_TEMPLATE(BM_convert,
+    std::complex<float>,
+    std::complex<short>,
+    convert_fc32_to_sc16)
+    ->Name("BM_convert_fc32_to_sc16")
+    ->Arg(1 << 16);
+BENCHMARK_TEMPLATE(BM_convert,
+    std::complex<short>,
+    std::complex<double>,
+    convert_sc16_to_fc64)
+    ->Name("BM_convert_sc16_to_fc64")
+    ->Arg(1 << 16);
+BENCHMARK_TEMPLATE(BM_convert,
+    std::complex<double>,
+    std::complex<short>,
+    convert_fc64_to_sc16)
+    ->Name("BM_convert_fc64_to_sc16")
+    ->Arg(1 << 16);
+BENCHMARK_TEMPLATE(BM_convert,
+    std::complex<float>,
+    std::complex<double>,
+    convert_fc32_to_fc64)
+    ->Name("BM_convert_fc32_to_fc64")
+    ->Arg(1 << 16);
+BENCHMARK_TEMPLATE(BM_convert,
+    std::complex<double>,
+    std::complex<float>,
+    convert_fc64_to_fc32)
+    ->Name("BM_convert_fc64_to_fc32")
+    ->Arg(1 << 16);
+BENCHMARK_TEMPLATE(BM_convert,
+    std::complex<int8_t>,
+    std::complex<float>,
+    convert_sc8_to_fc32)
+    ->Name("BM_convert_sc8_to_fc32")
+    ->Arg(1 << 16);
+BENCHMARK_TEMPLATE(BM_convert,
+    std::complex<float>,
+    std::complex<int8_t>,
+    convert_fc32_to_sc8)
+    ->Name("BM_convert_fc32_to_sc8")
+    ->Arg(1 << 16);
+
+//! sc12 packing, items are complex samples on the sc16 side
+static void BM_convert_sc16_to_sc12(benchmark::State& state)
+{
+    const size_t n = state.range(0);
+    block_buffer<std::complex<short>> in(1, n);
+    std::vector<uint8_t> out(3 * n);
+    for (size_t i = 0; i < n; i++) {
+        in[0][i] = std::complex<short>(i % 1000, -(i % 777));
+    }
+    for (auto _ : state) {
+        convert_sc16_to_sc12(in[0], &out.front(), n);
+        benchmark::DoNotOptimize(&out.front());
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+    state.SetBytesProcessed(state.iterations() * n * sizeof(std::complex<short>));
+}
+BENCHMARK(BM_convert_sc16_to_sc12)->Arg(1 << 16);
+
+static void BM_convert_sc12_to_sc16(benchmark::State& state)
+{
+    const size_t n = state.range(0);
+    std::vector<uint8_t> in(3 * n);
+    block_buffer<std::complex<short>> out(1, n);
+    for (size_t i = 0; i < in.size(); i++) {
+        in[i] = uint8_t(i * 37);
+    }
+    for (auto _ : state) {
+        convert_sc12_to_sc16(&in.front(), out[0], n);
+        benchmark::DoNotOptimize(out[0]);
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+    state.SetBytesProcessed(state.iterations() * n * 3);
+}
+BENCHMARK(BM_convert_sc12_to_sc16)->Arg(1 << 16);
+
+//! I/Q split for the planar and blocked file layouts
+static void BM_deinterleave_sc16(benchmark::State& state)
+{
+    const size_t n = state.range(0);
+    block_buffer<std::complex<short>> in(1, n);
+    std::vector<short> i_out(n), q_out(n);
+    for (size_t i = 0; i < n; i++) {
+        in[0][i] = std::complex<short>(i % 1000, -(i % 777));
+    }
+    for (auto _ : state) {
+        deinterleave_samples(in[0], sample_format::sc16, &i_out.front(), &q_out.front(), n);
+        benchmark::DoNotOptimize(&i_out.front());
+        benchmark::DoNotOptimize(&q_out.front());
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+    state.SetBytesProcessed(state.iterations() * n * sizeof(std::complex<short>));
+}
+BENCHMARK(BM_deinterleave_sc16)->Arg(1 << 16);
+
+/***********************************************************************
+ * Writers (recv_to_file)
+ * One channel of sc16 into /dev/null, so only the writer path is timed
+ **********************************************************************/
+static void BM_file_sink_write(benchmark::State& state)
+{
+    const size_t spb = state.range(0);
+    block_buffer<std::complex<short>> buffs(1, spb);
+    file_sink sink("/dev/null", 1);
+
+    sample_block block;
+    block.buffs        = reinterpret_cast<void* const*>(&buffs.ptrs().front());
+    block.num_channels = 1;
+    block.first_chan   = 0;
+    block.num_samps    = spb;
+    block.samp_size    = sizeof(std::complex<short>);
+    block.first_samp   = 0;
+    block.time_secs    = 0.0;
+    block.ref          = nullptr;
+    block.rate         = 25e6;
+    for (auto _ : state) {
+        sink.write(block);
+        block.first_samp += spb;
+    }
+    sink.close();
+    state.SetItemsProcessed(state.iterations() * spb);
+    state.SetBytesProcessed(state.iterations() * spb * block.samp_size);
+}
+BENCHMARK(BM_file_sink_write)->Arg(364)->Arg(1 << 16);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+/***********************************************************************
+ * block_buffer
+ * One contiguous, aligned allocation holding samps_per_buff samples for
+ * each channel. Channel rows start on an alignment boundary so they can
+ * be handed to SIMD kernels and to the streamers without copies.
+ **********************************************************************/
+template <typename samp_type>
+class block_buffer
+{
+public:
+    block_buffer(size_t num_channels, size_t samps_per_buff, size_t alignment = 64)
+        : _samps_per_buff(samps_per_buff), _mem(nullptr)
+    {
+        // round each channel row up to the alignment boundary
+        const size_t row_bytes =
+            (samps_per_buff * sizeof(samp_type) + alignment - 1) / alignment * alignment;
+        if (posix_memalign(&_mem, alignment, row_bytes * num_channels) != 0) {
+            throw std::bad_alloc();
+        }
+        for (size_t i = 0; i < num_channels; i++) {
+            _ptrs.push_back(reinterpret_cast<samp_type*>(
+                static_cast<char*>(_mem) + i * row_bytes));
+        }
+    }
+
+    ~block_buffer()
+    {
+        free(_mem);
+    }
+
+    block_buffer(const block_buffer&) = delete;
+    block_buffer& operator=(const block_buffer&) = delete;
+
+    inline samp_type* operator[](const size_t chan) const
+    {
+        return _ptrs[chan];
+    }
+
+    //! Per-channel pointers, in the form the streamers expect
+    inline const std::vector<samp_type*>& ptrs() const
+    {
+        return _ptrs;
+    }
+
+    inline size_t num_channels() const
+    {
+        return _ptrs.size();
+    }
+
+    inline size_t samps_per_buff() const
+    {
+        return _samps_per_buff;
+    }
+
+private:
+    size_t _samps_per_buff;
+    void* _mem;
+    std::vector<samp_type*> _ptrs;
+};
@@ -0,0 +1,309 @@
+#include "block_stats.hpp"
+#include "convert.hpp"
+#include "stream_common.hpp"
+#include "thread_topology.hpp"
+#include <boost/format.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+static const char stats_magic[8] = {'E', 'T', 'S', 'T', 'A', 'T', 'S', '1'};
+
+/***********************************************************************
+ * Kernel
+ **********************************************************************/
+// Partial results per lane keep the reductions independent, so the
+// compiler can vectorise them without -ffast-math. acc_type is wide
+// enough for a lane's sums over one recv block.
+template <typename scalar_type, typename acc_type>
+static void measure(const scalar_type* iq, size_t n, acc_type clip, sample_sums& sums)
+{
+    static const size_t lanes = 8;
+    const acc_type hi         = std::numeric_limits<acc_type>::max();
+    const acc_type lo         = std::numeric_limits<acc_type>::lowest();
+    acc_type si[lanes] = {}, sq[lanes] = {}, sp[lanes] = {}, mp[lanes] = {};
+    acc_type mn_i[lanes], mx_i[lanes], mn_q[lanes], mx_q[lanes];
+    uint32_t nc[lanes] = {};
+    for (size_t l = 0; l < lanes; l++) {
+        mn_i[l] = mn_q[l] = hi;
+        mx_i[l] = mx_q[l] = lo;
+    }
+    size_t k = 0;
+    for (; k + lanes <= n; k += lanes) {
+        for (size_t l = 0; l < lanes; l++) {
+            const acc_type i = iq[2 * (k + l)], q = iq[2 * (k + l) + 1];
+            const acc_type p = i * i + q * q;
+            si[l] += i;
+            sq[l] += q;
+            sp[l] += p;
+            mp[l]   = p > mp[l] ? p : mp[l];
+            mn_i[l] = i < mn_i[l] ? i : mn_i[l];
+            mx_i[l] = i > mx_i[l] ? i : mx_i[l];
+            mn_q[l] = q < mn_q[l] ? q : mn_q[l];
+            mx_q[l] = q > mx_q[l] ? q : mx_q[l];
+            nc[l] += (i >= clip or -i >= clip or q >= clip or -q >= clip) ? 1 : 0;
+        }
+    }
+    for (; k < n; k++) {
+        const acc_type i = iq[2 * k], q = iq[2 * k + 1];
+        const acc_type p = i * i + q * q;
+        si[0] += i;
+        sq[0] += q;
+        sp[0] += p;
+        mp[0]   = std::max(mp[0], p);
+        mn_i[0] = std::min(mn_i[0], i);
+        mx_i[0] = std::max(mx_i[0], i);
+        mn_q[0] = std::min(mn_q[0], q);
+        mx_q[0] = std::max(mx_q[0], q);
+        nc[0] += (i >= clip or -i >= clip or q >= clip or -q >= clip) ? 1 : 0;
+    }
+    for (size_t l = 0; l < lanes; l++) {
+        sums.sum_i += double(si[l]);
+        sums.sum_q += double(sq[l]);
+        sums.sum_power += double(sp[l]);
+        sums.max_power = std::max(sums.max_power, double(mp[l]));
+        if (mn_i[l] <= mx_i[l]) { // the lane saw a sample
+            sums.min_i = std::min(sums.min_i, double(mn_i[l]));
+            sums.max_i = std::max(sums.max_i, double(mx_i[l]));
+            sums.min_q = std::min(sums.min_q, double(mn_q[l]));
+            sums.max_q = std::max(sums.max_q, double(mx_q[l]));
+        }
+        sums.clipped += nc[l];
+    }
+}
+
+sample_sums::sample_sums()
+    : sum_i(0)
+    , sum_q(0)
+    , sum_power(0)
+    , max_power(0)
+    , min_i(std::numeric_limits<double>::infinity())
+    , max_i(-std::numeric_limits<double>::infinity())
+    , min_q(std::numeric_limits<double>::infinity())
+    , max_q(-std::numeric_limits<double>::infinity())
+    , clipped(0)
+{
+}
+
+void measure_samples(const char* samps, size_t samp_size, size_t n, sample_sums& sums)
+{
+    switch (samp_size) {
+        case sizeof(std::complex<int8_t>):
+            measure(reinterpret_cast<const int8_t*>(samps), n, int64_t(127), sums);
+            break;
+        case sizeof(std::complex<short>):
+            measure(reinterpret_cast<const short*>(samps), n, int64_t(32767), sums);
+            break;
+        case sizeof(std::complex<float>):
+            measure(reinterpret_cast<const float*>(samps), n, 1.0f, sums);
+            break;
+        case sizeof(std::complex<double>):
+            measure(reinterpret_cast<const double*>(samps), n, 1.0, sums);
+            break;
+        default:
+            throw std::runtime_error("measure_samples: unsupported sample size");
+    }
+}
+
+/***********************************************************************
+ * Reader
+ **********************************************************************/
+std::vector<block_stats_record> read_block_stats(
+    const std::string& stats_file, block_stats_header* header)
+{
+    std::vector<block_stats_record> records;
+    std::ifstream in(stats_file.c_str(), std::ios::binary);
+    block_stats_header h;
+    if (not in.read(reinterpret_cast<char*>(&h), sizeof(h))
+        or std::memcmp(h.magic, stats_magic, sizeof(stats_magic)) != 0
+        or h.record_size != sizeof(block_stats_record)) {
+        return records;
+    }
+    in.seekg(h.header_size);
+    block_stats_record r;
+    while (in.read(reinterpret_cast<char*>(&r), sizeof(r))) {
+        records.push_back(r);
+    }
+    if (header) {
+        *header = h;
+    }
+    return records;
+}
+
+/***********************************************************************
+ * block_stats
+ **********************************************************************/
+block_stats::block_stats(const std::string& file,
+    size_t num_channels,
+    size_t samp_size,
+    double rate,
+    size_t block_samps,
+    capture_metadata::sptr metadata,
+    size_t num_slots)
+    : _samp_size(samp_size)
+    , _block_samps(block_samps)
+    , _slots(num_slots)
+    , _running(true)
+    , _blocks_dropped(0)
+    , _records(0)
+{
+    block_stats_header header;
+    std::memcpy(header.magic, stats_magic, sizeof(stats_magic));
+    header.header_size = sizeof(block_stats_header);
+    header.record_size = sizeof(block_stats_record);
+    header.block_samps = block_samps;
+    header.rate        = rate;
+
+    boost::property_tree::ptree files;
+    for (size_t c = 0; c < num_channels; c++) {
+        const std::string name =
+            generate_out_filename(file, num_channels, c) + ".stats";
+        std::unique_ptr<channel> ch(new channel());
+        ch->out.open(name.c_str(), std::ios::binary | std::ios::trunc);
+        if (not ch->out.is_open()) {
+            throw std::runtime_error("Unable to open " + name);
+        }
+        ch->out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        ch->block_index = 0;
+        ch->num_samps   = 0;
+        _channels.push_back(std::move(ch));
+
+        boost::property_tree::ptree entry;
+        entry.put("", name);
+        files.push_back(std::make_pair("", entry));
+    }
+    if (metadata) {
+        metadata->set("stats.block_samps", block_samps);
+        metadata->put_child("stats.files", files);
+    }
+
+    for (size_t i = 0; i < _slots.size(); i++) {
+        _free.push_back(i);
+    }
+    _thread = std::thread(&block_stats::worker, this);
+}
+
+block_stats::~block_stats()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running = false;
+    }
+    _cond.notify_one();
+    _thread.join();
+    for (size_t c = 0; c < _channels.size(); c++) {
+        flush(*_channels[c]);
+        _channels[c]->out.close();
+    }
+    std::cout << boost::format("Block stats: %d records, %d blocks not measured")
+                     % _records % _blocks_dropped
+              << std::endl;
+}
+
+void block_stats::write(const sample_block& block)
+{
+    size_t idx;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_free.empty()) {
+            _blocks_dropped++;
+            return;
+        }
+        idx = _free.back();
+        _free.pop_back();
+    }
+
+    slot& s = _slots[idx];
+    s.chans.resize(block.num_channels);
+    if (block.ref) {
+        s.ref = *block.ref;
+        for (size_t i = 0; i < block.num_channels; i++) {
+            s.chans[i] = static_cast<const char*>(block.buffs[i]);
+        }
+    } else {
+        const size_t chan_bytes = block.num_samps * block.samp_size;
+        if (s.data.size() < chan_bytes * block.num_channels) {
+            s.data.resize(chan_bytes * block.num_channels);
+        }
+        for (size_t i = 0; i < block.num_channels; i++) {
+            std::memcpy(&s.data[i * chan_bytes], block.buffs[i], chan_bytes);
+            s.chans[i] = &s.data[i * chan_bytes];
+        }
+    }
+    s.first_chan = block.first_chan;
+    s.num_samps  = block.num_samps;
+    s.first_samp = block.first_samp;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _ready.push_back(idx);
+    }
+    _cond.notify_one();
+}
+
+void block_stats::worker()
+{
+    apply_thread_role("dsp");
+    for (;;) {
+        size_t idx;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this] { return not _ready.empty() or not _running; });
+            if (_ready.empty()) {
+                break;
+            }
+            idx = _ready.front();
+            _ready.pop_front();
+        }
+        process(_slots[idx]);
+        _slots[idx].ref.reset();
+        std::lock_guard<std::mutex> lock(_mutex);
+        _free.push_back(idx);
+    }
+    record_thread_stats("dsp");
+}
+
+void block_stats::process(const slot& s)
+{
+    for (size_t i = 0; i < s.chans.size(); i++) {
+        channel& ch = *_channels.at(s.first_chan + i);
+        size_t done = 0;
+        while (done < s.num_samps) {
+            const uint64_t samp  = s.first_samp + done;
+            const uint64_t index = samp / _block_samps;
+            if (index != ch.block_index) {
+                flush(ch);
+                ch.block_index = index;
+            }
+            const size_t count = std::min<uint64_t>(
+                s.num_samps - done, (index + 1) * _block_samps - samp);
+            measure_samples(s.chans[i] + done * _samp_size, _samp_size, count, ch.sums);
+            ch.num_samps += count;
+            done += count;
+        }
+    }
+}
+
+void block_stats::flush(channel& ch)
+{
+    if (ch.num_samps > 0) {
+        const double scale = full_scale(sample_format_of_size(_samp_size));
+        block_stats_record r;
+        r.first_samp  = ch.block_index * _block_samps;
+        r.num_samps   = uint32_t(ch.num_samps);
+        r.num_clipped = uint32_t(ch.sums.clipped);
+        r.mean_power  = float(ch.sums.sum_power / ch.num_samps / (scale * scale));
+        r.peak        = float(std::sqrt(ch.sums.max_power) / scale);
+        r.dc_i        = float(ch.sums.sum_i / ch.num_samps / scale);
+        r.dc_q        = float(ch.sums.sum_q / ch.num_samps / scale);
+        ch.out.write(reinterpret_cast<const char*>(&r), sizeof(r));
+        _records++;
+    }
+    ch.num_samps = 0;
+    ch.sums      = sample_sums();
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "buffer_pool.hpp"
+#include "capture_meta.hpp"
+#include "rx_sink.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/***********************************************************************
+ * Block statistics sidecar
+ * One record per block_samps samples of a channel, so a tool can find
+ * the strong or clipped parts of a capture without reading the samples.
+ * Per channel file <channel file>.stats: a block_stats_header, then
+ * block_stats_record entries in sample order, both little endian.
+ * Levels are in full scale units (sc16 32767 and fc32/fc64 1.0 map to
+ * 1.0). A record covers fewer than block_samps samples at the end of
+ * the capture or when blocks were dropped.
+ **********************************************************************/
+struct block_stats_header
+{
+    char magic[8]; // "ETSTATS1"
+    uint32_t header_size;
+    uint32_t record_size;
+    uint64_t block_samps;
+    double rate;
+};
+
+struct block_stats_record
+{
+    uint64_t first_samp; // stream sample index of the block start
+    uint32_t num_samps; // samples measured
+    uint32_t num_clipped; // samples with I or Q at full scale
+    float mean_power; // mean |x|^2
+    float peak; // max |x|
+    float dc_i, dc_q; // mean I and Q
+};
+
+//! Records of a .stats file, empty if it is not one
+std::vector<block_stats_record> read_block_stats(
+    const std::string& stats_file, block_stats_header* header = nullptr);
+
+/***********************************************************************
+ * Sample sums
+ * The one pass over the samples behind the capture sidecars (.stats and
+ * .ovr): sums, extremes and clipped samples of n interleaved samples of
+ * samp_size bytes, in the samples' own units; full_scale() of their
+ * format turns them into full scale units. measure_samples() adds to
+ * sums, so a fresh sample_sums starts a new range.
+ **********************************************************************/
+struct sample_sums
+{
+    sample_sums();
+
+    double sum_i, sum_q, sum_power, max_power;
+    double min_i, max_i, min_q, max_q;
+    uint64_t clipped; // samples with I or Q at full scale
+};
+
+void measure_samples(const char* samps, size_t samp_size, size_t n, sample_sums& sums);
+
+/***********************************************************************
+ * block_stats
+ * rx_sink writing the .stats sidecars. write() only queues the block
+ * (by pool reference, or a copy when it is not pooled) for a worker
+ * thread that does the arithmetic and the file writes; blocks arriving
+ * while every slot is queued are left out of the statistics. Like
+ * net_sink the worker finishes in the destructor, so one sink can be
+ * shared by several streamers.
+ **********************************************************************/
+class block_stats : public rx_sink
+{
+public:
+    //! num_channels files named like file_sink's for file
+    block_stats(const std::string& file,
+        size_t num_channels,
+        size_t samp_size,
+        double rate,
+        size_t block_samps = 65536,
+        capture_metadata::sptr metadata = capture_metadata::sptr(),
+        size_t num_slots                = 32);
+    ~block_stats();
+
+    void write(const sample_block& block);
+
+private:
+    struct slot
+    {
+        pool_ref ref;
+        std::vector<char> data;
+        std::vector<const char*> chans;
+        size_t first_chan;
+        size_t num_samps;
+        uint64_t first_samp;
+    };
+
+    struct channel
+    {
+        std::ofstream out;
+        uint64_t block_index; // block being accumulated
+        uint64_t num_samps;
+        sample_sums sums;
+    };
+
+    void worker();
+    void process(const slot& s);
+    void flush(channel& ch);
+
+    const size_t _samp_size;
+    const size_t _block_samps;
+    std::vector<std::unique_ptr<channel>> _channels;
+    std::vector<slot> _slots;
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::vector<size_t> _free;
+    std::deque<size_t> _ready;
+    bool _running;
+    uint64_t _blocks_dropped, _records;
+    std::thread _thread;
+};
@@ -0,0 +1,114 @@
+#include "buffer_pool.hpp"
+#include <boost/format.hpp>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <sys/mman.h>
+
+static const size_t hugepage_bytes = 2 << 20;
+
+/***********************************************************************
+ * pool_ref
+ **********************************************************************/
+pool_ref::pool_ref(const pool_ref& other) : _block(other._block)
+{
+    if (_block)
+        _block->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void pool_ref::reset()
+{
+    if (_block and _block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        // keep the pool alive until put() has returned
+        buffer_pool::sptr pool;
+        pool.swap(_block->pool);
+        pool->put(_block);
+    }
+    _block = nullptr;
+}
+
+char* pool_ref::data() const
+{
+    return _block->data;
+}
+
+/***********************************************************************
+ * buffer_pool
+ **********************************************************************/
+buffer_pool::buffer_pool(size_t block_bytes, size_t num_blocks)
+    : _block_bytes((block_bytes + alignment - 1) / alignment * alignment)
+    , _mem(nullptr)
+    , _hugepages(true)
+    , _locked(true)
+    , _blocks(num_blocks)
+    , _min_free(num_blocks)
+    , _num_exhausted(0)
+{
+    _map_bytes = (_block_bytes * num_blocks + hugepage_bytes - 1) / hugepage_bytes
+                 * hugepage_bytes;
+    void* mem = ::mmap(nullptr,
+        _map_bytes,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+        -1,
+        0);
+    if (mem == MAP_FAILED) {
+        // no reserved hugepages, ask for transparent ones instead
+        _hugepages = false;
+        mem = ::mmap(nullptr, _map_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+        ::madvise(mem, _map_bytes, MADV_HUGEPAGE);
+#endif
+    }
+    _mem = static_cast<char*>(mem);
+    if (::mlock(_mem, _map_bytes) != 0) {
+        _locked = false;
+        // at least fault everything in now rather than on the sample path
+        std::memset(_mem, 0, _map_bytes);
+    }
+
+    _free.reserve(num_blocks);
+    for (size_t i = 0; i < num_blocks; i++) {
+        _blocks[i].refs = 0;
+        _blocks[i].data = _mem + i * _block_bytes;
+        _free.push_back(&_blocks[num_blocks - 1 - i]);
+    }
+}
+
+buffer_pool::~buffer_pool()
+{
+    std::cout << boost::format("Buffer pool: %d blocks of %d KiB (%s, %s), "
+                               "at most %d in use, exhausted %d times")
+                     % _blocks.size() % (_block_bytes / 1024)
+                     % (_hugepages ? "hugepages" : "regular pages")
+                     % (_locked ? "locked" : "not locked, raise RLIMIT_MEMLOCK")
+                     % (_blocks.size() - _min_free) % _num_exhausted
+              << std::endl;
+    ::munmap(_mem, _map_bytes);
+}
+
+pool_ref buffer_pool::get()
+{
+    pool_ref::block* b;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_free.empty()) {
+            _num_exhausted++;
+            return pool_ref();
+        }
+        b = _free.back();
+        _free.pop_back();
+        _min_free = std::min(_min_free, _free.size());
+    }
+    b->refs = 1;
+    b->pool = shared_from_this();
+    return pool_ref(b);
+}
+
+void buffer_pool::put(pool_ref::block* b)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _free.push_back(b);
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class buffer_pool;
+
+/***********************************************************************
+ * pool_ref
+ * Counted reference to one block of a buffer_pool. Copies share the
+ * block; it goes back to the pool when the last reference is dropped,
+ * and the pool itself lives until all of its blocks are back.
+ **********************************************************************/
+class pool_ref
+{
+public:
+    pool_ref() : _block(nullptr) {}
+    pool_ref(const pool_ref& other);
+    pool_ref(pool_ref&& other) : _block(other._block)
+    {
+        other._block = nullptr;
+    }
+    pool_ref& operator=(pool_ref other)
+    {
+        std::swap(_block, other._block);
+        return *this;
+    }
+    ~pool_ref()
+    {
+        reset();
+    }
+
+    void reset();
+
+    explicit operator bool() const
+    {
+        return _block != nullptr;
+    }
+
+    char* data() const;
+
+private:
+    friend class buffer_pool;
+    struct block;
+    explicit pool_ref(block* b) : _block(b) {}
+
+    block* _block;
+};
+
+struct pool_ref::block
+{
+    std::atomic<int> refs;
+    char* data;
+    std::shared_ptr<buffer_pool> pool; // set while the block is out
+};
+
+/***********************************************************************
+ * buffer_pool
+ * Fixed set of equal blocks in one mapping, allocated up front from 2 MiB
+ * hugepages where the system has them reserved (else regular pages with
+ * transparent hugepages requested) and mlocked, so nothing on the
+ * sample path allocates or page faults. Blocks start on 4 KiB
+ * boundaries (O_DIRECT, SIMD). get() on an exhausted pool returns an
+ * empty ref and counts it; the caller falls back to its own buffer.
+ **********************************************************************/
+class buffer_pool : public std::enable_shared_from_this<buffer_pool>
+{
+public:
+    typedef std::shared_ptr<buffer_pool> sptr;
+
+    static const size_t alignment = 4096;
+
+    static sptr make(size_t block_bytes, size_t num_blocks)
+    {
+        return sptr(new buffer_pool(block_bytes, num_blocks));
+    }
+
+    ~buffer_pool();
+
+    pool_ref get();
+
+    size_t block_bytes() const
+    {
+        return _block_bytes;
+    }
+    size_t num_blocks() const
+    {
+        return _blocks.size();
+    }
+    uint64_t num_exhausted() const
+    {
+        return _num_exhausted;
+    }
+    bool hugepages() const
+    {
+        return _hugepages;
+    }
+    bool locked() const
+    {
+        return _locked;
+    }
+
+private:
+    friend class pool_ref;
+
+    buffer_pool(size_t block_bytes, size_t num_blocks);
+    void put(pool_ref::block* b);
+
+    size_t _block_bytes;
+    size_t _map_bytes;
+    char* _mem;
+    bool _hugepages, _locked;
+    std::vector<pool_ref::block> _blocks;
+
+    std::mutex _mutex;
+    std::vector<pool_ref::block*> _free;
+    size_t _min_free;
+    std::atomic<uint64_t> _num_exhausted;
+};
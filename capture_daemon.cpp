@@ -0,0 +1,453 @@
+//
+// Long-running capture service: owns the device and its streamers and runs
+// capture/playback jobs received over a Unix-domain socket back to back.
+//
+
+#include "file_sink.hpp"
+#include "host_setup.hpp"
+#include "recv_to_file.hpp"
+#include "sim_device.hpp"
+#include "stream_common.hpp"
+#include "stream_device.hpp"
+#include "tx_async_monitor.hpp"
+#include "usrp_setup.hpp"
+#include <uhd/exception.hpp>
+#include <uhd/utils/safe_main.hpp>
+#include <uhd/utils/thread.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace po = boost::program_options;
+
+/***********************************************************************
+ * Jobs
+ * One line of whitespace separated key=value pairs per job:
+ *   capture  file=F duration=SECS [freq=HZ] [gain=DB]
+ *   playback file=F [freq=HZ] [gain=DB]
+ * plus the commands "status", "quit" (close this connection) and
+ * "shutdown". Each line gets one reply line, "ok ..." or "error ...".
+ * Frequency and gain stay as the previous job left them when omitted.
+ * A capture that delivers fewer samples than asked for is an error, so
+ * a batch can retry it. A playback is answered once the device has
+ * acknowledged the end of its burst, with the underflows and late
+ * packets seen meanwhile.
+ **********************************************************************/
+struct capture_job
+{
+    std::string kind;
+    std::string file;
+    double duration = 0;
+    double freq     = std::numeric_limits<double>::quiet_NaN();
+    double gain     = std::numeric_limits<double>::quiet_NaN();
+};
+
+static capture_job parse_job(const std::string& line)
+{
+    std::vector<std::string> tokens;
+    boost::split(tokens, line, boost::is_any_of(" \t"), boost::token_compress_on);
+    capture_job job;
+    job.kind = tokens.front();
+    for (size_t i = 1; i < tokens.size(); i++) {
+        const size_t eq = tokens[i].find('=');
+        if (eq == std::string::npos) {
+            throw std::runtime_error("expected key=value, got \"" + tokens[i] + "\"");
+        }
+        const std::string key = tokens[i].substr(0, eq);
+        const std::string val = tokens[i].substr(eq + 1);
+        if (key == "file")
+            job.file = val;
+        else if (key == "duration")
+            job.duration = std::stod(val);
+        else if (key == "freq")
+            job.freq = std::stod(val);
+        else if (key == "gain")
+            job.gain = std::stod(val);
+        else
+            throw std::runtime_error("unknown key \"" + key + "\"");
+    }
+    if ((job.kind == "capture" or job.kind == "playback") and job.file.empty()) {
+        throw std::runtime_error(job.kind + " needs file=");
+    }
+    if (job.kind == "capture" and job.duration <= 0) {
+        throw std::runtime_error("capture needs duration=");
+    }
+    return job;
+}
+
+/***********************************************************************
+ * capture_daemon
+ * The streamers are made once; between jobs only the changed frequency
+ * and gain are applied, as timed commands retune_lead seconds ahead,
+ * and the job starts settle seconds after that.
+ **********************************************************************/
+template <typename samp_type>
+class capture_daemon
+{
+public:
+    capture_daemon(stream_device::sptr device,
+        const std::string& cpu_format,
+        const std::string& otw,
+        size_t num_channels,
+        size_t spb,
+        double freq,
+        double gain,
+        double retune_lead,
+        double settle)
+        : _device(device)
+        , _num_channels(num_channels)
+        , _retune_lead(retune_lead)
+        , _settle(settle)
+        , _num_jobs(0)
+        , _freq(freq)
+        , _gain(gain)
+    {
+        uhd::stream_args_t stream_args(cpu_format, otw);
+        for (size_t ch = 0; ch < num_channels; ch++) {
+            stream_args.channels.push_back(ch);
+        }
+        _rx_stream = device->get_rx_stream(stream_args);
+        stream_args.channels = std::vector<size_t>(1, 0);
+        _tx_stream           = device->get_tx_stream(stream_args);
+        _tx_monitor.reset(new tx_async_monitor(_tx_stream));
+        _spb = spb ? spb : _rx_stream->get_max_num_samps() * 10;
+        // one pool, sized for _num_channels x _spb, for every job: mapping
+        // and locking a pool per capture is the per-job cost to avoid
+        _pool = make_recv_pool<samp_type>(num_channels, _spb);
+        _tx_buff.resize(_tx_stream->get_max_num_samps() * 10);
+    }
+
+    ~capture_daemon()
+    {
+        _tx_monitor->stop();
+        _tx_monitor->report();
+    }
+
+    std::string run(const capture_job& job)
+    {
+        const std::chrono::steady_clock::time_point received =
+            std::chrono::steady_clock::now();
+        const double start = retune(job);
+        size_t num_samps   = 0;
+        std::string tx_events;
+        if (job.kind == "capture") {
+            num_samps = size_t(std::llround(job.duration * _device->get_rx_rate()));
+            std::vector<rx_sink::sptr> sinks;
+            sinks.push_back(rx_sink::sptr(new file_sink(job.file, _num_channels)));
+            const uint64_t delivered = recv_to_sinks<samp_type>(
+                _device, _rx_stream, sinks, _spb, num_samps, start, 0, _pool);
+            if (delivered < num_samps) {
+                throw std::runtime_error(
+                    str(boost::format("capture %s stopped after %d of %d samples")
+                        % job.file % delivered % num_samps));
+            }
+        } else {
+            const tx_async_monitor::totals before = _tx_monitor->get_totals();
+            num_samps = playback(job.file, start, before.acks + 1);
+            const tx_async_monitor::totals after = _tx_monitor->get_totals();
+            tx_events = str(boost::format(" underflows=%d late=%d")
+                            % (after.underflows - before.underflows)
+                            % (after.late - before.late));
+        }
+        _num_jobs++;
+        const double elapsed =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - received)
+                .count();
+        return str(boost::format("ok %s %s samples=%d start=%.6f%s elapsed_ms=%.1f")
+                   % job.kind % job.file % num_samps % start % tx_events
+                   % (elapsed * 1e3));
+    }
+
+    std::string status()
+    {
+        return str(boost::format("ok status jobs=%d time=%.6f freq=%f gain=%f")
+                   % _num_jobs % _device->get_time_now().get_real_secs() % _freq
+                   % _gain);
+    }
+
+private:
+    //! Apply what changed as timed commands, return the job start time
+    double retune(const capture_job& job)
+    {
+        const uhd::time_spec_t tune_time =
+            _device->get_time_now() + uhd::time_spec_t(_retune_lead);
+        const bool new_freq = not std::isnan(job.freq) and job.freq != _freq;
+        const bool new_gain = not std::isnan(job.gain) and job.gain != _gain;
+        if (new_freq or new_gain) {
+            _device->set_command_time(tune_time);
+            for (size_t ch = 0; ch < _num_channels; ch++) {
+                if (new_freq)
+                    _device->set_rx_freq(make_tune_request(job.freq, false), ch);
+                if (new_gain)
+                    _device->set_rx_gain(job.gain, ch);
+            }
+            if (new_freq)
+                _device->set_tx_freq(make_tune_request(job.freq, false), 0);
+            if (new_gain)
+                _device->set_tx_gain(job.gain, 0);
+            _device->clear_command_time();
+            if (new_freq)
+                _freq = job.freq;
+            if (new_gain)
+                _gain = job.gain;
+        }
+        return (tune_time + uhd::time_spec_t(_settle)).get_real_secs();
+    }
+
+    //! Send the file as one burst starting at start and wait for its ACK,
+    //  the num_acks-th, return samples sent
+    size_t playback(const std::string& file, double start, uint64_t num_acks)
+    {
+        std::ifstream infile(file.c_str(), std::ifstream::binary);
+        if (not infile.is_open()) {
+            throw std::runtime_error("unable to open " + file);
+        }
+        uhd::tx_metadata_t md;
+        md.start_of_burst = true;
+        md.has_time_spec  = true;
+        md.time_spec      = uhd::time_spec_t(start);
+        size_t total      = 0;
+        while (not md.end_of_burst and not stop_signal_called) {
+            infile.read((char*)&_tx_buff.front(), _tx_buff.size() * sizeof(samp_type));
+            const size_t num_samps = size_t(infile.gcount() / sizeof(samp_type));
+            md.end_of_burst        = infile.eof();
+            if (md.end_of_burst)
+                _tx_monitor->begin_end_of_burst();
+            const size_t sent =
+                _tx_stream->send(&_tx_buff.front(), num_samps, md, _settle + 1.0);
+            total += sent;
+            if (sent != num_samps) {
+                throw std::runtime_error("tx timed out");
+            }
+            md.start_of_burst = false;
+            md.has_time_spec  = false;
+        }
+        if (not md.end_of_burst) { // stopped, close the burst
+            md.end_of_burst = true;
+            _tx_monitor->begin_end_of_burst();
+            _tx_stream->send(&_tx_buff.front(), 0, md, _settle + 1.0);
+        }
+        // the device buffers part of the burst; the next job's retune must
+        // not land in it
+        const double drain = start + double(total) / _device->get_tx_rate()
+                             - _device->get_time_now().get_real_secs();
+        if (not _tx_monitor->wait_for_acks(num_acks, std::max(0.0, drain) + 1.0)) {
+            throw std::runtime_error("no burst ACK from the device");
+        }
+        return total;
+    }
+
+    stream_device::sptr _device;
+    const size_t _num_channels;
+    const double _retune_lead, _settle;
+    uhd::rx_streamer::sptr _rx_stream;
+    uhd::tx_streamer::sptr _tx_stream;
+    tx_async_monitor::sptr _tx_monitor;
+    size_t _spb;
+    buffer_pool::sptr _pool;
+    std::vector<samp_type> _tx_buff;
+    size_t _num_jobs;
+    double _freq, _gain;
+};
+
+/***********************************************************************
+ * Unix socket server, one connection at a time
+ **********************************************************************/
+static int open_server_socket(const std::string& path)
+{
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw std::runtime_error("socket() failed");
+    }
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("socket path too long: " + path);
+    }
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    ::unlink(path.c_str());
+    if (::bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 or ::listen(fd, 4) < 0) {
+        ::close(fd);
+        throw std::runtime_error("unable to listen on " + path);
+    }
+    return fd;
+}
+
+//! Wait up to 100 ms for fd to become readable, so Ctrl + C is noticed
+static bool wait_readable(int fd)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    return ::poll(&pfd, 1, 100) > 0;
+}
+
+template <typename samp_type>
+static void serve(capture_daemon<samp_type>& daemon, int server_fd)
+{
+    bool shutdown = false;
+    while (not shutdown and not stop_signal_called) {
+        if (not wait_readable(server_fd))
+            continue;
+        const int conn = ::accept(server_fd, nullptr, nullptr);
+        if (conn < 0)
+            continue;
+
+        std::string pending;
+        bool open = true;
+        while (open and not stop_signal_called) {
+            if (not wait_readable(conn))
+                continue;
+            char buff[4096];
+            const ssize_t len = ::recv(conn, buff, sizeof(buff), 0);
+            if (len <= 0)
+                break;
+            pending.append(buff, size_t(len));
+
+            // jobs queued on the connection run back to back
+            size_t eol;
+            while (open and (eol = pending.find('\n')) != std::string::npos) {
+                const std::string line = boost::trim_copy(pending.substr(0, eol));
+                pending.erase(0, eol + 1);
+                if (line.empty())
+                    continue;
+                std::string reply;
+                try {
+                    const capture_job job = parse_job(line);
+                    if (job.kind == "quit") {
+                        open = false;
+                        continue;
+                    } else if (job.kind == "shutdown") {
+                        open = false;
+                        shutdown = true;
+                        reply    = "ok shutdown";
+                    } else if (job.kind == "status") {
+                        reply = daemon.status();
+                    } else if (job.kind == "capture" or job.kind == "playback") {
+                        reply = daemon.run(job);
+                    } else {
+                        reply = "error unknown job \"" + job.kind + "\"";
+                    }
+                } catch (const std::exception& e) {
+                    reply = std::string("error ") + e.what();
+                }
+                std::cout << line << " -> " << reply << std::endl;
+                reply += "\n";
+                ::send(conn, reply.data(), reply.size(), MSG_NOSIGNAL);
+            }
+        }
+        ::close(conn);
+    }
+}
+
+int UHD_SAFE_MAIN(int argc, char* argv[])
+{
+    startup_timer timer;
+    uhd::set_thread_priority_safe();
+
+    std::string args, socket_path, type, otw;
+    double rate, freq, gain, retune_lead, settle;
+    size_t num_channels, spb;
+
+    po::options_description desc("Allowed options");
+    // clang-format off
+    desc.add_options()
+        ("help", "help message")
+        ("args", po::value<std::string>(&args)->default_value(""), "uhd device address args, or \"sim\" for a simulated board")
+        ("socket", po::value<std::string>(&socket_path)->default_value("/tmp/ettus_capture.sock"), "Unix socket to accept jobs on")
+        ("channels", po::value<size_t>(&num_channels)->default_value(1), "number of RX channels captured per job")
+        ("type", po::value<std::string>(&type)->default_value("short"), "sample type in files: double, float, or short")
+        ("rate", po::value<double>(&rate)->default_value(1e6), "TX and RX sample rate, fixed for the daemon's lifetime")
+        ("freq", po::value<double>(&freq)->default_value(1e9), "initial center frequency in Hz")
+        ("gain", po::value<double>(&gain)->default_value(0), "initial gain in dB")
+        ("spb", po::value<size_t>(&spb)->default_value(0), "samples per buffer, 0 for default")
+        ("otw", po::value<std::string>(&otw)->default_value("sc16"), "over-the-wire sample mode")
+        ("retune-lead", po::value<double>(&retune_lead)->default_value(0.01), "seconds ahead of now a job's timed retune is scheduled")
+        ("settle", po::value<double>(&settle)->default_value(0.005), "seconds between the retune and the start of a job")
+        ("sim-fast", "run a simulated board as fast as the host allows instead of in real time")
+    ;
+    // clang-format on
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        std::cout << boost::format("Capture daemon %s") % desc << std::endl;
+        return ~0;
+    }
+
+    std::string cpu_format;
+    if (type == "double")
+        cpu_format = "fc64";
+    else if (type == "float")
+        cpu_format = "fc32";
+    else if (type == "short")
+        cpu_format = "sc16";
+    else
+        throw std::runtime_error("Unknown type " + type);
+
+    stream_device::sptr device;
+    if (args == "sim") {
+        sim_config config;
+        config.num_channels = num_channels;
+        config.rate         = rate;
+        config.realtime     = (vm.count("sim-fast") == 0);
+        device              = sim_stream_device::make(config);
+    } else {
+        uhd::usrp::multi_usrp::sptr usrp = make_usrp_cached(args);
+        usrp->set_tx_rate(rate);
+        usrp->set_rx_rate(rate);
+        for (size_t ch = 0; ch < num_channels; ch++) {
+            usrp->set_rx_freq(make_tune_request(freq, false), ch);
+            usrp->set_rx_gain(gain, ch);
+            check_lo_locked(usrp, "RX", ch, 1.0);
+        }
+        usrp->set_tx_freq(make_tune_request(freq, false), 0);
+        usrp->set_tx_gain(gain, 0);
+        check_lo_locked(usrp, "TX", 0, 1.0);
+        device = usrp_stream_device::make(usrp);
+    }
+    device->set_time_now(uhd::time_spec_t(0.0));
+    timer.mark("device");
+
+    std::signal(SIGINT, &sig_int_handler);
+    const int server_fd = open_server_socket(socket_path);
+    std::cout << boost::format("Accepting jobs on %s (Ctrl + C to stop)") % socket_path
+              << std::endl;
+
+    if (type == "double") {
+        capture_daemon<std::complex<double>> daemon(
+            device, cpu_format, otw, num_channels, spb, freq, gain, retune_lead, settle);
+        timer.mark("streamers");
+        timer.report();
+        serve(daemon, server_fd);
+    } else if (type == "float") {
+        capture_daemon<std::complex<float>> daemon(
+            device, cpu_format, otw, num_channels, spb, freq, gain, retune_lead, settle);
+        timer.mark("streamers");
+        timer.report();
+        serve(daemon, server_fd);
+    } else {
+        capture_daemon<std::complex<short>> daemon(
+            device, cpu_format, otw, num_channels, spb, freq, gain, retune_lead, settle);
+        timer.mark("streamers");
+        timer.report();
+        serve(daemon, server_fd);
+    }
+
+    ::close(server_fd);
+    ::unlink(socket_path.c_str());
+    std::cout << std::endl << "Done!" << std::endl << std::endl;
+    return EXIT_SUCCESS;
+}
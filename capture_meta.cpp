@@ -0,0 +1,53 @@
+#include "capture_meta.hpp"
+#include <boost/property_tree/json_parser.hpp>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+capture_metadata::capture_metadata(const std::string& file) : _path(file + ".json") {}
+
+void capture_metadata::append(
+    const std::string& path, const boost::property_tree::ptree& entry)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    boost::optional<boost::property_tree::ptree&> list = _tree.get_child_optional(path);
+    if (not list) {
+        list = _tree.put_child(path, boost::property_tree::ptree());
+    }
+    list->push_back(std::make_pair("", entry));
+}
+
+void capture_metadata::put_child(
+    const std::string& path, const boost::property_tree::ptree& tree)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _tree.put_child(path, tree);
+}
+
+bool capture_metadata::load()
+{
+    return load_from(_path.substr(0, _path.size() - 5));
+}
+
+bool capture_metadata::load_from(const std::string& file)
+{
+    std::ifstream in((file + ".json").c_str());
+    if (not in.is_open()) {
+        return false;
+    }
+    boost::property_tree::ptree tree;
+    boost::property_tree::read_json(in, tree);
+    std::lock_guard<std::mutex> lock(_mutex);
+    _tree.swap(tree);
+    return true;
+}
+
+void capture_metadata::write()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    const std::string tmp_path = _path + ".tmp";
+    boost::property_tree::write_json(tmp_path, _tree);
+    if (std::rename(tmp_path.c_str(), _path.c_str()) != 0) {
+        throw std::runtime_error("Unable to write " + _path);
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <boost/property_tree/ptree.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/***********************************************************************
+ * capture_metadata
+ * JSON sidecar describing a capture (rate, format, files, ...) that
+ * stages can add their results to. Thread safe; write() replaces the
+ * file atomically, so it can be called repeatedly during a run.
+ **********************************************************************/
+class capture_metadata
+{
+public:
+    typedef std::shared_ptr<capture_metadata> sptr;
+
+    //! Sidecar for the capture written to file: file + ".json"
+    capture_metadata(const std::string& file);
+
+    template <typename value_type>
+    void set(const std::string& path, const value_type& value)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tree.put(path, value);
+    }
+
+    template <typename value_type>
+    value_type get(const std::string& path, const value_type& fallback) const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _tree.get(path, fallback);
+    }
+
+    //! Append entry to the list at path
+    void append(const std::string& path, const boost::property_tree::ptree& entry);
+
+    //! Replace whatever is at path with tree
+    void put_child(const std::string& path, const boost::property_tree::ptree& tree);
+
+    //! Replace the contents with the sidecar on disk, false if there is none
+    bool load();
+
+    //! Same from the sidecar of another capture, for files derived from it
+    bool load_from(const std::string& file);
+
+    void write();
+
+    const std::string& path() const
+    {
+        return _path;
+    }
+
+private:
+    std::string _path;
+    mutable std::mutex _mutex;
+    boost::property_tree::ptree _tree;
+};
@@ -0,0 +1,415 @@
+#include "cfar_detector.hpp"
+#include "convert.hpp"
+#include "thread_topology.hpp"
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+static const size_t no_slot = std::numeric_limits<size_t>::max();
+
+//! CA: the mean of n exponential cells times alpha is exceeded by noise
+//  with probability (1 + alpha / n)^-n
+static double ca_alpha(size_t n, double pfa)
+{
+    return n * (std::pow(pfa, -1.0 / n) - 1.0);
+}
+
+//! OS: the k-th smallest of n cells times alpha is exceeded with
+//  probability prod_{i<k} (n - i) / (n - i + alpha); solved by bisection
+static double os_alpha(size_t n, size_t k, double pfa)
+{
+    double lo = 0, hi = 1;
+    const auto pfa_of = [n, k](double alpha) {
+        double p = 1;
+        for (size_t i = 0; i < k; i++)
+            p *= double(n - i) / (n - i + alpha);
+        return p;
+    };
+    while (pfa_of(hi) > pfa)
+        hi *= 2;
+    for (int iter = 0; iter < 100; iter++) {
+        const double mid = (lo + hi) / 2;
+        (pfa_of(mid) > pfa ? lo : hi) = mid;
+    }
+    return hi;
+}
+
+/***********************************************************************
+ * Reader
+ **********************************************************************/
+std::vector<cfar_detection> read_cfar_detections(
+    const std::string& file, cfar_header* header)
+{
+    std::vector<cfar_detection> detections;
+    std::ifstream in(file.c_str(), std::ios::binary);
+    cfar_header h;
+    if (not in.read(reinterpret_cast<char*>(&h), sizeof(h))
+        or std::memcmp(h.magic, "ETCFAR01", sizeof(h.magic)) != 0
+        or h.record_size < sizeof(cfar_detection)) {
+        return detections;
+    }
+    if (header)
+        *header = h;
+    in.seekg(h.header_size);
+    std::vector<char> record(h.record_size);
+    while (in.read(&record.front(), record.size())) {
+        cfar_detection d;
+        std::memcpy(&d, &record.front(), sizeof(d));
+        detections.push_back(d);
+    }
+    return detections;
+}
+
+/***********************************************************************
+ * cfar_detector
+ **********************************************************************/
+cfar_detector::cfar_detector(const cfar_config& config,
+    const std::vector<std::complex<float>>& pulse,
+    const std::string& out_file,
+    size_t num_channels,
+    size_t samp_size,
+    double rate,
+    capture_metadata::sptr metadata)
+    : _config(config)
+    , _range_bins(pulse.size())
+    , _samp_size(samp_size)
+    , _rate(rate)
+    , _cpi_samps(uint64_t(pulse.size()) * config.num_pulses)
+    , _os_index(std::min(2 * config.train_cells,
+          std::max<size_t>(1, size_t(std::lround(config.os_rank * 2 * config.train_cells))))
+          - 1)
+    , _range_fft(pulse.size())
+    , _range_ifft(pulse.size(), true)
+    , _doppler_fft(std::max<size_t>(2, config.num_pulses))
+    , _metadata(metadata)
+    , _channels(num_channels)
+    , _slots(std::max<size_t>(1, config.num_slots))
+    , _running(true)
+    , _cpis_done(0)
+    , _cpis_skipped(0)
+    , _num_detections(0)
+    , _csv(boost::algorithm::iends_with(out_file, ".csv"))
+{
+    const size_t num_pulses = config.num_pulses;
+    if (num_pulses == 0 or (num_pulses & (num_pulses - 1)) != 0)
+        throw std::runtime_error("cfar_detector: pulses per CPI must be a power of two");
+    if (config.train_cells == 0 or _range_bins <= 2 * (config.train_cells + config.guard_cells))
+        throw std::runtime_error("cfar_detector: CFAR window wider than the range profile");
+
+    // matched filter: conj(P) / (|p|^2 * n), so a full scale copy of the
+    // pulse compresses to 1.0 after the unnormalised inverse FFT
+    double energy = 0;
+    for (size_t i = 0; i < pulse.size(); i++)
+        energy += std::norm(pulse[i]);
+    if (energy == 0)
+        throw std::runtime_error("cfar_detector: the TX pulse is all zeros");
+    _pulse_spectrum = pulse;
+    _range_fft.execute(&_pulse_spectrum.front());
+    const float norm = float(1.0 / (energy * _range_bins));
+    for (size_t i = 0; i < _range_bins; i++)
+        _pulse_spectrum[i] = std::conj(_pulse_spectrum[i]) * norm;
+
+    const size_t n = 2 * config.train_cells;
+    _alpha = float(config.ordered ? os_alpha(n, _os_index + 1, config.pfa)
+                                  : ca_alpha(n, config.pfa));
+
+    _out.open(out_file.c_str(), std::ios::binary | std::ios::trunc);
+    if (not _out.is_open())
+        throw std::runtime_error("Unable to open " + out_file);
+    if (_csv) {
+        _out << "time,cpi,chan,range_bin,doppler_bin,snr_db,power_db\n";
+    } else {
+        cfar_header h;
+        std::memcpy(h.magic, "ETCFAR01", sizeof(h.magic));
+        h.header_size = sizeof(cfar_header);
+        h.record_size = sizeof(cfar_detection);
+        h.range_bins  = uint32_t(_range_bins);
+        h.num_pulses  = uint32_t(num_pulses);
+        h.rate        = rate;
+        _out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    }
+
+    for (size_t c = 0; c < num_channels; c++) {
+        _channels[c].started    = false;
+        _channels[c].cpi        = 0;
+        _channels[c].filled     = 0;
+        _channels[c].slot_index = no_slot;
+    }
+    for (size_t i = 0; i < _slots.size(); i++) {
+        _slots[i].samps.resize(_cpi_samps);
+        _slots[i].done = false;
+        _free.push_back(i);
+    }
+    if (_metadata) {
+        _metadata->set("cfar.file", out_file);
+        _metadata->set("cfar.method", config.ordered ? "OS" : "CA");
+        _metadata->set("cfar.range_bins", _range_bins);
+        _metadata->set("cfar.num_pulses", num_pulses);
+        _metadata->set("cfar.train_cells", config.train_cells);
+        _metadata->set("cfar.guard_cells", config.guard_cells);
+        _metadata->set("cfar.pfa", config.pfa);
+        _metadata->set("cfar.alpha", _alpha);
+    }
+    for (size_t i = 0; i < std::max<size_t>(1, config.num_threads); i++) {
+        _threads.push_back(std::thread(&cfar_detector::worker, this));
+    }
+}
+
+cfar_detector::~cfar_detector()
+{
+    for (size_t c = 0; c < _channels.size(); c++) {
+        // a CPI cut off by the end of the capture
+        if (_channels[c].filled != 0)
+            release(_channels[c]);
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running = false;
+    }
+    _cond.notify_all();
+    for (size_t i = 0; i < _threads.size(); i++) {
+        _threads[i].join();
+    }
+    write_detections();
+    _out.close();
+
+    if (_metadata) {
+        _metadata->set("cfar.cpis", _cpis_done);
+        _metadata->set("cfar.cpis_skipped", _cpis_skipped);
+        _metadata->set("cfar.detections", _num_detections);
+    }
+    std::cout << boost::format("CFAR (%s, alpha %.2f): %d CPIs of %dx%d, %d skipped, "
+                               "%d detections")
+                     % (_config.ordered ? "OS" : "CA") % _alpha % _cpis_done
+                     % _config.num_pulses % _range_bins % _cpis_skipped % _num_detections
+              << std::endl;
+}
+
+/***********************************************************************
+ * recv side
+ **********************************************************************/
+void cfar_detector::write(const sample_block& block)
+{
+    const sample_format format = sample_format_of_size(block.samp_size);
+    for (size_t i = 0; i < block.num_channels; i++) {
+        const size_t c = block.first_chan + i;
+        channel& ch    = _channels.at(c);
+        if (not ch.started) {
+            ch.started      = true;
+            ch.stream_start = block.time_secs - double(block.first_samp) / _rate;
+            ch.cpi          = block.first_samp / _cpi_samps;
+        }
+
+        const char* samps  = static_cast<const char*>(block.buffs[i]);
+        const uint64_t end = block.first_samp + block.num_samps;
+        uint64_t pos       = block.first_samp;
+        while (pos < end) {
+            const uint64_t cpi = pos / _cpi_samps;
+            if (cpi != ch.cpi) {
+                // samples were lost
+                if (ch.filled != 0 or ch.slot_index != no_slot)
+                    release(ch);
+                ch.cpi = cpi;
+            }
+            const uint64_t offset = pos - cpi * _cpi_samps;
+            if (offset == 0 and ch.slot_index == no_slot) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (not _free.empty()) {
+                    ch.slot_index = _free.back();
+                    _free.pop_back();
+                }
+            }
+            const size_t count = size_t(std::min(end, (cpi + 1) * _cpi_samps) - pos);
+            if (ch.slot_index != no_slot) {
+                convert_samples(samps + (pos - block.first_samp) * _samp_size, format,
+                    &_slots[ch.slot_index].samps[size_t(offset)], sample_format::fc32,
+                    count);
+            }
+            ch.filled += count;
+            pos += count;
+            if (pos % _cpi_samps == 0) {
+                if (ch.filled == _cpi_samps and ch.slot_index != no_slot) {
+                    slot& s     = _slots[ch.slot_index];
+                    s.chan      = c;
+                    s.cpi       = ch.cpi;
+                    s.time_secs = ch.stream_start + double(ch.cpi * _cpi_samps) / _rate;
+                    s.done      = false;
+                    {
+                        std::lock_guard<std::mutex> lock(_mutex);
+                        _ready.push_back(ch.slot_index);
+                        _order.push_back(ch.slot_index);
+                    }
+                    _cond.notify_one();
+                    ch.slot_index = no_slot;
+                    ch.filled     = 0;
+                } else {
+                    release(ch);
+                }
+                ch.cpi++;
+            }
+        }
+    }
+}
+
+//! Skip the channel's CPI in progress
+void cfar_detector::release(channel& ch)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (ch.slot_index != no_slot)
+        _free.push_back(ch.slot_index);
+    _cpis_skipped++;
+    ch.slot_index = no_slot;
+    ch.filled     = 0;
+}
+
+/***********************************************************************
+ * workers
+ **********************************************************************/
+void cfar_detector::worker()
+{
+    apply_thread_role("dsp");
+    scratch w;
+    for (;;) {
+        size_t idx;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this] { return not _ready.empty() or not _running; });
+            if (_ready.empty())
+                break;
+            idx = _ready.front();
+            _ready.pop_front();
+        }
+        slot& s = _slots[idx];
+        s.detections.clear();
+        process(s, w);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            s.done = true;
+        }
+        write_detections();
+    }
+    record_thread_stats("dsp");
+}
+
+void cfar_detector::process(slot& s, scratch& w) const
+{
+    const size_t num_pulses = _config.num_pulses;
+    const size_t bins       = _range_bins;
+
+    // pulse compression, in place
+    for (size_t m = 0; m < num_pulses; m++) {
+        std::complex<float>* x = &s.samps[m * bins];
+        _range_fft.execute(x);
+        for (size_t k = 0; k < bins; k++)
+            x[k] *= _pulse_spectrum[k];
+        _range_ifft.execute(x);
+    }
+
+    // power map, row j holding Doppler bin j - num_pulses / 2
+    w.power.resize(num_pulses * bins);
+    if (num_pulses == 1) {
+        for (size_t r = 0; r < bins; r++)
+            w.power[r] = std::norm(s.samps[r]);
+    } else {
+        const float scale = 1.0f / float(num_pulses * num_pulses);
+        w.column.resize(num_pulses);
+        for (size_t r = 0; r < bins; r++) {
+            for (size_t m = 0; m < num_pulses; m++)
+                w.column[m] = s.samps[m * bins + r];
+            _doppler_fft.execute(&w.column.front());
+            for (size_t j = 0; j < num_pulses; j++) {
+                const size_t k           = (j + num_pulses / 2) % num_pulses;
+                w.power[j * bins + r] = std::norm(w.column[k]) * scale;
+            }
+        }
+    }
+
+    for (size_t j = 0; j < num_pulses; j++) {
+        const int doppler_bin = num_pulses == 1 ? 0 : int(j) - int(num_pulses / 2);
+        detect_row(&w.power[j * bins], doppler_bin, s, w);
+    }
+}
+
+void cfar_detector::detect_row(const float* row, int doppler_bin, slot& s, scratch& w) const
+{
+    const size_t bins  = _range_bins;
+    const size_t train = _config.train_cells;
+    const size_t guard = _config.guard_cells;
+    const size_t reach = train + guard;
+
+    // prefix[i] sums the circularly extended row up to, not including,
+    // cell i - reach, so any window sum is one subtraction
+    w.prefix.resize(bins + 2 * reach + 1);
+    w.prefix[0] = 0;
+    for (size_t i = 0; i < bins + 2 * reach; i++)
+        w.prefix[i + 1] = w.prefix[i] + row[(i + bins - reach) % bins];
+
+    for (size_t r = 0; r < bins; r++) {
+        const float cell = row[r];
+        float noise;
+        if (not _config.ordered) {
+            // lagging cells r - reach .. r - guard - 1, leading r + guard + 1 .. r + reach
+            const double lagging = w.prefix[r + train] - w.prefix[r];
+            const double leading = w.prefix[r + 2 * reach + 1] - w.prefix[r + reach + guard + 1];
+            noise = float((lagging + leading) / (2 * train));
+        } else {
+            w.cells.resize(2 * train);
+            for (size_t t = 0; t < train; t++) {
+                w.cells[t]         = row[(r + bins - reach + t) % bins];
+                w.cells[train + t] = row[(r + guard + 1 + t) % bins];
+            }
+            std::nth_element(w.cells.begin(), w.cells.begin() + _os_index, w.cells.end());
+            noise = w.cells[_os_index];
+        }
+        if (cell > _alpha * noise and noise > 0) {
+            cfar_detection d;
+            d.time_secs   = s.time_secs;
+            d.cpi         = uint32_t(s.cpi);
+            d.chan        = uint16_t(s.chan);
+            d.doppler_bin = int16_t(doppler_bin);
+            d.range_bin   = uint32_t(r);
+            d.snr_db      = 10 * std::log10(cell / noise);
+            d.power_db    = 10 * std::log10(cell);
+            d.reserved    = 0;
+            s.detections.push_back(d);
+        }
+    }
+}
+
+//! Writes finished CPIs in stream order and frees their slots
+void cfar_detector::write_detections()
+{
+    std::lock_guard<std::mutex> write_lock(_write_mutex);
+    for (;;) {
+        size_t idx;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_order.empty() or not _slots[_order.front()].done)
+                return;
+            idx = _order.front();
+            _order.pop_front();
+        }
+        const slot& s = _slots[idx];
+        for (size_t i = 0; i < s.detections.size(); i++) {
+            const cfar_detection& d = s.detections[i];
+            if (_csv) {
+                _out << boost::format("%.9f,%d,%d,%d,%d,%.2f,%.2f\n") % d.time_secs % d.cpi
+                            % d.chan % d.range_bin % d.doppler_bin % d.snr_db % d.power_db;
+            } else {
+                _out.write(reinterpret_cast<const char*>(&d), sizeof(d));
+            }
+        }
+        _out.flush();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _cpis_done++;
+            _num_detections += s.detections.size();
+            _free.push_back(idx);
+        }
+    }
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "capture_meta.hpp"
+#include "fft.hpp"
+#include "rx_sink.hpp"
+#include <complex>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/***********************************************************************
+ * Detection stream
+ * Binary: a cfar_header, then one cfar_detection per detection in
+ * stream order, both little endian. A file named *.csv gets the same
+ * fields as text instead, one detection per line after a header line.
+ **********************************************************************/
+struct cfar_header
+{
+    char magic[8]; // "ETCFAR01"
+    uint32_t header_size;
+    uint32_t record_size;
+    uint32_t range_bins; // samples per pulse (TX period)
+    uint32_t num_pulses; // per coherent processing interval
+    double rate;
+};
+
+struct cfar_detection
+{
+    double time_secs; // device time of the start of the CPI
+    uint32_t cpi; // CPI index since stream sample 0
+    uint16_t chan;
+    int16_t doppler_bin; // -num_pulses/2 .. num_pulses/2-1
+    uint32_t range_bin; // delay in samples
+    float snr_db; // cell over the noise estimate
+    float power_db; // cell, 0 dB for a full scale copy of the TX pulse
+    uint32_t reserved;
+};
+
+//! Detections of a binary detection file, empty if it is not one
+std::vector<cfar_detection> read_cfar_detections(
+    const std::string& file, cfar_header* header = nullptr);
+
+/***********************************************************************
+ * cfar_detector
+ * Streaming detector for --repeat playback, where the TX file is the
+ * pulse. Each RX channel is cut into coherent processing intervals
+ * (CPIs) of num_pulses periods, counted from stream sample 0 like
+ * period_integrator. Per CPI:
+ *  - every period is pulse compressed by circular correlation with the
+ *    TX pulse (an FFT of the period length, which must be a power of
+ *    two), giving a range profile;
+ *  - with num_pulses > 1 each range bin is Fourier transformed across
+ *    the pulses, giving a range-Doppler power map;
+ *  - every Doppler row is run through a CFAR along range: cell
+ *    averaging (CA) from a sliding sum, O(1) per cell, or ordered
+ *    statistic (OS) from the rank-th smallest training cell. The
+ *    window is circular, as the profile is. The threshold factor is set
+ *    from pfa for exponentially distributed noise power.
+ * Only the detections are written.
+ *
+ * The recv thread converts the samples into a CPI buffer; complete
+ * CPIs go to a pool of workers, so consecutive CPIs (rows of the
+ * range-time map) are processed in parallel, and the detections are
+ * written in stream order. CPIs that lost samples, or that find no
+ * free buffer, are skipped and counted.
+ **********************************************************************/
+struct cfar_config
+{
+    size_t num_pulses  = 16; // Doppler FFT size, a power of two; 1 for range only
+    size_t train_cells = 16; // each side
+    size_t guard_cells = 2; // each side
+    double pfa         = 1e-6;
+    bool ordered       = false; // OS instead of CA
+    double os_rank     = 0.75; // OS: fraction of the training cells
+    size_t num_threads = 2;
+    size_t num_slots   = 8; // CPI buffers
+};
+
+class cfar_detector : public rx_sink
+{
+public:
+    //! pulse is one TX period in RX samples (fc32, full scale 1.0)
+    cfar_detector(const cfar_config& config,
+        const std::vector<std::complex<float>>& pulse,
+        const std::string& out_file,
+        size_t num_channels,
+        size_t samp_size,
+        double rate,
+        capture_metadata::sptr metadata = capture_metadata::sptr());
+    ~cfar_detector();
+
+    void write(const sample_block& block);
+
+private:
+    struct slot
+    {
+        std::vector<std::complex<float>> samps; // num_pulses periods
+        size_t chan;
+        uint64_t cpi;
+        double time_secs;
+        std::vector<cfar_detection> detections;
+        bool done;
+    };
+
+    struct channel
+    {
+        bool started;
+        double stream_start; // device time of sample 0
+        uint64_t cpi; // being filled
+        uint64_t filled; // samples of it so far
+        size_t slot_index; // buffer being filled, or no_slot
+    };
+
+    //! Per worker buffers
+    struct scratch
+    {
+        std::vector<std::complex<float>> column;
+        std::vector<float> power; // range-Doppler map, rows by Doppler bin
+        std::vector<double> prefix; // sliding sums of a row
+        std::vector<float> cells; // OS training cells
+    };
+
+    void worker();
+    void process(slot& s, scratch& w) const;
+    void detect_row(const float* row, int doppler_bin, slot& s, scratch& w) const;
+    void write_detections();
+    void release(channel& ch);
+
+    const cfar_config _config;
+    const size_t _range_bins;
+    const size_t _samp_size;
+    const double _rate;
+    const uint64_t _cpi_samps;
+    const size_t _os_index;
+    float _alpha; // threshold factor on the noise estimate
+    std::vector<std::complex<float>> _pulse_spectrum; // conj, normalised
+    fft_plan _range_fft, _range_ifft, _doppler_fft;
+    capture_metadata::sptr _metadata;
+
+    std::vector<channel> _channels;
+    std::vector<slot> _slots;
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::vector<size_t> _free;
+    std::deque<size_t> _ready; // waiting for a worker
+    std::deque<size_t> _order; // queued, in stream order
+    bool _running;
+    uint64_t _cpis_done, _cpis_skipped, _num_detections;
+
+    std::mutex _write_mutex;
+    bool _csv;
+    std::ofstream _out;
+
+    std::vector<std::thread> _threads;
+};
@@ -0,0 +1,148 @@
+#include "channel_config.hpp"
+#include "usrp_setup.hpp"
+#include <boost/format.hpp>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+namespace {
+class phase_clock
+{
+public:
+    phase_clock(config_report& report)
+        : _report(report), _last(std::chrono::steady_clock::now())
+    {
+    }
+
+    void mark(const std::string& phase)
+    {
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        _report.phases.push_back(
+            std::make_pair(phase, std::chrono::duration<double>(now - _last).count()));
+        _last = now;
+    }
+
+private:
+    config_report& _report;
+    std::chrono::steady_clock::time_point _last;
+};
+} // namespace
+
+config_report apply_device_settings(uhd::usrp::multi_usrp::sptr usrp,
+    const device_settings& settings,
+    double command_lead,
+    double lock_timeout)
+{
+    typedef std::map<size_t, channel_settings>::const_iterator chan_iter;
+    config_report report;
+    phase_clock clock(report);
+
+    typedef std::map<size_t, std::string>::const_iterator subdev_iter;
+    for (subdev_iter it = settings.tx_subdev.begin(); it != settings.tx_subdev.end(); ++it)
+        usrp->set_tx_subdev_spec(uhd::usrp::subdev_spec_t(it->second), it->first);
+    for (subdev_iter it = settings.rx_subdev.begin(); it != settings.rx_subdev.end(); ++it)
+        usrp->set_rx_subdev_spec(uhd::usrp::subdev_spec_t(it->second), it->first);
+    clock.mark("subdev");
+
+    for (chan_iter it = settings.tx.begin(); it != settings.tx.end(); ++it) {
+        if (not std::isnan(it->second.rate))
+            usrp->set_tx_rate(it->second.rate, it->first);
+    }
+    for (chan_iter it = settings.rx.begin(); it != settings.rx.end(); ++it) {
+        if (not std::isnan(it->second.rate))
+            usrp->set_rx_rate(it->second.rate, it->first);
+    }
+    clock.mark("rates");
+
+    // everything else lands on the boards at the same device time
+    const uhd::time_spec_t cmd_time =
+        usrp->get_time_now() + uhd::time_spec_t(command_lead);
+    usrp->set_command_time(cmd_time);
+    for (chan_iter it = settings.tx.begin(); it != settings.tx.end(); ++it) {
+        const channel_settings& ch = it->second;
+        if (not ch.antenna.empty())
+            usrp->set_tx_antenna(ch.antenna, it->first);
+        if (not std::isnan(ch.freq))
+            usrp->set_tx_freq(make_tune_request(ch.freq, ch.int_n), it->first);
+        if (not std::isnan(ch.gain))
+            usrp->set_tx_gain(ch.gain, it->first);
+        if (not std::isnan(ch.bandwidth))
+            usrp->set_tx_bandwidth(ch.bandwidth, it->first);
+    }
+    for (chan_iter it = settings.rx.begin(); it != settings.rx.end(); ++it) {
+        const channel_settings& ch = it->second;
+        if (not ch.antenna.empty())
+            usrp->set_rx_antenna(ch.antenna, it->first);
+        if (not std::isnan(ch.freq))
+            usrp->set_rx_freq(make_tune_request(ch.freq, ch.int_n), it->first);
+        if (not std::isnan(ch.gain))
+            usrp->set_rx_gain(ch.gain, it->first);
+        if (not std::isnan(ch.bandwidth))
+            usrp->set_rx_bandwidth(ch.bandwidth, it->first);
+    }
+    usrp->clear_command_time();
+    clock.mark("timed batch");
+
+    const double wait = (cmd_time - usrp->get_time_now()).get_real_secs();
+    if (wait > 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long long>(wait * 1e6)));
+    clock.mark("command time");
+
+    for (chan_iter it = settings.tx.begin(); it != settings.tx.end(); ++it)
+        check_lo_locked(usrp, "TX", it->first, lock_timeout);
+    for (chan_iter it = settings.rx.begin(); it != settings.rx.end(); ++it)
+        check_lo_locked(usrp, "RX", it->first, lock_timeout);
+    clock.mark("lo lock");
+
+    for (chan_iter it = settings.tx.begin(); it != settings.tx.end(); ++it) {
+        channel_readback& rb = report.tx[it->first];
+        rb.rate              = usrp->get_tx_rate(it->first);
+        rb.freq              = usrp->get_tx_freq(it->first);
+        rb.gain              = usrp->get_tx_gain(it->first);
+        rb.bandwidth         = usrp->get_tx_bandwidth(it->first);
+        rb.antenna           = usrp->get_tx_antenna(it->first);
+    }
+    for (chan_iter it = settings.rx.begin(); it != settings.rx.end(); ++it) {
+        channel_readback& rb = report.rx[it->first];
+        rb.rate              = usrp->get_rx_rate(it->first);
+        rb.freq              = usrp->get_rx_freq(it->first);
+        rb.gain              = usrp->get_rx_gain(it->first);
+        rb.bandwidth         = usrp->get_rx_bandwidth(it->first);
+        rb.antenna           = usrp->get_rx_antenna(it->first);
+    }
+    clock.mark("readback");
+    return report;
+}
+
+static void print_channels(
+    const std::string& direction, const std::map<size_t, channel_readback>& channels)
+{
+    for (std::map<size_t, channel_readback>::const_iterator it = channels.begin();
+         it != channels.end();
+         ++it) {
+        const channel_readback& rb = it->second;
+        std::cout << boost::format("  %s %-3d %10.4f %12.4f %7.1f %9.3f  %s") % direction
+                         % it->first % (rb.rate / 1e6) % (rb.freq / 1e6) % rb.gain
+                         % (rb.bandwidth / 1e6) % rb.antenna
+                  << std::endl;
+    }
+}
+
+void print_config_report(const config_report& report)
+{
+    std::cout << std::endl
+              << "  ch        rate Msps    freq MHz gain dB   bw MHz  antenna" << std::endl;
+    print_channels("TX", report.tx);
+    print_channels("RX", report.rx);
+
+    double total = 0;
+    std::cout << "Configuration latency:" << std::endl;
+    for (size_t i = 0; i < report.phases.size(); i++) {
+        std::cout << boost::format("  %-14s %8.1f ms") % report.phases[i].first
+                         % (report.phases[i].second * 1e3)
+                  << std::endl;
+        total += report.phases[i].second;
+    }
+    std::cout << boost::format("  %-14s %8.1f ms") % "total" % (total * 1e3) << std::endl
+              << std::endl;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <uhd/usrp/multi_usrp.hpp>
+#include <cmath>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/***********************************************************************
+ * Batched channel configuration
+ * Declarative settings for every TX and RX channel, applied in one go:
+ * subdev specs and rates first (UHD cannot time those), then frequency,
+ * gain, bandwidth and antenna of all channels as one batch of timed
+ * commands, a wait for that time and the LO locks, and a single
+ * readback at the end. Fields left unset are not touched.
+ **********************************************************************/
+struct channel_settings
+{
+    double rate      = NAN;
+    double freq      = NAN;
+    double gain      = NAN;
+    double bandwidth = NAN;
+    std::string antenna;
+    bool int_n = false;
+};
+
+struct device_settings
+{
+    // subdev specs by mboard, multi_usrp::ALL_MBOARDS for all of them
+    std::map<size_t, std::string> tx_subdev, rx_subdev;
+    std::map<size_t, channel_settings> tx, rx; // keyed by channel
+};
+
+struct channel_readback
+{
+    double rate, freq, gain, bandwidth;
+    std::string antenna;
+};
+
+struct config_report
+{
+    std::vector<std::pair<std::string, double>> phases; // name, seconds
+    std::map<size_t, channel_readback> tx, rx;
+};
+
+//! command_lead: seconds ahead of the device time the timed batch is set
+//  for; lock_timeout: how long to wait for each LO lock afterwards
+config_report apply_device_settings(uhd::usrp::multi_usrp::sptr usrp,
+    const device_settings& settings,
+    double command_lead = 0.05,
+    double lock_timeout = 1.0);
+
+//! One table of the read back values plus the time spent per phase
+void print_config_report(const config_report& report);
@@ -0,0 +1,372 @@
+#include "channelizer.hpp"
+#include "convert.hpp"
+#include "stream_common.hpp"
+#include "thread_topology.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+//! Outputs are taken after input samples t with (t + 1) % decim == 0;
+//  the number of those in [first, last)
+static uint64_t outputs_between(uint64_t first, uint64_t last, size_t decim)
+{
+    return last / decim - first / decim;
+}
+
+//! Windowed sinc lowpass cutting off at the band edges, unity DC gain,
+//  stored time reversed so the fold runs forwards through the input
+static std::vector<float> make_prototype(size_t num_bands, size_t taps)
+{
+    const double cutoff = 0.5 / num_bands;
+    const double centre = (taps - 1) / 2.0;
+    std::vector<double> h(taps);
+    double sum = 0;
+    for (size_t m = 0; m < taps; m++) {
+        const double x    = m - centre;
+        const double arg  = 2 * M_PI * cutoff * x;
+        const double sinc = x == 0 ? 1.0 : std::sin(arg) / arg;
+        const double w    = 0.42 - 0.5 * std::cos(2 * M_PI * m / (taps - 1))
+                         + 0.08 * std::cos(4 * M_PI * m / (taps - 1));
+        h[m] = sinc * w;
+        sum += h[m];
+    }
+    std::vector<float> reversed(taps);
+    for (size_t m = 0; m < taps; m++) {
+        reversed[taps - 1 - m] = float(h[m] / sum);
+    }
+    return reversed;
+}
+
+static std::string band_file_name(const std::string& chan_file, size_t band)
+{
+    boost::filesystem::path path(chan_file);
+    path.replace_extension(boost::filesystem::path(
+        str(boost::format(".sb%02d%s") % band % path.extension().string())));
+    return path.string();
+}
+
+/***********************************************************************
+ * channelizer
+ **********************************************************************/
+channelizer::channelizer(const channelizer_config& config,
+    const std::string& file,
+    size_t num_channels,
+    size_t samp_size,
+    double rate,
+    double freq,
+    capture_metadata::sptr metadata)
+    : _config(config)
+    , _samp_size(samp_size)
+    , _rate(rate)
+    , _freq(freq)
+    , _decim(config.oversample ? config.num_bands / 2 : config.num_bands)
+    , _taps(config.num_bands * config.taps_per_band)
+    , _prototype(make_prototype(config.num_bands, _taps))
+    , _fft(config.num_bands)
+    , _metadata(metadata)
+    , _file(file)
+    , _channels(num_channels)
+    , _slots(config.num_slots)
+    , _running(true)
+    , _blocks_dropped(0)
+{
+    const int num_bands = int(config.num_bands);
+    for (size_t i = 0; i < config.bands.size(); i++) {
+        const int band = config.bands[i];
+        if (band < -num_bands / 2 or band >= num_bands)
+            throw std::runtime_error(str(
+                boost::format("Subband %d out of range for %d bands") % band % num_bands));
+        const size_t index = size_t((band + num_bands) % num_bands);
+        if (std::find(_bands.begin(), _bands.end(), index) == _bands.end())
+            _bands.push_back(index);
+    }
+    if (_bands.empty())
+        throw std::runtime_error("channelizer: no subbands selected");
+
+    boost::property_tree::ptree files;
+    for (size_t c = 0; c < num_channels; c++) {
+        channel& ch = _channels[c];
+        ch.history.assign((_taps - 1) * samp_size, 0);
+        ch.next_samp    = 0;
+        ch.end_samp     = 0;
+        ch.started      = false;
+        ch.stream_start = 0;
+        ch.num_outputs  = 0;
+        const std::string chan_file = generate_out_filename(file, num_channels, c);
+        for (size_t b = 0; b < _bands.size(); b++) {
+            const std::string name = band_file_name(chan_file, _bands[b]);
+            ch.files.push_back(std::unique_ptr<std::ofstream>(
+                new std::ofstream(name.c_str(), std::ios::binary | std::ios::trunc)));
+            if (not ch.files.back()->is_open())
+                throw std::runtime_error("Unable to open " + name);
+            ch.names.push_back(name);
+
+            boost::property_tree::ptree entry;
+            entry.put("file", name);
+            entry.put("chan", c);
+            entry.put("band", _bands[b]);
+            entry.put("freq", _freq + band_offset(_bands[b]));
+            files.push_back(std::make_pair("", entry));
+        }
+    }
+    if (_metadata) {
+        _metadata->set("channelizer.num_bands", config.num_bands);
+        _metadata->set("channelizer.decimation", _decim);
+        _metadata->set("channelizer.taps", _taps);
+        _metadata->put_child("channelizer.files", files);
+    }
+
+    for (size_t i = 0; i < _slots.size(); i++) {
+        _slots[i].done = false;
+        _free.push_back(i);
+    }
+    for (size_t i = 0; i < std::max<size_t>(1, config.num_threads); i++) {
+        _threads.push_back(std::thread(&channelizer::worker, this));
+    }
+}
+
+channelizer::~channelizer()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running = false;
+    }
+    _cond.notify_all();
+    for (size_t i = 0; i < _threads.size(); i++) {
+        _threads[i].join();
+    }
+    write_outputs();
+
+    const double out_rate = _rate / _decim;
+    for (size_t c = 0; c < _channels.size(); c++) {
+        channel& ch = _channels[c];
+        // the first output follows input sample first_output
+        const uint64_t first_output = (ch.first_samp + _decim) / _decim * _decim - 1;
+        // blocks dropped at the very end still count
+        const std::vector<std::complex<float>> zeros(
+            size_t(outputs_between(ch.next_samp, ch.end_samp, _decim)));
+        if (not zeros.empty())
+            ch.num_outputs += zeros.size();
+        for (size_t b = 0; b < _bands.size(); b++) {
+            ch.files[b]->write(reinterpret_cast<const char*>(zeros.data()),
+                zeros.size() * sizeof(std::complex<float>));
+            ch.files[b]->close();
+            capture_metadata band_metadata(ch.names[b]);
+            band_metadata.set("rate", out_rate);
+            band_metadata.set("freq", _freq + band_offset(_bands[b]));
+            band_metadata.set("cpu_format", "fc32");
+            band_metadata.set("num_channels", 1);
+            band_metadata.set("start_time", ch.stream_start + first_output / _rate);
+            band_metadata.set("num_samps", ch.num_outputs);
+            band_metadata.set(
+                "channelizer.source", generate_out_filename(_file, _channels.size(), c));
+            band_metadata.set("channelizer.band", _bands[b]);
+            band_metadata.set("channelizer.num_bands", _config.num_bands);
+            band_metadata.set("channelizer.decimation", _decim);
+            band_metadata.set("channelizer.group_delay_samps", (_taps - 1) / 2.0);
+            band_metadata.write();
+        }
+    }
+    std::cout << boost::format(
+                     "Channelizer: %d of %d subbands at %.3f kHz, %d blocks zero filled")
+                     % _bands.size() % _config.num_bands % (out_rate / 1e3)
+                     % _blocks_dropped
+              << std::endl;
+}
+
+double channelizer::band_offset(size_t band) const
+{
+    const int n = int(_config.num_bands);
+    const int k = int(band) < n / 2 ? int(band) : int(band) - n;
+    return k * _rate / n;
+}
+
+void channelizer::write(const sample_block& block)
+{
+    size_t idx  = 0;
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (not _free.empty()) {
+            idx = _free.back();
+            _free.pop_back();
+            queued = true;
+        } else {
+            _blocks_dropped++;
+        }
+    }
+
+    const size_t history_bytes = (_taps - 1) * _samp_size;
+    const size_t block_bytes   = block.num_samps * _samp_size;
+    slot& s                    = _slots[idx];
+    if (queued) {
+        s.chans.resize(block.num_channels);
+        s.history.resize(block.num_channels);
+        s.gap_outputs.resize(block.num_channels);
+        if (block.ref) {
+            s.ref = *block.ref;
+            for (size_t i = 0; i < block.num_channels; i++)
+                s.chans[i] = static_cast<const char*>(block.buffs[i]);
+        } else {
+            if (s.data.size() < block_bytes * block.num_channels)
+                s.data.resize(block_bytes * block.num_channels);
+            for (size_t i = 0; i < block.num_channels; i++) {
+                std::memcpy(&s.data[i * block_bytes], block.buffs[i], block_bytes);
+                s.chans[i] = &s.data[i * block_bytes];
+            }
+        }
+        s.first_chan = block.first_chan;
+        s.num_samps  = block.num_samps;
+        s.first_samp = block.first_samp;
+    }
+
+    for (size_t i = 0; i < block.num_channels; i++) {
+        channel& ch = _channels.at(block.first_chan + i);
+        if (not ch.started) {
+            ch.started            = true;
+            ch.stream_start       = block.time_secs - block.first_samp / block.rate;
+            ch.next_samp          = block.first_samp;
+            ch.first_samp = block.first_samp;
+        }
+        if (queued) {
+            s.history[i] = ch.history;
+            s.gap_outputs[i] =
+                block.first_samp > ch.next_samp
+                    ? outputs_between(ch.next_samp, block.first_samp, _decim)
+                    : 0;
+            ch.next_samp = block.first_samp + block.num_samps;
+        }
+        ch.end_samp = block.first_samp + block.num_samps;
+        // the filter history always follows the stream, queued or not
+        const char* samps = static_cast<const char*>(block.buffs[i]);
+        if (block_bytes >= history_bytes) {
+            std::memcpy(&ch.history[0], samps + block_bytes - history_bytes, history_bytes);
+        } else {
+            std::memmove(
+                &ch.history[0], &ch.history[block_bytes], history_bytes - block_bytes);
+            std::memcpy(&ch.history[history_bytes - block_bytes], samps, block_bytes);
+        }
+    }
+
+    if (queued) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _ready.push_back(idx);
+            _order.push_back(idx);
+        }
+        _cond.notify_one();
+    }
+}
+
+void channelizer::worker()
+{
+    apply_thread_role("dsp");
+    std::vector<std::complex<float>> buf, fold(_config.num_bands);
+    for (;;) {
+        size_t idx;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this] { return not _ready.empty() or not _running; });
+            if (_ready.empty())
+                break;
+            idx = _ready.front();
+            _ready.pop_front();
+        }
+        slot& s = _slots[idx];
+        s.out.resize(s.chans.size());
+        for (size_t i = 0; i < s.chans.size(); i++) {
+            filter(s, i, buf, fold);
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            s.done = true;
+        }
+        write_outputs();
+    }
+    record_thread_stats("dsp");
+}
+
+void channelizer::filter(slot& s,
+    size_t i,
+    std::vector<std::complex<float>>& buf,
+    std::vector<std::complex<float>>& fold)
+{
+    const size_t num_bands     = _config.num_bands;
+    const size_t history       = _taps - 1;
+    const sample_format format = sample_format_of_size(_samp_size);
+    buf.resize(history + s.num_samps);
+    convert_samples(&s.history[i][0], format, &buf[0], sample_format::fc32, history);
+    convert_samples(s.chans[i], format, &buf[history], sample_format::fc32, s.num_samps);
+
+    std::vector<std::vector<std::complex<float>>>& out = s.out[i];
+    out.resize(_bands.size());
+    const uint64_t first = (s.first_samp + _decim) / _decim * _decim - 1;
+    const size_t count =
+        size_t(outputs_between(s.first_samp, s.first_samp + s.num_samps, _decim));
+    for (size_t b = 0; b < _bands.size(); b++) {
+        out[b].resize(count);
+    }
+
+    std::vector<std::complex<float>> acc(num_bands);
+    for (size_t n = 0; n < count; n++) {
+        const uint64_t t = first + n * _decim;
+        // the window is buf[start, start + taps), ending at sample t
+        const std::complex<float>* x = &buf[size_t(t - s.first_samp)];
+        std::fill(acc.begin(), acc.end(), std::complex<float>(0));
+        for (size_t l = 0; l < _config.taps_per_band; l++) {
+            const float* h                = &_prototype[l * num_bands];
+            const std::complex<float>* xl = x + l * num_bands;
+            for (size_t p = 0; p < num_bands; p++) {
+                acc[p] += h[p] * xl[p];
+            }
+        }
+        // window sample p is stream sample t - taps + 1 + p, which the
+        // DFT must see at index (t + 1 + p) % num_bands
+        const size_t rot = size_t((t + 1) % num_bands);
+        for (size_t p = 0; p < num_bands; p++) {
+            fold[(rot + p) & (num_bands - 1)] = acc[p];
+        }
+        _fft.execute(&fold[0]);
+        for (size_t b = 0; b < _bands.size(); b++) {
+            out[b][n] = fold[_bands[b]];
+        }
+    }
+}
+
+void channelizer::write_outputs()
+{
+    std::lock_guard<std::mutex> write_lock(_write_mutex);
+    for (;;) {
+        size_t idx;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_order.empty() or not _slots[_order.front()].done)
+                return;
+            idx = _order.front();
+            _order.pop_front();
+        }
+        slot& s = _slots[idx];
+        for (size_t i = 0; i < s.chans.size(); i++) {
+            channel& ch = _channels[s.first_chan + i];
+            for (size_t b = 0; b < _bands.size(); b++) {
+                if (s.gap_outputs[i] > 0) {
+                    const std::vector<std::complex<float>> zeros(size_t(s.gap_outputs[i]));
+                    ch.files[b]->write(reinterpret_cast<const char*>(&zeros[0]),
+                        zeros.size() * sizeof(std::complex<float>));
+                }
+                ch.files[b]->write(reinterpret_cast<const char*>(s.out[i][b].data()),
+                    s.out[i][b].size() * sizeof(std::complex<float>));
+            }
+            ch.num_outputs += s.gap_outputs[i] + s.out[i].front().size();
+        }
+        s.ref.reset();
+        std::lock_guard<std::mutex> lock(_mutex);
+        s.done = false;
+        _free.push_back(idx);
+    }
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "buffer_pool.hpp"
+#include "capture_meta.hpp"
+#include "fft.hpp"
+#include "rx_sink.hpp"
+#include <complex>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/***********************************************************************
+ * channelizer
+ * Polyphase analysis filter bank: splits each RX channel into
+ * num_bands subbands of rate / num_bands each and writes only the
+ * selected ones, as fc32 at rate / decimation. Band k is centred at
+ * k * rate / num_bands from the tuned frequency (k - num_bands above
+ * num_bands / 2, so negative indices select the lower half). The
+ * decimation is num_bands (critically sampled) or num_bands / 2 with
+ * oversample, which keeps the band edges free of aliasing.
+ *
+ * Every output sample is a num_bands point FFT of the input window
+ * weighted by the prototype filter and folded into num_bands points, so
+ * all bands cost one FFT. The recv thread only queues the block, with
+ * the filter history of the block before it, so a pool of worker
+ * threads can filter blocks in any order; the outputs are written in
+ * stream order. Blocks that find every slot busy are written as zeros
+ * to keep the band files in time.
+ *
+ * Band files are named from the channel file with .sbNN before the
+ * extension (rx.00.sb03.dat), each with a .json sidecar holding its
+ * rate and centre frequency.
+ **********************************************************************/
+struct channelizer_config
+{
+    size_t num_bands     = 16; // power of two
+    size_t taps_per_band = 12;
+    bool oversample      = false;
+    std::vector<int> bands; // to write, -num_bands/2 .. num_bands-1
+    size_t num_threads = 2;
+    size_t num_slots   = 32;
+};
+
+class channelizer : public rx_sink
+{
+public:
+    channelizer(const channelizer_config& config,
+        const std::string& file,
+        size_t num_channels,
+        size_t samp_size,
+        double rate,
+        double freq,
+        capture_metadata::sptr metadata = capture_metadata::sptr());
+    ~channelizer();
+
+    void write(const sample_block& block);
+
+    //! Offset of band (0 .. num_bands-1) from the tuned frequency
+    double band_offset(size_t band) const;
+
+private:
+    struct slot
+    {
+        pool_ref ref;
+        std::vector<char> data;
+        std::vector<const char*> chans;
+        std::vector<std::vector<char>> history; // per channel, taps - 1 samples
+        std::vector<uint64_t> gap_outputs; // per channel, zeros to write first
+        size_t first_chan;
+        size_t num_samps;
+        uint64_t first_samp;
+        std::vector<std::vector<std::vector<std::complex<float>>>> out; // [chan][band]
+        bool done;
+    };
+
+    struct channel
+    {
+        // recv side
+        std::vector<char> history;
+        uint64_t next_samp; // first sample not yet queued
+        uint64_t end_samp; // past the last sample seen
+        bool started;
+        uint64_t first_samp; // of the first block
+        double stream_start; // device time of sample 0
+        // writer side
+        std::vector<std::unique_ptr<std::ofstream>> files;
+        std::vector<std::string> names;
+        uint64_t num_outputs;
+    };
+
+    void worker();
+    void filter(slot& s, size_t i, std::vector<std::complex<float>>& buf,
+        std::vector<std::complex<float>>& fold);
+    void write_outputs();
+
+    const channelizer_config _config;
+    const size_t _samp_size;
+    const double _rate, _freq;
+    const size_t _decim;
+    const size_t _taps;
+    std::vector<size_t> _bands;
+    std::vector<float> _prototype;
+    fft_plan _fft;
+    capture_metadata::sptr _metadata;
+    std::string _file;
+
+    std::vector<channel> _channels;
+    std::vector<slot> _slots;
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::vector<size_t> _free;
+    std::deque<size_t> _ready; // waiting for a worker
+    std::deque<size_t> _order; // queued, in stream order
+    bool _running;
+    uint64_t _blocks_dropped;
+    std::mutex _write_mutex;
+    std::vector<std::thread> _threads;
+};
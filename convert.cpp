@@ -0,0 +1,383 @@
+#include "convert.hpp"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+// The kernels work on the interleaved I/Q scalars as one flat array so the
+// compiler can vectorise them without shuffles.
+
+template <typename in_type, typename out_type>
+static inline void cast_copy(const in_type* in, out_type* out, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = static_cast<out_type>(in[i]);
+    }
+}
+
+template <typename in_type, typename out_type>
+static inline void scale_saturate(const in_type* in, out_type* out, size_t n, in_type scale)
+{
+    const in_type lo = std::numeric_limits<out_type>::min();
+    const in_type hi = std::numeric_limits<out_type>::max();
+    for (size_t i = 0; i < n; i++) {
+        // round half away from zero; lrint() would stop the loop vectorising
+        in_type v = in[i] * scale;
+        v         = v > hi ? hi : v;
+        v         = v < lo ? lo : v;
+        out[i]    = static_cast<out_type>(
+            static_cast<int32_t>(v + (v < 0 ? in_type(-0.5) : in_type(0.5))));
+    }
+}
+
+template <typename in_type>
+static inline void scale_saturate_sc16(const in_type* in, short* out, size_t n)
+{
+    scale_saturate(in, out, n, in_type(sc16_scale));
+}
+
+template <typename in_type, typename out_type>
+static inline void scale_copy(const in_type* in, out_type* out, size_t n, out_type scale)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = in[i] * scale;
+    }
+}
+
+void convert_sc16_to_fc32(
+    const std::complex<short>* in, std::complex<float>* out, size_t n)
+{
+    const short* i_in = reinterpret_cast<const short*>(in);
+    float* f_out      = reinterpret_cast<float*>(out);
+    const float scale = 1.0f / sc16_scale;
+    for (size_t i = 0; i < 2 * n; i++) {
+        f_out[i] = i_in[i] * scale;
+    }
+}
+
+void convert_fc32_to_sc16(
+    const std::complex<float>* in, std::complex<short>* out, size_t n)
+{
+    scale_saturate_sc16(
+        reinterpret_cast<const float*>(in), reinterpret_cast<short*>(out), 2 * n);
+}
+
+void convert_sc16_to_fc64(
+    const std::complex<short>* in, std::complex<double>* out, size_t n)
+{
+    const short* i_in  = reinterpret_cast<const short*>(in);
+    double* d_out      = reinterpret_cast<double*>(out);
+    const double scale = 1.0 / sc16_scale;
+    for (size_t i = 0; i < 2 * n; i++) {
+        d_out[i] = i_in[i] * scale;
+    }
+}
+
+void convert_fc64_to_sc16(
+    const std::complex<double>* in, std::complex<short>* out, size_t n)
+{
+    scale_saturate_sc16(
+        reinterpret_cast<const double*>(in), reinterpret_cast<short*>(out), 2 * n);
+}
+
+void convert_fc32_to_fc64(
+    const std::complex<float>* in, std::complex<double>* out, size_t n)
+{
+    cast_copy(
+        reinterpret_cast<const float*>(in), reinterpret_cast<double*>(out), 2 * n);
+}
+
+void convert_fc64_to_fc32(
+    const std::complex<double>* in, std::complex<float>* out, size_t n)
+{
+    cast_copy(
+        reinterpret_cast<const double*>(in), reinterpret_cast<float*>(out), 2 * n);
+}
+
+void convert_sc8_to_fc32(
+    const std::complex<int8_t>* in, std::complex<float>* out, size_t n)
+{
+    scale_copy(reinterpret_cast<const int8_t*>(in), reinterpret_cast<float*>(out),
+        2 * n, 1.0f / sc8_scale);
+}
+
+void convert_fc32_to_sc8(
+    const std::complex<float>* in, std::complex<int8_t>* out, size_t n)
+{
+    scale_saturate(reinterpret_cast<const float*>(in), reinterpret_cast<int8_t*>(out),
+        2 * n, sc8_scale);
+}
+
+/***********************************************************************
+ * sc12 packing
+ * Rounding to 12 bits is one flat pass over the scalars that the compiler
+ * vectorises; the byte shuffle that follows is a short fixed pattern per
+ * sample. Pieces keep the 12 bit codes in L1 between the two.
+ **********************************************************************/
+static const size_t convert_piece = 1024;
+
+void convert_sc16_to_sc12(const std::complex<short>* in, uint8_t* out, size_t n)
+{
+    uint16_t codes[2 * convert_piece];
+    const short* s_in = reinterpret_cast<const short*>(in);
+    for (size_t done = 0; done < n; done += convert_piece) {
+        const size_t count = std::min(convert_piece, n - done);
+        const short* s     = s_in + 2 * done;
+        for (size_t i = 0; i < 2 * count; i++) {
+            // (x + 8) >> 4 rounds to nearest; only the top needs saturating
+            const int32_t v = (int32_t(s[i]) + 8) >> 4;
+            codes[i]        = uint16_t((v > 2047 ? 2047 : v) & 0xfff);
+        }
+        uint8_t* o = out + 3 * done;
+        for (size_t k = 0; k < count; k++) {
+            const uint16_t i = codes[2 * k], q = codes[2 * k + 1];
+            o[3 * k]         = uint8_t(i);
+            o[3 * k + 1]     = uint8_t((i >> 8) | (q << 4));
+            o[3 * k + 2]     = uint8_t(q >> 4);
+        }
+    }
+}
+
+void convert_sc12_to_sc16(const uint8_t* in, std::complex<short>* out, size_t n)
+{
+    short* s_out = reinterpret_cast<short*>(out);
+    for (size_t k = 0; k < n; k++) {
+        const uint32_t w =
+            uint32_t(in[3 * k]) | uint32_t(in[3 * k + 1]) << 8 | uint32_t(in[3 * k + 2]) << 16;
+        // each 12 bit field lands in the top of a 16 bit word, sign included
+        s_out[2 * k]     = short(uint16_t(w << 4));
+        s_out[2 * k + 1] = short(uint16_t((w >> 8) & 0xfff0));
+    }
+}
+
+/***********************************************************************
+ * Any-to-any conversion
+ **********************************************************************/
+sample_format parse_sample_format(const std::string& name)
+{
+    if (name == "sc8")
+        return sample_format::sc8;
+    if (name == "sc12")
+        return sample_format::sc12;
+    if (name == "sc16" or name == "short")
+        return sample_format::sc16;
+    if (name == "fc32" or name == "float")
+        return sample_format::fc32;
+    if (name == "fc64" or name == "double")
+        return sample_format::fc64;
+    throw std::runtime_error("Unknown sample format " + name);
+}
+
+const char* sample_format_name(sample_format format)
+{
+    switch (format) {
+        case sample_format::sc8:
+            return "sc8";
+        case sample_format::sc12:
+            return "sc12";
+        case sample_format::sc16:
+            return "sc16";
+        case sample_format::fc32:
+            return "fc32";
+        default:
+            return "fc64";
+    }
+}
+
+size_t sample_format_size(sample_format format)
+{
+    switch (format) {
+        case sample_format::sc8:
+            return 2;
+        case sample_format::sc12:
+            return 3;
+        case sample_format::sc16:
+            return 4;
+        case sample_format::fc32:
+            return 8;
+        default:
+            return 16;
+    }
+}
+
+sample_format sample_format_of_size(size_t samp_size)
+{
+    switch (samp_size) {
+        case 2:
+            return sample_format::sc8;
+        case 4:
+            return sample_format::sc16;
+        case 8:
+            return sample_format::fc32;
+        case 16:
+            return sample_format::fc64;
+        default:
+            throw std::runtime_error("No sample format of that size");
+    }
+}
+
+double full_scale(sample_format format)
+{
+    switch (format) {
+        case sample_format::sc8:
+            return sc8_scale;
+        case sample_format::sc12:
+        case sample_format::sc16:
+            return sc16_scale;
+        default:
+            return 1.0;
+    }
+}
+
+//! Interleaved scalars of any format to float_type, multiplied by scale;
+//  n is at most 2 * convert_piece
+template <typename float_type>
+static void load_scaled(
+    const void* in, sample_format format, float_type* out, size_t n, float_type scale)
+{
+    short unpacked[2 * convert_piece];
+    switch (format) {
+        case sample_format::sc8:
+            scale_copy(static_cast<const int8_t*>(in), out, n, scale);
+            break;
+        case sample_format::sc12:
+            convert_sc12_to_sc16(static_cast<const uint8_t*>(in),
+                reinterpret_cast<std::complex<short>*>(unpacked), n / 2);
+            scale_copy(static_cast<const short*>(unpacked), out, n, scale);
+            break;
+        case sample_format::sc16:
+            scale_copy(static_cast<const short*>(in), out, n, scale);
+            break;
+        case sample_format::fc32:
+            scale_copy(static_cast<const float*>(in), out, n, scale);
+            break;
+        case sample_format::fc64:
+            scale_copy(static_cast<const double*>(in), out, n, scale);
+            break;
+    }
+}
+
+template <typename float_type>
+static void store(const float_type* in, void* out, sample_format format, size_t n)
+{
+    short to_pack[2 * convert_piece];
+    switch (format) {
+        case sample_format::sc8:
+            scale_saturate(in, static_cast<int8_t*>(out), n, float_type(sc8_scale));
+            break;
+        case sample_format::sc12:
+            scale_saturate(in, to_pack, n, float_type(sc16_scale));
+            convert_sc16_to_sc12(reinterpret_cast<const std::complex<short>*>(to_pack),
+                static_cast<uint8_t*>(out), n / 2);
+            break;
+        case sample_format::sc16:
+            scale_saturate(in, static_cast<short*>(out), n, float_type(sc16_scale));
+            break;
+        case sample_format::fc32:
+            cast_copy(in, static_cast<float*>(out), n);
+            break;
+        case sample_format::fc64:
+            cast_copy(in, static_cast<double*>(out), n);
+            break;
+    }
+}
+
+template <typename float_type>
+static void convert_via(const void* in,
+    sample_format in_format,
+    void* out,
+    sample_format out_format,
+    size_t n,
+    double scale,
+    bool swap_iq)
+{
+    // small enough that the intermediate stays in L1
+    static const size_t piece = convert_piece;
+    float_type tmp[2 * piece];
+    const float_type in_scale = float_type(scale / full_scale(in_format));
+    const size_t in_size      = sample_format_size(in_format);
+    const size_t out_size     = sample_format_size(out_format);
+    for (size_t done = 0; done < n; done += piece) {
+        const size_t count = std::min(piece, n - done);
+        load_scaled(static_cast<const char*>(in) + done * in_size, in_format, tmp,
+            2 * count, in_scale);
+        if (swap_iq) {
+            for (size_t i = 0; i < count; i++) {
+                std::swap(tmp[2 * i], tmp[2 * i + 1]);
+            }
+        }
+        store(tmp, static_cast<char*>(out) + done * out_size, out_format, 2 * count);
+    }
+}
+
+void convert_samples(const void* in,
+    sample_format in_format,
+    void* out,
+    sample_format out_format,
+    size_t n,
+    double scale,
+    bool swap_iq)
+{
+    typedef sample_format f;
+    if (scale == 1.0 and not swap_iq) {
+        if (in_format == out_format) {
+            std::memcpy(out, in, n * sample_format_size(in_format));
+            return;
+        }
+        if (in_format == f::sc16 and out_format == f::fc32) {
+            convert_sc16_to_fc32(static_cast<const std::complex<short>*>(in),
+                static_cast<std::complex<float>*>(out), n);
+            return;
+        }
+        if (in_format == f::fc32 and out_format == f::sc16) {
+            convert_fc32_to_sc16(static_cast<const std::complex<float>*>(in),
+                static_cast<std::complex<short>*>(out), n);
+            return;
+        }
+        if (in_format == f::sc16 and out_format == f::fc64) {
+            convert_sc16_to_fc64(static_cast<const std::complex<short>*>(in),
+                static_cast<std::complex<double>*>(out), n);
+            return;
+        }
+        if (in_format == f::fc64 and out_format == f::sc16) {
+            convert_fc64_to_sc16(static_cast<const std::complex<double>*>(in),
+                static_cast<std::complex<short>*>(out), n);
+            return;
+        }
+        if (in_format == f::fc32 and out_format == f::fc64) {
+            convert_fc32_to_fc64(static_cast<const std::complex<float>*>(in),
+                static_cast<std::complex<double>*>(out), n);
+            return;
+        }
+        if (in_format == f::fc64 and out_format == f::fc32) {
+            convert_fc64_to_fc32(static_cast<const std::complex<double>*>(in),
+                static_cast<std::complex<float>*>(out), n);
+            return;
+        }
+        if (in_format == f::sc8 and out_format == f::fc32) {
+            convert_sc8_to_fc32(static_cast<const std::complex<int8_t>*>(in),
+                static_cast<std::complex<float>*>(out), n);
+            return;
+        }
+        if (in_format == f::fc32 and out_format == f::sc8) {
+            convert_fc32_to_sc8(static_cast<const std::complex<float>*>(in),
+                static_cast<std::complex<int8_t>*>(out), n);
+            return;
+        }
+        if (in_format == f::sc16 and out_format == f::sc12) {
+            convert_sc16_to_sc12(static_cast<const std::complex<short>*>(in),
+                static_cast<uint8_t*>(out), n);
+            return;
+        }
+        if (in_format == f::sc12 and out_format == f::sc16) {
+            convert_sc12_to_sc16(static_cast<const uint8_t*>(in),
+                static_cast<std::complex<short>*>(out), n);
+            return;
+        }
+    }
+    if (in_format == f::fc64 or out_format == f::fc64) {
+        convert_via<double>(in, in_format, out, out_format, n, scale, swap_iq);
+    } else {
+        convert_via<float>(in, in_format, out, out_format, n, scale, swap_iq);
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/***********************************************************************
+ * Sample format converters
+ * Same conventions as the UHD host converters: sc16 full scale maps to
+ * +/-1.0 and narrowing conversions saturate. n counts complex samples.
+ **********************************************************************/
+static const float sc16_scale = 32767.0f;
+static const float sc8_scale  = 127.0f;
+
+void convert_sc16_to_fc32(
+    const std::complex<short>* in, std::complex<float>* out, size_t n);
+void convert_fc32_to_sc16(
+    const std::complex<float>* in, std::complex<short>* out, size_t n);
+void convert_sc16_to_fc64(
+    const std::complex<short>* in, std::complex<double>* out, size_t n);
+void convert_fc64_to_sc16(
+    const std::complex<double>* in, std::complex<short>* out, size_t n);
+void convert_fc32_to_fc64(
+    const std::complex<float>* in, std::complex<double>* out, size_t n);
+void convert_fc64_to_fc32(
+    const std::complex<double>* in, std::complex<float>* out, size_t n);
+void convert_sc8_to_fc32(
+    const std::complex<int8_t>* in, std::complex<float>* out, size_t n);
+void convert_fc32_to_sc8(
+    const std::complex<float>* in, std::complex<int8_t>* out, size_t n);
+
+/***********************************************************************
+ * sc12: sc16 packed to 12 bits per scalar, 3 bytes per complex sample
+ * Byte 0 holds I[7:0], byte 1 I[11:8] and Q[3:0], byte 2 Q[11:4]. The
+ * 12 bits are the top of the sc16 value (rounded, saturating), so an
+ * unpacked sample is the original with its low 4 bits cleared.
+ **********************************************************************/
+void convert_sc16_to_sc12(const std::complex<short>* in, uint8_t* out, size_t n);
+void convert_sc12_to_sc16(const uint8_t* in, std::complex<short>* out, size_t n);
+
+/***********************************************************************
+ * Any-to-any conversion
+ * For tools that pick formats at run time. Goes through fc32 (fc64 when
+ * either side is fc64) in cache sized pieces when scaling or swapping
+ * I and Q, and uses the direct kernels above otherwise.
+ **********************************************************************/
+enum class sample_format { sc8, sc12, sc16, fc32, fc64 };
+
+//! "sc8", "sc12", "sc16", "fc32", "fc64", or the --type names short/float/double
+sample_format parse_sample_format(const std::string& name);
+const char* sample_format_name(sample_format format);
+//! bytes per complex sample
+size_t sample_format_size(sample_format format);
+//! format of a sample_block from its samp_size (never the packed sc12)
+sample_format sample_format_of_size(size_t samp_size);
+//! value of format that maps to 1.0: sc16_scale, sc8_scale or 1.0
+double full_scale(sample_format format);
+
+//! Convert n samples, multiplying by scale (in full scale units) and
+//  optionally swapping I and Q; in and out must not overlap
+void convert_samples(const void* in,
+    sample_format in_format,
+    void* out,
+    sample_format out_format,
+    size_t n,
+    double scale = 1.0,
+    bool swap_iq = false);
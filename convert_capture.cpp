@@ -0,0 +1,240 @@
+//
+// Offline converter for capture files: maps the input, converts it in
+// chunks on every core with the same kernels the streaming code uses and
+// writes each chunk with one large aligned write at its final offset.
+//
+//   convert_capture rx.00.dat rx.00.fc32 --to fc32 [--from sc16] [--scale 2] [--swap-iq]
+//
+// Packed sc12 captures unpack like any other format; --to sc12 packs.
+//
+
+#include "capture_meta.hpp"
+#include "convert.hpp"
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace po = boost::program_options;
+
+// O_DIRECT wants buffers, offsets and lengths in multiples of this
+static const size_t write_alignment = 4096;
+
+/***********************************************************************
+ * Chunk worker
+ **********************************************************************/
+struct conversion_job
+{
+    const char* in;
+    sample_format in_format, out_format;
+    size_t num_samps;
+    size_t chunk_samps;
+    double scale;
+    bool swap_iq;
+    bool direct;
+    int fd;
+    std::atomic<size_t> next_chunk;
+    std::atomic<bool> failed;
+};
+
+static void convert_worker(conversion_job& job)
+{
+    const size_t in_size    = sample_format_size(job.in_format);
+    const size_t out_size   = sample_format_size(job.out_format);
+    const size_t num_chunks = (job.num_samps + job.chunk_samps - 1) / job.chunk_samps;
+
+    void* buff = nullptr;
+    if (posix_memalign(&buff, write_alignment, job.chunk_samps * out_size) != 0) {
+        job.failed = true;
+        return;
+    }
+    for (;;) {
+        const size_t chunk = job.next_chunk++;
+        if (chunk >= num_chunks or job.failed)
+            break;
+        const size_t first = chunk * job.chunk_samps;
+        const size_t count = std::min(job.chunk_samps, job.num_samps - first);
+        const char* in     = job.in + first * in_size;
+        convert_samples(
+            in, job.in_format, buff, job.out_format, count, job.scale, job.swap_iq);
+
+        // the last chunk is padded for O_DIRECT and the file truncated after
+        size_t len = count * out_size;
+        if (job.direct)
+            len = (len + write_alignment - 1) / write_alignment * write_alignment;
+        const off_t offset = off_t(first * out_size);
+        for (size_t done = 0; done < len;) {
+            const ssize_t ret = pwrite(job.fd, static_cast<char*>(buff) + done,
+                len - done, offset + off_t(done));
+            if (ret < 0) {
+                if (errno == EINTR)
+                    continue;
+                std::cerr << boost::format("write failed: %s") % std::strerror(errno)
+                          << std::endl;
+                job.failed = true;
+                break;
+            }
+            done += size_t(ret);
+        }
+        // this part of the input will not be read again
+        madvise(const_cast<char*>(in) - (size_t(in) % write_alignment),
+            count * in_size + size_t(in) % write_alignment, MADV_DONTNEED);
+    }
+    free(buff);
+}
+
+/***********************************************************************
+ * Main function
+ **********************************************************************/
+int main(int argc, char* argv[])
+{
+    std::string in_file, out_file, from, to;
+    double scale, chunk_mb;
+    size_t num_threads;
+
+    po::options_description desc("Allowed options");
+    // clang-format off
+    desc.add_options()
+        ("help", "help message")
+        ("in", po::value<std::string>(&in_file), "capture file to read")
+        ("out", po::value<std::string>(&out_file), "file to write")
+        ("from", po::value<std::string>(&from), "input format sc8, sc12, sc16, fc32 or fc64 (default: file_format, or cpu_format, from the input's .json sidecar)")
+        ("to", po::value<std::string>(&to)->default_value("fc32"), "output format sc8, sc12, sc16, fc32 or fc64")
+        ("scale", po::value<double>(&scale)->default_value(1.0), "multiply the samples by this (in full scale units), saturating integer outputs")
+        ("swap-iq", "swap I and Q")
+        ("threads", po::value<size_t>(&num_threads)->default_value(0), "worker threads, 0 for one per core")
+        ("chunk-mb", po::value<double>(&chunk_mb)->default_value(16), "output MB each worker converts and writes at a time")
+        ("direct", "write with O_DIRECT, bypassing the page cache")
+    ;
+    // clang-format on
+    po::positional_options_description pos;
+    pos.add("in", 1).add("out", 1);
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help") or not vm.count("in") or not vm.count("out")) {
+        std::cout << boost::format("Capture converter %s") % desc << std::endl;
+        std::cout << "Usage: convert_capture IN OUT --to FORMAT [options]" << std::endl;
+        return ~0;
+    }
+
+    capture_metadata metadata(in_file);
+    const bool have_metadata = metadata.load();
+    if (from.empty()) {
+        // captures written in another format than they were received in
+        // say so in file_format
+        from = metadata.get<std::string>(
+            "file_format", metadata.get<std::string>("cpu_format", ""));
+        if (from.empty())
+            throw std::runtime_error(
+                "No .json sidecar for " + in_file + ", please give --from");
+    }
+    // the kernels here assume I and Q alternate
+    if (metadata.get<std::string>("layout", "interleaved") != "interleaved")
+        throw std::runtime_error(
+            in_file + " has a planar or blocked layout, read it with planar_reader");
+    const sample_format in_format  = parse_sample_format(from);
+    const sample_format out_format = parse_sample_format(to);
+    const size_t in_size           = sample_format_size(in_format);
+    const size_t out_size          = sample_format_size(out_format);
+
+    const int in_fd = open(in_file.c_str(), O_RDONLY);
+    if (in_fd < 0)
+        throw std::runtime_error("Unable to open " + in_file);
+    struct stat st;
+    fstat(in_fd, &st);
+    const size_t num_samps = size_t(st.st_size) / in_size;
+    if (size_t(st.st_size) % in_size != 0)
+        std::cerr << boost::format("Ignoring %d trailing bytes of %s")
+                         % (size_t(st.st_size) % in_size) % in_file
+                  << std::endl;
+
+    const bool direct = vm.count("direct") > 0;
+    const int fd      = open(out_file.c_str(),
+        O_WRONLY | O_CREAT | O_TRUNC | (direct ? O_DIRECT : 0), 0644);
+    if (fd < 0)
+        throw std::runtime_error(str(
+            boost::format("Unable to open %s: %s") % out_file % std::strerror(errno)));
+
+    conversion_job job;
+    job.in = nullptr;
+    if (num_samps > 0) {
+        void* map = mmap(nullptr, num_samps * in_size, PROT_READ, MAP_SHARED, in_fd, 0);
+        if (map == MAP_FAILED)
+            throw std::runtime_error("Unable to map " + in_file);
+        madvise(map, num_samps * in_size, MADV_SEQUENTIAL);
+        job.in = static_cast<const char*>(map);
+    }
+    job.in_format  = in_format;
+    job.out_format = out_format;
+    job.num_samps  = num_samps;
+    // whole pages of output so every chunk lands on an aligned offset
+    const size_t page_samps = write_alignment;
+    job.chunk_samps =
+        std::max<size_t>(1, size_t(chunk_mb * 1e6) / out_size / page_samps) * page_samps;
+    job.scale      = scale;
+    job.swap_iq    = vm.count("swap-iq") > 0;
+    job.direct     = direct;
+    job.fd         = fd;
+    job.next_chunk = 0;
+    job.failed     = false;
+
+    if (num_threads == 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << boost::format("Converting %d samples %s -> %s on %d threads...")
+                     % num_samps % sample_format_name(in_format)
+                     % sample_format_name(out_format) % num_threads
+              << std::endl;
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < num_threads; i++)
+        workers.push_back(std::thread(convert_worker, std::ref(job)));
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    if (ftruncate(fd, off_t(num_samps * out_size)) != 0)
+        job.failed = true;
+    if (fsync(fd) != 0)
+        job.failed = true;
+    close(fd);
+    if (job.in)
+        munmap(const_cast<char*>(job.in), num_samps * in_size);
+    close(in_fd);
+    if (job.failed)
+        throw std::runtime_error("Conversion of " + in_file + " failed");
+
+    const double secs =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << boost::format("Done in %.2f s, %.1f MB/s in, %.1f MB/s out") % secs
+                     % (num_samps * in_size / 1e6 / secs)
+                     % (num_samps * out_size / 1e6 / secs)
+              << std::endl;
+
+    // the sidecar follows the file with the new format
+    if (have_metadata) {
+        capture_metadata out_metadata(out_file);
+        out_metadata.load_from(in_file);
+        out_metadata.set("file_format", sample_format_name(out_format));
+        out_metadata.set("cpu_format",
+            out_format == sample_format::sc12 ? "sc16" : sample_format_name(out_format));
+        out_metadata.set("conversion.source", in_file);
+        out_metadata.set("conversion.scale", scale);
+        out_metadata.set("conversion.swap_iq", job.swap_iq);
+        out_metadata.write();
+    }
+    return EXIT_SUCCESS;
+}
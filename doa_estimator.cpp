@@ -0,0 +1,304 @@
+#include "doa_estimator.hpp"
+#include "convert.hpp"
+#include "thread_topology.hpp"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+static const double speed_of_light = 299792458.0;
+
+//! 0.01 units in an int16, saturating; doa_no_angle stays reserved
+static int16_t centi(double value)
+{
+    return int16_t(std::max(-32767.0, std::min(32767.0, std::round(value * 100))));
+}
+
+static double power_db(double power)
+{
+    return power > 0 ? 10 * std::log10(power) : -327.67;
+}
+
+/***********************************************************************
+ * Reader
+ **********************************************************************/
+std::vector<doa_frame> read_doa_records(const std::string& file, doa_header* header)
+{
+    std::vector<doa_frame> frames;
+    std::ifstream in(file.c_str(), std::ios::binary);
+    doa_header h;
+    if (not in.read(reinterpret_cast<char*>(&h), sizeof(h))
+        or std::memcmp(h.magic, "ETDOA001", sizeof(h.magic)) != 0
+        or h.record_size
+               < sizeof(doa_record_header) + size_t(h.num_bands) * sizeof(doa_cell)) {
+        return frames;
+    }
+    if (header)
+        *header = h;
+    in.seekg(h.header_size);
+    std::vector<char> record(h.record_size);
+    while (in.read(&record.front(), record.size())) {
+        doa_frame f;
+        std::memcpy(&f.header, &record.front(), sizeof(f.header));
+        f.cells.resize(h.num_bands);
+        if (h.num_bands != 0) {
+            std::memcpy(&f.cells.front(), &record[sizeof(f.header)],
+                f.cells.size() * sizeof(doa_cell));
+        }
+        frames.push_back(f);
+    }
+    return frames;
+}
+
+/***********************************************************************
+ * doa_estimator
+ **********************************************************************/
+doa_estimator::doa_estimator(const doa_config& config,
+    const std::string& out_file,
+    double rate,
+    capture_metadata::sptr metadata)
+    : _config(config)
+    , _rate(rate)
+    , _num_bands(config.num_bands == 0 ? config.fft_len : config.num_bands)
+    , _span(config.fft_len * config.ffts_per_record)
+    , _fft(config.fft_len)
+    , _metadata(metadata)
+    , _pairing(config.num_windows, _span, _mutex)
+    , _running(true)
+    , _records(0)
+{
+    if (config.chan_a == config.chan_b or config.ffts_per_record == 0
+        or config.fft_len < 2 or config.fft_len % _num_bands != 0) {
+        throw std::runtime_error("doa_estimator: invalid configuration");
+    }
+    if (config.spacing_m <= 0 or config.freq <= 0)
+        throw std::runtime_error("doa_estimator: needs the antenna spacing and RF frequency");
+
+    _taper.resize(config.fft_len);
+    double sum_sq = 0;
+    for (size_t i = 0; i < config.fft_len; i++) {
+        _taper[i] = float(0.5 - 0.5 * std::cos(2 * M_PI * i / config.fft_len));
+        sum_sq += double(_taper[i]) * _taper[i];
+    }
+    // Parseval: the bins of one frame sum to n * sum(w^2) * mean |x|^2
+    _power_norm = 1.0 / (config.fft_len * sum_sq * config.ffts_per_record);
+
+    _out.open(out_file.c_str(), std::ios::binary | std::ios::trunc);
+    if (not _out.is_open())
+        throw std::runtime_error("Unable to open " + out_file);
+    doa_header h;
+    std::memcpy(h.magic, "ETDOA001", sizeof(h.magic));
+    h.header_size     = sizeof(doa_header);
+    h.record_size     = uint32_t(sizeof(doa_record_header) + _num_bands * sizeof(doa_cell));
+    h.fft_len         = uint32_t(config.fft_len);
+    h.num_bands       = uint32_t(_num_bands);
+    h.ffts_per_record = uint32_t(config.ffts_per_record);
+    h.reserved        = 0;
+    h.rate            = rate;
+    h.freq            = config.freq;
+    h.spacing_m       = config.spacing_m;
+    h.cal_phase_deg   = config.cal_phase_deg;
+    _out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+
+    for (pairing::window& win : _pairing.windows()) {
+        win.data.samps[0].resize(_span);
+        win.data.samps[1].resize(_span);
+    }
+    if (_metadata) {
+        _metadata->set("doa.file", out_file);
+        _metadata->set("doa.chan_a", config.chan_a);
+        _metadata->set("doa.chan_b", config.chan_b);
+        _metadata->set("doa.fft_len", config.fft_len);
+        _metadata->set("doa.ffts_per_record", config.ffts_per_record);
+        _metadata->set("doa.num_bands", _num_bands);
+        _metadata->set("doa.spacing_m", config.spacing_m);
+        _metadata->set("doa.cal_phase_deg", config.cal_phase_deg);
+    }
+    for (size_t i = 0; i < std::max<size_t>(1, config.num_threads); i++) {
+        _threads.push_back(std::thread(&doa_estimator::worker, this));
+    }
+}
+
+doa_estimator::~doa_estimator()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running = false;
+    }
+    _cond.notify_all();
+    for (size_t i = 0; i < _threads.size(); i++) {
+        _threads[i].join();
+    }
+    write_records();
+    _out.close();
+
+    uint64_t dropped;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        dropped = _pairing.num_dropped();
+    }
+    if (_metadata) {
+        _metadata->set("doa.records", _records);
+        _metadata->set("doa.dropped", dropped);
+    }
+    std::cout << boost::format("DOA: %d records of %dx%d, %d bands, %d windows dropped "
+                               "(workers behind)")
+                     % _records % _config.ffts_per_record % _config.fft_len % _num_bands
+                     % dropped
+              << std::endl;
+}
+
+/***********************************************************************
+ * recv side
+ **********************************************************************/
+void doa_estimator::write(const sample_block& block)
+{
+    const sample_format format = sample_format_of_size(block.samp_size);
+    for (size_t i = 0; i < block.num_channels; i++) {
+        const size_t chan = block.first_chan + i;
+        if (chan != _config.chan_a and chan != _config.chan_b) {
+            continue;
+        }
+        const size_t side = chan == _config.chan_a ? 0 : 1;
+        const char* samps = static_cast<const char*>(block.buffs[i]);
+        _pairing.fill(side, block.first_samp, block.num_samps, block.time_secs, _rate,
+            [samps, side, format, &block](
+                pairing::window& win, size_t offset, size_t in, size_t count) {
+                convert_samples(samps + in * block.samp_size, format,
+                    &win.data.samps[side][offset], sample_format::fc32, count);
+            },
+            // both channels complete windows in index order, so the later
+            // of the two does too
+            [this](pairing::window* win) {
+                win->data.done = false;
+                _ready.push_back(win);
+                _order.push_back(win);
+                _cond.notify_one();
+            });
+    }
+}
+
+/***********************************************************************
+ * workers
+ **********************************************************************/
+void doa_estimator::worker()
+{
+    apply_thread_role("dsp");
+    scratch w;
+    for (;;) {
+        pairing::window* win;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this] { return not _ready.empty() or not _running; });
+            if (_ready.empty())
+                break;
+            win = _ready.front();
+            _ready.pop_front();
+        }
+        process(*win, w);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            win->data.done = true;
+        }
+        write_records();
+    }
+    record_thread_stats("dsp");
+}
+
+void doa_estimator::process(pairing::window& win, scratch& w) const
+{
+    const size_t n        = _config.fft_len;
+    const size_t num_ffts = _config.ffts_per_record;
+    const size_t per_band = n / _num_bands;
+
+    // taper the whole record, then run its frames back to back
+    w.fa.resize(_span);
+    w.fb.resize(_span);
+    for (size_t i = 0; i < _span; i++) {
+        w.fa[i] = win.data.samps[0][i] * _taper[i % n];
+        w.fb[i] = win.data.samps[1][i] * _taper[i % n];
+    }
+    for (size_t f = 0; f < num_ffts; f++) {
+        _fft.execute(&w.fa[f * n]);
+        _fft.execute(&w.fb[f * n]);
+    }
+
+    // band b holds bins b * per_band .. of the centred spectrum
+    w.cross.assign(_num_bands, 0);
+    w.power_a.assign(_num_bands, 0);
+    w.power_b.assign(_num_bands, 0);
+    for (size_t f = 0; f < num_ffts; f++) {
+        const std::complex<float>* a = &w.fa[f * n];
+        const std::complex<float>* b = &w.fb[f * n];
+        for (size_t k = 0; k < n; k++) {
+            const size_t band = ((k + n / 2) % n) / per_band;
+            w.cross[band] += std::complex<double>(b[k] * std::conj(a[k]));
+            w.power_a[band] += std::norm(a[k]);
+            w.power_b[band] += std::norm(b[k]);
+        }
+    }
+
+    const double cal = _config.cal_phase_deg * M_PI / 180;
+    win.data.cells.resize(_num_bands);
+    doa_record_header& r = win.data.record;
+    r.time_secs          = win.time_secs;
+    r.num_ffts           = uint32_t(num_ffts);
+    r.peak_band          = 0;
+    r.reserved           = 0;
+    double peak_power    = -1;
+    double peak_sin      = 2;
+    for (size_t band = 0; band < _num_bands; band++) {
+        // the band's centre sets the wavelength
+        const double offset =
+            (band * per_band + (per_band - 1) / 2.0 - n / 2.0) * _rate / n;
+        const double wavelength = speed_of_light / (_config.freq + offset);
+        const double phase      = std::remainder(std::arg(w.cross[band]) - cal, 2 * M_PI);
+        const double sin_theta  = phase * wavelength / (2 * M_PI * _config.spacing_m);
+        const double power      = (w.power_a[band] + w.power_b[band]) / 2 * _power_norm;
+
+        doa_cell& cell = win.data.cells[band];
+        cell.angle_cdeg =
+            std::abs(sin_theta) <= 1 ? centi(std::asin(sin_theta) * 180 / M_PI) : doa_no_angle;
+        cell.power_cdb = centi(power_db(power));
+        if (power > peak_power) {
+            peak_power  = power;
+            peak_sin    = sin_theta;
+            r.peak_band = uint32_t(band);
+        }
+    }
+    const size_t p   = r.peak_band;
+    const double den = w.power_a[p] * w.power_b[p];
+    r.peak_angle_deg = std::abs(peak_sin) <= 1 ? float(std::asin(peak_sin) * 180 / M_PI)
+                                               : std::numeric_limits<float>::quiet_NaN();
+    r.peak_power_db  = float(power_db(peak_power));
+    r.peak_coherence = den > 0 ? float(std::norm(w.cross[p]) / den) : 0.0f;
+}
+
+//! Writes finished windows in stream order and frees them
+void doa_estimator::write_records()
+{
+    std::lock_guard<std::mutex> write_lock(_write_mutex);
+    for (;;) {
+        pairing::window* win;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_order.empty() or not _order.front()->data.done)
+                return;
+            win = _order.front();
+            _order.pop_front();
+        }
+        const window_data& d = win->data;
+        _out.write(reinterpret_cast<const char*>(&d.record), sizeof(d.record));
+        _out.write(reinterpret_cast<const char*>(&d.cells.front()),
+            d.cells.size() * sizeof(doa_cell));
+        _out.flush();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _records++;
+            _pairing.release(win);
+        }
+    }
+}
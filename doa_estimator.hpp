@@ -0,0 +1,158 @@
+#pragma once
+
+#include "capture_meta.hpp"
+#include "fft.hpp"
+#include "rx_sink.hpp"
+#include "window_pairing.hpp"
+#include <complex>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/***********************************************************************
+ * DOA time series
+ * A doa_header, then one record per ffts_per_record FFTs: a
+ * doa_record_header followed by num_bands doa_cells, lowest frequency
+ * first, all little endian. Band b covers FFT bins b * fft_len /
+ * num_bands onwards of the spectrum centred on freq.
+ *
+ * Angles are from broadside in 0.01 degree, positive towards chan_b
+ * (the wave reaches chan_b first); doa_no_angle marks a band whose
+ * phase difference no real angle explains. Powers are the mean of both
+ * channels' power within the band, in 0.01 dB full scale.
+ **********************************************************************/
+struct doa_header
+{
+    char magic[8]; // "ETDOA001"
+    uint32_t header_size;
+    uint32_t record_size; // header and cells of one record
+    uint32_t fft_len;
+    uint32_t num_bands;
+    uint32_t ffts_per_record;
+    uint32_t reserved;
+    double rate;
+    double freq; // RF centre
+    double spacing_m;
+    double cal_phase_deg;
+};
+
+struct doa_record_header
+{
+    double time_secs; // device time of the first sample
+    uint32_t num_ffts;
+    uint32_t peak_band; // band with the most power
+    float peak_angle_deg; // NaN when the peak band has no angle
+    float peak_power_db;
+    float peak_coherence; // |S_ab|^2 / (P_a P_b) of the peak band, 0..1
+    uint32_t reserved;
+};
+
+struct doa_cell
+{
+    int16_t angle_cdeg;
+    int16_t power_cdb;
+};
+
+static const int16_t doa_no_angle = -32768;
+
+struct doa_frame
+{
+    doa_record_header header;
+    std::vector<doa_cell> cells;
+};
+
+//! Records of a DOA file, empty if it is not one
+std::vector<doa_frame> read_doa_records(
+    const std::string& file, doa_header* header = nullptr);
+
+/***********************************************************************
+ * doa_estimator
+ * Direction of arrival from two coherent channels a spacing_m apart.
+ * The recv threads convert the two channels into windows of
+ * ffts_per_record FFT frames; a window whose two halves are complete
+ * goes to a pool of workers ("dsp" role), which run its Hann windowed
+ * FFTs as one batch, average the cross-spectrum B conj(A) and both
+ * power spectra, and per band turn the phase, less cal_phase_deg, into
+ * an angle with the band's wavelength. Records are written in stream
+ * order. Windows are dropped rather than queued when the workers fall
+ * behind, so the recv path never waits.
+ *
+ * cal_phase_deg is the phase of chan_b relative to chan_a that is not
+ * due to the geometry (cables, LOs), as --cal reports it; leave it 0
+ * behind --cal-apply, which has already removed it. Spacings over half
+ * a wavelength make the angle ambiguous.
+ **********************************************************************/
+struct doa_config
+{
+    size_t chan_a          = 0;
+    size_t chan_b          = 1;
+    size_t fft_len         = 1024;
+    size_t ffts_per_record = 16;
+    size_t num_bands       = 64; // 0 for one per FFT bin
+    double spacing_m       = 0;
+    double freq            = 0; // RF centre, for the wavelength
+    double cal_phase_deg   = 0;
+    size_t num_threads     = 1;
+    size_t num_windows     = 8; // in flight between recv and workers
+};
+
+class doa_estimator : public rx_sink
+{
+public:
+    doa_estimator(const doa_config& config,
+        const std::string& out_file,
+        double rate,
+        capture_metadata::sptr metadata = capture_metadata::sptr());
+    ~doa_estimator();
+
+    void write(const sample_block& block);
+
+private:
+    struct window_data
+    {
+        std::vector<std::complex<float>> samps[2];
+        bool done;
+        doa_record_header record;
+        std::vector<doa_cell> cells;
+    };
+    typedef window_pairing<window_data> pairing;
+
+    //! Per worker buffers
+    struct scratch
+    {
+        std::vector<std::complex<float>> fa, fb;
+        std::vector<std::complex<double>> cross;
+        std::vector<double> power_a, power_b;
+    };
+
+    void worker();
+    void process(pairing::window& win, scratch& w) const;
+    void write_records();
+
+    const doa_config _config;
+    const double _rate;
+    const size_t _num_bands;
+    const size_t _span; // samples per window
+    std::vector<float> _taper; // Hann
+    double _power_norm; // FFT |X|^2 to full scale power
+    fft_plan _fft;
+    capture_metadata::sptr _metadata;
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    pairing _pairing;
+    std::deque<pairing::window*> _ready; // waiting for a worker
+    std::deque<pairing::window*> _order; // queued, in stream order
+    bool _running;
+    uint64_t _records;
+
+    std::mutex _write_mutex;
+    std::ofstream _out;
+
+    std::vector<std::thread> _threads;
+};
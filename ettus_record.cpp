@@ -1,3 +1,19 @@
+#include "block_stats.hpp"
+#include "capture_meta.hpp"
+#include "host_setup.hpp"
+#include "iq_correction.hpp"
+#include "net_sink.hpp"
+#include "overview_pyramid.hpp"
+#include "recv_to_file.hpp"
+#include "sample_layout.hpp"
+#include "segment_sink.hpp"
+#include "shm_sink.hpp"
+#include "stream_common.hpp"
+#include "stream_device.hpp"
+#include "thread_topology.hpp"
+#include "trace.hpp"
+#include "tx_async_monitor.hpp"
+#include "usrp_setup.hpp"
 #include "wavetable.hpp"
 
 #include <iostream>
@@ -33,38 +49,36 @@
 namespace po = boost::program_options;
 
 
-/***********************************************************************
- * Signal handlers - black box
- **********************************************************************/
-static bool stop_signal_called = false;
-void sig_int_handler(int)
-{
-    stop_signal_called = true;
-}
-
 /***********************************************************************
  * transmit_worker function
  * A function to be used as a boost::thread_group thread for transmitting
  **********************************************************************/
-void transmit_worker(std::vector<std::complex<float>> buff,
-    wave_table_class wave_table,
+void transmit_worker(size_t samps_per_buff,
+    const wave_table_class& wave_table,
     uhd::tx_streamer::sptr tx_streamer,
     uhd::tx_metadata_t metadata,
     size_t step,
     size_t index,
-    int num_channels)
+    int num_channels,
+    tx_async_monitor::sptr monitor)
 {
-    std::vector<std::complex<float>*> buffs(num_channels, &buff.front());
+    // the worker's own aligned buffer, nothing is copied in
+    block_buffer<std::complex<float>> buff(1, samps_per_buff);
+    std::vector<std::complex<float>*> buffs(num_channels, buff[0]);
 
     // send data until the signal handler gets called
     while (not stop_signal_called) {
         // fill the buffer with the waveform
-        for (size_t n = 0; n < buff.size(); n++) {
-            buff[n] = wave_table(index += step);
+        {
+            TRACE_SCOPE("wave fill");
+            index = wave_table.fill(buff[0], samps_per_buff, index, step);
         }
 
         // send the entire contents of the buffer
-        tx_streamer->send(buffs, buff.size(), metadata);
+        {
+            TRACE_SCOPE("send");
+            tx_streamer->send(buffs, samps_per_buff, metadata);
+        }
 
         metadata.start_of_burst = false;
         metadata.has_time_spec  = false;
@@ -72,145 +86,37 @@ void transmit_worker(std::vector<std::complex<float>> buff,
 
     // send a mini EOB packet
     metadata.end_of_burst = true;
+    monitor->begin_end_of_burst();
     tx_streamer->send("", 0, metadata);
 }
 
-/***********************************************************************
- * Utilities - black box
- **********************************************************************/
-//! Change to filename, e.g. from usrp_samples.dat to usrp_samples.00.dat,
-//  but only if multiple names are to be generated.
-std::string generate_out_filename(
-    const std::string& base_fn, size_t n_names, size_t this_name)
-{
-    if (n_names == 1) {
-        return base_fn;
-    }
-
-    boost::filesystem::path base_fn_fp(base_fn);
-    base_fn_fp.replace_extension(boost::filesystem::path(
-        str(boost::format("%02d%s") % this_name % base_fn_fp.extension().string())));
-    return base_fn_fp.string();
-}
-
-
-/***********************************************************************
- * recv_to_file function - black box
- **********************************************************************/
-template <typename samp_type>
-void recv_to_file(uhd::usrp::multi_usrp::sptr usrp,
-    const std::string& cpu_format,
-    const std::string& wire_format,
-    const std::string& file,
-    size_t samps_per_buff,
-    int num_requested_samples,
-    double settling_time,
-    std::vector<size_t> rx_channel_nums)
-{
-    int num_total_samps = 0;
-    // create a receive streamer
-    uhd::stream_args_t stream_args(cpu_format, wire_format);
-    stream_args.channels             = rx_channel_nums;
-    uhd::rx_streamer::sptr rx_stream = usrp->get_rx_stream(stream_args);
-
-    // Prepare buffers for received samples and metadata
-    uhd::rx_metadata_t md;
-    std::vector<std::vector<samp_type>> buffs(
-        rx_channel_nums.size(), std::vector<samp_type>(samps_per_buff));
-    // create a vector of pointers to point to each of the channel buffers
-    std::vector<samp_type*> buff_ptrs;
-    for (size_t i = 0; i < buffs.size(); i++) {
-        buff_ptrs.push_back(&buffs[i].front());
-    }
-
-    // Create one ofstream object per channel
-    // (use shared_ptr because ofstream is non-copyable)
-    std::vector<std::shared_ptr<std::ofstream>> outfiles;
-    for (size_t i = 0; i < buffs.size(); i++) {
-        const std::string this_filename = generate_out_filename(file, buffs.size(), i);
-        outfiles.push_back(std::shared_ptr<std::ofstream>(
-            new std::ofstream(this_filename.c_str(), std::ofstream::binary)));
-    }
-    UHD_ASSERT_THROW(outfiles.size() == buffs.size());
-    UHD_ASSERT_THROW(buffs.size() == rx_channel_nums.size());
-    bool overflow_message = true;
-    double timeout =
-        settling_time + 0.1f; // expected settling time + padding for first recv
-
-    // setup streaming
-    uhd::stream_cmd_t stream_cmd((num_requested_samples == 0)
-                                     ? uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS
-                                     : uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_DONE);
-    stream_cmd.num_samps  = num_requested_samples;
-    stream_cmd.stream_now = false;
-    stream_cmd.time_spec  = uhd::time_spec_t(settling_time);
-    rx_stream->issue_stream_cmd(stream_cmd);
-
-    while (not stop_signal_called
-           and (num_requested_samples > num_total_samps or num_requested_samples == 0)) {
-        size_t num_rx_samps = rx_stream->recv(buff_ptrs, samps_per_buff, md, timeout);
-        timeout             = 0.1f; // small timeout for subsequent recv
-
-        if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
-            std::cout << boost::format("Timeout while streaming") << std::endl;
-            break;
-        }
-        if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW) {
-            if (overflow_message) {
-                overflow_message = false;
-                std::cerr
-                    << boost::format(
-                           "Got an overflow indication. Please consider the following:\n"
-                           "  Your write medium must sustain a rate of %fMB/s.\n"
-                           "  Dropped samples will not be written to the file.\n"
-                           "  Please modify this example for your purposes.\n"
-                           "  This message will not appear again.\n")
-                           % (usrp->get_rx_rate() * sizeof(samp_type) / 1e6);
-            }
-            continue;
-        }
-        if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE) {
-            throw std::runtime_error(
-                str(boost::format("Receiver error %s") % md.strerror()));
-        }
-
-        num_total_samps += num_rx_samps;
-
-        for (size_t i = 0; i < outfiles.size(); i++) {
-            outfiles[i]->write(
-                (const char*)buff_ptrs[i], num_rx_samps * sizeof(samp_type));
-        }
-    }
-
-    // Shut down receiver
-    stream_cmd.stream_mode = uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS;
-    rx_stream->issue_stream_cmd(stream_cmd);
-
-    // Close files
-    for (size_t i = 0; i < outfiles.size(); i++) {
-        outfiles[i]->close();
-    }
-}
-
 /***********************************************************************
  * Main function
  **********************************************************************/
 
 int main(int argc, char* argv[])
 {
+    startup_timer timer;
 
     uhd::set_thread_priority_safe();
 
-    // Network adapters need some configuration to work with x300. This script does all that. Proved to work for GNU Radio 100 times before.
-    std::cout << "Configuring network adapter settings" << std::endl;
-	// NB: This file should be used to set ALL variables
-    system("./usrp_n210_init.sh");
-
     // 
     std::string devAddress, file, ref, wave_type,type, pps, otw, print_time;
+    std::string layout_name;
+    size_t layout_block;
     size_t total_num_samps, numChannels;
     double tx_rate, rx_rate, tx_freq, rx_freq, tx_gain, rx_gain, tx_bw, rx_bw;
     double wave_freq, lo_offset, total_time, settling, spb, setup_time;
+    std::vector<std::string> net_specs;
+    std::string shm_spec;
+    nic_config nic;
+    double segment_mb, retain_gb;
+    segment_config seg_config;
+    std::string threads_spec;
+    double jitter_secs;
+    size_t stats_block;
+    size_t overview_base;
+    iq_correction_config iq_config;
     float ampl;
 
     //setup the program options
@@ -219,8 +125,18 @@ int main(int argc, char* argv[])
         ("help", "help message")
         ("dev", po::value<std::string>(&devAddress)->default_value("addr0=192.168.10.2"), "single uhd device address args (dev=addr0=192.168.10.2")
         ("file", po::value<std::string>(&file)->default_value("usrp_samples.bin"), "name of the file to write binary samples to")
-        ("nsamps", po::value<size_t>(&total_num_samps), "total number of samples to receive")
-        ("type", po::value<std::string>(&type)->default_value("short"), "sample type in file: double, float, or short")
+        ("segment-mb", po::value<double>(&segment_mb)->default_value(0), "rotate the file every this many MB (usrp_samples.000000.bin, ...)")
+        ("segment-secs", po::value<double>(&seg_config.max_secs)->default_value(0), "rotate the file every this many seconds")
+        ("iq-correct", "estimate and correct DC offset and IQ imbalance while streaming")
+        ("iq-estimate", "only estimate DC offset and IQ imbalance, recorded in the metadata file")
+        ("iq-time-const", po::value<double>(&iq_config.time_const_secs)->default_value(1.0), "seconds the DC and IQ estimates are averaged over")
+        ("stats", "write per-block power, peak, DC and clipping statistics next to the file (.stats)")
+        ("stats-block", po::value<size_t>(&stats_block)->default_value(65536), "samples per statistics record")
+        ("overview", "write a min/max/mean power overview pyramid next to the file (.ovr)")
+        ("overview-base", po::value<size_t>(&overview_base)->default_value(256), "samples per record of the finest overview level, a power of two")
+        ("retain-gb", po::value<double>(&retain_gb)->default_value(0), "with rotation, delete the oldest segments beyond this many GB in total")
+        ("nsamps", po::value<size_t>(&total_num_samps)->default_value(0), "total number of samples to receive")
+        ("type", po::value<std::string>(&type)->default_value("short"), "sample type in file: double, float, short, sc8 (use with --otw sc8) or sc12 (short packed to 12 bits, 3 bytes per sample)")
         ("duration", po::value<double>(&total_time)->default_value(0), "total number of seconds to receive")
         ("settling", po::value<double>(&settling)->default_value(double(0.2)), "settling time (seconds) before receiving")
         ("spb", po::value<double>(&spb)->default_value(1), "buffer multiplier") //buffer per channel
@@ -233,6 +149,8 @@ int main(int argc, char* argv[])
         ("tx-bw", po::value<double>(&tx_bw)->default_value(0.0), "analog frontend filter bandwidth in Hz")
         ("rx-bw", po::value<double>(&rx_bw)->default_value(0.0), "analog frontend filter bandwidth in Hz")
         ("ampl", po::value<float>(&ampl)->default_value(float(0.3)), "amplitude of the waveform [0 to 0.7]")
+        ("layout", po::value<std::string>(&layout_name)->default_value("interleaved"), "file layout: interleaved, planar (I and Q in separate .i/.q files) or blocked (blocks of I then Q, see --layout-block)")
+        ("layout-block", po::value<size_t>(&layout_block)->default_value(256), "samples per block of the blocked layout")
         ("wave-type", po::value<std::string>(&wave_type)->default_value("CONST"), "waveform type (CONST, SQUARE, RAMP, SINE)")
         ("wave-freq", po::value<double>(&wave_freq)->default_value(0), "waveform frequency in Hz")
         ("lo-offset", po::value<double>(&lo_offset)->default_value(0.0),"Offset for frontend LO in Hz (optional)")
@@ -240,7 +158,14 @@ int main(int argc, char* argv[])
 		("ref", po::value<std::string>(&ref)->default_value("internal"), "reference source (gpsdo, internal, external)")
 		("otw", po::value<std::string>(&otw)->default_value("sc16"), "specify the over-the-wire sample mode")
         ("print", po::value<std::string>(&print_time)->default_value("N"), "y/N")
-        ("setup", po::value<double>(&setup_time)->default_value(1.0), "seconds of setup time")
+        ("setup", po::value<double>(&setup_time)->default_value(1.0), "seconds to wait for the LOs and reference to lock")
+        ("iface", po::value<std::string>(&nic.iface)->default_value(nic.iface), "network interface the device is on, checked for the usrp_n210_init.sh settings")
+        ("skip-host-setup", "do not check or change the host network settings")
+        ("net", po::value<std::vector<std::string>>(&net_specs), "also stream samples to tcp:PORT or udp:HOST:PORT[:BYTES] (repeatable)")
+        ("shm", po::value<std::string>(&shm_spec), "also publish samples in shared-memory ring NAME[:SLOTS] for local readers")
+        ("threads", po::value<std::string>(&threads_spec), "thread placement role=CORES[:POLICY[:PRIO]],... for recv, generator, writer, net (or @FILE)")
+        ("mlockall", "lock all current and future memory of the process")
+        ("jitter-test", po::value<double>(&jitter_secs)->default_value(0), "before streaming, measure wakeup latency on each placement for this many seconds")
     ;
 
     // clang-format on
@@ -255,13 +180,32 @@ int main(int argc, char* argv[])
         return ~0;
     }
 
+    // placements apply to the pipeline threads as they start; the device's
+    // own threads keep the default
+    thread_topology topology;
+    if (vm.count("threads"))
+        topology = thread_topology::parse(threads_spec);
+    topology.mlockall = topology.mlockall or vm.count("mlockall");
+    set_thread_topology(topology);
+    if (jitter_secs > 0)
+        run_jitter_test(jitter_secs);
+
+    // Network adapters need some configuration to work with the N210: MTU,
+    // NIC rings and socket buffer limits, as set by usrp_n210_init.sh.
+    // Only what differs gets changed, without running any tools.
+    if (not vm.count("skip-host-setup")) {
+        check_host_network(nic);
+        timer.mark("host setup");
+    }
+
     // create a usrp device
     // single board, 2 slots on ettusN210
     //printing IP which device is recorded as using
     std::cout << boost::format("Creating the TxRx usrp device with: %s...") % devAddress
               << std::endl;
-    uhd::usrp::multi_usrp::sptr usrp = uhd::usrp::multi_usrp::make(devAddress);
+    uhd::usrp::multi_usrp::sptr usrp = make_usrp_cached(devAddress);
     std::cout << std::endl;
+    timer.mark("device");
     // setting rx and tx subdevice
  
 
@@ -331,10 +275,7 @@ int main(int argc, char* argv[])
     }
     //Note 0 channel transmission is hardcoded
     size_t channel = 0;
-    uhd::tune_request_t tx_tune_request(tx_freq);
-    if (vm.count("tx-int-n"))
-        tx_tune_request.args = uhd::device_addr_t("mode_n=integer");
-    usrp->set_tx_freq(tx_tune_request, channel);
+    usrp->set_tx_freq(make_tune_request(tx_freq, vm.count("tx-int-n") > 0), channel);
     //printing transmit channel
     std::cout << boost::format("Setting TX Freq: %f MHz...") % (tx_freq / 1e6)
                 << std::endl;
@@ -371,10 +312,7 @@ int main(int argc, char* argv[])
 
     std::cout << boost::format("Setting RX Freq: %f MHz...") % (rx_freq / 1e6)
                   << std::endl;
-    uhd::tune_request_t rx_tune_request(rx_freq);
-    if (vm.count("rx-int-n"))
-        rx_tune_request.args = uhd::device_addr_t("mode_n=integer");
-    usrp->set_rx_freq(rx_tune_request, channel);
+    usrp->set_rx_freq(make_tune_request(rx_freq, vm.count("rx-int-n") > 0), channel);
     std::cout << boost::format("Actual RX Freq: %f MHz...")
                         % (usrp->get_rx_freq(channel) / 1e6)
                 << std::endl
@@ -438,8 +376,7 @@ int main(int argc, char* argv[])
     //              Data Handling Config
     //---------------------------------------------------------------------
 
-    // allow for some setup time
-    std::this_thread::sleep_for(std::chrono::seconds(1)); 
+    timer.mark("configure");
 
     // create a transmit streamer
     // linearly map channels (index0 = channel0, index1 = channel1, ...)
@@ -449,8 +386,7 @@ int main(int argc, char* argv[])
    // allocate a buffer which we re-use for each channel
     if (spb == 0)
         spb = tx_stream->get_max_num_samps() * 10;
-    std::vector<std::complex<float>> buff(spb);
-    int num_channels = channel;
+    int num_channels = int(tx_stream->get_num_channels());
 
     // setup the metadata flags
     uhd::tx_metadata_t md;
@@ -461,95 +397,116 @@ int main(int argc, char* argv[])
 
     //463 and down
 
-    // Check Ref and LO Lock detect
-    std::vector<std::string> tx_sensor_names, rx_sensor_names;
-    tx_sensor_names = usrp->get_tx_sensor_names(0);
-    if (std::find(tx_sensor_names.begin(), tx_sensor_names.end(), "lo_locked")
-        != tx_sensor_names.end()) {
-        uhd::sensor_value_t lo_locked = usrp->get_tx_sensor("lo_locked", 0);
-        std::cout << boost::format("Checking TX: %s ...") % lo_locked.to_pp_string()
-                  << std::endl;
-        UHD_ASSERT_THROW(lo_locked.to_bool());
-    }
-    rx_sensor_names = usrp->get_rx_sensor_names(0);
-    if (std::find(rx_sensor_names.begin(), rx_sensor_names.end(), "lo_locked")
-        != rx_sensor_names.end()) {
-        uhd::sensor_value_t lo_locked = usrp->get_rx_sensor("lo_locked", 0);
-        std::cout << boost::format("Checking RX: %s ...") % lo_locked.to_pp_string()
-                  << std::endl;
-        UHD_ASSERT_THROW(lo_locked.to_bool());
-    }
-
-    tx_sensor_names = usrp->get_mboard_sensor_names(0);
-    if ((ref == "mimo")
-        and (std::find(tx_sensor_names.begin(), tx_sensor_names.end(), "mimo_locked")
-                != tx_sensor_names.end())) {
-        uhd::sensor_value_t mimo_locked = usrp->get_mboard_sensor("mimo_locked", 0);
-        std::cout << boost::format("Checking TX: %s ...") % mimo_locked.to_pp_string()
-                  << std::endl;
-        UHD_ASSERT_THROW(mimo_locked.to_bool());
-    }
-    if ((ref == "external")
-        and (std::find(tx_sensor_names.begin(), tx_sensor_names.end(), "ref_locked")
-                != tx_sensor_names.end())) {
-        uhd::sensor_value_t ref_locked = usrp->get_mboard_sensor("ref_locked", 0);
-        std::cout << boost::format("Checking TX: %s ...") % ref_locked.to_pp_string()
-                  << std::endl;
-        UHD_ASSERT_THROW(ref_locked.to_bool());
-    }
-
-    rx_sensor_names = usrp->get_mboard_sensor_names(0);
-    if ((ref == "mimo")
-        and (std::find(rx_sensor_names.begin(), rx_sensor_names.end(), "mimo_locked")
-                != rx_sensor_names.end())) {
-        uhd::sensor_value_t mimo_locked = usrp->get_mboard_sensor("mimo_locked", 0);
-        std::cout << boost::format("Checking RX: %s ...") % mimo_locked.to_pp_string()
-                  << std::endl;
-        UHD_ASSERT_THROW(mimo_locked.to_bool());
-    }
-    if ((ref == "external")
-        and (std::find(rx_sensor_names.begin(), rx_sensor_names.end(), "ref_locked")
-                != rx_sensor_names.end())) {
-        uhd::sensor_value_t ref_locked = usrp->get_mboard_sensor("ref_locked", 0);
-        std::cout << boost::format("Checking RX: %s ...") % ref_locked.to_pp_string()
-                  << std::endl;
-        UHD_ASSERT_THROW(ref_locked.to_bool());
-    }
+    // Check Ref and LO Lock detect, waiting up to the setup time for them
+    check_lo_locked(usrp, "TX", 0, setup_time);
+    check_lo_locked(usrp, "RX", 0, setup_time);
+    check_ref_locked(usrp, ref, 0, "TX", setup_time);
+    check_ref_locked(usrp, ref, 0, "RX", setup_time);
+    timer.mark("lock");
 
     if (total_num_samps == 0) {
         std::signal(SIGINT, &sig_int_handler);
         std::cout << "Press Ctrl + C to stop streaming..." << std::endl;
     }
 
-    // reset usrp time to prepare for transmit/receive
-    std::cout << boost::format("Setting device timestamp to 0...") << std::endl;
-    usrp->set_time_now(uhd::time_spec_t(0.0));
-
-    
-
     //line 523 and up
 
     // reset usrp time to prepare for transmit/receive
     std::cout << boost::format("Setting device timestamp to 0...") << std::endl;
     usrp->set_time_now(uhd::time_spec_t(0.0));
 
-    // start transmit worker thread
+    // start transmit worker thread, with a monitor for its async messages
+    tx_async_monitor::sptr tx_monitor(new tx_async_monitor(tx_stream));
     boost::thread_group transmit_thread;
-    transmit_thread.create_thread(std::bind(
-        &transmit_worker, buff, wave_table, tx_stream, md, step, index, num_channels));
-
-    std::vector<long unsigned int> channels ={channel}; 
+    transmit_thread.create_thread(with_thread_role("generator", std::bind(
+        &transmit_worker, size_t(spb), std::cref(wave_table), tx_stream, md, step, index, num_channels, tx_monitor)));
 
-    // recv to file
+    // create a receive streamer
+    std::string rx_cpu_format;
+    if (type == "double")
+        rx_cpu_format = "fc64";
+    else if (type == "float")
+        rx_cpu_format = "fc32";
+    else if (type == "short" or type == "sc12")
+        rx_cpu_format = "sc16";
+    else if (type == "sc8")
+        rx_cpu_format = "sc8";
+    // sc12 is received as sc16 and packed by the file writers
+    const std::string file_format = type == "sc12" ? "sc12" : rx_cpu_format;
+    uhd::stream_args_t rx_stream_args(rx_cpu_format, otw);
+    rx_stream_args.channels          = std::vector<size_t>{channel};
+    uhd::rx_streamer::sptr rx_stream;
+    if (not rx_cpu_format.empty())
+        rx_stream = usrp->get_rx_stream(rx_stream_args);
+
+    capture_metadata::sptr metadata(new capture_metadata(file));
+    metadata->set("rate", usrp->get_rx_rate());
+    metadata->set("freq", rx_freq);
+    metadata->set("cpu_format", rx_cpu_format);
+    metadata->set("file_format", file_format);
+    const sample_layout layout = parse_sample_layout(layout_name);
+    metadata->set("layout", sample_layout_name(layout));
+    if (layout == sample_layout::blocked)
+        metadata->set("layout_block_samps", layout_block);
+    metadata->set("num_channels", 1);
+    metadata->set("start_time", settling);
+
+    // recv to file (or rotating segments), and to any network subscribers
+    std::vector<rx_sink::sptr> sinks;
+    sinks.push_back(timer.first_sample_sink());
+    const size_t samp_size = (type == "double") ? sizeof(std::complex<double>)
+                             : (type == "float") ? sizeof(std::complex<float>)
+                             : (type == "sc8")   ? sizeof(std::complex<int8_t>)
+                                                 : sizeof(std::complex<short>);
+    if (rx_stream and (vm.count("iq-correct") or vm.count("iq-estimate"))) {
+        iq_config.apply = vm.count("iq-correct") > 0;
+        sinks.push_back(rx_sink::sptr(new iq_correction(
+            iq_config, rx_stream->get_num_channels(), usrp->get_rx_rate(), metadata)));
+    }
+    seg_config.max_bytes    = uint64_t(segment_mb * 1e6);
+    seg_config.retain_bytes = uint64_t(retain_gb * 1e9);
+    if (rx_stream and (seg_config.max_bytes != 0 or seg_config.max_secs > 0)) {
+        if (layout != sample_layout::interleaved)
+            throw std::runtime_error("--layout is for plain files, not segments");
+        if (vm.count("overview"))
+            throw std::runtime_error("--overview is for plain files, not segments");
+        sinks.push_back(rx_sink::sptr(new segment_sink(file, rx_stream->get_num_channels(),
+            samp_size, usrp->get_rx_rate(), seg_config, metadata, file_format)));
+    } else if (rx_stream) {
+        sinks.push_back(rx_sink::sptr(
+            new file_sink(file, rx_stream->get_num_channels(), file_format, layout,
+                layout_block)));
+        if (vm.count("overview"))
+            sinks.push_back(rx_sink::sptr(new overview_pyramid(file,
+                rx_stream->get_num_channels(), 0, rx_stream->get_num_channels(),
+                samp_size, usrp->get_rx_rate(), overview_base, metadata)));
+    }
+    if (rx_stream and vm.count("stats")) {
+        sinks.push_back(rx_sink::sptr(new block_stats(file, rx_stream->get_num_channels(),
+            samp_size, usrp->get_rx_rate(), stats_block, metadata)));
+    }
+    for (size_t i = 0; i < net_specs.size(); i++) {
+        sinks.push_back(rx_sink::sptr(new net_sink(net_specs[i])));
+    }
+    if (rx_stream and vm.count("shm")) {
+        sinks.push_back(rx_sink::sptr(make_shm_sink(
+            shm_spec, rx_stream->get_num_channels(), samp_size, usrp->get_rx_rate(), spb)));
+    }
+    stream_device::sptr device = usrp_stream_device::make(usrp);
+    timer.mark("stream setup");
+    apply_thread_role("recv");
     if (type == "double")
-        recv_to_file<std::complex<double>>(
-            usrp, "fc64", otw, file, spb, total_num_samps, settling, channels);
+        recv_to_sinks<std::complex<double>>(
+            device, rx_stream, sinks, spb, total_num_samps, settling, 0);
     else if (type == "float")
-        recv_to_file<std::complex<float>>(
-            usrp, "fc32", otw, file, spb, total_num_samps, settling, channels);
-    else if (type == "short")
-        recv_to_file<std::complex<short>>(
-            usrp, "sc16", otw, file, spb, total_num_samps, settling, channels);
+        recv_to_sinks<std::complex<float>>(
+            device, rx_stream, sinks, spb, total_num_samps, settling, 0);
+    else if (type == "short" or type == "sc12")
+        recv_to_sinks<std::complex<short>>(
+            device, rx_stream, sinks, spb, total_num_samps, settling, 0);
+    else if (type == "sc8")
+        recv_to_sinks<std::complex<int8_t>>(
+            device, rx_stream, sinks, spb, total_num_samps, settling, 0);
     else {
         // clean up transmit worker
         stop_signal_called = true;
@@ -560,6 +517,12 @@ int main(int argc, char* argv[])
     // clean up transmit worker
     stop_signal_called = true;
     transmit_thread.join_all();
+    tx_monitor->stop();
+    tx_monitor->report(metadata);
+    record_thread_stats("recv");
+    sinks.clear();
+    metadata->write();
+    print_thread_report();
 
     // finished
     std::cout << std::endl << "Done!" << std::endl << std::endl;
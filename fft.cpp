@@ -0,0 +1,46 @@
+#include "fft.hpp"
+#include <cmath>
+#include <stdexcept>
+
+fft_plan::fft_plan(size_t n, bool inverse) : _n(n), _twiddles(n / 2), _bitrev(n)
+{
+    if (n < 2 or (n & (n - 1)) != 0) {
+        throw std::runtime_error("fft_plan: size must be a power of two");
+    }
+    const double sign = inverse ? 1.0 : -1.0;
+    for (size_t k = 0; k < n / 2; k++) {
+        const double angle = sign * 2 * M_PI * k / n;
+        _twiddles[k]       = std::complex<float>(std::cos(angle), std::sin(angle));
+    }
+    size_t bits = 0;
+    while ((size_t(1) << bits) < n)
+        bits++;
+    for (size_t i = 0; i < n; i++) {
+        size_t r = 0;
+        for (size_t b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        _bitrev[i] = r;
+    }
+}
+
+void fft_plan::execute(std::complex<float>* data) const
+{
+    for (size_t i = 0; i < _n; i++) {
+        if (i < _bitrev[i])
+            std::swap(data[i], data[_bitrev[i]]);
+    }
+    for (size_t len = 2; len <= _n; len <<= 1) {
+        const size_t half   = len / 2;
+        const size_t stride = _n / len;
+        for (size_t start = 0; start < _n; start += len) {
+            std::complex<float>* lo = data + start;
+            std::complex<float>* hi = lo + half;
+            for (size_t k = 0; k < half; k++) {
+                const std::complex<float> t = hi[k] * _twiddles[k * stride];
+                hi[k]                       = lo[k] - t;
+                lo[k] += t;
+            }
+        }
+    }
+}
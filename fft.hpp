@@ -0,0 +1,28 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+
+/***********************************************************************
+ * fft_plan
+ * In-place radix-2 complex FFT with precomputed twiddles and bit
+ * reversal. Unnormalised in both directions, like FFTW.
+ **********************************************************************/
+class fft_plan
+{
+public:
+    //! n must be a power of two
+    fft_plan(size_t n, bool inverse = false);
+
+    void execute(std::complex<float>* data) const;
+
+    inline size_t size() const
+    {
+        return _n;
+    }
+
+private:
+    size_t _n;
+    std::vector<std::complex<float>> _twiddles;
+    std::vector<size_t> _bitrev;
+};
@@ -0,0 +1,160 @@
+#include "file_sink.hpp"
+#include "stream_common.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+// the default filebuf flushes every few KiB; at tens of MB/s that is a
+// write() syscall per packet
+static const size_t file_sink_buff_size = 1 << 20;
+
+file_sink::file_sink(const std::string& file,
+    size_t num_channels,
+    const std::string& file_format,
+    sample_layout layout,
+    size_t block_samps)
+{
+    open(file, num_channels, 0, num_channels, file_format, layout, block_samps);
+}
+
+file_sink::file_sink(const std::string& file,
+    size_t num_channels,
+    size_t first_name,
+    size_t total_names,
+    const std::string& file_format,
+    sample_layout layout,
+    size_t block_samps)
+{
+    open(file, num_channels, first_name, total_names, file_format, layout, block_samps);
+}
+
+void file_sink::open(const std::string& file,
+    size_t num_channels,
+    size_t first_name,
+    size_t total_names,
+    const std::string& file_format,
+    sample_layout layout,
+    size_t block_samps)
+{
+    _convert      = not file_format.empty();
+    _file_format  = _convert ? parse_sample_format(file_format) : sample_format::sc16;
+    _layout       = layout;
+    _block_samps  = block_samps;
+    _split_format = _file_format;
+    if (layout != sample_layout::interleaved and _convert
+        and _file_format == sample_format::sc12)
+        throw std::runtime_error("sc12 files can only be interleaved");
+    if (layout == sample_layout::blocked and block_samps == 0)
+        throw std::runtime_error("file_sink: blocked layout needs a block size");
+    // Create one ofstream object per channel
+    for (size_t i = 0; i < num_channels; i++) {
+        const std::string this_filename =
+            generate_out_filename(file, total_names, first_name + i);
+        if (layout == sample_layout::planar) {
+            _outfiles.push_back(open_file(planar_file_name(this_filename, 'i')));
+            _qfiles.push_back(open_file(planar_file_name(this_filename, 'q')));
+        } else {
+            _outfiles.push_back(open_file(this_filename));
+        }
+    }
+    _pending.resize(num_channels);
+}
+
+std::shared_ptr<std::ofstream> file_sink::open_file(const std::string& name)
+{
+    _stream_bufs.push_back(std::vector<char>(file_sink_buff_size));
+    std::shared_ptr<std::ofstream> outfile(new std::ofstream);
+    outfile->rdbuf()->pubsetbuf(&_stream_bufs.back().front(), file_sink_buff_size);
+    outfile->open(name.c_str(), std::ofstream::binary);
+    if (not outfile->is_open()) {
+        throw std::runtime_error("Unable to open " + name);
+    }
+    return outfile;
+}
+
+void file_sink::write(const sample_block& block)
+{
+    TRACE_SCOPE("file write");
+    const sample_format format = sample_format_of_size(block.samp_size);
+    if (_convert and format != _file_format and block.num_samps != 0) {
+        const size_t bytes = block.num_samps * sample_format_size(_file_format);
+        _converted.resize(bytes);
+        for (size_t i = 0; i < _outfiles.size(); i++) {
+            convert_samples(block.buffs[i], format, &_converted.front(), _file_format,
+                block.num_samps);
+            if (_layout == sample_layout::interleaved)
+                _outfiles[i]->write(&_converted.front(), bytes);
+            else
+                write_split(i, &_converted.front(), _file_format, block.num_samps);
+        }
+        return;
+    }
+    for (size_t i = 0; i < _outfiles.size(); i++) {
+        if (_layout == sample_layout::interleaved)
+            _outfiles[i]->write(
+                (const char*)block.buffs[i], block.num_samps * block.samp_size);
+        else
+            write_split(i, (const char*)block.buffs[i], format, block.num_samps);
+    }
+}
+
+void file_sink::write_split(size_t chan, const char* samps, sample_format format, size_t n)
+{
+    const size_t samp_size   = sample_format_size(format);
+    const size_t scalar_size = samp_size / 2;
+    _split_format            = format;
+    if (_layout == sample_layout::planar) {
+        _split.resize(n * samp_size);
+        deinterleave_samples(samps, format, &_split.front(), &_split[n * scalar_size], n);
+        _outfiles[chan]->write(&_split.front(), n * scalar_size);
+        _qfiles[chan]->write(&_split[n * scalar_size], n * scalar_size);
+        return;
+    }
+
+    // top up the block left over from the last write first
+    std::vector<char>& pending = _pending[chan];
+    if (not pending.empty()) {
+        const size_t take = std::min(n, _block_samps - pending.size() / samp_size);
+        pending.insert(pending.end(), samps, samps + take * samp_size);
+        samps += take * samp_size;
+        n -= take;
+        if (pending.size() == _block_samps * samp_size) {
+            write_blocks(chan, &pending.front(), format, _block_samps);
+            pending.clear();
+        }
+    }
+    const size_t whole = n / _block_samps * _block_samps;
+    if (whole != 0)
+        write_blocks(chan, samps, format, whole);
+    pending.insert(pending.end(), samps + whole * samp_size, samps + n * samp_size);
+}
+
+void file_sink::write_blocks(size_t chan, const char* samps, sample_format format, size_t n)
+{
+    const size_t samp_size   = sample_format_size(format);
+    const size_t scalar_size = samp_size / 2;
+    _split.resize(n * samp_size);
+    for (size_t done = 0; done < n; done += _block_samps) {
+        const size_t count = std::min(_block_samps, n - done);
+        char* out          = &_split[done * samp_size];
+        deinterleave_samples(
+            samps + done * samp_size, format, out, out + count * scalar_size, count);
+    }
+    _outfiles[chan]->write(&_split.front(), n * samp_size);
+}
+
+void file_sink::close()
+{
+    for (size_t i = 0; i < _outfiles.size(); i++) {
+        // the short last block
+        if (not _pending[i].empty()) {
+            write_blocks(i, &_pending[i].front(), _split_format,
+                _pending[i].size() / sample_format_size(_split_format));
+            _pending[i].clear();
+        }
+        _outfiles[i]->close();
+    }
+    for (size_t i = 0; i < _qfiles.size(); i++) {
+        _qfiles[i]->close();
+    }
+}
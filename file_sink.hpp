@@ -0,0 +1,65 @@
+#pragma once
+
+#include "convert.hpp"
+#include "rx_sink.hpp"
+#include "sample_layout.hpp"
+#include <fstream>
+#include <string>
+#include <vector>
+
+/***********************************************************************
+ * file_sink
+ * Writes each channel to its own raw binary file, named with
+ * generate_out_filename when there is more than one channel. With a
+ * file_format ("sc12", "fc32", ...) the blocks are converted to that
+ * format on the way out; empty writes them as they arrive. A planar
+ * or blocked layout splits I and Q on the writer thread (see
+ * sample_layout.hpp); planar opens a second file per channel for Q.
+ **********************************************************************/
+class file_sink : public rx_sink
+{
+public:
+    file_sink(const std::string& file,
+        size_t num_channels,
+        const std::string& file_format = "",
+        sample_layout layout = sample_layout::interleaved,
+        size_t block_samps = 0);
+
+    //! For one of several streamers sharing a file name: this sink's
+    //  channels are named first_name, first_name + 1, ... of total_names
+    file_sink(const std::string& file,
+        size_t num_channels,
+        size_t first_name,
+        size_t total_names,
+        const std::string& file_format = "",
+        sample_layout layout = sample_layout::interleaved,
+        size_t block_samps = 0);
+
+    void write(const sample_block& block);
+    void close();
+
+private:
+    void open(const std::string& file,
+        size_t num_channels,
+        size_t first_name,
+        size_t total_names,
+        const std::string& file_format,
+        sample_layout layout,
+        size_t block_samps);
+    std::shared_ptr<std::ofstream> open_file(const std::string& name);
+    void write_split(size_t chan, const char* samps, sample_format format, size_t n);
+    void write_blocks(size_t chan, const char* samps, sample_format format, size_t n);
+
+    // (use shared_ptr because ofstream is non-copyable)
+    std::vector<std::shared_ptr<std::ofstream>> _outfiles;
+    std::vector<std::vector<char>> _stream_bufs;
+    bool _convert;
+    sample_format _file_format;
+    std::vector<char> _converted;
+    sample_layout _layout;
+    size_t _block_samps;
+    sample_format _split_format; // of the samples in _pending
+    std::vector<std::shared_ptr<std::ofstream>> _qfiles; // planar
+    std::vector<std::vector<char>> _pending; // blocked: the last partial block
+    std::vector<char> _split;
+};
@@ -0,0 +1,232 @@
+#include "host_setup.hpp"
+#include <uhd/device.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/***********************************************************************
+ * Host network setup
+ **********************************************************************/
+static void print_setting(const std::string& what, size_t have, size_t want, bool ok)
+{
+    std::cout << boost::format("  %-16s %10d (want %d) %s") % what % have % want
+                     % (ok ? "ok" : "") << std::endl;
+}
+
+static bool report_failure(const std::string& what)
+{
+    std::cerr << boost::format("  unable to set %s: %s") % what % std::strerror(errno)
+              << std::endl;
+    return false;
+}
+
+static bool check_sysctl(const std::string& name, size_t want)
+{
+    const std::string path = "/proc/sys/net/core/" + name;
+    size_t have            = 0;
+    std::ifstream in(path.c_str());
+    if (not(in >> have)) {
+        std::cerr << "  unable to read " << path << std::endl;
+        return false;
+    }
+    print_setting(name, have, want, have >= want);
+    if (have >= want) {
+        return true;
+    }
+    std::ofstream out(path.c_str());
+    if (not(out << want << std::endl)) {
+        return report_failure(name);
+    }
+    return true;
+}
+
+bool check_host_network(const nic_config& config)
+{
+    std::cout << boost::format("Checking host network (%s)...") % config.iface
+              << std::endl;
+    bool ok = true;
+
+    const int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return report_failure("socket");
+    }
+    struct ifreq ifr;
+    std::memset(&ifr, 0, sizeof(ifr));
+    std::strncpy(ifr.ifr_name, config.iface.c_str(), IFNAMSIZ - 1);
+
+    if (::ioctl(fd, SIOCGIFMTU, &ifr) < 0) {
+        std::cerr << boost::format("  no interface %s: %s") % config.iface
+                         % std::strerror(errno)
+                  << std::endl;
+        ok = false;
+    } else {
+        print_setting("mtu", ifr.ifr_mtu, config.mtu, size_t(ifr.ifr_mtu) == config.mtu);
+        if (size_t(ifr.ifr_mtu) != config.mtu) {
+            ifr.ifr_mtu = int(config.mtu);
+            if (::ioctl(fd, SIOCSIFMTU, &ifr) < 0)
+                ok = report_failure("mtu");
+        }
+
+        // ring sizes are capped by the driver, like ethtool -G
+        struct ethtool_ringparam ring;
+        std::memset(&ring, 0, sizeof(ring));
+        ring.cmd     = ETHTOOL_GRINGPARAM;
+        ifr.ifr_data = reinterpret_cast<char*>(&ring);
+        if (::ioctl(fd, SIOCETHTOOL, &ifr) < 0) {
+            std::cerr << boost::format("  ring sizes not available: %s")
+                             % std::strerror(errno)
+                      << std::endl;
+        } else {
+            const size_t rx_want = std::min<size_t>(config.rx_ring, ring.rx_max_pending);
+            const size_t tx_want = std::min<size_t>(config.tx_ring, ring.tx_max_pending);
+            print_setting("rx ring", ring.rx_pending, rx_want, ring.rx_pending == rx_want);
+            print_setting("tx ring", ring.tx_pending, tx_want, ring.tx_pending == tx_want);
+            if (ring.rx_pending != rx_want or ring.tx_pending != tx_want) {
+                ring.cmd        = ETHTOOL_SRINGPARAM;
+                ring.rx_pending = uint32_t(rx_want);
+                ring.tx_pending = uint32_t(tx_want);
+                if (::ioctl(fd, SIOCETHTOOL, &ifr) < 0)
+                    ok = report_failure("ring sizes");
+            }
+        }
+    }
+    ::close(fd);
+
+    ok = check_sysctl("rmem_max", config.rmem_max) and ok;
+    ok = check_sysctl("wmem_max", config.wmem_max) and ok;
+    return ok;
+}
+
+/***********************************************************************
+ * Cached device discovery
+ **********************************************************************/
+static std::string device_cache_path()
+{
+    const char* home = std::getenv("HOME");
+    return std::string(home ? home : ".") + "/.cache/ettus_record/devices";
+}
+
+static std::string read_cached_device(const std::string& args)
+{
+    std::ifstream in(device_cache_path().c_str());
+    std::string line;
+    while (std::getline(in, line)) {
+        const size_t tab = line.find('\t');
+        if (tab != std::string::npos and line.substr(0, tab) == args) {
+            return line.substr(tab + 1);
+        }
+    }
+    return "";
+}
+
+static void write_cached_device(const std::string& args, const std::string& resolved)
+{
+    const std::string path = device_cache_path();
+    std::vector<std::string> lines;
+    {
+        std::ifstream in(path.c_str());
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.substr(0, line.find('\t')) != args)
+                lines.push_back(line);
+        }
+    }
+    lines.push_back(args + "\t" + resolved);
+
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(boost::filesystem::path(path).parent_path(), ec);
+    std::ofstream out(path.c_str());
+    for (size_t i = 0; i < lines.size(); i++) {
+        out << lines[i] << "\n";
+    }
+}
+
+uhd::usrp::multi_usrp::sptr make_usrp_cached(const std::string& args)
+{
+    // an explicit address is already a unicast probe, nothing to cache
+    const uhd::device_addr_t hint(args);
+    if (hint.has_key("addr") or hint.has_key("addr0")) {
+        return uhd::usrp::multi_usrp::make(hint);
+    }
+
+    const std::string cached = read_cached_device(args);
+    if (not cached.empty()) {
+        try {
+            return uhd::usrp::multi_usrp::make(uhd::device_addr_t(cached));
+        } catch (const std::exception& e) {
+            std::cerr << boost::format("Cached device %s failed (%s), searching...")
+                             % cached % e.what()
+                      << std::endl;
+        }
+    }
+
+    const uhd::device_addrs_t found = uhd::device::find(hint, uhd::device::USRP);
+    if (found.empty()) {
+        throw std::runtime_error("No device found for \"" + args + "\"");
+    }
+    uhd::usrp::multi_usrp::sptr usrp = uhd::usrp::multi_usrp::make(found.front());
+    write_cached_device(args, found.front().to_string());
+    return usrp;
+}
+
+/***********************************************************************
+ * startup_timer
+ **********************************************************************/
+startup_timer::startup_timer() : _start(clock::now()), _last(_start) {}
+
+void startup_timer::mark(const std::string& phase)
+{
+    const clock::time_point now = clock::now();
+    _phases.push_back(
+        std::make_pair(phase, std::chrono::duration<double>(now - _last).count()));
+    _last = now;
+}
+
+void startup_timer::report(const std::string& total_label) const
+{
+    std::cout << "Startup:" << std::endl;
+    for (size_t i = 0; i < _phases.size(); i++) {
+        std::cout << boost::format("  %-20s %8.1f ms") % _phases[i].first
+                         % (_phases[i].second * 1e3)
+                  << std::endl;
+    }
+    std::cout << boost::format("  %-20s %8.1f ms") % total_label
+                     % (std::chrono::duration<double>(_last - _start).count() * 1e3)
+              << std::endl;
+}
+
+namespace {
+class first_sample_marker : public rx_sink
+{
+public:
+    first_sample_marker(startup_timer* timer) : _timer(timer), _seen(false) {}
+
+    void write(const sample_block&)
+    {
+        if (not _seen) {
+            _seen = true;
+            _timer->mark("first sample");
+            _timer->report("time to first sample");
+        }
+    }
+
+private:
+    startup_timer* _timer;
+    bool _seen;
+};
+} // namespace
+
+rx_sink::sptr startup_timer::first_sample_sink()
+{
+    return rx_sink::sptr(new first_sample_marker(this));
+}
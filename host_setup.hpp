@@ -0,0 +1,66 @@
+#pragma once
+
+#include "rx_sink.hpp"
+#include <uhd/usrp/multi_usrp.hpp>
+#include <chrono>
+#include <string>
+#include <vector>
+
+/***********************************************************************
+ * Host network setup
+ * What usrp_n210_init.sh does, checked directly through ioctl and
+ * /proc instead of ip/ethtool/sysctl, and only changed where the host
+ * differs. Socket buffer limits only ever get raised. Changing anything
+ * needs root (or CAP_NET_ADMIN); without it the differences are
+ * reported and the run carries on.
+ **********************************************************************/
+struct nic_config
+{
+    std::string iface = "enp0s25";
+    size_t mtu        = 4092;
+    size_t rx_ring    = 4092;
+    size_t tx_ring    = 2048;
+    size_t rmem_max   = 50000000;
+    size_t wmem_max   = 50000000;
+};
+
+//! Returns true when the host already matched or was brought in line
+bool check_host_network(const nic_config& config);
+
+/***********************************************************************
+ * Cached device discovery
+ * Args without an explicit address make multi_usrp broadcast for the
+ * device on every run. The address found the first time is cached per
+ * args string (in ~/.cache/ettus_record/devices) and used directly
+ * afterwards, falling back to discovery if the cached board is gone.
+ **********************************************************************/
+uhd::usrp::multi_usrp::sptr make_usrp_cached(const std::string& args);
+
+/***********************************************************************
+ * startup_timer
+ * Wall time of each startup phase and of the first received sample,
+ * measured from construction (the start of main).
+ **********************************************************************/
+class startup_timer
+{
+public:
+    typedef std::shared_ptr<startup_timer> sptr;
+
+    startup_timer();
+
+    //! End the current phase, naming it
+    void mark(const std::string& phase);
+
+    //! Sink that marks "first sample" and prints the report on the first
+    //  block it sees; put it first in the sink list
+    rx_sink::sptr first_sample_sink();
+
+    //! Print each phase and the total since construction
+    void report(const std::string& total_label = "total") const;
+
+private:
+    typedef std::chrono::steady_clock clock;
+    const clock::time_point _start;
+    clock::time_point _last;
+    std::vector<std::pair<std::string, double>> _phases;
+};
@@ -0,0 +1,299 @@
+#include "iq_correction.hpp"
+#include "convert.hpp"
+#include "thread_topology.hpp"
+#include <boost/format.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+/***********************************************************************
+ * Kernels
+ **********************************************************************/
+// The corrections work on the interleaved I/Q scalars with no branches
+// so the compiler can vectorise them.
+template <typename scalar_type>
+static void correct_float(scalar_type* iq,
+    size_t n,
+    scalar_type dc_i,
+    scalar_type dc_q,
+    scalar_type q_from_i,
+    scalar_type q_from_q)
+{
+    for (size_t k = 0; k < n; k++) {
+        const scalar_type i = iq[2 * k] - dc_i;
+        const scalar_type q = iq[2 * k + 1] - dc_q;
+        iq[2 * k]           = i;
+        iq[2 * k + 1]       = q_from_q * q + q_from_i * i;
+    }
+}
+
+template <typename int_type>
+static inline int_type round_saturate(float v)
+{
+    const float lo = std::numeric_limits<int_type>::min();
+    const float hi = std::numeric_limits<int_type>::max();
+    v = v > hi ? hi : v;
+    v = v < lo ? lo : v;
+    return int_type(int32_t(v + (v < 0 ? -0.5f : 0.5f)));
+}
+
+template <typename int_type>
+static void correct_int(
+    int_type* iq, size_t n, float dc_i, float dc_q, float q_from_i, float q_from_q)
+{
+    for (size_t k = 0; k < n; k++) {
+        const float i = iq[2 * k] - dc_i;
+        const float q = iq[2 * k + 1] - dc_q;
+        iq[2 * k]     = round_saturate<int_type>(i);
+        iq[2 * k + 1] = round_saturate<int_type>(q_from_q * q + q_from_i * i);
+    }
+}
+
+/***********************************************************************
+ * iq_correction
+ **********************************************************************/
+iq_correction::iq_correction(const iq_correction_config& config,
+    size_t num_channels,
+    double rate,
+    capture_metadata::sptr metadata)
+    : _config(config)
+    , _rate(rate)
+    , _window_spacing(
+          std::max<uint64_t>(config.window_samps, uint64_t(rate / config.windows_per_sec)))
+    , _metadata(metadata)
+    , _capture(num_channels)
+    , _average(num_channels)
+    , _windows(config.num_windows)
+    , _coeffs(num_channels)
+    , _running(true)
+    , _windows_skipped(0)
+{
+    for (size_t c = 0; c < num_channels; c++) {
+        _capture[c].filling   = nullptr;
+        _capture[c].filled    = 0;
+        _capture[c].next_samp = 0;
+        average_state& avg    = _average[c];
+        avg.mean_i = avg.mean_q = avg.ii = avg.qq = avg.iq = 0;
+        avg.num_windows = 0;
+        avg.next_report = 0;
+        _coeffs[c].valid = false;
+    }
+    for (size_t i = 0; i < _windows.size(); i++) {
+        _windows[i].samps.resize(config.window_samps);
+        _free.push_back(&_windows[i]);
+    }
+    if (_metadata) {
+        _metadata->set("iq_correction.window_samps", config.window_samps);
+        _metadata->set("iq_correction.time_const_secs", config.time_const_secs);
+        _metadata->set("iq_correction.apply", config.apply);
+    }
+    _thread = std::thread(&iq_correction::worker, this);
+}
+
+iq_correction::~iq_correction()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running = false;
+    }
+    _cond.notify_one();
+    _thread.join();
+    for (size_t c = 0; c < _average.size(); c++) {
+        if (_average[c].num_windows > 0)
+            report(c);
+    }
+    if (_windows_skipped > 0) {
+        std::cout << boost::format("IQ correction: %d windows skipped, worker behind")
+                         % _windows_skipped
+                  << std::endl;
+    }
+}
+
+void iq_correction::write(const sample_block& block)
+{
+    for (size_t i = 0; i < block.num_channels; i++) {
+        const size_t chan = block.first_chan + i;
+        capture(chan, static_cast<const char*>(block.buffs[i]), block);
+        if (_config.apply)
+            correct(chan, block.buffs[i], block);
+    }
+}
+
+void iq_correction::capture(size_t chan, const char* samps, const sample_block& block)
+{
+    capture_state& state = _capture.at(chan);
+    const uint64_t end   = block.first_samp + block.num_samps;
+    size_t offset        = 0; // where in the block the window continues
+    if (state.filling == nullptr) {
+        if (end <= state.next_samp)
+            return;
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_free.empty()) {
+            _windows_skipped++;
+            state.next_samp = end + _window_spacing;
+            return;
+        }
+        state.filling = _free.back();
+        _free.pop_back();
+        state.filled = 0;
+        const uint64_t start     = std::max(block.first_samp, state.next_samp);
+        offset                   = size_t(start - block.first_samp);
+        state.filling->chan      = chan;
+        state.filling->time_secs = block.time_secs + offset / block.rate;
+        state.next_samp          = start + _window_spacing;
+    }
+
+    window* win = state.filling;
+    const size_t count =
+        std::min<size_t>(block.num_samps - offset, _config.window_samps - state.filled);
+    convert_samples(samps + offset * block.samp_size,
+        sample_format_of_size(block.samp_size), &win->samps[state.filled],
+        sample_format::fc32, count);
+    state.filled += count;
+    if (state.filled == _config.window_samps) {
+        state.filling = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _ready.push_back(win);
+        }
+        _cond.notify_one();
+    }
+}
+
+void iq_correction::correct(size_t chan, void* samps, const sample_block& block)
+{
+    coefficients c;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        c = _coeffs.at(chan);
+    }
+    if (not c.valid)
+        return;
+    switch (sample_format_of_size(block.samp_size)) {
+        case sample_format::sc8:
+            correct_int(static_cast<int8_t*>(samps), block.num_samps, c.dc_i * sc8_scale,
+                c.dc_q * sc8_scale, c.q_from_i, c.q_from_q);
+            break;
+        case sample_format::sc16:
+            correct_int(static_cast<short*>(samps), block.num_samps, c.dc_i * sc16_scale,
+                c.dc_q * sc16_scale, c.q_from_i, c.q_from_q);
+            break;
+        case sample_format::fc32:
+            correct_float(static_cast<float*>(samps), block.num_samps, c.dc_i, c.dc_q,
+                c.q_from_i, c.q_from_q);
+            break;
+        case sample_format::fc64:
+            correct_float(static_cast<double*>(samps), block.num_samps, double(c.dc_i),
+                double(c.dc_q), double(c.q_from_i), double(c.q_from_q));
+            break;
+        default:
+            throw std::runtime_error("iq_correction: unsupported sample format");
+    }
+}
+
+iq_estimate iq_correction::estimate(size_t chan) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _average.at(chan).estimate;
+}
+
+void iq_correction::worker()
+{
+    apply_thread_role("dsp");
+    for (;;) {
+        window* win;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this] { return not _ready.empty() or not _running; });
+            if (_ready.empty())
+                break;
+            win = _ready.front();
+            _ready.pop_front();
+        }
+        update(*win);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _free.push_back(win);
+    }
+    record_thread_stats("dsp");
+}
+
+void iq_correction::update(const window& win)
+{
+    const size_t n = win.samps.size();
+    double si = 0, sq = 0;
+    for (size_t k = 0; k < n; k++) {
+        si += win.samps[k].real();
+        sq += win.samps[k].imag();
+    }
+    const double mi = si / n, mq = sq / n;
+    double ii = 0, qq = 0, iq = 0;
+    for (size_t k = 0; k < n; k++) {
+        const double i = win.samps[k].real() - mi, q = win.samps[k].imag() - mq;
+        ii += i * i;
+        qq += q * q;
+        iq += i * q;
+    }
+
+    // a plain mean until there are time_const_secs of windows, then an
+    // exponential average over that time
+    average_state& avg = _average.at(win.chan);
+    avg.num_windows++;
+    const double alpha = std::max(1.0 / avg.num_windows,
+        1.0 / std::max(1.0, _config.time_const_secs * _config.windows_per_sec));
+    avg.mean_i += alpha * (mi - avg.mean_i);
+    avg.mean_q += alpha * (mq - avg.mean_q);
+    avg.ii += alpha * (ii / n - avg.ii);
+    avg.qq += alpha * (qq / n - avg.qq);
+    avg.iq += alpha * (iq / n - avg.iq);
+    if (avg.ii <= 0 or avg.qq <= 0)
+        return;
+
+    const double gain = std::sqrt(avg.qq / avg.ii);
+    const double s    = std::max(-0.9, std::min(0.9, avg.iq / std::sqrt(avg.ii * avg.qq)));
+    const double c    = std::sqrt(1 - s * s);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        avg.estimate.time_secs   = win.time_secs;
+        avg.estimate.dc_i        = avg.mean_i;
+        avg.estimate.dc_q        = avg.mean_q;
+        avg.estimate.gain        = gain;
+        avg.estimate.phase_deg   = std::asin(s) * 180 / M_PI;
+        avg.estimate.num_windows = avg.num_windows;
+        coefficients& coeffs     = _coeffs.at(win.chan);
+        coeffs.dc_i              = float(avg.mean_i);
+        coeffs.dc_q              = float(avg.mean_q);
+        coeffs.q_from_q          = float(1 / (gain * c));
+        coeffs.q_from_i          = float(-s / c);
+        coeffs.valid             = true;
+    }
+
+    if (avg.next_report == 0) {
+        avg.next_report = win.time_secs + _config.interval_secs;
+    } else if (win.time_secs >= avg.next_report) {
+        report(win.chan);
+        avg.next_report += _config.interval_secs;
+    }
+}
+
+void iq_correction::report(size_t chan)
+{
+    const iq_estimate e = estimate(chan);
+    std::cout << boost::format("IQ ch%d at %.3f s: DC %+.5f%+.5fj, gain %+.3f dB, "
+                               "phase %+.3f deg (%d windows)")
+                     % chan % e.time_secs % e.dc_i % e.dc_q % (20 * std::log10(e.gain))
+                     % e.phase_deg % e.num_windows
+              << std::endl;
+    if (_metadata) {
+        boost::property_tree::ptree entry;
+        entry.put("chan", chan);
+        entry.put("time_secs", e.time_secs);
+        entry.put("dc_i", e.dc_i);
+        entry.put("dc_q", e.dc_q);
+        entry.put("gain_db", 20 * std::log10(e.gain));
+        entry.put("phase_deg", e.phase_deg);
+        _metadata->append("iq_correction.estimates", entry);
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "capture_meta.hpp"
+#include "rx_sink.hpp"
+#include <complex>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/***********************************************************************
+ * iq_correction
+ * Streaming DC offset and IQ imbalance correction. The recv threads
+ * copy a window of each channel now and then (at most windows_per_sec)
+ * for a worker thread, which measures the DC offset and the gain and
+ * phase of Q relative to I, averages them over time_const_secs and
+ * publishes correction coefficients. With apply set the recv threads
+ * correct every block in place for the sinks after this one:
+ *
+ *   I' = I - dc_i
+ *   Q' = ((Q - dc_q) / gain - I' sin(phase)) / cos(phase)
+ *
+ * The estimate assumes a signal with uncorrelated I and Q of equal power
+ * on average (noise, modulated carriers, off-centre tones). Estimates are
+ * printed and added to the metadata once per interval.
+ **********************************************************************/
+struct iq_correction_config
+{
+    size_t window_samps    = 4096;
+    double windows_per_sec = 100; // per channel
+    double time_const_secs = 1.0;
+    double interval_secs   = 1.0;
+    bool apply             = true;
+    size_t num_windows     = 16; // windows in flight to the worker
+};
+
+struct iq_estimate
+{
+    double time_secs = 0;
+    double dc_i = 0, dc_q = 0; // full scale units
+    double gain      = 1; // Q relative to I
+    double phase_deg = 0; // of Q off quadrature
+    size_t num_windows = 0;
+};
+
+class iq_correction : public rx_sink
+{
+public:
+    iq_correction(const iq_correction_config& config,
+        size_t num_channels,
+        double rate,
+        capture_metadata::sptr metadata = capture_metadata::sptr());
+    ~iq_correction();
+
+    void write(const sample_block& block);
+
+    //! Current estimate of channel chan
+    iq_estimate estimate(size_t chan) const;
+
+private:
+    struct window
+    {
+        size_t chan;
+        double time_secs;
+        std::vector<std::complex<float>> samps;
+    };
+
+    //! What the recv threads apply, in full scale units
+    struct coefficients
+    {
+        bool valid;
+        float dc_i, dc_q;
+        float q_from_i, q_from_q;
+    };
+
+    //! recv side, touched only by the thread streaming the channel
+    struct capture_state
+    {
+        window* filling;
+        size_t filled;
+        uint64_t next_samp;
+    };
+
+    //! worker side running averages
+    struct average_state
+    {
+        double mean_i, mean_q, ii, qq, iq;
+        size_t num_windows;
+        double next_report;
+        iq_estimate estimate;
+    };
+
+    void capture(size_t chan, const char* samps, const sample_block& block);
+    void correct(size_t chan, void* samps, const sample_block& block);
+    void worker();
+    void update(const window& win);
+    void report(size_t chan);
+
+    const iq_correction_config _config;
+    const double _rate;
+    const uint64_t _window_spacing;
+    capture_metadata::sptr _metadata;
+
+    std::vector<capture_state> _capture;
+    std::vector<average_state> _average;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _cond;
+    std::vector<window> _windows;
+    std::vector<window*> _free;
+    std::deque<window*> _ready;
+    std::vector<coefficients> _coeffs;
+    bool _running;
+    uint64_t _windows_skipped;
+    std::thread _thread;
+};
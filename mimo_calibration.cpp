@@ -0,0 +1,327 @@
+#include "mimo_calibration.hpp"
+#include "convert.hpp"
+#include "thread_topology.hpp"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+// a tone alone correlates almost as well at every lag; only move samples
+// once the peak stands this far above the mean
+static const double min_peak_to_mean_for_delay = 10.0;
+
+mimo_calibration::mimo_calibration(
+    const calibration_config& config, double rate, capture_metadata::sptr metadata)
+    : _config(config)
+    , _rate(rate)
+    , _span(config.fft_len / 2 * config.decim)
+    , _windows_per_interval(std::max<uint64_t>(
+          1, std::llround(config.interval_secs * rate / (config.fft_len / 2 * config.decim))))
+    , _metadata(metadata)
+    , _pairing(config.num_windows, config.fft_len / 2 * config.decim, _mutex)
+    , _num_closed(0)
+    , _closing(false)
+    , _forward(config.fft_len, false)
+    , _inverse(config.fft_len, true)
+    , _fa(config.fft_len)
+    , _fb(config.fft_len)
+    , _acc(config.fft_len)
+    , _acc_interval(0)
+{
+    if (config.chan_a == config.chan_b or config.decim == 0 or config.num_windows == 0) {
+        throw std::runtime_error("mimo_calibration: invalid configuration");
+    }
+    for (size_t side = 0; side < 2; side++) {
+        _registered[side]    = false;
+        _applied_delay[side] = 0;
+    }
+    for (pairing::window& win : _pairing.windows()) {
+        win.data.samps[0].resize(config.fft_len / 2);
+        win.data.samps[1].resize(config.fft_len / 2);
+    }
+    if (_metadata) {
+        _metadata->set("calibration.chan_a", config.chan_a);
+        _metadata->set("calibration.chan_b", config.chan_b);
+        _metadata->set("calibration.fft_len", config.fft_len);
+        _metadata->set("calibration.decim", config.decim);
+        _metadata->set("calibration.interval_secs", config.interval_secs);
+        _metadata->set("calibration.apply", config.apply);
+    }
+    _thread = std::thread(&mimo_calibration::worker, this);
+}
+
+mimo_calibration::~mimo_calibration()
+{
+    stop();
+}
+
+calibration_estimate mimo_calibration::last_estimate() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _estimate;
+}
+
+/***********************************************************************
+ * recv side
+ **********************************************************************/
+void mimo_calibration::write(const sample_block& block)
+{
+    for (size_t i = 0; i < block.num_channels; i++) {
+        const size_t chan = block.first_chan + i;
+        if (chan != _config.chan_a and chan != _config.chan_b) {
+            continue;
+        }
+        const size_t side = chan == _config.chan_a ? 0 : 1;
+        if (not _registered[side]) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (std::find(_writers.begin(), _writers.end(), std::this_thread::get_id())
+                == _writers.end()) {
+                _writers.push_back(std::this_thread::get_id());
+            }
+            _registered[side] = true;
+        }
+
+        // the estimate always sees the raw samples, before any correction
+        std::vector<std::complex<float>>& samps = _scratch[side];
+        samps.resize(block.num_samps);
+        convert_samples(block.buffs[i], sample_format_of_size(block.samp_size),
+            &samps.front(), sample_format::fc32, block.num_samps);
+        feed(side, &samps.front(), block.first_samp, block.num_samps, block.time_secs);
+
+        if (_config.apply) {
+            correct(block, i, side);
+        }
+    }
+}
+
+void mimo_calibration::feed(size_t side,
+    const std::complex<float>* samps,
+    uint64_t first_samp,
+    size_t num_samps,
+    double time_secs)
+{
+    const size_t decim = _config.decim;
+    _pairing.fill(side, first_samp, num_samps, time_secs, _rate,
+        [samps, side, decim](pairing::window& win, size_t offset, size_t in, size_t count) {
+            std::complex<float>* out = &win.data.samps[side].front();
+            for (size_t k = (offset + decim - 1) / decim * decim; k < offset + count;
+                 k += decim) {
+                out[k / decim] = samps[in + k - offset];
+            }
+        },
+        [this](pairing::window* win) {
+            _ready.push_back(win);
+            _cond.notify_one();
+        });
+}
+
+template <typename samp_type>
+static void rotate(void* buff, size_t num_samps, std::complex<double> w)
+{
+    std::complex<samp_type>* samps = static_cast<std::complex<samp_type>*>(buff);
+    const std::complex<samp_type> ws(samp_type(w.real()), samp_type(w.imag()));
+    for (size_t i = 0; i < num_samps; i++) {
+        samps[i] *= ws;
+    }
+}
+
+template <typename int_type>
+static void rotate_int(void* buff, size_t num_samps, std::complex<double> w)
+{
+    std::complex<int_type>* samps = static_cast<std::complex<int_type>*>(buff);
+    const std::complex<float> ws(float(w.real()), float(w.imag()));
+    const float lo = std::numeric_limits<int_type>::min();
+    const float hi = std::numeric_limits<int_type>::max();
+    for (size_t i = 0; i < num_samps; i++) {
+        const std::complex<float> x =
+            std::complex<float>(samps[i].real(), samps[i].imag()) * ws;
+        samps[i] = std::complex<int_type>(
+            int_type(std::max(lo, std::min(hi, std::round(x.real())))),
+            int_type(std::max(lo, std::min(hi, std::round(x.imag())))));
+    }
+}
+
+void mimo_calibration::correct(const sample_block& block, size_t i, size_t side)
+{
+    const calibration_estimate estimate = last_estimate();
+    if (estimate.num_windows == 0) {
+        return;
+    }
+
+    // delay whichever channel leads; keep the previous delay while the
+    // peak is ambiguous
+    if (estimate.peak_to_mean >= min_peak_to_mean_for_delay) {
+        const long long lead = side == 0 ? estimate.int_delay : -estimate.int_delay;
+        const size_t delay   = size_t(std::max<long long>(lead, 0));
+        if (delay != _applied_delay[side]) {
+            _applied_delay[side] = delay;
+            _delay_line[side].assign(delay * block.samp_size, 0);
+        }
+    }
+    const size_t delay_bytes = _delay_line[side].size();
+    if (delay_bytes != 0) {
+        const size_t block_bytes = block.num_samps * block.samp_size;
+        std::vector<char>& line  = _delay_line[side];
+        line.resize(delay_bytes + block_bytes);
+        std::memcpy(&line[delay_bytes], block.buffs[i], block_bytes);
+        std::memcpy(block.buffs[i], &line.front(), block_bytes);
+        line.erase(line.begin(), line.begin() + block_bytes);
+    }
+
+    if (side == 1) {
+        const std::complex<double> w = std::polar(1.0, -estimate.phase_deg * M_PI / 180);
+        if (block.samp_size == sizeof(std::complex<int8_t>)) {
+            rotate_int<int8_t>(block.buffs[i], block.num_samps, w);
+        } else if (block.samp_size == sizeof(std::complex<short>)) {
+            rotate_int<short>(block.buffs[i], block.num_samps, w);
+        } else if (block.samp_size == sizeof(std::complex<float>)) {
+            rotate<float>(block.buffs[i], block.num_samps, w);
+        } else {
+            rotate<double>(block.buffs[i], block.num_samps, w);
+        }
+    }
+}
+
+void mimo_calibration::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        // wait for every thread that carried one of the channels
+        const bool writer =
+            std::find(_writers.begin(), _writers.end(), std::this_thread::get_id())
+            != _writers.end();
+        if (not _writers.empty() and (not writer or ++_num_closed < _writers.size())) {
+            return;
+        }
+    }
+    stop();
+}
+
+void mimo_calibration::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closing = true;
+        _cond.notify_one();
+    }
+    if (_thread.joinable()) {
+        _thread.join();
+        uint64_t num_dropped;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            num_dropped = _pairing.num_dropped();
+        }
+        std::cout << boost::format("Calibration: %d window pairs dropped (worker behind)")
+                         % num_dropped
+                  << std::endl;
+    }
+}
+
+/***********************************************************************
+ * worker
+ **********************************************************************/
+void mimo_calibration::worker()
+{
+    apply_thread_role("dsp");
+    const size_t half = _config.fft_len / 2;
+    for (;;) {
+        pairing::window* win = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this] { return _closing or not _ready.empty(); });
+            if (_ready.empty()) {
+                break;
+            }
+            win = _ready.front();
+            _ready.pop_front();
+        }
+
+        const uint64_t interval = win->index / _windows_per_interval;
+        if (interval != _acc_interval) {
+            finish_interval();
+            _acc_interval = interval;
+        }
+        if (_pending.num_windows == 0) {
+            _pending.time_secs = win->time_secs;
+        }
+
+        // zero padding to twice the window keeps the correlation linear
+        std::copy(win->data.samps[0].begin(), win->data.samps[0].end(), _fa.begin());
+        std::copy(win->data.samps[1].begin(), win->data.samps[1].end(), _fb.begin());
+        std::fill(_fa.begin() + half, _fa.end(), 0);
+        std::fill(_fb.begin() + half, _fb.end(), 0);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _pairing.release(win);
+        }
+        _forward.execute(&_fa.front());
+        _forward.execute(&_fb.front());
+        for (size_t k = 0; k < _config.fft_len; k++) {
+            _acc[k] += _fa[k] * std::conj(_fb[k]);
+        }
+        _pending.num_windows++;
+    }
+    finish_interval();
+    record_thread_stats("dsp");
+}
+
+void mimo_calibration::finish_interval()
+{
+    if (_pending.num_windows == 0) {
+        return;
+    }
+    const size_t n = _config.fft_len;
+    _inverse.execute(&_acc.front());
+
+    // c[m] = sum a[k] conj(b[k - m]), so b lagging a by d peaks at m = -d
+    size_t peak = 0;
+    double peak_mag = 0, sum_mag = 0;
+    for (size_t k = 0; k < n; k++) {
+        const double mag = std::abs(_acc[k]);
+        sum_mag += mag;
+        if (k != n / 2 and mag > peak_mag) {
+            peak_mag = mag;
+            peak     = k;
+        }
+    }
+    const double y0 = std::abs(_acc[(peak + n - 1) % n]);
+    const double y2 = std::abs(_acc[(peak + 1) % n]);
+    const double curvature = y0 - 2 * peak_mag + y2;
+    const double offset    = curvature < 0 ? 0.5 * (y0 - y2) / curvature : 0;
+    const long long lag    = peak < n / 2 ? (long long)peak : (long long)peak - (long long)n;
+    const double delay     = -(lag + offset) * _config.decim;
+
+    calibration_estimate estimate = _pending;
+    estimate.int_delay            = std::llround(delay);
+    estimate.frac_delay           = delay - estimate.int_delay;
+    estimate.phase_deg            = -std::arg(_acc[peak]) * 180 / M_PI;
+    estimate.peak_to_mean         = sum_mag > 0 ? peak_mag / (sum_mag / n) : 0;
+
+    std::fill(_acc.begin(), _acc.end(), 0);
+    _pending = calibration_estimate();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _estimate = estimate;
+    }
+
+    std::cout << boost::format("Calibration @ %.3f s: ch%d vs ch%d delay %+d %+.3f samples, "
+                               "phase %+.2f deg (peak/mean %.1f, %d windows)")
+                     % estimate.time_secs % _config.chan_b % _config.chan_a
+                     % estimate.int_delay % estimate.frac_delay % estimate.phase_deg
+                     % estimate.peak_to_mean % estimate.num_windows
+              << std::endl;
+    if (_metadata) {
+        boost::property_tree::ptree entry;
+        entry.put("time_secs", estimate.time_secs);
+        entry.put("int_delay", estimate.int_delay);
+        entry.put("frac_delay", estimate.frac_delay);
+        entry.put("phase_deg", estimate.phase_deg);
+        entry.put("peak_to_mean", estimate.peak_to_mean);
+        entry.put("windows", estimate.num_windows);
+        _metadata->append("calibration.intervals", entry);
+        _metadata->write();
+    }
+}
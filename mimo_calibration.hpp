@@ -0,0 +1,111 @@
+#pragma once
+
+#include "capture_meta.hpp"
+#include "fft.hpp"
+#include "rx_sink.hpp"
+#include "window_pairing.hpp"
+#include <atomic>
+#include <complex>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/***********************************************************************
+ * mimo_calibration
+ * Online estimate of the delay and phase of chan_b relative to chan_a.
+ * The recv threads only downsample each channel into fixed windows;
+ * a worker thread cross-correlates every complete pair of windows via
+ * the FFT and, once per interval, reports the integer and fractional
+ * delay (in full rate samples, positive when chan_b lags) and the phase
+ * of chan_b relative to chan_a. Pairs are dropped rather than queued
+ * when the worker falls behind, so the recv path never waits on it.
+ *
+ * With apply set the stage also corrects the stream in place for the
+ * sinks after it: chan_b is rotated by the phase estimate and the
+ * leading channel is delayed by the integer delay (only once the
+ * correlation peak is clear, as a tone alone leaves the delay
+ * ambiguous). Fractional delay is reported but not corrected.
+ **********************************************************************/
+struct calibration_config
+{
+    size_t chan_a        = 0;
+    size_t chan_b        = 1;
+    size_t fft_len       = 4096; // windows are fft_len/2, zero padded
+    size_t decim         = 1;
+    double interval_secs = 1.0;
+    bool apply           = false;
+    size_t num_windows   = 8; // pairs in flight to the worker
+};
+
+struct calibration_estimate
+{
+    double time_secs        = 0; // device time at the start of the interval
+    long long int_delay     = 0;
+    double frac_delay       = 0;
+    double phase_deg        = 0;
+    double peak_to_mean     = 0;
+    size_t num_windows      = 0;
+};
+
+class mimo_calibration : public rx_sink
+{
+public:
+    mimo_calibration(const calibration_config& config,
+        double rate,
+        capture_metadata::sptr metadata = capture_metadata::sptr());
+    ~mimo_calibration();
+
+    void write(const sample_block& block);
+    void close();
+
+    //! Most recent estimate (num_windows == 0 before the first one)
+    calibration_estimate last_estimate() const;
+
+private:
+    struct window_samps
+    {
+        std::vector<std::complex<float>> samps[2];
+    };
+    typedef window_pairing<window_samps> pairing;
+
+    void feed(size_t side,
+        const std::complex<float>* samps,
+        uint64_t first_samp,
+        size_t num_samps,
+        double time_secs);
+    void correct(const sample_block& block, size_t i, size_t side);
+    void stop();
+    void worker();
+    void finish_interval();
+
+    const calibration_config _config;
+    const double _rate;
+    const size_t _span; // full rate samples per window
+    const uint64_t _windows_per_interval;
+    capture_metadata::sptr _metadata;
+
+    // recv side, one thread per channel
+    std::atomic<bool> _registered[2];
+    std::vector<std::complex<float>> _scratch[2];
+    std::vector<char> _delay_line[2];
+    size_t _applied_delay[2];
+
+    mutable std::mutex _mutex;
+    std::condition_variable _cond;
+    pairing _pairing;
+    std::deque<pairing::window*> _ready;
+    std::vector<std::thread::id> _writers;
+    size_t _num_closed;
+    bool _closing;
+    calibration_estimate _estimate;
+
+    // worker side
+    fft_plan _forward, _inverse;
+    std::vector<std::complex<float>> _fa, _fb, _acc;
+    uint64_t _acc_interval;
+    calibration_estimate _pending;
+
+    std::thread _thread;
+};
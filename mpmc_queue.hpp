@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/***********************************************************************
+ * mpmc_queue
+ * Bounded lock-free queue for any number of producers and consumers
+ * (Vyukov's ring: every cell carries a sequence number that says whose
+ * turn it is). try_push() and try_pop() never block or allocate; they
+ * fail when the queue is full or empty. Capacity is a power of two.
+ **********************************************************************/
+template <typename T>
+class mpmc_queue
+{
+public:
+    mpmc_queue(size_t capacity) : _cells(capacity), _mask(capacity - 1), _head(0), _tail(0)
+    {
+        if (capacity < 2 or (capacity & (capacity - 1)) != 0)
+            throw std::runtime_error("mpmc_queue: capacity must be a power of two");
+        for (size_t i = 0; i < capacity; i++)
+            _cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    mpmc_queue(const mpmc_queue&) = delete;
+    mpmc_queue& operator=(const mpmc_queue&) = delete;
+
+    bool try_push(T&& value)
+    {
+        uint64_t pos = _tail.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& c           = _cells[pos & _mask];
+            const uint64_t seq = c.seq.load(std::memory_order_acquire);
+            const int64_t diff = int64_t(seq) - int64_t(pos);
+            if (diff == 0) {
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.value = std::move(value);
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& value)
+    {
+        uint64_t pos = _head.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& c           = _cells[pos & _mask];
+            const uint64_t seq = c.seq.load(std::memory_order_acquire);
+            const int64_t diff = int64_t(seq) - int64_t(pos + 1);
+            if (diff == 0) {
+                if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(c.value);
+                    c.seq.store(pos + _mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // empty
+            } else {
+                pos = _head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t capacity() const
+    {
+        return _cells.size();
+    }
+
+    //! Approximate while producers or consumers are active
+    size_t size() const
+    {
+        return size_t(_tail.load(std::memory_order_relaxed)
+                      - _head.load(std::memory_order_relaxed));
+    }
+
+private:
+    struct cell
+    {
+        std::atomic<uint64_t> seq;
+        T value;
+    };
+
+    typedef std::atomic<uint64_t> counter;
+
+    std::vector<cell> _cells;
+    const uint64_t _mask;
+    // The two ends on separate cache lines: each counter starts 64 bytes
+    // after anything before it and ends 64 bytes before anything after
+    // it, so no 64 byte line holds both, or either and another member,
+    // whatever the object's alignment. alignas(64) instead would rely on
+    // an aligned new, which plain new is not before C++17, and the queue
+    // lives inside heap objects (tx_injector).
+    char _pad0[64];
+    counter _head;
+    char _pad1[64 - sizeof(counter)];
+    counter _tail;
+    char _pad2[64 - sizeof(counter)];
+};
@@ -0,0 +1,137 @@
+#include "multi_device.hpp"
+#include "usrp_setup.hpp"
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+std::vector<std::string> parse_device_list(const std::string& devices)
+{
+    std::vector<std::string> addrs;
+    boost::split(addrs, devices, boost::is_any_of(","));
+    for (size_t i = 0; i < addrs.size(); i++) {
+        boost::trim(addrs[i]);
+        if (addrs[i].empty()) {
+            throw std::runtime_error("Empty entry in device list: " + devices);
+        }
+    }
+    return addrs;
+}
+
+bool is_sim_device_list(const std::vector<std::string>& addrs)
+{
+    const size_t num_sim = std::count(addrs.begin(), addrs.end(), "sim");
+    if (num_sim != 0 and num_sim != addrs.size()) {
+        throw std::runtime_error("Cannot mix simulated and real devices");
+    }
+    return num_sim != 0;
+}
+
+uhd::device_addr_t make_multi_device_addr(const std::vector<std::string>& addrs)
+{
+    uhd::device_addr_t dev_addr;
+    for (size_t i = 0; i < addrs.size(); i++) {
+        dev_addr[str(boost::format("addr%d") % i)] = addrs[i];
+    }
+    return dev_addr;
+}
+
+std::string default_sync_mode(size_t num_boards)
+{
+    if (num_boards == 1)
+        return "internal";
+    if (num_boards == 2)
+        return "mimo";
+    return "external";
+}
+
+void sync_devices(uhd::usrp::multi_usrp::sptr usrp, const std::string& sync)
+{
+    const size_t num_boards = usrp->get_num_mboards();
+    std::cout << boost::format("\nTime Synchronisation (%s, %d boards)") % sync
+                     % num_boards
+              << std::endl;
+
+    if (sync == "mimo") {
+        // the MIMO cable joins exactly two boards: board 1 runs from its
+        // own reference and board 0 takes clock and time over the cable
+        if (num_boards != 2) {
+            throw std::runtime_error("MIMO cable sync needs exactly two boards");
+        }
+        usrp->set_clock_source("internal", 1);
+        usrp->set_time_source("mimo", 0);
+        usrp->set_clock_source("mimo", 0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    } else if (sync == "external") {
+        // 10 MHz and PPS distributed to every board
+        usrp->set_clock_source("external");
+        usrp->set_time_source("external");
+        for (size_t mb = 0; mb < num_boards; mb++) {
+            check_ref_locked(usrp, "external", mb, str(boost::format("board %d") % mb));
+        }
+    } else if (sync == "internal") {
+        if (num_boards != 1) {
+            throw std::runtime_error("Multiple boards need mimo or external sync");
+        }
+        usrp->set_clock_source("internal");
+    } else {
+        throw std::runtime_error("Unknown sync mode " + sync);
+    }
+    reset_device_time(usrp, sync);
+
+    for (size_t mb = 0; mb < num_boards; mb++) {
+        std::cout << boost::format("Board %d clock source: %s, time source: %s") % mb
+                         % usrp->get_clock_source(mb) % usrp->get_time_source(mb)
+                  << std::endl;
+    }
+}
+
+void reset_device_time(uhd::usrp::multi_usrp::sptr usrp, const std::string& sync)
+{
+    if (sync == "mimo") {
+        // board 0 takes its time from board 1 over the cable
+        usrp->set_time_now(uhd::time_spec_t(0.0), 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    } else if (sync == "external") {
+        // latches time 0 on all boards at the same PPS edge
+        usrp->set_time_unknown_pps(uhd::time_spec_t(0.0));
+    } else {
+        usrp->set_time_now(uhd::time_spec_t(0.0));
+    }
+}
+
+void verify_device_sync(uhd::usrp::multi_usrp::sptr usrp, const std::string& sync)
+{
+    const size_t num_boards = usrp->get_num_mboards();
+    for (size_t mb = 0; mb < num_boards; mb++) {
+        check_ref_locked(usrp, sync, mb, str(boost::format("board %d") % mb));
+    }
+    if (num_boards > 1 and not usrp->get_time_synchronized()) {
+        throw std::runtime_error("Device times are not synchronised across boards");
+    }
+}
+
+std::vector<std::vector<size_t>> partition_channels(
+    size_t num_channels, size_t num_groups)
+{
+    num_groups = std::max<size_t>(1, std::min(num_groups, num_channels));
+    std::vector<std::vector<size_t>> groups(num_groups);
+    size_t chan = 0;
+    for (size_t g = 0; g < num_groups; g++) {
+        const size_t group_size =
+            num_channels / num_groups + (g < num_channels % num_groups ? 1 : 0);
+        for (size_t i = 0; i < group_size; i++) {
+            groups[g].push_back(chan++);
+        }
+    }
+    return groups;
+}
+
+size_t default_num_rx_streamers(size_t num_channels)
+{
+    const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    return std::max<size_t>(1, std::min((num_channels + 1) / 2, cores));
+}
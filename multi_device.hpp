@@ -0,0 +1,45 @@
+#pragma once
+
+#include <uhd/types/device_addr.hpp>
+#include <uhd/usrp/multi_usrp.hpp>
+#include <string>
+#include <vector>
+
+/***********************************************************************
+ * Multi-board helpers
+ * One N210 per --devices entry, one RX (and TX) channel per board, so
+ * channel i lives on mboard i.
+ **********************************************************************/
+//! Split a comma separated --devices list ("192.168.10.2,192.168.10.3")
+std::vector<std::string> parse_device_list(const std::string& devices);
+
+//! True if every entry is "sim" (simulated boards), false if none is;
+//  mixing real and simulated boards throws
+bool is_sim_device_list(const std::vector<std::string>& addrs);
+
+//! multi_usrp args addressing one board per entry: addr0=..,addr1=..
+uhd::device_addr_t make_multi_device_addr(const std::vector<std::string>& addrs);
+
+//! Default synchronisation for num_boards: "internal" for one board,
+//  "mimo" for a MIMO-cabled pair, "external" (10 MHz + PPS) beyond that
+std::string default_sync_mode(size_t num_boards);
+
+//! Bring all boards onto a common clock and time base (device time 0)
+void sync_devices(uhd::usrp::multi_usrp::sptr usrp, const std::string& sync);
+
+//! Set device time 0 again the way sync mode aligns the boards (at a PPS
+//  edge for external), so a reset does not undo the alignment
+void reset_device_time(uhd::usrp::multi_usrp::sptr usrp, const std::string& sync);
+
+//! Throw unless every board reports its reference locked and the boards
+//  agree on the device time
+void verify_device_sync(uhd::usrp::multi_usrp::sptr usrp, const std::string& sync);
+
+//! Split channels 0..num_channels-1 into num_groups contiguous groups
+//  whose sizes differ by at most one
+std::vector<std::vector<size_t>> partition_channels(
+    size_t num_channels, size_t num_groups);
+
+//! One RX streamer per two channels (the pairing a single streamer was
+//  shown to sustain), but never more streamers than host cores
+size_t default_num_rx_streamers(size_t num_channels);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+/***********************************************************************
+ * Network sample framing (net_sink / net_receiver)
+ * Every frame is a net_frame_header followed by num_samps samples of one
+ * channel, host (little endian) byte order. Over TCP a frame carries one
+ * channel of one received block; over UDP a block is split so each
+ * datagram holds exactly one frame. Over UDP seq counts the datagrams
+ * sent to each subscriber, so a receiver can count what the network
+ * lost; over TCP it counts frames of the sink, so a subscriber that
+ * joins later starts mid-count.
+ **********************************************************************/
+static const uint32_t net_frame_magic   = 0x58525445; // "ETRX"
+static const uint16_t net_frame_version = 1;
+
+struct net_frame_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_len; // sizeof(net_frame_header), payload starts here
+    uint32_t seq;
+    uint16_t channel;
+    uint16_t samp_size; // bytes per complex sample: 4 sc16, 8 fc32, 16 fc64
+    uint32_t num_samps;
+    uint32_t reserved;
+    uint64_t first_samp; // sample index of the first payload sample
+    double time_secs; // device time of the first payload sample
+};
+static_assert(sizeof(net_frame_header) == 40, "net_frame_header must not be padded");
@@ -0,0 +1,192 @@
+//
+// Reference receiver for net_sink: subscribes to a tcp:PORT sink or
+// listens for a udp:HOST:PORT sink, checks the framing and writes each
+// channel to its own file, exactly as recv_to_file would have.
+//
+
+#include "net_protocol.hpp"
+#include "stream_common.hpp"
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace po = boost::program_options;
+
+/***********************************************************************
+ * Socket helpers
+ **********************************************************************/
+static int connect_tcp(const std::string& host_port)
+{
+    std::vector<std::string> fields;
+    boost::split(fields, host_port, boost::is_any_of(":"));
+    if (fields.size() != 2)
+        throw std::runtime_error("expected HOST:PORT, got " + host_port);
+    addrinfo hints, *res;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(fields[0].c_str(), fields[1].c_str(), &hints, &res) != 0)
+        throw std::runtime_error("cannot resolve " + host_port);
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    const int ret = connect(fd, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (ret < 0)
+        throw std::runtime_error(
+            str(boost::format("connect %s: %s") % host_port % std::strerror(errno)));
+    return fd;
+}
+
+static int bind_udp(int port)
+{
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    const int rcvbuf = 32 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons(port);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+        throw std::runtime_error(
+            str(boost::format("bind udp %d: %s") % port % std::strerror(errno)));
+    // wake up now and then to notice Ctrl + C and --duration
+    timeval tv = {0, 100000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+//! Read exactly len bytes, false on EOF
+static bool read_all(int fd, char* buf, size_t len)
+{
+    while (len > 0) {
+        const ssize_t n = ::read(fd, buf, len);
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+/***********************************************************************
+ * Main function
+ **********************************************************************/
+int main(int argc, char* argv[])
+{
+    std::string connect, file;
+    int listen_port;
+    size_t num_channels;
+    double duration;
+
+    // clang-format off
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "help message")
+        ("connect", po::value<std::string>(&connect), "HOST:PORT of a tcp:PORT net sink to subscribe to")
+        ("listen", po::value<int>(&listen_port), "UDP port a udp:HOST:PORT net sink sends to")
+        ("file", po::value<std::string>(&file)->default_value("net_rx.dat"), "name of the file to write binary samples to")
+        ("channels", po::value<size_t>(&num_channels)->default_value(1), "number of channels the sink sends")
+        ("duration", po::value<double>(&duration)->default_value(0), "seconds to receive, 0 until the sender stops")
+    ;
+    // clang-format on
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help") or (vm.count("connect") == vm.count("listen"))) {
+        std::cout << boost::format("net_sink reference receiver %s") % desc << std::endl;
+        std::cout << "Give exactly one of --connect or --listen" << std::endl;
+        return ~0;
+    }
+
+    const bool tcp = vm.count("connect") > 0;
+    const int fd   = tcp ? connect_tcp(connect) : bind_udp(listen_port);
+    std::signal(SIGINT, &sig_int_handler);
+
+    std::vector<std::shared_ptr<std::ofstream>> outfiles;
+    for (size_t i = 0; i < num_channels; i++) {
+        outfiles.push_back(std::shared_ptr<std::ofstream>(new std::ofstream(
+            generate_out_filename(file, num_channels, i).c_str(), std::ofstream::binary)));
+    }
+
+    std::vector<char> buff(1 << 16);
+    std::vector<uint64_t> next_samp(num_channels, 0);
+    uint64_t frames = 0, bytes = 0, lost_frames = 0, samp_gaps = 0, bad_datagrams = 0;
+    uint32_t next_seq = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    while (not stop_signal_called) {
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        if (duration > 0 and elapsed.count() > duration)
+            break;
+
+        net_frame_header hdr;
+        const char* payload;
+        if (tcp) {
+            if (not read_all(fd, (char*)&hdr, sizeof(hdr)))
+                break;
+            if (buff.size() < size_t(hdr.num_samps) * hdr.samp_size)
+                buff.resize(size_t(hdr.num_samps) * hdr.samp_size);
+            if (not read_all(fd, &buff.front(), size_t(hdr.num_samps) * hdr.samp_size))
+                break;
+            payload = &buff.front();
+        } else {
+            const ssize_t n = recv(fd, &buff.front(), buff.size(), 0);
+            if (n < ssize_t(sizeof(hdr)))
+                continue;
+            std::memcpy(&hdr, &buff.front(), sizeof(hdr));
+            // a truncated or malformed datagram must not be read past its end
+            if (hdr.header_len < sizeof(hdr)
+                or size_t(n) < hdr.header_len + size_t(hdr.num_samps) * hdr.samp_size) {
+                bad_datagrams++;
+                continue;
+            }
+            payload = &buff.front() + hdr.header_len;
+        }
+
+        if (hdr.magic != net_frame_magic or hdr.version != net_frame_version) {
+            throw std::runtime_error("Bad frame header, stream out of sync");
+        }
+        if (hdr.channel >= num_channels) {
+            throw std::runtime_error(
+                str(boost::format("Frame for channel %d, only --channels %d")
+                    % hdr.channel % num_channels));
+        }
+        if (frames != 0 and hdr.seq != next_seq)
+            lost_frames += uint32_t(hdr.seq - next_seq);
+        next_seq = hdr.seq + 1;
+        if (next_samp[hdr.channel] != 0 and hdr.first_samp != next_samp[hdr.channel])
+            samp_gaps++;
+        next_samp[hdr.channel] = hdr.first_samp + hdr.num_samps;
+
+        outfiles[hdr.channel]->write(payload, size_t(hdr.num_samps) * hdr.samp_size);
+        frames++;
+        bytes += size_t(hdr.num_samps) * hdr.samp_size;
+    }
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << boost::format("Received %d frames, %.1f MB in %.2f s (%.1f MB/s), "
+                               "%d frames lost, %d sample gaps, %d bad datagrams")
+                     % frames % (bytes / 1e6) % elapsed.count()
+                     % (bytes / 1e6 / elapsed.count()) % lost_frames % samp_gaps
+                     % bad_datagrams
+              << std::endl;
+
+    ::close(fd);
+    for (size_t i = 0; i < outfiles.size(); i++) {
+        outfiles[i]->close();
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,409 @@
+#include "net_sink.hpp"
+#include "thread_topology.hpp"
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#ifdef __linux__
+#    include <linux/errqueue.h>
+#endif
+
+// frames below this size are cheaper to copy than to pin
+static const size_t zerocopy_min_bytes = 16384;
+// socket buffer per subscriber; a subscriber further behind is dropped
+static const int net_sndbuf_bytes = 4 * 1024 * 1024;
+static const size_t udp_batch = 64;
+
+static std::runtime_error net_error(const std::string& what)
+{
+    return std::runtime_error(
+        str(boost::format("net_sink: %s: %s") % what % std::strerror(errno)));
+}
+
+net_sink::net_sink(const std::string& spec, size_t num_slots)
+    : _tcp(false)
+    , _listen_fd(-1)
+    , _max_datagram(1472)
+    , _seq(0)
+    , _slots(num_slots)
+    , _num_subs(0)
+    , _running(true)
+    , _blocks_dropped(0)
+    , _blocks_sent(0)
+    , _subs_accepted(0)
+    , _subs_slow(0)
+    , _datagrams_dropped(0)
+    , _zc_sends(0)
+    , _zc_copied(0)
+{
+    std::vector<std::string> fields;
+    boost::split(fields, spec, boost::is_any_of(":"));
+
+    if (fields.size() == 2 and fields[0] == "tcp") {
+        _tcp       = true;
+        _listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (_listen_fd < 0)
+            throw net_error("socket");
+        int one = 1;
+        setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port        = htons(std::stoi(fields[1]));
+        if (bind(_listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+            throw net_error("bind " + spec);
+        if (listen(_listen_fd, 8) < 0)
+            throw net_error("listen " + spec);
+    } else if ((fields.size() == 3 or fields.size() == 4) and fields[0] == "udp") {
+        if (fields.size() == 4)
+            _max_datagram = std::stoul(fields[3]);
+        if (_max_datagram <= sizeof(net_frame_header))
+            throw std::runtime_error("net_sink: datagram size too small in " + spec);
+        addrinfo hints, *res;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family   = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        if (getaddrinfo(fields[1].c_str(), fields[2].c_str(), &hints, &res) != 0)
+            throw std::runtime_error("net_sink: cannot resolve " + spec);
+        subscriber sub;
+        sub.fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sub.fd < 0 or connect(sub.fd, res->ai_addr, res->ai_addrlen) < 0) {
+            freeaddrinfo(res);
+            throw net_error("connect " + spec);
+        }
+        freeaddrinfo(res);
+        setsockopt(sub.fd, SOL_SOCKET, SO_SNDBUF, &net_sndbuf_bytes, sizeof(int));
+        sub.zerocopy   = false;
+        sub.zc_next_id = 0;
+        sub.seq        = 0;
+        _subs.push_back(sub);
+        _num_subs = 1;
+    } else {
+        throw std::runtime_error(
+            "net_sink: expected tcp:PORT or udp:HOST:PORT[:BYTES], got " + spec);
+    }
+
+    for (size_t i = 0; i < _slots.size(); i++) {
+        _slots[i].refs = 0;
+        _free.push_back(i);
+    }
+    _thread = std::thread(&net_sink::sender_loop, this);
+}
+
+net_sink::~net_sink()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running = false;
+    }
+    _cond.notify_one();
+    _thread.join();
+
+    for (size_t i = 0; i < _subs.size(); i++) {
+        ::close(_subs[i].fd);
+    }
+    if (_listen_fd >= 0)
+        ::close(_listen_fd);
+
+    std::cout << boost::format("net_sink: %d blocks sent, %d dropped (sender behind), "
+                               "%d subscribers (%d disconnected as slow), "
+                               "%d datagrams dropped, %d zero-copy sends (kernel copied %d times)")
+                     % _blocks_sent % _blocks_dropped % _subs_accepted % _subs_slow
+                     % _datagrams_dropped % _zc_sends % _zc_copied
+              << std::endl;
+}
+
+void net_sink::write(const sample_block& block)
+{
+    if (_num_subs == 0) {
+        return;
+    }
+
+    size_t idx;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_free.empty()) {
+            _blocks_dropped++;
+            return;
+        }
+        idx = _free.back();
+        _free.pop_back();
+    }
+
+    slot& s = _slots[idx];
+    s.chans.resize(block.num_channels);
+    if (block.ref) {
+        s.ref = *block.ref;
+        for (size_t i = 0; i < block.num_channels; i++) {
+            s.chans[i] = static_cast<const char*>(block.buffs[i]);
+        }
+    } else {
+        const size_t chan_bytes  = block.num_samps * block.samp_size;
+        const size_t total_bytes = chan_bytes * block.num_channels;
+        if (s.data.size() < total_bytes) {
+            // only the first blocks through a slot grow it
+            s.data.resize(total_bytes);
+        }
+        for (size_t i = 0; i < block.num_channels; i++) {
+            std::memcpy(&s.data[i * chan_bytes], block.buffs[i], chan_bytes);
+            s.chans[i] = &s.data[i * chan_bytes];
+        }
+    }
+    s.block       = block;
+    s.block.buffs = nullptr;
+    s.block.ref   = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _ready.push_back(idx);
+    }
+    _cond.notify_one();
+}
+
+void net_sink::sender_loop()
+{
+    apply_thread_role("net");
+    while (true) {
+        size_t idx    = 0;
+        bool have_one = false;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait_for(lock, std::chrono::milliseconds(10), [this] {
+                return not _ready.empty() or not _running;
+            });
+            if (not _ready.empty()) {
+                idx      = _ready.front();
+                have_one = true;
+                _ready.pop_front();
+            } else if (not _running) {
+                break;
+            }
+        }
+        if (_tcp)
+            accept_subscribers();
+        for (size_t i = 0; i < _subs.size(); i++) {
+            reap_completions(_subs[i]);
+        }
+        if (have_one)
+            send_slot(idx);
+    }
+    record_thread_stats("net");
+}
+
+void net_sink::accept_subscribers()
+{
+    while (true) {
+        const int fd = accept4(_listen_fd, nullptr, nullptr, SOCK_NONBLOCK);
+        if (fd < 0)
+            return;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &net_sndbuf_bytes, sizeof(int));
+        subscriber sub;
+        sub.fd         = fd;
+        sub.zerocopy   = false;
+        sub.zc_next_id = 0;
+        sub.seq        = 0;
+#ifdef SO_ZEROCOPY
+        sub.zerocopy = (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0);
+#endif
+        _subs.push_back(sub);
+        _num_subs = _subs.size();
+        _subs_accepted++;
+    }
+}
+
+void net_sink::send_slot(size_t idx)
+{
+    slot& s = _slots[idx];
+    // hold the slot while sending, dropping a subscriber must not free it
+    s.refs++;
+    if (_tcp) {
+        // headers live in the slot so zero-copy sends can reference them
+        s.headers.resize(s.block.num_channels);
+        for (size_t i = 0; i < s.block.num_channels; i++) {
+            net_frame_header& hdr = s.headers[i];
+            hdr.magic             = net_frame_magic;
+            hdr.version           = net_frame_version;
+            hdr.header_len        = sizeof(net_frame_header);
+            hdr.seq               = _seq++;
+            hdr.channel           = uint16_t(s.block.first_chan + i);
+            hdr.samp_size         = uint16_t(s.block.samp_size);
+            hdr.num_samps         = uint32_t(s.block.num_samps);
+            hdr.reserved          = 0;
+            hdr.first_samp        = s.block.first_samp;
+            hdr.time_secs         = s.block.time_secs;
+        }
+        for (size_t i = 0; i < _subs.size();) {
+            if (send_tcp(_subs[i], idx)) {
+                i++;
+            } else {
+                drop_subscriber(i);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < _subs.size(); i++) {
+            send_udp(_subs[i], idx);
+        }
+    }
+    _blocks_sent++;
+    if (--s.refs == 0)
+        release(idx);
+}
+
+bool net_sink::send_tcp(subscriber& sub, size_t idx)
+{
+    slot& s                 = _slots[idx];
+    const size_t chan_bytes = s.block.num_samps * s.block.samp_size;
+    for (size_t i = 0; i < s.block.num_channels; i++) {
+        iovec iov[2];
+        iov[0].iov_base = &s.headers[i];
+        iov[0].iov_len  = sizeof(net_frame_header);
+        iov[1].iov_base = const_cast<char*>(s.chans[i]);
+        iov[1].iov_len  = chan_bytes;
+        msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = 2;
+
+        int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+        bool zc   = false;
+#ifdef MSG_ZEROCOPY
+        zc = sub.zerocopy and chan_bytes >= zerocopy_min_bytes;
+        if (zc)
+            flags |= MSG_ZEROCOPY;
+#endif
+        const ssize_t sent = sendmsg(sub.fd, &msg, flags);
+        if (sent != ssize_t(sizeof(net_frame_header) + chan_bytes)) {
+            // a full socket buffer (or a partial frame) means the
+            // subscriber cannot keep up; anything else means it went away
+            if (sent >= 0 or errno == EAGAIN or errno == EWOULDBLOCK)
+                _subs_slow++;
+            return false;
+        }
+        if (zc) {
+            sub.zc_pending.push_back(std::make_pair(sub.zc_next_id++, idx));
+            s.refs++;
+            _zc_sends++;
+        }
+    }
+    return true;
+}
+
+void net_sink::send_udp(subscriber& sub, size_t idx)
+{
+    const slot& s = _slots[idx];
+    const size_t samps_per_dgram =
+        (_max_datagram - sizeof(net_frame_header)) / s.block.samp_size;
+
+    net_frame_header headers[udp_batch];
+    iovec iovs[udp_batch][2];
+    mmsghdr msgs[udp_batch];
+    size_t batched = 0;
+
+    for (size_t i = 0; i < s.block.num_channels; i++) {
+        for (size_t offset = 0; offset < s.block.num_samps; offset += samps_per_dgram) {
+            const size_t nsamps = std::min(samps_per_dgram, s.block.num_samps - offset);
+            net_frame_header& hdr = headers[batched];
+            hdr.magic             = net_frame_magic;
+            hdr.version           = net_frame_version;
+            hdr.header_len        = sizeof(net_frame_header);
+            hdr.seq               = sub.seq++;
+            hdr.channel           = uint16_t(s.block.first_chan + i);
+            hdr.samp_size         = uint16_t(s.block.samp_size);
+            hdr.num_samps         = uint32_t(nsamps);
+            hdr.reserved          = 0;
+            hdr.first_samp        = s.block.first_samp + offset;
+            hdr.time_secs         = s.block.time_secs + offset / s.block.rate;
+
+            iovs[batched][0].iov_base = &hdr;
+            iovs[batched][0].iov_len  = sizeof(net_frame_header);
+            iovs[batched][1].iov_base =
+                const_cast<char*>(s.chans[i] + offset * s.block.samp_size);
+            iovs[batched][1].iov_len = nsamps * s.block.samp_size;
+            std::memset(&msgs[batched], 0, sizeof(mmsghdr));
+            msgs[batched].msg_hdr.msg_iov    = iovs[batched];
+            msgs[batched].msg_hdr.msg_iovlen = 2;
+
+            if (++batched == udp_batch) {
+                const int sent = sendmmsg(sub.fd, msgs, batched, MSG_DONTWAIT);
+                _datagrams_dropped += batched - std::max(sent, 0);
+                batched = 0;
+            }
+        }
+    }
+    if (batched != 0) {
+        const int sent = sendmmsg(sub.fd, msgs, batched, MSG_DONTWAIT);
+        _datagrams_dropped += batched - std::max(sent, 0);
+    }
+}
+
+void net_sink::reap_completions(subscriber& sub)
+{
+#if defined(__linux__) && defined(SO_EE_ORIGIN_ZEROCOPY)
+    while (not sub.zc_pending.empty()) {
+        char control[128];
+        msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sub.fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            return;
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+            const sock_extended_err* serr = (const sock_extended_err*)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 or serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                _zc_copied++;
+            // completions cover the id range [ee_info, ee_data]
+            while (not sub.zc_pending.empty()
+                   and int32_t(sub.zc_pending.front().first - serr->ee_data) <= 0) {
+                const size_t idx = sub.zc_pending.front().second;
+                sub.zc_pending.pop_front();
+                if (--_slots[idx].refs == 0)
+                    release(idx);
+            }
+        }
+    }
+#else
+    (void)sub;
+#endif
+}
+
+void net_sink::drop_subscriber(size_t i)
+{
+    subscriber& sub = _subs[i];
+    // a normal close would let TCP go on sending queued zero-copy data
+    // straight from the slots' pages, which are about to be refilled;
+    // abort the connection so the queue is discarded with the socket
+    if (not sub.zc_pending.empty()) {
+        linger abort_linger;
+        abort_linger.l_onoff  = 1;
+        abort_linger.l_linger = 0;
+        setsockopt(sub.fd, SOL_SOCKET, SO_LINGER, &abort_linger, sizeof(abort_linger));
+    }
+    while (not sub.zc_pending.empty()) {
+        const size_t idx = sub.zc_pending.front().second;
+        sub.zc_pending.pop_front();
+        if (--_slots[idx].refs == 0)
+            release(idx);
+    }
+    ::close(sub.fd);
+    _subs.erase(_subs.begin() + i);
+    _num_subs = _subs.size();
+}
+
+void net_sink::release(size_t idx)
+{
+    _slots[idx].ref.reset();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _free.push_back(idx);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "buffer_pool.hpp"
+#include "net_protocol.hpp"
+#include "rx_sink.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/***********************************************************************
+ * net_sink
+ * Streams received blocks to other hosts, framed as in net_protocol.hpp.
+ *
+ *   tcp:PORT                   listen on PORT, any number of subscribers
+ *   udp:HOST:PORT[:BYTES]      send datagrams of at most BYTES (default
+ *                              1472, one Ethernet frame) to HOST:PORT
+ *
+ * write() takes a free slot of a fixed set, holding a reference to the
+ * block when it comes from a buffer_pool and copying it otherwise, and
+ * queues it for the sender thread, so the recv thread never waits on
+ * the network.
+ * If every slot is still in flight the block is dropped for all
+ * subscribers. A TCP subscriber whose socket buffer is full is
+ * disconnected; a UDP datagram that does not fit the socket buffer is
+ * dropped. Large TCP frames go out with MSG_ZEROCOPY where the kernel
+ * supports it, and their slot stays pinned until the kernel reports the
+ * send complete.
+ *
+ * The sender thread drains the queue and stops in the destructor, so a
+ * sink shared by several streamers is only torn down once all of them
+ * have finished; close() does nothing.
+ **********************************************************************/
+class net_sink : public rx_sink
+{
+public:
+    net_sink(const std::string& spec, size_t num_slots = 64);
+    ~net_sink();
+
+    void write(const sample_block& block);
+
+private:
+    struct slot
+    {
+        pool_ref ref; // the pooled block, when there is one
+        std::vector<char> data; // channels back to back, when copied
+        std::vector<const char*> chans; // per channel, into ref or data
+        sample_block block; // metadata, buffs unused
+        std::vector<net_frame_header> headers; // one per channel (TCP)
+        size_t refs; // zero-copy sends not yet completed
+    };
+
+    struct subscriber
+    {
+        int fd;
+        bool zerocopy;
+        uint32_t zc_next_id;
+        uint32_t seq; // UDP datagrams sent to this subscriber
+        std::deque<std::pair<uint32_t, size_t>> zc_pending; // (send id, slot)
+    };
+
+    void sender_loop();
+    void accept_subscribers();
+    void send_slot(size_t idx);
+    bool send_tcp(subscriber& sub, size_t idx);
+    void send_udp(subscriber& sub, size_t idx);
+    void reap_completions(subscriber& sub);
+    void drop_subscriber(size_t i);
+    void release(size_t idx);
+
+    bool _tcp;
+    int _listen_fd;
+    size_t _max_datagram;
+    uint32_t _seq; // TCP frames, stamped once per block for every subscriber
+    std::vector<slot> _slots;
+    std::vector<subscriber> _subs;
+    std::atomic<size_t> _num_subs;
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::vector<size_t> _free;
+    std::deque<size_t> _ready;
+    bool _running;
+    std::thread _thread;
+
+    // statistics, printed by the destructor
+    std::atomic<uint64_t> _blocks_dropped;
+    uint64_t _blocks_sent, _subs_accepted, _subs_slow, _datagrams_dropped;
+    uint64_t _zc_sends, _zc_copied;
+};
@@ -0,0 +1,316 @@
+#include "overview_pyramid.hpp"
+#include "block_stats.hpp"
+#include "convert.hpp"
+#include "stream_common.hpp"
+#include "trace.hpp"
+#include <boost/format.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+static const char overview_magic[8] = {'E', 'T', 'O', 'V', 'R', '0', '0', '1'};
+
+// one page is one 4 KiB read
+static const size_t overview_page_size = 4096;
+static const size_t overview_page_records =
+    (overview_page_size - sizeof(overview_page_header)) / sizeof(overview_record);
+
+/***********************************************************************
+ * Reader
+ **********************************************************************/
+overview_reader::overview_reader(const std::string& ovr_file)
+    : _in(ovr_file.c_str(), std::ios::binary)
+{
+    if (not _in.read(reinterpret_cast<char*>(&_header), sizeof(_header))
+        or std::memcmp(_header.magic, overview_magic, sizeof(overview_magic)) != 0
+        or _header.record_size != sizeof(overview_record)
+        or _header.page_size < sizeof(overview_page_header)) {
+        throw std::runtime_error(ovr_file + " is not an overview file");
+    }
+    if (_header.index_offset == 0) {
+        throw std::runtime_error(
+            ovr_file + " has no page index (the capture did not close)");
+    }
+    overview_index_header index;
+    _in.seekg(std::streamoff(_header.index_offset));
+    if (not _in.read(reinterpret_cast<char*>(&index), sizeof(index))
+        or index.num_levels > 64) {
+        throw std::runtime_error(ovr_file + ": bad page index");
+    }
+    _levels.resize(index.num_levels);
+    if (index.num_levels != 0
+        and not _in.read(reinterpret_cast<char*>(&_levels.front()),
+            std::streamsize(_levels.size() * sizeof(overview_level_index)))) {
+        throw std::runtime_error(ovr_file + ": bad page index");
+    }
+}
+
+uint64_t overview_reader::num_records(size_t level) const
+{
+    return level < _levels.size() ? _levels[level].num_records : 0;
+}
+
+std::vector<overview_record> overview_reader::read(
+    size_t level, uint64_t first, size_t count)
+{
+    std::vector<overview_record> records;
+    const uint64_t end = std::min(first + count, num_records(level));
+    if (first >= end)
+        return records;
+
+    // the page numbers of just the pages the range covers
+    const uint64_t first_page = first / _header.page_records;
+    const uint64_t last_page  = (end - 1) / _header.page_records;
+    std::vector<uint32_t> pages(size_t(last_page - first_page + 1));
+    _in.clear();
+    _in.seekg(
+        std::streamoff(_levels[level].pages_offset + first_page * sizeof(uint32_t)));
+    if (not _in.read(reinterpret_cast<char*>(&pages.front()),
+            std::streamsize(pages.size() * sizeof(uint32_t)))) {
+        return records;
+    }
+    while (first < end) {
+        const uint64_t page   = first / _header.page_records;
+        const uint64_t within = first % _header.page_records;
+        const size_t n =
+            size_t(std::min<uint64_t>(end - first, _header.page_records - within));
+        const size_t done = records.size();
+        records.resize(done + n);
+        _in.clear();
+        const uint64_t number = pages[size_t(page - first_page)];
+        _in.seekg(std::streamoff(_header.header_size + number * _header.page_size
+                                 + sizeof(overview_page_header)
+                                 + within * sizeof(overview_record)));
+        if (not _in.read(reinterpret_cast<char*>(&records[done]),
+                std::streamsize(n * sizeof(overview_record)))) {
+            records.resize(done);
+            break;
+        }
+        first += n;
+    }
+    return records;
+}
+
+/***********************************************************************
+ * overview_pyramid
+ **********************************************************************/
+overview_pyramid::overview_pyramid(const std::string& file,
+    size_t num_channels,
+    size_t first_name,
+    size_t total_names,
+    size_t samp_size,
+    double rate,
+    size_t base_samps,
+    capture_metadata::sptr metadata)
+    : _samp_size(samp_size)
+    , _base_samps(base_samps)
+    , _full_scale(full_scale(sample_format_of_size(samp_size)))
+    , _metadata(metadata)
+    , _closed(false)
+    , _pages(0)
+{
+    if (base_samps == 0 or (base_samps & (base_samps - 1)) != 0)
+        throw std::runtime_error("overview_pyramid: base_samps must be a power of two");
+
+    std::vector<char> header_page(overview_page_size, 0);
+    overview_header header;
+    std::memcpy(header.magic, overview_magic, sizeof(overview_magic));
+    header.header_size  = overview_page_size;
+    header.page_size    = overview_page_size;
+    header.record_size  = sizeof(overview_record);
+    header.page_records = overview_page_records;
+    header.base_samps   = base_samps;
+    header.rate         = rate;
+    header.index_offset = 0;
+    std::memcpy(&header_page.front(), &header, sizeof(header));
+
+    for (size_t c = 0; c < num_channels; c++) {
+        std::unique_ptr<channel> ch(new channel());
+        ch->name = generate_out_filename(file, total_names, first_name + c) + ".ovr";
+        ch->out.open(ch->name.c_str(), std::ios::binary | std::ios::trunc);
+        if (not ch->out.is_open()) {
+            throw std::runtime_error("Unable to open " + ch->name);
+        }
+        ch->out.write(&header_page.front(), std::streamsize(header_page.size()));
+        ch->levels.resize(1);
+        _channels.push_back(std::move(ch));
+    }
+    if (_metadata)
+        _metadata->set("overview.base_samps", base_samps);
+}
+
+overview_pyramid::~overview_pyramid()
+{
+    close();
+}
+
+overview_pyramid::partial overview_pyramid::measure(const char* samps, size_t n) const
+{
+    sample_sums sums;
+    measure_samples(samps, _samp_size, n, sums);
+    const double scale = 1.0 / _full_scale, power_scale = scale * scale;
+    partial p;
+    p.min_i     = float(sums.min_i * scale);
+    p.max_i     = float(sums.max_i * scale);
+    p.min_q     = float(sums.min_q * scale);
+    p.max_q     = float(sums.max_q * scale);
+    p.sum_power = sums.sum_power * power_scale;
+    p.max_power = float(sums.max_power * power_scale);
+    p.num_samps = n;
+    p.num_parts = 1;
+    return p;
+}
+
+void overview_pyramid::merge(partial& into, const partial& from)
+{
+    if (into.num_samps == 0) {
+        into = from;
+        return;
+    }
+    into.min_i = std::min(into.min_i, from.min_i);
+    into.max_i = std::max(into.max_i, from.max_i);
+    into.min_q = std::min(into.min_q, from.min_q);
+    into.max_q = std::max(into.max_q, from.max_q);
+    into.sum_power += from.sum_power;
+    into.max_power = std::max(into.max_power, from.max_power);
+    into.num_samps += from.num_samps;
+    into.num_parts += from.num_parts;
+}
+
+void overview_pyramid::write(const sample_block& block)
+{
+    TRACE_SCOPE("overview");
+    for (size_t i = 0; i < block.num_channels; i++) {
+        channel& ch       = *_channels.at(i);
+        const char* samps = static_cast<const char*>(block.buffs[i]);
+        size_t n          = block.num_samps;
+        while (n != 0) {
+            // pieces end on level 0 record boundaries of the file
+            const size_t count = size_t(
+                std::min<uint64_t>(n, _base_samps - ch.levels[0].acc.num_samps));
+            partial piece = measure(samps, count);
+            piece.num_parts = 0;
+            merge(ch.levels[0].acc, piece);
+            if (ch.levels[0].acc.num_samps == _base_samps)
+                finish(ch, 0);
+            samps += count * _samp_size;
+            n -= count;
+        }
+    }
+}
+
+void overview_pyramid::finish(channel& ch, size_t level_index)
+{
+    const partial acc = ch.levels[level_index].acc;
+    ch.levels[level_index].acc = partial();
+
+    overview_record record;
+    record.min_i      = acc.min_i;
+    record.max_i      = acc.max_i;
+    record.min_q      = acc.min_q;
+    record.max_q      = acc.max_q;
+    record.mean_power = float(acc.sum_power / double(acc.num_samps));
+    record.max_power  = acc.max_power;
+    ch.levels[level_index].page.push_back(record);
+    ch.levels[level_index].num_records++;
+    if (ch.levels[level_index].page.size() == overview_page_records)
+        write_page(ch, level_index);
+
+    // two records of this level make one of the next
+    if (ch.levels.size() == level_index + 1)
+        ch.levels.push_back(level());
+    partial up   = acc;
+    up.num_parts = 1;
+    merge(ch.levels[level_index + 1].acc, up);
+    if (ch.levels[level_index + 1].acc.num_parts == 2)
+        finish(ch, level_index + 1);
+}
+
+void overview_pyramid::write_page(channel& ch, size_t level_index)
+{
+    std::vector<overview_record>& page = ch.levels[level_index].page;
+    overview_page_header header;
+    header.level        = uint32_t(level_index);
+    header.num_records  = uint32_t(page.size());
+    header.first_record = ch.levels[level_index].num_records - page.size();
+    ch.out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ch.out.write(reinterpret_cast<const char*>(&page.front()),
+        std::streamsize(page.size() * sizeof(overview_record)));
+    // short pages are padded, so pages stay at fixed offsets
+    static const char zeros[overview_page_size] = {};
+    ch.out.write(zeros,
+        std::streamsize(overview_page_size - sizeof(header)
+                        - page.size() * sizeof(overview_record)));
+    page.clear();
+    ch.levels[level_index].pages.push_back(ch.num_pages++);
+    _pages++;
+}
+
+void overview_pyramid::write_index(channel& ch)
+{
+    const uint64_t index_offset =
+        overview_page_size + uint64_t(ch.num_pages) * overview_page_size;
+    overview_index_header index;
+    index.num_levels = uint32_t(ch.levels.size());
+    index.reserved   = 0;
+    ch.out.write(reinterpret_cast<const char*>(&index), sizeof(index));
+    uint64_t pages_offset =
+        index_offset + sizeof(index) + ch.levels.size() * sizeof(overview_level_index);
+    for (size_t l = 0; l < ch.levels.size(); l++) {
+        overview_level_index entry;
+        entry.num_records  = ch.levels[l].num_records;
+        entry.num_pages    = ch.levels[l].pages.size();
+        entry.pages_offset = pages_offset;
+        ch.out.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        pages_offset += entry.num_pages * sizeof(uint32_t);
+    }
+    for (size_t l = 0; l < ch.levels.size(); l++) {
+        const std::vector<uint32_t>& pages = ch.levels[l].pages;
+        if (not pages.empty()) {
+            ch.out.write(reinterpret_cast<const char*>(&pages.front()),
+                std::streamsize(pages.size() * sizeof(uint32_t)));
+        }
+    }
+    // last, so a reader never finds an index that is not all there
+    ch.out.seekp(std::streamoff(offsetof(overview_header, index_offset)));
+    ch.out.write(reinterpret_cast<const char*>(&index_offset), sizeof(index_offset));
+}
+
+void overview_pyramid::close()
+{
+    if (_closed)
+        return;
+    _closed = true;
+    size_t max_levels = 0;
+    for (size_t c = 0; c < _channels.size(); c++) {
+        channel& ch = *_channels[c];
+        for (size_t l = 0; l < ch.levels.size(); l++) {
+            if (ch.levels[l].acc.num_samps != 0)
+                finish(ch, l);
+            if (not ch.levels[l].page.empty())
+                write_page(ch, l);
+            // one record covers the capture; the levels above only hold
+            // copies of it
+            if (ch.levels[l].num_records <= 1) {
+                ch.levels.resize(l + 1);
+                break;
+            }
+        }
+        write_index(ch);
+        ch.out.close();
+        max_levels = std::max(max_levels, ch.levels.size());
+
+        if (_metadata) {
+            boost::property_tree::ptree entry;
+            entry.put("file", ch.name);
+            entry.put("levels", ch.levels.size());
+            _metadata->append("overview.files", entry);
+        }
+    }
+    std::cout << boost::format("Overview: %d levels of %d samples and up, %d pages")
+                     % max_levels % _base_samps % _pages
+              << std::endl;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "capture_meta.hpp"
+#include "rx_sink.hpp"
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/***********************************************************************
+ * Overview pyramid sidecar
+ * Per channel file <channel file>.ovr summarising the raw file at every
+ * zoom level: a level 0 record covers base_samps samples of the file,
+ * a level k record 2^k level 0 records, up to the level that covers
+ * the whole capture in one record. Records follow the file, not the
+ * stream, so dropped samples do not leave holes.
+ *
+ * The file is a sequence of page_size pages: an overview_header padded
+ * to a page, then pages of one level each, holding an
+ * overview_page_header and up to page_records records. The pages of a
+ * level appear in record order and all but its last are full, so page
+ * j of a level starts at record j * page_records. Levels interleave in
+ * the order their pages filled, so close() appends a page index at
+ * index_offset: an overview_index_header, one overview_level_index per
+ * level, then per level the file page number (counted from
+ * header_size) of each of its pages as a uint32. A viewer reads the
+ * level table, then only the index entries and pages it displays.
+ * index_offset stays 0 until close(). Levels are in full scale units
+ * (sc16 32767 and fc32/fc64 1.0 map to 1.0), little endian. The last
+ * record of a level may cover fewer samples.
+ **********************************************************************/
+struct overview_header
+{
+    char magic[8]; // "ETOVR001"
+    uint32_t header_size; // bytes before the first level page
+    uint32_t page_size;
+    uint32_t record_size;
+    uint32_t page_records; // records in a full page
+    uint64_t base_samps; // samples per level 0 record
+    double rate;
+    uint64_t index_offset; // of the page index, 0 until closed
+};
+
+struct overview_page_header
+{
+    uint32_t level;
+    uint32_t num_records;
+    uint64_t first_record;
+};
+
+struct overview_index_header
+{
+    uint32_t num_levels;
+    uint32_t reserved;
+};
+
+struct overview_level_index
+{
+    uint64_t num_records;
+    uint64_t num_pages;
+    uint64_t pages_offset; // of the level's uint32 page numbers
+};
+
+struct overview_record
+{
+    float min_i, max_i;
+    float min_q, max_q;
+    float mean_power; // mean |x|^2
+    float max_power;
+};
+
+/***********************************************************************
+ * overview_reader
+ * Loads the level table of a closed .ovr file; read() loads only the
+ * index entries and pages that hold the records asked for.
+ **********************************************************************/
+class overview_reader
+{
+public:
+    overview_reader(const std::string& ovr_file);
+
+    const overview_header& header() const
+    {
+        return _header;
+    }
+    size_t num_levels() const
+    {
+        return _levels.size();
+    }
+    uint64_t num_records(size_t level) const;
+
+    //! Records first .. first + count - 1 of level, fewer at the end
+    std::vector<overview_record> read(size_t level, uint64_t first, size_t count);
+
+private:
+    std::ifstream _in;
+    overview_header _header;
+    std::vector<overview_level_index> _levels;
+};
+
+/***********************************************************************
+ * overview_pyramid
+ * rx_sink building the .ovr files as blocks arrive, next to a
+ * file_sink with the same naming. Level 0 comes from one vectorised
+ * pass over the samples; each completed record is merged into the
+ * level above, so the work above level 0 is O(n / base_samps) and the
+ * memory one page per level, plus 4 bytes per written page for the
+ * index. Full pages are appended as they fill; the partial records and
+ * pages and the index are written by close(). Like file_sink it belongs
+ * to one streamer.
+ **********************************************************************/
+class overview_pyramid : public rx_sink
+{
+public:
+    //! base_samps is a power of two
+    overview_pyramid(const std::string& file,
+        size_t num_channels,
+        size_t first_name,
+        size_t total_names,
+        size_t samp_size,
+        double rate,
+        size_t base_samps = 256,
+        capture_metadata::sptr metadata = capture_metadata::sptr());
+    ~overview_pyramid();
+
+    void write(const sample_block& block);
+    void close();
+
+private:
+    //! A record being merged; sums stay exact until it is written
+    struct partial
+    {
+        float min_i = 0, max_i = 0, min_q = 0, max_q = 0;
+        double sum_power = 0;
+        float max_power = 0;
+        uint64_t num_samps = 0;
+        size_t num_parts = 0; // records merged from the level below
+    };
+
+    struct level
+    {
+        partial acc;
+        uint64_t num_records = 0; // written or in the page
+        std::vector<overview_record> page;
+        std::vector<uint32_t> pages; // file page numbers, in record order
+    };
+
+    struct channel
+    {
+        std::string name;
+        std::ofstream out;
+        std::vector<level> levels;
+        uint32_t num_pages = 0; // written after the header
+    };
+
+    partial measure(const char* samps, size_t n) const;
+    static void merge(partial& into, const partial& from);
+    void finish(channel& ch, size_t level_index);
+    void write_page(channel& ch, size_t level_index);
+    void write_index(channel& ch);
+
+    const size_t _samp_size;
+    const size_t _base_samps;
+    const double _full_scale;
+    std::vector<std::unique_ptr<channel>> _channels;
+    capture_metadata::sptr _metadata;
+    bool _closed;
+    uint64_t _pages;
+};
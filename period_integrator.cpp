@@ -0,0 +1,213 @@
+#include "period_integrator.hpp"
+#include "convert.hpp"
+#include "stream_common.hpp"
+#include "trace.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <algorithm>
+#include <complex>
+#include <iostream>
+#include <stdexcept>
+
+// One flat loop over the interleaved scalars, so the adds vectorise
+template <typename scalar_type>
+static void accumulate(const scalar_type* in, float* acc, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        acc[i] += float(in[i]);
+    }
+}
+
+static void accumulate_samples(const char* samps, size_t samp_size, float* acc, size_t n)
+{
+    switch (samp_size) {
+        case sizeof(std::complex<int8_t>):
+            accumulate(reinterpret_cast<const int8_t*>(samps), acc, 2 * n);
+            break;
+        case sizeof(std::complex<short>):
+            accumulate(reinterpret_cast<const short*>(samps), acc, 2 * n);
+            break;
+        case sizeof(std::complex<float>):
+            accumulate(reinterpret_cast<const float*>(samps), acc, 2 * n);
+            break;
+        case sizeof(std::complex<double>):
+            accumulate(reinterpret_cast<const double*>(samps), acc, 2 * n);
+            break;
+        default:
+            throw std::runtime_error("period_integrator: unsupported sample size");
+    }
+}
+
+static std::string average_file_name(const std::string& chan_file)
+{
+    boost::filesystem::path path(chan_file);
+    path.replace_extension(
+        boost::filesystem::path(".avg" + path.extension().string()));
+    return path.string();
+}
+
+/***********************************************************************
+ * period_integrator
+ **********************************************************************/
+period_integrator::period_integrator(const std::string& file,
+    size_t num_channels,
+    size_t samp_size,
+    double rate,
+    double freq,
+    size_t period_samps,
+    size_t num_periods,
+    capture_metadata::sptr metadata)
+    : _file(file)
+    , _samp_size(samp_size)
+    , _rate(rate)
+    , _freq(freq)
+    , _period_samps(period_samps)
+    , _num_periods(num_periods)
+    , _group_samps(uint64_t(period_samps) * num_periods)
+    , _metadata(metadata)
+    , _channels(num_channels)
+{
+    if (period_samps == 0 or num_periods == 0)
+        throw std::runtime_error("period_integrator: empty period");
+
+    boost::property_tree::ptree files;
+    for (size_t c = 0; c < num_channels; c++) {
+        channel& ch = _channels[c];
+        ch.acc.assign(2 * period_samps, 0.0f);
+        ch.avg.resize(2 * period_samps);
+        ch.group        = 0;
+        ch.filled       = 0;
+        ch.started      = false;
+        ch.stream_start = 0;
+        ch.first_group  = 0;
+        ch.written      = 0;
+        ch.skipped      = 0;
+        ch.name = average_file_name(generate_out_filename(file, num_channels, c));
+        ch.out.reset(new std::ofstream(ch.name.c_str(), std::ios::binary | std::ios::trunc));
+        if (not ch.out->is_open())
+            throw std::runtime_error("Unable to open " + ch.name);
+
+        boost::property_tree::ptree entry;
+        entry.put("file", ch.name);
+        entry.put("chan", c);
+        files.push_back(std::make_pair("", entry));
+    }
+    if (_metadata) {
+        _metadata->set("integration.period_samps", period_samps);
+        _metadata->set("integration.num_periods", num_periods);
+        _metadata->put_child("integration.files", files);
+    }
+}
+
+period_integrator::~period_integrator()
+{
+    uint64_t written = 0, skipped = 0;
+    for (size_t c = 0; c < _channels.size(); c++) {
+        channel& ch = _channels[c];
+        // a group cut off by the end of the capture
+        if (ch.filled != 0)
+            ch.skipped++;
+        ch.out->close();
+        written += ch.written;
+        skipped += ch.skipped;
+
+        capture_metadata avg_metadata(ch.name);
+        avg_metadata.set("rate", _rate);
+        avg_metadata.set("freq", _freq);
+        avg_metadata.set("cpu_format", "fc32");
+        avg_metadata.set("num_channels", 1);
+        avg_metadata.set("start_time",
+            ch.stream_start + double(ch.first_group * _group_samps) / _rate);
+        avg_metadata.set("num_samps", ch.written * _period_samps);
+        avg_metadata.set("integration.source",
+            generate_out_filename(_file, _channels.size(), c));
+        avg_metadata.set("integration.period_samps", _period_samps);
+        avg_metadata.set("integration.num_periods", _num_periods);
+        avg_metadata.set("integration.first_group", ch.first_group);
+        avg_metadata.set("integration.groups_written", ch.written);
+        avg_metadata.set("integration.groups_skipped", ch.skipped);
+        avg_metadata.write();
+    }
+    if (_metadata) {
+        _metadata->set("integration.groups_written", written);
+        _metadata->set("integration.groups_skipped", skipped);
+    }
+    std::cout << boost::format("Integration: %d periods of %d samples per average, "
+                               "%d averages written, %d groups skipped")
+                     % _num_periods % _period_samps % written % skipped
+              << std::endl;
+}
+
+void period_integrator::write(const sample_block& block)
+{
+    TRACE_SCOPE("integrate");
+    for (size_t i = 0; i < block.num_channels; i++) {
+        channel& ch = _channels.at(block.first_chan + i);
+        if (not ch.started) {
+            ch.started      = true;
+            ch.group        = block.first_samp / _group_samps;
+            ch.first_group  = ch.group;
+            ch.stream_start = block.time_secs - double(block.first_samp) / _rate;
+        }
+
+        const char* samps  = static_cast<const char*>(block.buffs[i]);
+        const uint64_t end = block.first_samp + block.num_samps;
+        uint64_t pos       = block.first_samp;
+        while (pos < end) {
+            const uint64_t group = pos / _group_samps;
+            if (group != ch.group) {
+                // samples were lost, or the group started before the stream
+                if (ch.filled != 0) {
+                    ch.skipped++;
+                    std::fill(ch.acc.begin(), ch.acc.end(), 0.0f);
+                }
+                ch.group  = group;
+                ch.filled = 0;
+            }
+            const size_t count =
+                size_t(std::min(end, (group + 1) * _group_samps) - pos);
+            add(ch, samps + (pos - block.first_samp) * _samp_size, pos, count);
+            ch.filled += count;
+            pos += count;
+            if (ch.filled == _group_samps) {
+                finish_group(ch);
+            } else if (pos % _group_samps == 0) {
+                // reached the end of a group with holes in it
+                ch.skipped++;
+                std::fill(ch.acc.begin(), ch.acc.end(), 0.0f);
+                ch.group++;
+                ch.filled = 0;
+            }
+        }
+    }
+}
+
+void period_integrator::add(channel& ch, const char* samps, uint64_t pos, size_t count)
+{
+    while (count != 0) {
+        const size_t phase = size_t(pos % _period_samps);
+        const size_t n     = std::min(count, _period_samps - phase);
+        accumulate_samples(samps, _samp_size, &ch.acc[2 * phase], n);
+        samps += n * _samp_size;
+        pos += n;
+        count -= n;
+    }
+}
+
+void period_integrator::finish_group(channel& ch)
+{
+    const double full = full_scale(sample_format_of_size(_samp_size));
+    const float scale = float(1.0 / (full * _num_periods));
+    for (size_t k = 0; k < ch.acc.size(); k++) {
+        ch.avg[k] = ch.acc[k] * scale;
+    }
+    ch.out->write(reinterpret_cast<const char*>(ch.avg.data()),
+        std::streamsize(ch.avg.size() * sizeof(float)));
+    if (ch.written == 0)
+        ch.first_group = ch.group;
+    ch.written++;
+    std::fill(ch.acc.begin(), ch.acc.end(), 0.0f);
+    ch.group++;
+    ch.filled = 0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "capture_meta.hpp"
+#include "rx_sink.hpp"
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/***********************************************************************
+ * period_integrator
+ * Coherent integration of a periodic RX signal, for --repeat playback
+ * of a TX file. The stream is cut into groups of num_periods periods of
+ * period_samps samples, counted from stream sample 0 (TX and RX start
+ * at the same device time, so sample 0 is period phase 0). Each group
+ * is summed into a one period accumulator per channel and written as
+ * the averaged period, fc32 in full scale units: one period of output
+ * per num_periods of input, with the noise power down by num_periods.
+ *
+ * The sums run on the recv thread; the accumulator is small enough to
+ * stay in cache and the adds vectorise. Groups that lost samples (or
+ * were cut off at the start or end) are skipped rather than averaged
+ * over fewer periods.
+ *
+ * Files are named from the channel file with .avg before the extension
+ * (rx.00.avg.dat), each with a .json sidecar. Each channel must only be
+ * written from one thread.
+ **********************************************************************/
+class period_integrator : public rx_sink
+{
+public:
+    period_integrator(const std::string& file,
+        size_t num_channels,
+        size_t samp_size,
+        double rate,
+        double freq,
+        size_t period_samps,
+        size_t num_periods,
+        capture_metadata::sptr metadata = capture_metadata::sptr());
+    ~period_integrator();
+
+    void write(const sample_block& block);
+
+private:
+    struct channel
+    {
+        std::vector<float> acc; // interleaved I/Q, one period
+        std::vector<float> avg;
+        uint64_t group; // group being summed
+        uint64_t filled; // samples of it summed so far
+        bool started;
+        double stream_start; // device time of stream sample 0
+        uint64_t first_group; // first one written
+        uint64_t written, skipped;
+        std::string name;
+        std::unique_ptr<std::ofstream> out;
+    };
+
+    void add(channel& ch, const char* samps, uint64_t pos, size_t count);
+    void finish_group(channel& ch);
+
+    const std::string _file;
+    const size_t _samp_size;
+    const double _rate;
+    const double _freq;
+    const size_t _period_samps;
+    const size_t _num_periods;
+    const uint64_t _group_samps;
+    capture_metadata::sptr _metadata;
+    std::vector<channel> _channels;
+};
@@ -0,0 +1,214 @@
+#pragma once
+
+#include "block_buffer.hpp"
+#include "buffer_pool.hpp"
+#include "file_sink.hpp"
+#include "rx_sink.hpp"
+#include "stream_common.hpp"
+#include "stream_device.hpp"
+#include "trace.hpp"
+#include <uhd/exception.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+/***********************************************************************
+ * recv_to_sinks function
+ * Streams from rx_stream (all of its channels) starting at device time
+ * start_time and hands every block to each sink, until
+ * num_requested_samples have been received (0 = until stop_signal_called).
+ * first_chan is the global number of the streamer's first channel when
+ * the channels are split across several streamers. Sample counts are
+ * 64 bit; requests beyond what one stream command can carry stream
+ * continuously and stop on the count. Returns the number of samples
+ * handed to the sinks, short of the request when the stream timed out,
+ * ended early or was stopped.
+ *
+ * Every recv() lands in a fresh block of pool (one is made when none
+ * is given), so sinks can keep a block by reference instead of copying
+ * it. When all blocks are held the recv goes to a private reserve
+ * buffer and the sinks copy as usual.
+ **********************************************************************/
+static const uint64_t max_samps_per_stream_cmd = 0x0fffffff;
+
+//! Blocks per streamer: enough for every net_sink slot plus headroom
+static const size_t recv_pool_blocks = 128;
+
+//! Bytes of one channel row in a pooled receive block
+template <typename samp_type>
+inline size_t recv_row_bytes(size_t samps_per_buff)
+{
+    return (samps_per_buff * sizeof(samp_type) + buffer_pool::alignment - 1)
+           / buffer_pool::alignment * buffer_pool::alignment;
+}
+
+//! One pool for num_streamers streamers of up to num_channels channels each
+template <typename samp_type>
+buffer_pool::sptr make_recv_pool(
+    size_t num_channels, size_t samps_per_buff, size_t num_streamers = 1)
+{
+    return buffer_pool::make(recv_row_bytes<samp_type>(samps_per_buff) * num_channels,
+        recv_pool_blocks * num_streamers);
+}
+
+template <typename samp_type>
+uint64_t recv_to_sinks(stream_device::sptr device,
+    uhd::rx_streamer::sptr rx_stream,
+    const std::vector<rx_sink::sptr>& sinks,
+    size_t samps_per_buff,
+    uint64_t num_requested_samples,
+    double start_time,
+    size_t first_chan,
+    buffer_pool::sptr pool = buffer_pool::sptr())
+{
+    uint64_t num_total_samps = 0;
+
+    // Prepare buffers for received samples and metadata
+    uhd::rx_metadata_t md;
+    const size_t num_channels = rx_stream->get_num_channels();
+    const size_t row_bytes    = recv_row_bytes<samp_type>(samps_per_buff);
+    if (not pool) {
+        pool = make_recv_pool<samp_type>(num_channels, samps_per_buff);
+    } else if (pool->block_bytes() < row_bytes * num_channels) {
+        throw std::runtime_error("recv_to_sinks: pool blocks too small");
+    }
+    block_buffer<samp_type> reserve(num_channels, samps_per_buff, buffer_pool::alignment);
+    std::vector<samp_type*> buffs(num_channels);
+
+    sample_block block;
+    block.buffs        = reinterpret_cast<void* const*>(&buffs.front());
+    block.num_channels = num_channels;
+    block.first_chan   = first_chan;
+    block.samp_size    = sizeof(samp_type);
+    block.rate         = device->get_rx_rate();
+
+    bool overflow_message = true;
+    bool stream_ended     = false; // nothing left queued in the streamer
+    // time until the start, which is an absolute device time, + padding
+    // for the first recv
+    double timeout =
+        std::max(0.0, start_time - device->get_time_now().get_real_secs()) + 0.1;
+
+    // setup streaming
+    const bool continuous = (num_requested_samples == 0
+                             or num_requested_samples > max_samps_per_stream_cmd);
+    uhd::stream_cmd_t stream_cmd(continuous
+                                     ? uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS
+                                     : uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_DONE);
+    stream_cmd.num_samps  = continuous ? 0 : size_t(num_requested_samples);
+    stream_cmd.stream_now = false;
+    stream_cmd.time_spec  = uhd::time_spec_t(start_time);
+    rx_stream->issue_stream_cmd(stream_cmd);
+
+    while (not stop_signal_called
+           and (num_requested_samples > num_total_samps or num_requested_samples == 0)) {
+        pool_ref ref = pool->get();
+        for (size_t i = 0; i < num_channels; i++) {
+            buffs[i] = ref ? reinterpret_cast<samp_type*>(ref.data() + i * row_bytes)
+                           : reserve[i];
+        }
+        block.ref = ref ? &ref : nullptr;
+
+        size_t num_rx_samps;
+        {
+            TRACE_SCOPE("recv");
+            num_rx_samps = rx_stream->recv(buffs, samps_per_buff, md, timeout);
+        }
+        timeout = 0.1f; // small timeout for subsequent recv
+
+        if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
+            std::cout << boost::format("Timeout while streaming") << std::endl;
+            stream_ended = true;
+            break;
+        }
+        if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW) {
+            TRACE_INSTANT("overflow");
+            if (overflow_message) {
+                overflow_message = false;
+                std::cerr
+                    << boost::format(
+                           "Got an overflow indication. Please consider the following:\n"
+                           "  Your write medium must sustain a rate of %fMB/s.\n"
+                           "  Dropped samples will not be written to the file.\n"
+                           "  Please modify this example for your purposes.\n"
+                           "  This message will not appear again.\n")
+                           % (device->get_rx_rate() * sizeof(samp_type) / 1e6);
+            }
+            continue;
+        }
+        if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE) {
+            throw std::runtime_error(
+                str(boost::format("Receiver error %s") % md.strerror()));
+        }
+
+        if (num_requested_samples != 0) {
+            num_rx_samps = size_t(
+                std::min<uint64_t>(num_rx_samps, num_requested_samples - num_total_samps));
+        }
+
+        // index from the timestamp, so samples lost to an overflow leave a
+        // gap in first_samp rather than shifting everything after them
+        block.num_samps  = num_rx_samps;
+        block.first_samp = md.has_time_spec
+                               ? uint64_t((md.time_spec - uhd::time_spec_t(start_time))
+                                              .to_ticks(block.rate))
+                               : num_total_samps;
+        block.time_secs  = md.time_spec.get_real_secs();
+        num_total_samps += num_rx_samps;
+
+        TRACE_SCOPE("sinks");
+        for (size_t i = 0; i < sinks.size(); i++) {
+            sinks[i]->write(block);
+        }
+        // the burst is over: the request was met, or the source ended the
+        // stream early (a replayed capture ran out)
+        if (md.end_of_burst) {
+            stream_ended = true;
+            break;
+        }
+    }
+
+    // Shut down receiver
+    stream_cmd.stream_mode = uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS;
+    rx_stream->issue_stream_cmd(stream_cmd);
+
+    // A continuous or interrupted stream leaves packets queued behind the
+    // stop; drop them, so the streamer's next user (the capture daemon
+    // reuses it across jobs) does not receive this stream's samples
+    if (not stream_ended) {
+        for (size_t i = 0; i < num_channels; i++) {
+            buffs[i] = reserve[i];
+        }
+        do {
+            rx_stream->recv(buffs, samps_per_buff, md, 0.05);
+        } while (md.error_code == uhd::rx_metadata_t::ERROR_CODE_NONE
+                 or md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW);
+    }
+
+    for (size_t i = 0; i < sinks.size(); i++) {
+        sinks[i]->close();
+    }
+    return num_total_samps;
+}
+
+/***********************************************************************
+ * recv_to_file function
+ * recv_to_sinks with one raw file per channel
+ **********************************************************************/
+template <typename samp_type>
+void recv_to_file(stream_device::sptr device,
+    uhd::rx_streamer::sptr rx_stream,
+    const std::string& file,
+    size_t samps_per_buff,
+    uint64_t num_requested_samples,
+    double start_time)
+{
+    std::vector<rx_sink::sptr> sinks;
+    sinks.push_back(
+        rx_sink::sptr(new file_sink(file, rx_stream->get_num_channels())));
+    recv_to_sinks<samp_type>(
+        device, rx_stream, sinks, samps_per_buff, num_requested_samples, start_time, 0);
+}
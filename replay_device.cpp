@@ -0,0 +1,248 @@
+#include "replay_device.hpp"
+#include "capture_meta.hpp"
+#include "stream_common.hpp"
+#include <boost/format.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+/***********************************************************************
+ * replay_capture
+ **********************************************************************/
+replay_capture::replay_capture(const std::string& file)
+    : _num_samps(std::numeric_limits<uint64_t>::max())
+{
+    capture_metadata metadata(file);
+    if (not metadata.load())
+        throw std::runtime_error("replay: no sidecar for " + file);
+    if (metadata.get<std::string>("layout", "interleaved") != "interleaved")
+        throw std::runtime_error("replay: " + file + " is not interleaved");
+    _rate   = metadata.get<double>("rate", 0);
+    _freq   = metadata.get<double>("freq", 0);
+    _format = parse_sample_format(metadata.get<std::string>(
+        "file_format", metadata.get<std::string>("cpu_format", "sc16")));
+    if (_rate <= 0)
+        throw std::runtime_error("replay: " + file + " has no rate");
+
+    const size_t num_channels = metadata.get<size_t>("num_channels", 1);
+    const size_t samp_size    = sample_format_size(_format);
+    for (size_t c = 0; c < num_channels; c++) {
+        const std::string name = generate_out_filename(file, num_channels, c);
+        const int fd           = open(name.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error(
+                str(boost::format("replay %s: %s") % name % std::strerror(errno)));
+        }
+        struct stat st;
+        fstat(fd, &st);
+        mapping m = {nullptr, size_t(st.st_size)};
+        if (m.bytes != 0) {
+            void* mem = mmap(nullptr, m.bytes, PROT_READ, MAP_SHARED, fd, 0);
+            if (mem == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("replay " + name + ": cannot map");
+            }
+            madvise(mem, m.bytes, MADV_SEQUENTIAL);
+            m.data = static_cast<const char*>(mem);
+        }
+        ::close(fd);
+        _chans.push_back(m);
+        _num_samps = std::min<uint64_t>(_num_samps, m.bytes / samp_size);
+    }
+}
+
+replay_capture::~replay_capture()
+{
+    for (size_t c = 0; c < _chans.size(); c++) {
+        if (_chans[c].bytes != 0)
+            munmap(const_cast<char*>(_chans[c].data), _chans[c].bytes);
+    }
+}
+
+/***********************************************************************
+ * replay_rx_streamer
+ **********************************************************************/
+replay_rx_streamer::replay_rx_streamer(const uhd::stream_args_t& args,
+    const replay_config& config,
+    replay_capture::sptr capture,
+    sim_clock::sptr clock)
+    : _config(config)
+    , _capture(capture)
+    , _clock(clock)
+    , _cpu_format(parse_sample_format(args.cpu_format))
+    , _chans(args.channels.empty() ? std::vector<size_t>(1, 0) : args.channels)
+    , _rate(capture->rate())
+    , _streaming(false)
+    , _continuous(false)
+    , _samps_left(0)
+    , _next_samp(0)
+{
+    if (_cpu_format == sample_format::sc12)
+        throw std::runtime_error("replay: unsupported cpu format " + args.cpu_format);
+    for (size_t i = 0; i < _chans.size(); i++) {
+        if (_chans[i] >= capture->num_channels())
+            throw std::runtime_error(str(boost::format("replay: the capture has %d "
+                                                       "channels, not %d")
+                                         % capture->num_channels() % (_chans[i] + 1)));
+    }
+}
+
+size_t replay_rx_streamer::get_num_channels() const
+{
+    return _chans.size();
+}
+
+size_t replay_rx_streamer::get_max_num_samps() const
+{
+    return _config.max_num_samps;
+}
+
+void replay_rx_streamer::issue_stream_cmd(const uhd::stream_cmd_t& stream_cmd)
+{
+    std::lock_guard<std::mutex> lock(_cmd_mutex);
+    switch (stream_cmd.stream_mode) {
+        case uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS:
+            _streaming = false;
+            return;
+        case uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS:
+            _continuous = true;
+            break;
+        default:
+            _continuous = false;
+            _samps_left = stream_cmd.num_samps;
+            break;
+    }
+    _streaming  = true;
+    _start_time = stream_cmd.stream_now ? _clock->get_time_now() : stream_cmd.time_spec;
+    _next_samp  = 0;
+}
+
+size_t replay_rx_streamer::recv(const buffs_type& buffs,
+    const size_t nsamps_per_buff,
+    uhd::rx_metadata_t& metadata,
+    const double timeout,
+    const bool one_packet)
+{
+    metadata.has_time_spec  = false;
+    metadata.more_fragments = false;
+    metadata.start_of_burst = false;
+    metadata.end_of_burst   = false;
+    metadata.error_code     = uhd::rx_metadata_t::ERROR_CODE_NONE;
+
+    std::unique_lock<std::mutex> lock(_cmd_mutex);
+    if (not _streaming) {
+        lock.unlock();
+        std::this_thread::sleep_for(std::chrono::duration<double>(timeout));
+        metadata.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+        return 0;
+    }
+
+    size_t nsamps = one_packet ? std::min(nsamps_per_buff, _config.max_num_samps)
+                               : nsamps_per_buff;
+    nsamps = size_t(std::min<uint64_t>(nsamps, _capture->num_samps() - _next_samp));
+    if (not _continuous) {
+        nsamps = size_t(std::min<uint64_t>(nsamps, _samps_left));
+    }
+    const uhd::time_spec_t first_time =
+        _start_time + uhd::time_spec_t::from_ticks(_next_samp, _rate);
+
+    if (_config.realtime) {
+        const uhd::time_spec_t now = _clock->get_time_now();
+        if ((now - first_time).get_real_secs() > _config.buffer_secs) {
+            // what a board would have dropped; the files move on regardless
+            _next_samp = std::min<uint64_t>(
+                (now - _start_time).to_ticks(_rate), _capture->num_samps());
+            metadata.has_time_spec = true;
+            metadata.time_spec =
+                _start_time + uhd::time_spec_t::from_ticks(_next_samp, _rate);
+            metadata.error_code = uhd::rx_metadata_t::ERROR_CODE_OVERFLOW;
+            return 0;
+        }
+        const uhd::time_spec_t deadline = now + uhd::time_spec_t(timeout);
+        const uhd::time_spec_t last_time =
+            first_time + uhd::time_spec_t::from_ticks(nsamps, _rate);
+        lock.unlock();
+        if (last_time > deadline) {
+            _clock->sleep_until(deadline);
+            const long long arrived = (deadline - first_time).to_ticks(_rate);
+            nsamps = size_t(std::max(0ll, std::min<long long>(arrived, nsamps)));
+        } else {
+            _clock->sleep_until(last_time);
+        }
+        lock.lock();
+        if (nsamps == 0 and _next_samp < _capture->num_samps()) {
+            metadata.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+            return 0;
+        }
+    }
+
+    const size_t in_size = sample_format_size(_capture->format());
+    for (size_t i = 0; i < _chans.size(); i++) {
+        convert_samples(_capture->samps(_chans[i]) + _next_samp * in_size,
+            _capture->format(), buffs[i], _cpu_format, nsamps);
+    }
+    metadata.has_time_spec  = true;
+    metadata.time_spec      = first_time;
+    metadata.start_of_burst = (_next_samp == 0);
+    _next_samp += nsamps;
+    if (not _continuous) {
+        _samps_left -= nsamps;
+    }
+    if (_next_samp == _capture->num_samps() or (not _continuous and _samps_left == 0)) {
+        _streaming            = false;
+        metadata.end_of_burst = true;
+    }
+    return nsamps;
+}
+
+/***********************************************************************
+ * replay_stream_device
+ **********************************************************************/
+replay_stream_device::replay_stream_device(const replay_config& config)
+    : _config(config), _capture(new replay_capture(config.file)), _clock(new sim_clock)
+{
+}
+
+uhd::rx_streamer::sptr replay_stream_device::get_rx_stream(
+    const uhd::stream_args_t& args)
+{
+    return uhd::rx_streamer::sptr(new replay_rx_streamer(args, _config, _capture, _clock));
+}
+
+uhd::tx_streamer::sptr replay_stream_device::get_tx_stream(
+    const uhd::stream_args_t& args)
+{
+    sim_config sim;
+    sim.rate          = _capture->rate();
+    sim.realtime      = _config.realtime;
+    sim.buffer_secs   = _config.buffer_secs;
+    sim.max_num_samps = _config.max_num_samps;
+    return uhd::tx_streamer::sptr(new sim_tx_streamer(args, sim, _clock));
+}
+
+double replay_stream_device::get_rx_rate(size_t)
+{
+    return _capture->rate();
+}
+
+double replay_stream_device::get_tx_rate(size_t)
+{
+    return _capture->rate();
+}
+
+uhd::time_spec_t replay_stream_device::get_time_now()
+{
+    return _clock->get_time_now();
+}
+
+void replay_stream_device::set_time_now(const uhd::time_spec_t& time_spec)
+{
+    _clock->set_time_now(time_spec);
+}
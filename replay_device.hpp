@@ -0,0 +1,159 @@
+#pragma once
+
+#include "convert.hpp"
+#include "sim_device.hpp"
+#include "stream_device.hpp"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/***********************************************************************
+ * Replay device
+ * Feeds an earlier capture through the streaming paths in place of a
+ * board, so new stages can be run and timed on recorded data. The
+ * capture's sidecar (file + ".json") gives the rate, format, channel
+ * count and centre frequency; the channel files are mapped read-only.
+ *
+ * Stream channel c replays capture channel c. A stream command starts
+ * at sample 0 of the files, and sample n carries the time of the
+ * command plus n / rate, so with the --settling of the original run
+ * the timestamps match the recording. The last block of the files has
+ * end_of_burst set, which ends recv_to_sinks. Samples are converted to
+ * the streamer's cpu_format on the way out (a copy when they match).
+ *
+ * realtime paces recv() to the capture's rate on the wall clock and,
+ * like sim_rx_streamer, reports an overflow and skips ahead when the
+ * host falls more than buffer_secs behind; otherwise blocks are handed
+ * out as fast as they are asked for. TX is a sim_tx_streamer that
+ * consumes the samples.
+ **********************************************************************/
+struct replay_config
+{
+    std::string file; // name the capture was written with
+    bool realtime        = true;
+    double buffer_secs   = 0.1;
+    size_t max_num_samps = 363;
+};
+
+//! The mapped channel files of a capture
+class replay_capture
+{
+public:
+    typedef std::shared_ptr<replay_capture> sptr;
+
+    replay_capture(const std::string& file);
+    ~replay_capture();
+
+    size_t num_channels() const
+    {
+        return _chans.size();
+    }
+    double rate() const
+    {
+        return _rate;
+    }
+    double freq() const
+    {
+        return _freq;
+    }
+    sample_format format() const
+    {
+        return _format;
+    }
+    //! Samples in every channel (the shortest file)
+    uint64_t num_samps() const
+    {
+        return _num_samps;
+    }
+    const char* samps(size_t chan) const
+    {
+        return _chans.at(chan).data;
+    }
+
+private:
+    replay_capture(const replay_capture&);
+    replay_capture& operator=(const replay_capture&);
+
+    struct mapping
+    {
+        const char* data;
+        size_t bytes;
+    };
+
+    double _rate, _freq;
+    sample_format _format;
+    uint64_t _num_samps;
+    std::vector<mapping> _chans;
+};
+
+class replay_rx_streamer : public uhd::rx_streamer
+{
+public:
+    replay_rx_streamer(const uhd::stream_args_t& args,
+        const replay_config& config,
+        replay_capture::sptr capture,
+        sim_clock::sptr clock);
+
+    size_t get_num_channels() const;
+    size_t get_max_num_samps() const;
+    size_t recv(const buffs_type& buffs,
+        const size_t nsamps_per_buff,
+        uhd::rx_metadata_t& metadata,
+        const double timeout  = 0.1,
+        const bool one_packet = false);
+    void issue_stream_cmd(const uhd::stream_cmd_t& stream_cmd);
+
+private:
+    const replay_config _config;
+    replay_capture::sptr _capture;
+    sim_clock::sptr _clock;
+    const sample_format _cpu_format;
+    std::vector<size_t> _chans;
+    const double _rate;
+
+    std::mutex _cmd_mutex;
+    bool _streaming;
+    bool _continuous;
+    uint64_t _samps_left;
+    uhd::time_spec_t _start_time;
+    uint64_t _next_samp;
+};
+
+class replay_stream_device : public stream_device
+{
+public:
+    replay_stream_device(const replay_config& config);
+
+    static sptr make(const replay_config& config)
+    {
+        return sptr(new replay_stream_device(config));
+    }
+
+    replay_capture::sptr get_capture() const
+    {
+        return _capture;
+    }
+
+    uhd::rx_streamer::sptr get_rx_stream(const uhd::stream_args_t& args);
+    uhd::tx_streamer::sptr get_tx_stream(const uhd::stream_args_t& args);
+
+    double get_rx_rate(size_t chan = 0);
+    double get_tx_rate(size_t chan = 0);
+
+    uhd::time_spec_t get_time_now();
+    void set_time_now(const uhd::time_spec_t& time_spec);
+
+    //! The recording is fixed; tuning is accepted and ignored
+    void set_command_time(const uhd::time_spec_t&) {}
+    void clear_command_time() {}
+    void set_rx_freq(const uhd::tune_request_t&, size_t = 0) {}
+    void set_tx_freq(const uhd::tune_request_t&, size_t = 0) {}
+    void set_rx_gain(double, size_t = 0) {}
+    void set_tx_gain(double, size_t = 0) {}
+
+private:
+    const replay_config _config;
+    replay_capture::sptr _capture;
+    sim_clock::sptr _clock;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+class pool_ref;
+
+/***********************************************************************
+ * sample_block
+ * One recv() worth of samples: num_samps samples for each channel,
+ * all in the same cpu format.
+ **********************************************************************/
+struct sample_block
+{
+    void* const* buffs; // one pointer per channel
+    size_t num_channels;
+    size_t first_chan; // global channel number of buffs[0]
+    size_t num_samps;
+    size_t samp_size; // bytes per (complex) sample
+    uint64_t first_samp; // index of buffs[*][0] since the stream started
+    double time_secs; // device time of buffs[*][0]
+    double rate; // samples per second
+    const pool_ref* ref; // pool block behind buffs, null if not pooled; a
+                         // sink copies the ref to keep the samples past write()
+};
+
+/***********************************************************************
+ * rx_sink
+ * Destination for received blocks. recv_to_sinks hands every block to
+ * each sink in turn on the recv thread, so write() must not block for
+ * long. Sinks run in list order and a correcting stage may rewrite the
+ * samples in place for the sinks after it. A sink shared by several
+ * streamers gets write() and close() from each of their threads.
+ **********************************************************************/
+class rx_sink
+{
+public:
+    typedef std::shared_ptr<rx_sink> sptr;
+
+    virtual ~rx_sink() {}
+
+    virtual void write(const sample_block& block) = 0;
+
+    //! Called by each streamer's thread after its last block, so a
+    //  shared sink is closed once per streamer that carries it
+    virtual void close() {}
+};
@@ -0,0 +1,180 @@
+#include "sample_layout.hpp"
+#include "capture_meta.hpp"
+#include "stream_common.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+sample_layout parse_sample_layout(const std::string& name)
+{
+    if (name == "interleaved")
+        return sample_layout::interleaved;
+    if (name == "planar")
+        return sample_layout::planar;
+    if (name == "blocked")
+        return sample_layout::blocked;
+    throw std::runtime_error("Unknown sample layout " + name);
+}
+
+const char* sample_layout_name(sample_layout layout)
+{
+    switch (layout) {
+        case sample_layout::planar:
+            return "planar";
+        case sample_layout::blocked:
+            return "blocked";
+        default:
+            return "interleaved";
+    }
+}
+
+std::string planar_file_name(const std::string& chan_file, char component)
+{
+    boost::filesystem::path path(chan_file);
+    path.replace_extension(boost::filesystem::path(
+        str(boost::format(".%c%s") % component % path.extension().string())));
+    return path.string();
+}
+
+/***********************************************************************
+ * Deinterleave
+ * A stride two load per output array; the compiler turns each loop into
+ * vector loads and shuffles, one instantiation per scalar width.
+ **********************************************************************/
+template <typename scalar_type>
+static void split_iq(const scalar_type* in, scalar_type* i_out, scalar_type* q_out, size_t n)
+{
+    for (size_t k = 0; k < n; k++) {
+        i_out[k] = in[2 * k];
+        q_out[k] = in[2 * k + 1];
+    }
+}
+
+void deinterleave_samples(
+    const void* in, sample_format format, void* i_out, void* q_out, size_t n)
+{
+    switch (format) {
+        case sample_format::sc8:
+            split_iq(static_cast<const int8_t*>(in), static_cast<int8_t*>(i_out),
+                static_cast<int8_t*>(q_out), n);
+            break;
+        case sample_format::sc16:
+            split_iq(static_cast<const int16_t*>(in), static_cast<int16_t*>(i_out),
+                static_cast<int16_t*>(q_out), n);
+            break;
+        case sample_format::fc32:
+            split_iq(static_cast<const float*>(in), static_cast<float*>(i_out),
+                static_cast<float*>(q_out), n);
+            break;
+        case sample_format::fc64:
+            split_iq(static_cast<const double*>(in), static_cast<double*>(i_out),
+                static_cast<double*>(q_out), n);
+            break;
+        default:
+            throw std::runtime_error("sc12 samples cannot be split into I and Q");
+    }
+}
+
+/***********************************************************************
+ * planar_reader
+ **********************************************************************/
+planar_reader::planar_reader(const std::string& file, size_t chan)
+{
+    capture_metadata metadata(file);
+    if (not metadata.load())
+        throw std::runtime_error("planar_reader: no sidecar for " + file);
+    const size_t num_channels = metadata.get<size_t>("num_channels", 1);
+    if (chan >= num_channels)
+        throw std::runtime_error(
+            str(boost::format("planar_reader: %s has %d channels") % file % num_channels));
+    _format = parse_sample_format(metadata.get<std::string>(
+        "file_format", metadata.get<std::string>("cpu_format", "sc16")));
+    _layout = parse_sample_layout(metadata.get<std::string>("layout", "interleaved"));
+    if (_layout == sample_layout::interleaved or _format == sample_format::sc12)
+        throw std::runtime_error(
+            "planar_reader: " + file + " is interleaved, convert it first");
+    _scalar_size = sample_format_size(_format) / 2;
+
+    const std::string chan_file = generate_out_filename(file, num_channels, chan);
+    if (_layout == sample_layout::planar) {
+        _maps.push_back(map_file(planar_file_name(chan_file, 'i')));
+        _maps.push_back(map_file(planar_file_name(chan_file, 'q')));
+        if (_maps[0].bytes != _maps[1].bytes)
+            throw std::runtime_error(
+                "planar_reader: I and Q files of " + chan_file + " differ in length");
+        _num_samps   = _maps[0].bytes / _scalar_size;
+        _block_samps = size_t(_num_samps);
+    } else {
+        _maps.push_back(map_file(chan_file));
+        _num_samps   = _maps[0].bytes / (2 * _scalar_size);
+        _block_samps = metadata.get<size_t>("layout_block_samps", 0);
+        if (_block_samps == 0)
+            throw std::runtime_error("planar_reader: " + file + " has no block size");
+    }
+}
+
+planar_reader::~planar_reader()
+{
+    for (size_t m = 0; m < _maps.size(); m++) {
+        if (_maps[m].bytes != 0)
+            munmap(const_cast<char*>(_maps[m].data), _maps[m].bytes);
+    }
+}
+
+planar_reader::mapping planar_reader::map_file(const std::string& name)
+{
+    const int fd = open(name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(
+            str(boost::format("planar_reader %s: %s") % name % std::strerror(errno)));
+    }
+    struct stat st;
+    fstat(fd, &st);
+    mapping m = {nullptr, size_t(st.st_size)};
+    if (m.bytes != 0) {
+        void* mem = mmap(nullptr, m.bytes, PROT_READ, MAP_SHARED, fd, 0);
+        if (mem == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("planar_reader " + name + ": cannot map");
+        }
+        // consumers mostly stream through the blocks in order
+        madvise(mem, m.bytes, MADV_SEQUENTIAL);
+        m.data = static_cast<const char*>(mem);
+    }
+    ::close(fd);
+    return m;
+}
+
+size_t planar_reader::num_blocks() const
+{
+    if (_num_samps == 0)
+        return 0;
+    return size_t((_num_samps + _block_samps - 1) / _block_samps);
+}
+
+planar_view planar_reader::block(size_t index) const
+{
+    if (index >= num_blocks())
+        throw std::runtime_error("planar_reader: block out of range");
+    planar_view view;
+    if (_layout == sample_layout::planar) {
+        view.i = _maps[0].data;
+        view.q = _maps[1].data;
+        view.num_samps  = size_t(_num_samps);
+        view.first_samp = 0;
+        return view;
+    }
+    view.first_samp = uint64_t(index) * _block_samps;
+    view.num_samps  = size_t(std::min<uint64_t>(_block_samps, _num_samps - view.first_samp));
+    const char* base = _maps[0].data + view.first_samp * 2 * _scalar_size;
+    view.i           = base;
+    view.q           = base + view.num_samps * _scalar_size;
+    return view;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "convert.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/***********************************************************************
+ * Sample layouts on disk
+ *  - interleaved: I Q I Q ..., as the samples arrive.
+ *  - planar: the I scalars of a channel file in one file and the Q
+ *    scalars in another, named by planar_file_name.
+ *  - blocked: blocks of block_samps samples, each stored as I[block]
+ *    then Q[block]. The last block of a file may be short.
+ * The capture sidecar records "layout" and, for blocked,
+ * "layout_block_samps". sc12 packs I and Q together, so it is
+ * interleaved only.
+ **********************************************************************/
+enum class sample_layout { interleaved, planar, blocked };
+
+//! "interleaved", "planar" or "blocked"
+sample_layout parse_sample_layout(const std::string& name);
+const char* sample_layout_name(sample_layout layout);
+
+//! rx.00.dat -> rx.00.i.dat or rx.00.q.dat, component 'i' or 'q'
+std::string planar_file_name(const std::string& chan_file, char component);
+
+//! Split n interleaved samples of format into n I and n Q scalars
+void deinterleave_samples(
+    const void* in, sample_format format, void* i_out, void* q_out, size_t n);
+
+/***********************************************************************
+ * planar_reader
+ * Maps one channel of a planar or blocked capture read-only and hands
+ * out I and Q pointers straight into the mapping, so consumers get
+ * split arrays without a conversion pass. The layout, format and
+ * channel count come from the capture sidecar (file + ".json"); file is
+ * the name the capture was written with, as for the sidecar.
+ *
+ * A planar capture is one block of num_samps(); a blocked capture has
+ * num_blocks() blocks of block_samps(), the last maybe short.
+ **********************************************************************/
+struct planar_view
+{
+    const void* i; // num_samps scalars of format()
+    const void* q;
+    size_t num_samps;
+    uint64_t first_samp; // index of i[0] in the channel
+};
+
+class planar_reader
+{
+public:
+    planar_reader(const std::string& file, size_t chan = 0);
+    ~planar_reader();
+
+    sample_format format() const
+    {
+        return _format;
+    }
+    sample_layout layout() const
+    {
+        return _layout;
+    }
+    uint64_t num_samps() const
+    {
+        return _num_samps;
+    }
+    size_t block_samps() const
+    {
+        return _block_samps;
+    }
+    size_t num_blocks() const;
+
+    planar_view block(size_t index) const;
+
+private:
+    planar_reader(const planar_reader&);
+    planar_reader& operator=(const planar_reader&);
+
+    struct mapping
+    {
+        const char* data;
+        size_t bytes;
+    };
+    mapping map_file(const std::string& name);
+
+    sample_format _format;
+    sample_layout _layout;
+    size_t _scalar_size;
+    uint64_t _num_samps;
+    size_t _block_samps;
+    std::vector<mapping> _maps; // one file, or the I and Q files
+};
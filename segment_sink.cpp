@@ -0,0 +1,331 @@
+#include "segment_sink.hpp"
+#include "stream_common.hpp"
+#include "thread_topology.hpp"
+#include "trace.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+
+static const size_t segment_buff_size = 1 << 20;
+
+//! rx.dat -> rx.000042.dat, before the channel number is added
+static std::string segment_filename(const std::string& file, uint64_t segment)
+{
+    boost::filesystem::path path(file);
+    path.replace_extension(boost::filesystem::path(
+        str(boost::format("%06d%s") % segment % path.extension().string())));
+    return path.string();
+}
+
+static uint64_t segment_length(
+    const segment_config& config, size_t samp_size, double rate)
+{
+    uint64_t len = 0;
+    if (config.max_bytes != 0)
+        len = config.max_bytes / samp_size;
+    if (config.max_secs > 0) {
+        const uint64_t by_time = uint64_t(std::llround(config.max_secs * rate));
+        len                    = len == 0 ? by_time : std::min(len, by_time);
+    }
+    if (len == 0) {
+        throw std::runtime_error("segment_sink: needs a size or duration limit");
+    }
+    return len;
+}
+
+segment_sink::segment_sink(const std::string& file,
+    size_t num_channels,
+    size_t samp_size,
+    double rate,
+    const segment_config& config,
+    capture_metadata::sptr metadata,
+    const std::string& file_format)
+    : _file(file)
+    , _num_channels(num_channels)
+    , _samp_size(samp_size)
+    , _file_format(file_format.empty() ? sample_format_of_size(samp_size)
+                                       : parse_sample_format(file_format))
+    , _file_samp_size(sample_format_size(_file_format))
+    , _rate(rate)
+    , _config(config)
+    , _segment_samps(segment_length(config, _file_samp_size, rate))
+    , _metadata(metadata)
+    , _channels(num_channels)
+    , _num_closed(0)
+    , _late_opens(0)
+    , _finished(false)
+    , _kept_bytes(0)
+    , _num_deleted(0)
+{
+    for (size_t c = 0; c < num_channels; c++) {
+        _channels[c].owned   = false;
+        _channels[c].closed  = false;
+        _channels[c].current = open_segment(c, 0);
+        _channels[c].wanted  = 1;
+    }
+    _metadata->set("segment_samps", _segment_samps);
+    _metadata->set("retain_bytes", config.retain_bytes);
+    _thread = std::thread(&segment_sink::helper, this);
+}
+
+segment_sink::~segment_sink()
+{
+    // channels that never saw a block are closed here
+    for (size_t c = 0; c < _num_channels; c++) {
+        if (not _channels[c].closed)
+            close_channel(c);
+    }
+    if (_thread.joinable())
+        _thread.join();
+}
+
+segment_sink::segment_file_sptr segment_sink::open_segment(
+    size_t chan, uint64_t segment) const
+{
+    segment_file_sptr file(new segment_file);
+    file->chan      = chan;
+    file->segment   = segment;
+    file->name      = generate_out_filename(
+        segment_filename(_file, segment), _num_channels, chan);
+    file->started   = false;
+    file->num_samps = 0;
+    file->buff.resize(segment_buff_size);
+    file->out.rdbuf()->pubsetbuf(&file->buff.front(), segment_buff_size);
+    file->out.open(file->name.c_str(), std::ofstream::binary);
+    if (not file->out.is_open()) {
+        throw std::runtime_error("Unable to open " + file->name);
+    }
+    return file;
+}
+
+/***********************************************************************
+ * recv side
+ **********************************************************************/
+void segment_sink::write(const sample_block& block)
+{
+    for (size_t i = 0; i < block.num_channels; i++) {
+        const size_t c = block.first_chan + i;
+        channel& ch    = _channels.at(c);
+        if (not ch.owned) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            ch.owner = std::this_thread::get_id();
+            ch.owned = true;
+        }
+
+        const char* samps  = static_cast<const char*>(block.buffs[i]);
+        const uint64_t end = block.first_samp + block.num_samps;
+        uint64_t pos       = block.first_samp;
+        while (pos < end) {
+            const uint64_t segment = pos / _segment_samps;
+            if (segment != ch.current->segment) {
+                rotate(c, segment);
+            }
+            segment_file& file   = *ch.current;
+            const uint64_t count = std::min(end, (segment + 1) * _segment_samps) - pos;
+            if (not file.started) {
+                file.started    = true;
+                file.first_samp = pos;
+                file.time_secs = block.time_secs + double(pos - block.first_samp) / _rate;
+            }
+            {
+                TRACE_SCOPE("segment write");
+                const char* out = samps + (pos - block.first_samp) * _samp_size;
+                if (_file_format != sample_format_of_size(_samp_size)) {
+                    ch.converted.resize(count * _file_samp_size);
+                    convert_samples(out, sample_format_of_size(_samp_size),
+                        &ch.converted.front(), _file_format, count);
+                    out = &ch.converted.front();
+                }
+                file.out.write(out, std::streamsize(count * _file_samp_size));
+            }
+            file.num_samps += count;
+            pos += count;
+        }
+    }
+}
+
+void segment_sink::rotate(size_t chan, uint64_t segment)
+{
+    channel& ch = _channels[chan];
+    segment_file_sptr next;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _to_close.push_back(ch.current);
+        if (ch.next and ch.next->segment == segment) {
+            next = ch.next;
+        } else if (ch.next) {
+            _to_discard.push_back(ch.next);
+        }
+        ch.next   = segment_file_sptr();
+        ch.wanted = segment + 1;
+        if (not next)
+            _late_opens++;
+        _cond.notify_one();
+    }
+    // the helper was behind (or samples were lost across a boundary)
+    ch.current = next ? next : open_segment(chan, segment);
+}
+
+void segment_sink::close()
+{
+    for (size_t c = 0; c < _num_channels; c++) {
+        bool mine;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            mine = _channels[c].owned and not _channels[c].closed
+                   and _channels[c].owner == std::this_thread::get_id();
+        }
+        if (mine)
+            close_channel(c);
+    }
+}
+
+void segment_sink::close_channel(size_t chan)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    channel& ch = _channels[chan];
+    ch.closed   = true;
+    _to_close.push_back(ch.current);
+    ch.current = segment_file_sptr();
+    if (ch.next)
+        _to_discard.push_back(ch.next);
+    ch.next = segment_file_sptr();
+    if (++_num_closed == _num_channels)
+        _finished = true;
+    _cond.notify_one();
+}
+
+/***********************************************************************
+ * helper thread
+ **********************************************************************/
+void segment_sink::helper()
+{
+    apply_thread_role("writer");
+    for (;;) {
+        segment_file_sptr to_close, to_discard;
+        size_t open_chan = _num_channels;
+        uint64_t open_segment_index = 0;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            for (;;) {
+                if (not _to_close.empty()) {
+                    to_close = _to_close.front();
+                    _to_close.pop_front();
+                    break;
+                }
+                if (not _to_discard.empty()) {
+                    to_discard = _to_discard.front();
+                    _to_discard.pop_front();
+                    break;
+                }
+                for (size_t c = 0; c < _num_channels and open_chan == _num_channels; c++) {
+                    const channel& ch = _channels[c];
+                    if (not ch.closed and not ch.next) {
+                        open_chan          = c;
+                        open_segment_index = ch.wanted;
+                    }
+                }
+                if (open_chan != _num_channels or _finished)
+                    break;
+                _cond.wait(lock);
+            }
+        }
+
+        if (to_close) {
+            finish_file(to_close);
+        } else if (to_discard) {
+            to_discard->out.close();
+            std::remove(to_discard->name.c_str());
+        } else if (open_chan != _num_channels) {
+            segment_file_sptr file = open_segment(open_chan, open_segment_index);
+            std::lock_guard<std::mutex> lock(_mutex);
+            channel& ch = _channels[open_chan];
+            if (not ch.closed and ch.wanted == open_segment_index and not ch.next) {
+                ch.next = file;
+            } else {
+                _to_discard.push_back(file);
+            }
+        } else {
+            break;
+        }
+    }
+
+    update_manifest();
+    std::cout << boost::format("Segments: %d kept (%.1f MB), %d deleted, %d opened late")
+                     % _kept.size() % (_kept_bytes / 1e6) % _num_deleted % _late_opens
+              << std::endl;
+    record_thread_stats("writer");
+}
+
+void segment_sink::finish_file(const segment_file_sptr& file)
+{
+    file->out.close();
+    const uint64_t bytes = file->num_samps * _file_samp_size;
+
+    std::deque<segment_record>::iterator it = _pending.begin();
+    while (it != _pending.end() and it->segment != file->segment)
+        ++it;
+    if (it == _pending.end()) {
+        segment_record record;
+        record.segment    = file->segment;
+        record.first_samp = file->started ? file->first_samp : file->segment * _segment_samps;
+        record.time_secs  = file->started ? file->time_secs : 0;
+        record.num_samps  = 0;
+        record.bytes      = 0;
+        record.num_files  = 0;
+        record.files.resize(_num_channels);
+        _pending.push_back(record);
+        it = _pending.end() - 1;
+    }
+    if (file->started and file->first_samp < it->first_samp) {
+        it->first_samp = file->first_samp;
+        it->time_secs  = file->time_secs;
+    }
+    it->num_samps = std::max(it->num_samps, file->num_samps);
+    it->bytes += bytes;
+    it->files[file->chan] = file->name;
+    if (++it->num_files < _num_channels)
+        return;
+
+    // every channel of the segment is on disk
+    _kept.push_back(*it);
+    _kept_bytes += it->bytes;
+    _pending.erase(it);
+    while (_config.retain_bytes != 0 and _kept_bytes > _config.retain_bytes
+           and _kept.size() > 1) {
+        const segment_record& oldest = _kept.front();
+        for (size_t c = 0; c < oldest.files.size(); c++)
+            std::remove(oldest.files[c].c_str());
+        _kept_bytes -= oldest.bytes;
+        _num_deleted++;
+        _kept.pop_front();
+    }
+    update_manifest();
+}
+
+void segment_sink::update_manifest()
+{
+    boost::property_tree::ptree list;
+    for (size_t i = 0; i < _kept.size(); i++) {
+        const segment_record& record = _kept[i];
+        boost::property_tree::ptree entry, files;
+        entry.put("segment", record.segment);
+        entry.put("first_samp", record.first_samp);
+        entry.put("time_secs", record.time_secs);
+        entry.put("num_samps", record.num_samps);
+        for (size_t c = 0; c < record.files.size(); c++) {
+            boost::property_tree::ptree name;
+            name.put_value(record.files[c]);
+            files.push_back(std::make_pair("", name));
+        }
+        entry.put_child("files", files);
+        list.push_back(std::make_pair("", entry));
+    }
+    _metadata->put_child("segments", list);
+    _metadata->set("segments_deleted", _num_deleted);
+    _metadata->write();
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "capture_meta.hpp"
+#include "convert.hpp"
+#include "rx_sink.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/***********************************************************************
+ * segment_sink
+ * Rolling capture: like file_sink, but each channel's file is cut into
+ * segments of a fixed number of samples (from a size and/or duration
+ * limit), named rx.000000.00.dat, rx.000001.00.dat, ... Segment k holds
+ * samples [k * len, (k + 1) * len) of every channel, so the channels
+ * of a segment line up even when they arrive on different streamers.
+ *
+ * A helper thread opens each channel's next segment ahead of time,
+ * closes finished ones, deletes the oldest segments once the total
+ * exceeds retain_bytes, and keeps the segment list (first sample, time,
+ * files) in the capture metadata up to date. One sink takes every
+ * channel; each channel must only be written from one thread. Like
+ * file_sink, a file_format converts (or packs) the samples on the way
+ * out, and the size limit then counts the converted bytes.
+ **********************************************************************/
+struct segment_config
+{
+    uint64_t max_bytes    = 0; // per channel file, 0 for no size limit
+    double max_secs       = 0; // 0 for no duration limit
+    uint64_t retain_bytes = 0; // all channels, 0 keeps every segment
+};
+
+class segment_sink : public rx_sink
+{
+public:
+    segment_sink(const std::string& file,
+        size_t num_channels,
+        size_t samp_size,
+        double rate,
+        const segment_config& config,
+        capture_metadata::sptr metadata,
+        const std::string& file_format = "");
+    ~segment_sink();
+
+    void write(const sample_block& block);
+
+    //! Closes the channels written from the calling thread
+    void close();
+
+private:
+    struct segment_file
+    {
+        size_t chan;
+        uint64_t segment;
+        std::string name;
+        std::vector<char> buff;
+        std::ofstream out;
+        bool started;
+        uint64_t first_samp;
+        double time_secs;
+        uint64_t num_samps;
+    };
+    typedef std::shared_ptr<segment_file> segment_file_sptr;
+
+    struct channel
+    {
+        bool owned;
+        std::thread::id owner;
+        bool closed;
+        segment_file_sptr current;
+        segment_file_sptr next; // opened by the helper, under _mutex
+        uint64_t wanted; // segment the helper should open next
+        std::vector<char> converted;
+    };
+
+    struct segment_record
+    {
+        uint64_t segment;
+        uint64_t first_samp;
+        double time_secs;
+        uint64_t num_samps;
+        uint64_t bytes;
+        size_t num_files;
+        std::vector<std::string> files;
+    };
+
+    segment_file_sptr open_segment(size_t chan, uint64_t segment) const;
+    void rotate(size_t chan, uint64_t segment);
+    void close_channel(size_t chan);
+    void helper();
+    void finish_file(const segment_file_sptr& file);
+    void update_manifest();
+
+    const std::string _file;
+    const size_t _num_channels;
+    const size_t _samp_size;
+    const sample_format _file_format;
+    const size_t _file_samp_size; // bytes per sample in the files
+    const double _rate;
+    const segment_config _config;
+    const uint64_t _segment_samps;
+    capture_metadata::sptr _metadata;
+
+    std::vector<channel> _channels;
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::deque<segment_file_sptr> _to_close;
+    std::deque<segment_file_sptr> _to_discard; // opened ahead, never used
+    size_t _num_closed;
+    size_t _late_opens;
+    bool _finished;
+
+    // helper side
+    std::deque<segment_record> _pending; // waiting for all channels
+    std::deque<segment_record> _kept;
+    uint64_t _kept_bytes;
+    uint64_t _num_deleted;
+
+    std::thread _thread;
+};
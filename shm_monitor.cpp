@@ -0,0 +1,114 @@
+//
+// Follows a --shm ring with shm_ring_reader and prints, once a second,
+// the block and sample rate, lost blocks and mean power of each channel.
+// Doubles as the usage example for the reader library.
+//
+
+#include "shm_ring.hpp"
+#include "stream_common.hpp"
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <csignal>
+#include <iostream>
+#include <thread>
+
+namespace po = boost::program_options;
+
+template <typename samp_type>
+static double sum_power(const void* data, size_t nsamps)
+{
+    const samp_type* samps = static_cast<const samp_type*>(data);
+    double acc             = 0.0;
+    for (size_t i = 0; i < nsamps; i++) {
+        acc += double(samps[i].real()) * samps[i].real()
+               + double(samps[i].imag()) * samps[i].imag();
+    }
+    return acc;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string name;
+
+    // clang-format off
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "help message")
+        ("name", po::value<std::string>(&name)->default_value("ettus_rx"), "name of the ring (--shm NAME of the capture tool)")
+        ("oldest", "start at the oldest block in the ring instead of the newest")
+    ;
+    // clang-format on
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+    if (vm.count("help")) {
+        std::cout << boost::format("Shared-memory ring monitor %s") % desc << std::endl;
+        return ~0;
+    }
+
+    shm_ring_reader reader(name, vm.count("oldest") == 0);
+    std::signal(SIGINT, &sig_int_handler);
+    const size_t num_channels = reader.num_channels();
+    std::cout << boost::format("Following %s: %d channels, %d byte samples, %f Msps")
+                     % name % num_channels % reader.samp_size() % (reader.rate() / 1e6)
+              << std::endl;
+
+    std::vector<uint64_t> blocks(num_channels), samps(num_channels), torn(num_channels);
+    std::vector<double> power(num_channels);
+    auto last_report = std::chrono::steady_clock::now();
+    while (not stop_signal_called) {
+        bool got_any = false, all_done = true;
+        for (size_t ch = 0; ch < num_channels; ch++) {
+            shm_block_view view;
+            while (reader.next(ch, view)) {
+                got_any = true;
+                double p = 0.0;
+                switch (reader.samp_size()) {
+                    case 2:
+                        p = sum_power<std::complex<int8_t>>(view.data, view.num_samps);
+                        break;
+                    case 4:
+                        p = sum_power<std::complex<short>>(view.data, view.num_samps);
+                        break;
+                    case 8:
+                        p = sum_power<std::complex<float>>(view.data, view.num_samps);
+                        break;
+                    case 16:
+                        p = sum_power<std::complex<double>>(view.data, view.num_samps);
+                        break;
+                }
+                if (not reader.still_valid(view)) {
+                    torn[ch]++;
+                    continue;
+                }
+                blocks[ch]++;
+                samps[ch] += view.num_samps;
+                power[ch] += p;
+            }
+            all_done = all_done and reader.finished(ch);
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now - last_report >= std::chrono::seconds(1) or all_done) {
+            for (size_t ch = 0; ch < num_channels; ch++) {
+                std::cout << boost::format("ch%d: %d blocks, %.3f Msamps, %d lost, "
+                                           "%d torn, mean power %.2f dB")
+                                 % ch % blocks[ch] % (samps[ch] / 1e6)
+                                 % reader.lost(ch) % torn[ch]
+                                 % (10 * std::log10(power[ch] / std::max<uint64_t>(samps[ch], 1)))
+                          << std::endl;
+                blocks[ch] = samps[ch] = 0;
+                power[ch]              = 0.0;
+            }
+            last_report = now;
+        }
+        if (all_done)
+            break;
+        if (not got_any)
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,159 @@
+#include "shm_ring.hpp"
+#include <boost/format.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+static size_t align64(size_t bytes)
+{
+    return (bytes + 63) / 64 * 64;
+}
+
+size_t shm_ring_bytes(
+    size_t num_channels, size_t samp_size, size_t num_slots, size_t slot_samps)
+{
+    const size_t slot_stride = sizeof(shm_slot_header) + align64(slot_samps * samp_size);
+    return sizeof(shm_ring_info) + num_channels * sizeof(shm_channel_info)
+           + num_channels * num_slots * slot_stride;
+}
+
+shm_ring_reader::shm_ring_reader(const std::string& name, bool live)
+    : _mem(MAP_FAILED), _bytes(0)
+{
+    const int fd = shm_open(("/" + name).c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        throw std::runtime_error(str(
+            boost::format("shm ring %s: %s") % name % std::strerror(errno)));
+    }
+    struct stat st;
+    fstat(fd, &st);
+    _bytes = st.st_size;
+    // read-only for samples, but the header atomics are only ever loaded
+    _mem = mmap(nullptr, _bytes, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (_mem == MAP_FAILED or _bytes < sizeof(shm_ring_info)) {
+        throw std::runtime_error("shm ring " + name + ": cannot map");
+    }
+    _info = static_cast<const shm_ring_info*>(_mem);
+    if (_info->magic != shm_ring_magic or _info->version != shm_ring_version
+        or _bytes
+               < shm_ring_bytes(_info->num_channels,
+                   _info->samp_size,
+                   _info->num_slots,
+                   _info->slot_samps)) {
+        munmap(_mem, _bytes);
+        throw std::runtime_error("shm ring " + name + ": not a sample ring");
+    }
+    _channels = reinterpret_cast<shm_channel_info*>(
+        static_cast<char*>(_mem) + sizeof(shm_ring_info));
+    _slots = reinterpret_cast<char*>(_channels + _info->num_channels);
+
+    for (size_t ch = 0; ch < _info->num_channels; ch++) {
+        const uint64_t written = _channels[ch].write_count.load(std::memory_order_acquire);
+        uint64_t start         = written;
+        if (not live) {
+            start = written > _info->num_slots ? written - _info->num_slots : 0;
+        }
+        _next.push_back(start);
+        _lost.push_back(0);
+    }
+}
+
+shm_ring_reader::~shm_ring_reader()
+{
+    munmap(_mem, _bytes);
+}
+
+size_t shm_ring_reader::num_channels() const
+{
+    return _info->num_channels;
+}
+
+size_t shm_ring_reader::samp_size() const
+{
+    return _info->samp_size;
+}
+
+double shm_ring_reader::rate() const
+{
+    return _info->rate;
+}
+
+bool shm_ring_reader::finished(size_t chan) const
+{
+    return _info->finished.load(std::memory_order_acquire)
+           and _next[chan]
+                   >= _channels[chan].write_count.load(std::memory_order_acquire);
+}
+
+shm_slot_header* shm_ring_reader::slot(size_t chan, uint64_t block) const
+{
+    return reinterpret_cast<shm_slot_header*>(_slots
+                                              + (chan * _info->num_slots
+                                                    + block % _info->num_slots)
+                                                    * _info->slot_stride);
+}
+
+bool shm_ring_reader::next(size_t chan, shm_block_view& view)
+{
+    while (true) {
+        const uint64_t written = _channels[chan].write_count.load(std::memory_order_acquire);
+        uint64_t& n            = _next[chan];
+        if (n >= written) {
+            return false;
+        }
+        if (written - n >= _info->num_slots) {
+            // lapped: everything up to the newest block is gone or going
+            _lost[chan] += written - 1 - n;
+            n = written - 1;
+        }
+        shm_slot_header* hdr = slot(chan, n);
+        const uint64_t seq   = hdr->seq.load(std::memory_order_acquire);
+        if (seq != 2 * n + 2) {
+            // overwritten between the two loads
+            _lost[chan]++;
+            n++;
+            continue;
+        }
+        view.data       = reinterpret_cast<const char*>(hdr) + sizeof(shm_slot_header);
+        view.num_samps  = hdr->num_samps;
+        view.first_samp = hdr->first_samp;
+        view.time_secs  = hdr->time_secs;
+        view.block      = n;
+        view.seq        = &hdr->seq;
+        view.expect     = seq;
+        n++;
+        return true;
+    }
+}
+
+bool shm_ring_reader::wait_next(size_t chan, shm_block_view& view, double timeout)
+{
+    const auto deadline = std::chrono::steady_clock::now()
+                          + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                              std::chrono::duration<double>(timeout));
+    while (not next(chan, view)) {
+        if (finished(chan) or std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    return true;
+}
+
+bool shm_ring_reader::still_valid(const shm_block_view& view) const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return view.seq->load(std::memory_order_relaxed) == view.expect;
+}
+
+uint64_t shm_ring_reader::lost(size_t chan) const
+{
+    return _lost[chan];
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/***********************************************************************
+ * Shared-memory sample ring (shm_sink writes, shm_ring_reader follows)
+ *
+ * One POSIX shm object holds an independent ring per channel, so each
+ * channel has exactly one writer even when the channels are split across
+ * several RX streamers. Layout, every part 64 byte aligned:
+ *
+ *   shm_ring_info
+ *   shm_channel_info[num_channels]          blocks written per channel
+ *   for each channel, for each of num_slots:
+ *       shm_slot_header, then slot_samps samples
+ *
+ * Slots are seqlocked: while block n is written its slot's seq is 2n+1,
+ * afterwards 2n+2. Readers never take a lock; they check seq before and
+ * after using a slot and discard it if the writer lapped them.
+ **********************************************************************/
+static const uint32_t shm_ring_magic   = 0x53525445; // "ETRS"
+static const uint32_t shm_ring_version = 1;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shm ring needs lock-free 64 bit atomics");
+
+struct shm_ring_info
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_channels;
+    uint32_t samp_size; // bytes per complex sample
+    uint64_t num_slots;
+    uint64_t slot_samps; // capacity of one slot, per channel
+    uint64_t slot_stride; // bytes from one slot header to the next
+    double rate;
+    std::atomic<uint32_t> finished; // set once the writer has stopped
+    char pad[12];
+};
+static_assert(sizeof(shm_ring_info) == 64, "shm_ring_info layout");
+
+struct shm_channel_info
+{
+    std::atomic<uint64_t> write_count;
+    char pad[56];
+};
+
+struct shm_slot_header
+{
+    std::atomic<uint64_t> seq;
+    uint64_t first_samp;
+    double time_secs;
+    uint64_t num_samps;
+    char pad[32];
+};
+static_assert(sizeof(shm_slot_header) == 64, "shm_slot_header layout");
+
+//! Total size of a ring with the given geometry
+size_t shm_ring_bytes(
+    size_t num_channels, size_t samp_size, size_t num_slots, size_t slot_samps);
+
+/***********************************************************************
+ * shm_ring_reader
+ * Follows a ring by name. The returned views point straight into the
+ * shared memory; check still_valid() once done with the samples.
+ **********************************************************************/
+struct shm_block_view
+{
+    const void* data; // num_samps samples of one channel
+    uint64_t num_samps;
+    uint64_t first_samp;
+    double time_secs;
+    uint64_t block; // per-channel block number
+    const std::atomic<uint64_t>* seq; // for still_valid
+    uint64_t expect;
+};
+
+class shm_ring_reader
+{
+public:
+    //! Attach to the ring created by shm_sink(name). A live reader starts
+    //  at the newest block, otherwise at the oldest one still in the ring.
+    shm_ring_reader(const std::string& name, bool live = true);
+    ~shm_ring_reader();
+
+    shm_ring_reader(const shm_ring_reader&) = delete;
+    shm_ring_reader& operator=(const shm_ring_reader&) = delete;
+
+    size_t num_channels() const;
+    size_t samp_size() const;
+    double rate() const;
+
+    //! True once the writer has stopped and everything has been read
+    bool finished(size_t chan) const;
+
+    //! Next block of chan, false if the writer has not produced it yet.
+    //  A reader more than a ring behind skips to the newest block.
+    bool next(size_t chan, shm_block_view& view);
+
+    //! Like next(), polling until a block arrives or timeout expires
+    bool wait_next(size_t chan, shm_block_view& view, double timeout);
+
+    //! False if the writer reused the slot while the view was in use
+    bool still_valid(const shm_block_view& view) const;
+
+    //! Blocks of chan this reader missed because it fell behind
+    uint64_t lost(size_t chan) const;
+
+private:
+    shm_slot_header* slot(size_t chan, uint64_t block) const;
+
+    void* _mem;
+    size_t _bytes;
+    const shm_ring_info* _info;
+    shm_channel_info* _channels;
+    char* _slots;
+    std::vector<uint64_t> _next;
+    std::vector<uint64_t> _lost;
+};
@@ -0,0 +1,114 @@
+#include "shm_sink.hpp"
+#include <boost/format.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+shm_sink::shm_sink(const std::string& name,
+    size_t num_channels,
+    size_t samp_size,
+    double rate,
+    size_t slot_samps,
+    size_t num_slots)
+    : _name("/" + name)
+    , _mem(MAP_FAILED)
+    , _bytes(shm_ring_bytes(num_channels, samp_size, num_slots, slot_samps))
+{
+    // replace whatever a previous run left behind
+    shm_unlink(_name.c_str());
+    const int fd = shm_open(_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 or ftruncate(fd, _bytes) < 0) {
+        throw std::runtime_error(str(
+            boost::format("shm_sink %s: %s") % name % std::strerror(errno)));
+    }
+    _mem = mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (_mem == MAP_FAILED) {
+        shm_unlink(_name.c_str());
+        throw std::runtime_error(str(
+            boost::format("shm_sink %s: mmap: %s") % name % std::strerror(errno)));
+    }
+
+    // ftruncate zero-filled the ring: every seq and write_count starts at 0
+    _info               = static_cast<shm_ring_info*>(_mem);
+    _info->num_channels = num_channels;
+    _info->samp_size    = samp_size;
+    _info->num_slots    = num_slots;
+    _info->slot_samps   = slot_samps;
+    _info->slot_stride =
+        sizeof(shm_slot_header) + (slot_samps * samp_size + 63) / 64 * 64;
+    _info->rate = rate;
+    _channels   = reinterpret_cast<shm_channel_info*>(
+        static_cast<char*>(_mem) + sizeof(shm_ring_info));
+    _slots = reinterpret_cast<char*>(_channels + num_channels);
+    _info->version = shm_ring_version;
+    std::atomic_thread_fence(std::memory_order_release);
+    // readers check the magic last
+    _info->magic = shm_ring_magic;
+}
+
+shm_sink::~shm_sink()
+{
+    _info->finished.store(1, std::memory_order_release);
+    shm_unlink(_name.c_str());
+    munmap(_mem, _bytes);
+}
+
+shm_slot_header* shm_sink::slot(size_t chan, uint64_t block) const
+{
+    return reinterpret_cast<shm_slot_header*>(_slots
+                                              + (chan * _info->num_slots
+                                                    + block % _info->num_slots)
+                                                    * _info->slot_stride);
+}
+
+void shm_sink::write(const sample_block& block)
+{
+    for (size_t i = 0; i < block.num_channels; i++) {
+        const size_t chan           = block.first_chan + i;
+        std::atomic<uint64_t>& count = _channels[chan].write_count;
+        const char* in               = static_cast<const char*>(block.buffs[i]);
+
+        for (size_t offset = 0; offset < block.num_samps;) {
+            const size_t nsamps =
+                std::min<size_t>(_info->slot_samps, block.num_samps - offset);
+            const uint64_t n     = count.load(std::memory_order_relaxed);
+            shm_slot_header* hdr = slot(chan, n);
+
+            hdr->seq.store(2 * n + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            hdr->first_samp = block.first_samp + offset;
+            hdr->time_secs  = block.time_secs + offset / block.rate;
+            hdr->num_samps  = nsamps;
+            std::memcpy(reinterpret_cast<char*>(hdr) + sizeof(shm_slot_header),
+                in + offset * block.samp_size,
+                nsamps * block.samp_size);
+            hdr->seq.store(2 * n + 2, std::memory_order_release);
+            count.store(n + 1, std::memory_order_release);
+            offset += nsamps;
+        }
+    }
+}
+
+shm_sink* make_shm_sink(const std::string& spec,
+    size_t num_channels,
+    size_t samp_size,
+    double rate,
+    size_t slot_samps)
+{
+    const size_t colon = spec.find(':');
+    if (colon == std::string::npos) {
+        return new shm_sink(spec, num_channels, samp_size, rate, slot_samps);
+    }
+    return new shm_sink(spec.substr(0, colon),
+        num_channels,
+        samp_size,
+        rate,
+        slot_samps,
+        std::stoul(spec.substr(colon + 1)));
+}
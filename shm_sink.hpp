@@ -0,0 +1,49 @@
+#pragma once
+
+#include "rx_sink.hpp"
+#include "shm_ring.hpp"
+#include <string>
+
+/***********************************************************************
+ * shm_sink
+ * Publishes received blocks in a named shared-memory ring (shm_ring.hpp)
+ * for readers on the same host. The recv thread copies each block into
+ * the ring once; readers use it in place. The writer never waits for
+ * readers, a reader that falls a whole ring behind loses blocks.
+ *
+ * A sink shared by several streamers is safe because every channel has
+ * its own ring and belongs to one streamer. The ring is marked finished
+ * and its name removed in the destructor; mapped readers keep working.
+ **********************************************************************/
+class shm_sink : public rx_sink
+{
+public:
+    //! name is the shm object without the leading '/'; slot_samps must be
+    //  at least the samples per recv() or blocks are split across slots
+    shm_sink(const std::string& name,
+        size_t num_channels,
+        size_t samp_size,
+        double rate,
+        size_t slot_samps,
+        size_t num_slots = 256);
+    ~shm_sink();
+
+    void write(const sample_block& block);
+
+private:
+    shm_slot_header* slot(size_t chan, uint64_t block) const;
+
+    std::string _name;
+    void* _mem;
+    size_t _bytes;
+    shm_ring_info* _info;
+    shm_channel_info* _channels;
+    char* _slots;
+};
+
+//! Parse "NAME[:SLOTS]" for the --shm options
+shm_sink* make_shm_sink(const std::string& spec,
+    size_t num_channels,
+    size_t samp_size,
+    double rate,
+    size_t slot_samps);
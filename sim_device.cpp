@@ -0,0 +1,370 @@
+#include "sim_device.hpp"
+#include "convert.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+/***********************************************************************
+ * sim_clock
+ **********************************************************************/
+sim_clock::sim_clock() : _epoch(std::chrono::steady_clock::now()), _offset(0.0) {}
+
+uhd::time_spec_t sim_clock::get_time_now() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - _epoch;
+    return uhd::time_spec_t(_offset + elapsed.count());
+}
+
+void sim_clock::set_time_now(const uhd::time_spec_t& time_spec)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _epoch  = std::chrono::steady_clock::now();
+    _offset = time_spec.get_real_secs();
+}
+
+void sim_clock::sleep_until(const uhd::time_spec_t& time_spec) const
+{
+    const double secs = (time_spec - get_time_now()).get_real_secs();
+    if (secs > 0) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(secs));
+    }
+}
+
+/***********************************************************************
+ * sim_rx_streamer
+ **********************************************************************/
+sim_rx_streamer::sim_rx_streamer(
+    const uhd::stream_args_t& args, const sim_config& config, sim_clock::sptr clock)
+    : _config(config)
+    , _cpu_format(args.cpu_format)
+    , _chans(args.channels.empty() ? std::vector<size_t>(1, 0) : args.channels)
+    , _clock(clock)
+    , _wave_table("SINE", config.ampl)
+    , _step(std::lround(config.tone_freq / config.rate * wave_table_len))
+    , _streaming(false)
+    , _continuous(false)
+    , _samps_left(0)
+    , _next_samp(0)
+{
+    if (_cpu_format != "sc8" and _cpu_format != "sc16" and _cpu_format != "fc32"
+        and _cpu_format != "fc64") {
+        throw std::runtime_error("sim: unsupported cpu format " + _cpu_format);
+    }
+}
+
+size_t sim_rx_streamer::get_num_channels() const
+{
+    return _chans.size();
+}
+
+size_t sim_rx_streamer::get_max_num_samps() const
+{
+    return _config.max_num_samps;
+}
+
+void sim_rx_streamer::issue_stream_cmd(const uhd::stream_cmd_t& stream_cmd)
+{
+    std::lock_guard<std::mutex> lock(_cmd_mutex);
+    switch (stream_cmd.stream_mode) {
+        case uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS:
+            _streaming = false;
+            return;
+        case uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS:
+            _continuous = true;
+            break;
+        default:
+            _continuous = false;
+            _samps_left = stream_cmd.num_samps;
+            break;
+    }
+    _streaming  = true;
+    _start_time = stream_cmd.stream_now ? _clock->get_time_now() : stream_cmd.time_spec;
+    _next_samp  = 0;
+}
+
+size_t sim_rx_streamer::recv(const buffs_type& buffs,
+    const size_t nsamps_per_buff,
+    uhd::rx_metadata_t& metadata,
+    const double timeout,
+    const bool one_packet)
+{
+    metadata.has_time_spec  = false;
+    metadata.more_fragments = false;
+    metadata.start_of_burst = false;
+    metadata.end_of_burst   = false;
+    metadata.error_code     = uhd::rx_metadata_t::ERROR_CODE_NONE;
+
+    std::unique_lock<std::mutex> lock(_cmd_mutex);
+    if (not _streaming) {
+        lock.unlock();
+        std::this_thread::sleep_for(std::chrono::duration<double>(timeout));
+        metadata.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+        return 0;
+    }
+
+    size_t nsamps = one_packet ? std::min(nsamps_per_buff, _config.max_num_samps)
+                               : nsamps_per_buff;
+    if (not _continuous) {
+        nsamps = size_t(std::min<uint64_t>(nsamps, _samps_left));
+    }
+    const uhd::time_spec_t first_time =
+        _start_time + uhd::time_spec_t::from_ticks(_next_samp, _config.rate);
+
+    if (_config.realtime) {
+        const uhd::time_spec_t now = _clock->get_time_now();
+        if ((now - first_time).get_real_secs() > _config.buffer_secs) {
+            // the board dropped everything the host did not collect in time
+            _next_samp = (now - _start_time).to_ticks(_config.rate);
+            metadata.has_time_spec = true;
+            metadata.time_spec =
+                _start_time + uhd::time_spec_t::from_ticks(_next_samp, _config.rate);
+            metadata.error_code = uhd::rx_metadata_t::ERROR_CODE_OVERFLOW;
+            return 0;
+        }
+        const uhd::time_spec_t deadline = now + uhd::time_spec_t(timeout);
+        const uhd::time_spec_t last_time =
+            first_time + uhd::time_spec_t::from_ticks(nsamps, _config.rate);
+        lock.unlock();
+        if (last_time > deadline) {
+            // hand back whatever arrives before the timeout
+            _clock->sleep_until(deadline);
+            const long long arrived = (deadline - first_time).to_ticks(_config.rate);
+            nsamps = size_t(std::max(0ll, std::min<long long>(arrived, nsamps)));
+        } else {
+            _clock->sleep_until(last_time);
+        }
+        lock.lock();
+        if (nsamps == 0) {
+            metadata.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+            return 0;
+        }
+    }
+
+    generate(buffs, 0, nsamps);
+    metadata.has_time_spec = true;
+    metadata.time_spec     = first_time;
+    metadata.start_of_burst = (_next_samp == 0);
+    _next_samp += nsamps;
+    if (not _continuous) {
+        _samps_left -= nsamps;
+        if (_samps_left == 0) {
+            _streaming            = false;
+            metadata.end_of_burst = true;
+        }
+    }
+    return nsamps;
+}
+
+//! Common noise: a hash of the sample index, so a delayed channel sees
+//! exactly the same sequence later
+static inline std::complex<float> sim_noise(uint64_t n)
+{
+    uint64_t z = n * 0x9e3779b97f4a7c15ULL;
+    z          = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z          = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    const float scale = 1.0f / 2147483648.0f;
+    return std::complex<float>(
+        int32_t(uint32_t(z)) * scale, int32_t(uint32_t(z >> 32)) * scale);
+}
+
+void sim_rx_streamer::generate(const buffs_type& buffs, size_t offset, size_t nsamps)
+{
+    if (_scratch.size() < nsamps) {
+        _scratch.resize(nsamps);
+    }
+    for (size_t ch = 0; ch < _chans.size(); ch++) {
+        // each device channel sits an eighth of a turn behind the previous
+        // one, whichever streamer carries it
+        const size_t chan  = _chans[ch];
+        const size_t index = size_t(_next_samp) * _step + chan * wave_table_len / 8;
+        std::complex<float>* samps =
+            _cpu_format == "fc32"
+                ? static_cast<std::complex<float>*>(buffs[ch]) + offset
+                : &_scratch.front();
+        _wave_table.fill(samps, nsamps, index, _step);
+        if (_config.noise_ampl > 0) {
+            const uint64_t first = _next_samp - chan * _config.chan_delay;
+            for (size_t i = 0; i < nsamps; i++) {
+                samps[i] += _config.noise_ampl * sim_noise(first + i);
+            }
+        }
+        if (_config.iq_gain != 1.0f or _config.iq_phase_deg != 0.0f
+            or _config.dc_offset != std::complex<float>(0.0f)) {
+            const float phase = _config.iq_phase_deg * float(M_PI / 180.0);
+            const float g_cos = _config.iq_gain * std::cos(phase);
+            const float g_sin = _config.iq_gain * std::sin(phase);
+            for (size_t i = 0; i < nsamps; i++) {
+                const float re = samps[i].real(), im = samps[i].imag();
+                samps[i] = std::complex<float>(re, g_cos * im + g_sin * re)
+                           + _config.dc_offset;
+            }
+        }
+        if (_cpu_format == "sc16") {
+            convert_fc32_to_sc16(
+                samps, static_cast<std::complex<short>*>(buffs[ch]) + offset, nsamps);
+        } else if (_cpu_format == "sc8") {
+            convert_fc32_to_sc8(
+                samps, static_cast<std::complex<int8_t>*>(buffs[ch]) + offset, nsamps);
+        } else if (_cpu_format == "fc64") {
+            convert_fc32_to_fc64(
+                samps, static_cast<std::complex<double>*>(buffs[ch]) + offset, nsamps);
+        }
+    }
+}
+
+/***********************************************************************
+ * sim_tx_streamer
+ **********************************************************************/
+sim_tx_streamer::sim_tx_streamer(
+    const uhd::stream_args_t& args, const sim_config& config, sim_clock::sptr clock)
+    : _config(config)
+    , _num_channels(args.channels.empty() ? 1 : args.channels.size())
+    , _clock(clock)
+    , _in_burst(false)
+{
+}
+
+size_t sim_tx_streamer::get_num_channels() const
+{
+    return _num_channels;
+}
+
+size_t sim_tx_streamer::get_max_num_samps() const
+{
+    return _config.max_num_samps;
+}
+
+size_t sim_tx_streamer::send(const buffs_type&,
+    const size_t nsamps_per_buff,
+    const uhd::tx_metadata_t& metadata,
+    const double timeout)
+{
+    const uhd::time_spec_t now = _clock->get_time_now();
+    uhd::time_spec_t next_time = _next_time;
+    if (metadata.has_time_spec) {
+        if (metadata.time_spec < now) {
+            // late packets are dropped by the board
+            post(uhd::async_metadata_t::EVENT_CODE_TIME_ERROR, now);
+            _in_burst = not metadata.end_of_burst;
+            return nsamps_per_buff;
+        }
+        next_time = metadata.time_spec;
+    } else if (not _in_burst) {
+        next_time = now;
+    } else if (_config.realtime and now > next_time) {
+        post(uhd::async_metadata_t::EVENT_CODE_UNDERFLOW, now);
+        next_time = now;
+    }
+    next_time += uhd::time_spec_t::from_ticks(nsamps_per_buff, _config.rate);
+
+    if (_config.realtime) {
+        // the board buffers buffer_secs of samples ahead of the DAC
+        const uhd::time_spec_t ready = next_time - uhd::time_spec_t(_config.buffer_secs);
+        if ((ready - now).get_real_secs() > timeout) {
+            _clock->sleep_until(now + uhd::time_spec_t(timeout));
+            return 0;
+        }
+        _clock->sleep_until(ready);
+    }
+
+    _next_time = next_time;
+    _in_burst  = true;
+    if (metadata.end_of_burst) {
+        post(uhd::async_metadata_t::EVENT_CODE_BURST_ACK, _next_time);
+        _in_burst = false;
+    }
+    return nsamps_per_buff;
+}
+
+void sim_tx_streamer::post(
+    uhd::async_metadata_t::event_code_t event_code, const uhd::time_spec_t& time_spec)
+{
+    uhd::async_metadata_t msg;
+    msg.channel       = 0;
+    msg.has_time_spec = true;
+    msg.time_spec     = time_spec;
+    msg.event_code    = event_code;
+    {
+        std::lock_guard<std::mutex> lock(_async_mutex);
+        _async_msgs.push_back(msg);
+    }
+    _async_cond.notify_one();
+}
+
+bool sim_tx_streamer::recv_async_msg(
+    uhd::async_metadata_t& async_metadata, double timeout)
+{
+    const std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now()
+        + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(timeout));
+    std::unique_lock<std::mutex> lock(_async_mutex);
+    while (true) {
+        if (not _async_msgs.empty()) {
+            // a message is only reported once the device time reaches it
+            const double wait =
+                _config.realtime
+                    ? (_async_msgs.front().time_spec - _clock->get_time_now())
+                          .get_real_secs()
+                    : 0.0;
+            if (wait <= 0) {
+                async_metadata = _async_msgs.front();
+                _async_msgs.pop_front();
+                return true;
+            }
+            const std::chrono::steady_clock::time_point due =
+                std::chrono::steady_clock::now()
+                + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(wait));
+            if (_async_cond.wait_until(lock, std::min(due, deadline))
+                    == std::cv_status::timeout
+                and std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+        } else if (_async_cond.wait_until(lock, deadline) == std::cv_status::timeout) {
+            return false;
+        }
+    }
+}
+
+/***********************************************************************
+ * sim_stream_device
+ **********************************************************************/
+sim_stream_device::sim_stream_device(const sim_config& config)
+    : _config(config), _clock(new sim_clock)
+{
+}
+
+uhd::rx_streamer::sptr sim_stream_device::get_rx_stream(const uhd::stream_args_t& args)
+{
+    return uhd::rx_streamer::sptr(new sim_rx_streamer(args, _config, _clock));
+}
+
+uhd::tx_streamer::sptr sim_stream_device::get_tx_stream(const uhd::stream_args_t& args)
+{
+    return uhd::tx_streamer::sptr(new sim_tx_streamer(args, _config, _clock));
+}
+
+double sim_stream_device::get_rx_rate(size_t)
+{
+    return _config.rate;
+}
+
+double sim_stream_device::get_tx_rate(size_t)
+{
+    return _config.rate;
+}
+
+uhd::time_spec_t sim_stream_device::get_time_now()
+{
+    return _clock->get_time_now();
+}
+
+void sim_stream_device::set_time_now(const uhd::time_spec_t& time_spec)
+{
+    _clock->set_time_now(time_spec);
+}
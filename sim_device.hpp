@@ -0,0 +1,155 @@
+#pragma once
+
+#include "stream_device.hpp"
+#include "wavetable.hpp"
+#include <chrono>
+#include <complex>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+/***********************************************************************
+ * Simulated device
+ * Lets the streaming paths run without hardware. RX produces a complex
+ * tone (each channel with its own phase), optionally plus broadband noise
+ * common to all channels with channel k delayed by k * chan_delay
+ * samples, and front end DC offset and IQ imbalance (Q scaled by
+ * iq_gain and leaking I at iq_phase_deg). TX consumes samples, both
+ * either paced by the wall clock like a real board (realtime) or as fast
+ * as the host can go. A realtime RX streamer that falls more than
+ * buffer_secs behind reports an overflow and drops the backlog, the
+ * way a board does when the host stops reading.
+ **********************************************************************/
+struct sim_config
+{
+    size_t num_channels  = 1;
+    double rate          = 1e6;
+    double tone_freq     = 100e3;
+    float ampl           = 0.3f;
+    bool realtime        = true;
+    double buffer_secs   = 0.1;
+    size_t max_num_samps = 363; // sc16 payload of a 1500 byte N210 packet
+    float noise_ampl     = 0.0f;
+    size_t chan_delay    = 0;
+    std::complex<float> dc_offset = 0.0f;
+    float iq_gain                 = 1.0f;
+    float iq_phase_deg            = 0.0f;
+};
+
+//! Device time shared by all streamers of one sim_stream_device
+class sim_clock
+{
+public:
+    typedef std::shared_ptr<sim_clock> sptr;
+
+    sim_clock();
+
+    uhd::time_spec_t get_time_now() const;
+    void set_time_now(const uhd::time_spec_t& time_spec);
+
+    //! Sleep until the device time reaches time_spec
+    void sleep_until(const uhd::time_spec_t& time_spec) const;
+
+private:
+    mutable std::mutex _mutex;
+    std::chrono::steady_clock::time_point _epoch;
+    double _offset;
+};
+
+class sim_rx_streamer : public uhd::rx_streamer
+{
+public:
+    sim_rx_streamer(const uhd::stream_args_t& args,
+        const sim_config& config,
+        sim_clock::sptr clock);
+
+    size_t get_num_channels() const;
+    size_t get_max_num_samps() const;
+    size_t recv(const buffs_type& buffs,
+        const size_t nsamps_per_buff,
+        uhd::rx_metadata_t& metadata,
+        const double timeout   = 0.1,
+        const bool one_packet = false);
+    void issue_stream_cmd(const uhd::stream_cmd_t& stream_cmd);
+
+private:
+    void generate(const buffs_type& buffs, size_t offset, size_t nsamps);
+
+    const sim_config _config;
+    const std::string _cpu_format;
+    const std::vector<size_t> _chans; // device channel of each stream channel
+    sim_clock::sptr _clock;
+    const wave_table_class _wave_table;
+    const size_t _step;
+    std::vector<std::complex<float>> _scratch;
+
+    std::mutex _cmd_mutex;
+    bool _streaming;
+    bool _continuous;
+    uint64_t _samps_left;
+    uhd::time_spec_t _start_time;
+    uint64_t _next_samp;
+};
+
+class sim_tx_streamer : public uhd::tx_streamer
+{
+public:
+    sim_tx_streamer(const uhd::stream_args_t& args,
+        const sim_config& config,
+        sim_clock::sptr clock);
+
+    size_t get_num_channels() const;
+    size_t get_max_num_samps() const;
+    size_t send(const buffs_type& buffs,
+        const size_t nsamps_per_buff,
+        const uhd::tx_metadata_t& metadata,
+        const double timeout = 0.1);
+    bool recv_async_msg(uhd::async_metadata_t& async_metadata, double timeout = 0.1);
+
+private:
+    void post(uhd::async_metadata_t::event_code_t event_code,
+        const uhd::time_spec_t& time_spec);
+
+    const sim_config _config;
+    const size_t _num_channels;
+    sim_clock::sptr _clock;
+    bool _in_burst;
+    uhd::time_spec_t _next_time;
+
+    std::mutex _async_mutex;
+    std::condition_variable _async_cond;
+    std::deque<uhd::async_metadata_t> _async_msgs;
+};
+
+class sim_stream_device : public stream_device
+{
+public:
+    sim_stream_device(const sim_config& config);
+
+    static sptr make(const sim_config& config)
+    {
+        return sptr(new sim_stream_device(config));
+    }
+
+    uhd::rx_streamer::sptr get_rx_stream(const uhd::stream_args_t& args);
+    uhd::tx_streamer::sptr get_tx_stream(const uhd::stream_args_t& args);
+
+    double get_rx_rate(size_t chan = 0);
+    double get_tx_rate(size_t chan = 0);
+
+    uhd::time_spec_t get_time_now();
+    void set_time_now(const uhd::time_spec_t& time_spec);
+
+    //! Tuning is accepted and ignored, the tone stays where it is
+    void set_command_time(const uhd::time_spec_t&) {}
+    void clear_command_time() {}
+    void set_rx_freq(const uhd::tune_request_t&, size_t = 0) {}
+    void set_tx_freq(const uhd::tune_request_t&, size_t = 0) {}
+    void set_rx_gain(double, size_t = 0) {}
+    void set_tx_gain(double, size_t = 0) {}
+
+private:
+    const sim_config _config;
+    sim_clock::sptr _clock;
+};
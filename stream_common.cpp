@@ -0,0 +1,30 @@
+#include "stream_common.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+
+/***********************************************************************
+ * Signal handlers
+ **********************************************************************/
+std::atomic<bool> stop_signal_called(false);
+
+void sig_int_handler(int)
+{
+    stop_signal_called = true;
+}
+
+/***********************************************************************
+ * Utilities
+ **********************************************************************/
+std::string generate_out_filename(
+    const std::string& base_fn, size_t n_names, size_t this_name)
+{
+    if (n_names == 1) {
+        return base_fn;
+    }
+
+    boost::filesystem::path base_fn_fp(base_fn);
+    base_fn_fp.replace_extension(boost::filesystem::path(
+        str(boost::format("%02d%s") % this_name % base_fn_fp.extension().string())));
+    return base_fn_fp.string();
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+/***********************************************************************
+ * Signal handlers
+ **********************************************************************/
+//! Set by sig_int_handler, polled by every streaming loop
+extern std::atomic<bool> stop_signal_called;
+
+void sig_int_handler(int);
+
+/***********************************************************************
+ * Utilities
+ **********************************************************************/
+//! Change to filename, e.g. from usrp_samples.dat to usrp_samples.00.dat,
+//  but only if multiple names are to be generated.
+std::string generate_out_filename(
+    const std::string& base_fn, size_t n_names, size_t this_name);
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <uhd/stream.hpp>
+#include <uhd/types/time_spec.hpp>
+#include <uhd/types/tune_request.hpp>
+#include <uhd/usrp/multi_usrp.hpp>
+#include <memory>
+
+/***********************************************************************
+ * stream_device
+ * The part of a device the streaming functions need: streamers, rates,
+ * the device clock and (timed) retuning. usrp_stream_device forwards to a multi_usrp;
+ * sim_stream_device (sim_device.hpp) stands in for hardware.
+ **********************************************************************/
+class stream_device
+{
+public:
+    typedef std::shared_ptr<stream_device> sptr;
+
+    virtual ~stream_device() {}
+
+    virtual uhd::rx_streamer::sptr get_rx_stream(const uhd::stream_args_t& args) = 0;
+    virtual uhd::tx_streamer::sptr get_tx_stream(const uhd::stream_args_t& args) = 0;
+
+    virtual double get_rx_rate(size_t chan = 0) = 0;
+    virtual double get_tx_rate(size_t chan = 0) = 0;
+
+    //! Device time of mboard 0
+    virtual uhd::time_spec_t get_time_now() = 0;
+    //! Set the time of all mboards
+    virtual void set_time_now(const uhd::time_spec_t& time_spec) = 0;
+
+    //! Settings made until clear_command_time() apply at time_spec
+    virtual void set_command_time(const uhd::time_spec_t& time_spec) = 0;
+    virtual void clear_command_time() = 0;
+
+    virtual void set_rx_freq(const uhd::tune_request_t& tune_request, size_t chan = 0) = 0;
+    virtual void set_tx_freq(const uhd::tune_request_t& tune_request, size_t chan = 0) = 0;
+    virtual void set_rx_gain(double gain, size_t chan = 0) = 0;
+    virtual void set_tx_gain(double gain, size_t chan = 0) = 0;
+};
+
+class usrp_stream_device : public stream_device
+{
+public:
+    usrp_stream_device(uhd::usrp::multi_usrp::sptr usrp) : _usrp(usrp) {}
+
+    static sptr make(uhd::usrp::multi_usrp::sptr usrp)
+    {
+        return sptr(new usrp_stream_device(usrp));
+    }
+
+    uhd::rx_streamer::sptr get_rx_stream(const uhd::stream_args_t& args)
+    {
+        return _usrp->get_rx_stream(args);
+    }
+    uhd::tx_streamer::sptr get_tx_stream(const uhd::stream_args_t& args)
+    {
+        return _usrp->get_tx_stream(args);
+    }
+
+    double get_rx_rate(size_t chan = 0)
+    {
+        return _usrp->get_rx_rate(chan);
+    }
+    double get_tx_rate(size_t chan = 0)
+    {
+        return _usrp->get_tx_rate(chan);
+    }
+
+    uhd::time_spec_t get_time_now()
+    {
+        return _usrp->get_time_now();
+    }
+    void set_time_now(const uhd::time_spec_t& time_spec)
+    {
+        _usrp->set_time_now(time_spec);
+    }
+
+    void set_command_time(const uhd::time_spec_t& time_spec)
+    {
+        _usrp->set_command_time(time_spec);
+    }
+    void clear_command_time()
+    {
+        _usrp->clear_command_time();
+    }
+
+    void set_rx_freq(const uhd::tune_request_t& tune_request, size_t chan = 0)
+    {
+        _usrp->set_rx_freq(tune_request, chan);
+    }
+    void set_tx_freq(const uhd::tune_request_t& tune_request, size_t chan = 0)
+    {
+        _usrp->set_tx_freq(tune_request, chan);
+    }
+    void set_rx_gain(double gain, size_t chan = 0)
+    {
+        _usrp->set_rx_gain(gain, chan);
+    }
+    void set_tx_gain(double gain, size_t chan = 0)
+    {
+        _usrp->set_tx_gain(gain, chan);
+    }
+
+    uhd::usrp::multi_usrp::sptr get_usrp() const
+    {
+        return _usrp;
+    }
+
+private:
+    uhd::usrp::multi_usrp::sptr _usrp;
+};
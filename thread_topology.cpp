@@ -0,0 +1,324 @@
+#include "thread_topology.hpp"
+#include "trace.hpp"
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <thread>
+
+/***********************************************************************
+ * Parsing
+ **********************************************************************/
+static int parse_policy(const std::string& name)
+{
+    if (name == "other")
+        return SCHED_OTHER;
+    if (name == "batch")
+        return SCHED_BATCH;
+    if (name == "idle")
+        return SCHED_IDLE;
+    if (name == "fifo")
+        return SCHED_FIFO;
+    if (name == "rr")
+        return SCHED_RR;
+    throw std::runtime_error("Unknown scheduling policy " + name);
+}
+
+static const char* policy_name(int policy)
+{
+    switch (policy) {
+        case SCHED_BATCH:
+            return "batch";
+        case SCHED_IDLE:
+            return "idle";
+        case SCHED_FIFO:
+            return "fifo";
+        case SCHED_RR:
+            return "rr";
+        default:
+            return "other";
+    }
+}
+
+static std::vector<int> parse_cores(const std::string& spec)
+{
+    std::vector<std::string> parts;
+    boost::split(parts, spec, boost::is_any_of("+"));
+    std::vector<int> cores;
+    for (size_t i = 0; i < parts.size(); i++) {
+        const size_t dash = parts[i].find('-');
+        const int first   = std::stoi(parts[i].substr(0, dash));
+        const int last =
+            dash == std::string::npos ? first : std::stoi(parts[i].substr(dash + 1));
+        for (int c = first; c <= last; c++)
+            cores.push_back(c);
+    }
+    return cores;
+}
+
+static thread_placement parse_placement(const std::string& entry)
+{
+    const size_t eq = entry.find('=');
+    if (eq == std::string::npos) {
+        throw std::runtime_error("Expected role=CORES[:POLICY[:PRIORITY]], got " + entry);
+    }
+    thread_placement placement;
+    placement.role = boost::trim_copy(entry.substr(0, eq));
+    std::vector<std::string> fields;
+    boost::split(fields, entry.substr(eq + 1), boost::is_any_of(":"));
+    if (not fields[0].empty() and fields[0] != "*")
+        placement.cores = parse_cores(fields[0]);
+    if (fields.size() > 1)
+        placement.policy = parse_policy(fields[1]);
+    if (fields.size() > 2)
+        placement.priority = std::stoi(fields[2]);
+    return placement;
+}
+
+thread_topology thread_topology::parse(const std::string& spec)
+{
+    std::vector<std::string> entries;
+    if (not spec.empty() and spec[0] == '@') {
+        std::ifstream in(spec.substr(1).c_str());
+        if (not in.is_open())
+            throw std::runtime_error("Unable to open " + spec.substr(1));
+        std::string line;
+        while (std::getline(in, line)) {
+            line = boost::trim_copy(line.substr(0, line.find('#')));
+            if (not line.empty())
+                entries.push_back(line);
+        }
+    } else {
+        boost::split(entries, spec, boost::is_any_of(","));
+    }
+
+    thread_topology topology;
+    for (size_t i = 0; i < entries.size(); i++) {
+        const std::string entry = boost::trim_copy(entries[i]);
+        if (entry.empty())
+            continue;
+        if (entry == "mlockall")
+            topology.mlockall = true;
+        else
+            topology.placements.push_back(parse_placement(entry));
+    }
+    return topology;
+}
+
+const thread_placement* thread_topology::find(const std::string& role) const
+{
+    for (size_t i = 0; i < placements.size(); i++) {
+        if (placements[i].role == role)
+            return &placements[i];
+    }
+    return nullptr;
+}
+
+/***********************************************************************
+ * Placement
+ **********************************************************************/
+namespace {
+struct thread_stats
+{
+    std::string role;
+    std::string cores;
+    std::string policy;
+    long voluntary, involuntary;
+};
+
+std::mutex topology_mutex;
+thread_topology process_topology;
+std::vector<thread_stats> recorded_stats;
+} // namespace
+
+void set_thread_topology(const thread_topology& topology)
+{
+    {
+        std::lock_guard<std::mutex> lock(topology_mutex);
+        process_topology = topology;
+    }
+    if (topology.mlockall and ::mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        std::cerr << boost::format("mlockall failed: %s") % std::strerror(errno)
+                  << std::endl;
+    }
+}
+
+static void place_thread(const thread_placement& placement)
+{
+    if (not placement.cores.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (size_t i = 0; i < placement.cores.size(); i++)
+            CPU_SET(placement.cores[i], &set);
+        const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            std::cerr << boost::format("%s: unable to set affinity: %s")
+                             % placement.role % std::strerror(err)
+                      << std::endl;
+        }
+    }
+    struct sched_param param;
+    std::memset(&param, 0, sizeof(param));
+    param.sched_priority = placement.priority;
+    const int err = pthread_setschedparam(pthread_self(), placement.policy, &param);
+    if (err != 0) {
+        std::cerr << boost::format("%s: unable to set %s priority %d: %s")
+                         % placement.role % policy_name(placement.policy)
+                         % placement.priority % std::strerror(err)
+                  << std::endl;
+    }
+}
+
+void apply_thread_role(const std::string& role)
+{
+    TRACE_THREAD_NAME(role.c_str());
+    thread_placement placement;
+    {
+        std::lock_guard<std::mutex> lock(topology_mutex);
+        const thread_placement* found = process_topology.find(role);
+        if (found == nullptr)
+            return;
+        placement = *found;
+    }
+    place_thread(placement);
+}
+
+std::function<void()> with_thread_role(const std::string& role, std::function<void()> fn)
+{
+    return [role, fn] {
+        apply_thread_role(role);
+        fn();
+        record_thread_stats(role);
+    };
+}
+
+void record_thread_stats(const std::string& role)
+{
+    thread_stats stats;
+    stats.role = role;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+        if (CPU_COUNT(&set) >= int(std::thread::hardware_concurrency())) {
+            stats.cores = "any";
+        } else {
+            for (int c = 0; c < CPU_SETSIZE; c++) {
+                if (CPU_ISSET(c, &set))
+                    stats.cores += (stats.cores.empty() ? "" : "+") + std::to_string(c);
+            }
+        }
+    }
+
+    int policy;
+    struct sched_param param;
+    if (pthread_getschedparam(pthread_self(), &policy, &param) == 0)
+        stats.policy = str(boost::format("%s:%d") % policy_name(policy) % param.sched_priority);
+
+    struct rusage usage;
+    std::memset(&usage, 0, sizeof(usage));
+    getrusage(RUSAGE_THREAD, &usage);
+    stats.voluntary   = usage.ru_nvcsw;
+    stats.involuntary = usage.ru_nivcsw;
+
+    std::lock_guard<std::mutex> lock(topology_mutex);
+    recorded_stats.push_back(stats);
+}
+
+void print_thread_report()
+{
+    std::lock_guard<std::mutex> lock(topology_mutex);
+    if (recorded_stats.empty())
+        return;
+    std::cout << "Threads:          cores       policy       ctx switches (involuntary)"
+              << std::endl;
+    for (size_t i = 0; i < recorded_stats.size(); i++) {
+        const thread_stats& s = recorded_stats[i];
+        std::cout << boost::format("  %-14s %-11s %-12s %8d (%d)") % s.role % s.cores
+                         % s.policy % (s.voluntary + s.involuntary) % s.involuntary
+                  << std::endl;
+    }
+}
+
+/***********************************************************************
+ * Jitter test
+ **********************************************************************/
+static void jitter_probe(const thread_placement& placement,
+    double secs,
+    unsigned period_us,
+    std::vector<long>& latencies)
+{
+    place_thread(placement);
+    const long period_ns = long(period_us) * 1000;
+    latencies.reserve(size_t(secs * 1e6 / period_us) + 1);
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    const long long end_ns =
+        next.tv_sec * 1000000000LL + next.tv_nsec + (long long)(secs * 1e9);
+    for (;;) {
+        next.tv_nsec += period_ns;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        const long long target_ns = next.tv_sec * 1000000000LL + next.tv_nsec;
+        if (target_ns > end_ns)
+            break;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        latencies.push_back(long(now.tv_sec * 1000000000LL + now.tv_nsec - target_ns));
+    }
+}
+
+void run_jitter_test(double secs, unsigned period_us)
+{
+    std::vector<thread_placement> placements;
+    {
+        std::lock_guard<std::mutex> lock(topology_mutex);
+        placements = process_topology.placements;
+    }
+    if (placements.empty()) {
+        thread_placement unplaced;
+        unplaced.role = "default";
+        placements.push_back(unplaced);
+    }
+
+    std::cout << boost::format("Jitter test: %d us period for %.1f s per role...")
+                     % period_us % secs
+              << std::endl;
+    std::vector<std::vector<long>> latencies(placements.size());
+    std::vector<std::thread> probes;
+    for (size_t i = 0; i < placements.size(); i++) {
+        probes.push_back(std::thread(
+            jitter_probe, placements[i], secs, period_us, std::ref(latencies[i])));
+    }
+    for (size_t i = 0; i < probes.size(); i++)
+        probes[i].join();
+
+    std::cout << "  role            wakeups   mean us    p99 us    max us" << std::endl;
+    for (size_t i = 0; i < placements.size(); i++) {
+        std::vector<long>& lat = latencies[i];
+        if (lat.empty())
+            continue;
+        std::sort(lat.begin(), lat.end());
+        double sum = 0;
+        for (size_t k = 0; k < lat.size(); k++)
+            sum += lat[k];
+        std::cout << boost::format("  %-14s %8d %9.1f %9.1f %9.1f") % placements[i].role
+                         % lat.size() % (sum / lat.size() / 1e3)
+                         % (lat[lat.size() * 99 / 100] / 1e3) % (lat.back() / 1e3)
+                  << std::endl;
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/***********************************************************************
+ * Thread topology
+ * Where each pipeline thread runs: a core set, a scheduling policy and
+ * priority per role. Roles are "recv", "send", "generator" (waveform
+ * TX), "writer" (segment files), "net" (network sender), "dsp"
+ * (calibration and other worker stages) and "monitor" (TX async
+ * messages). The spec is a comma separated
+ * list, or @FILE with one entry per line (# comments):
+ *
+ *   role=CORES[:POLICY[:PRIORITY]]    e.g. recv=2-3:fifo:80,send=1:rr:70
+ *
+ * CORES is a list of cores and ranges joined by '+' ("2-3+6"), POLICY
+ * one of other, batch, idle, fifo or rr. Roles not listed keep the
+ * default placement.
+ **********************************************************************/
+struct thread_placement
+{
+    std::string role;
+    std::vector<int> cores;
+    int policy   = 0; // SCHED_OTHER
+    int priority = 0;
+};
+
+struct thread_topology
+{
+    std::vector<thread_placement> placements;
+    bool mlockall = false;
+
+    static thread_topology parse(const std::string& spec);
+
+    const thread_placement* find(const std::string& role) const;
+};
+
+//! Make topology the process-wide one (and mlockall if it asks for it)
+void set_thread_topology(const thread_topology& topology);
+
+//! Place the calling thread as the process topology says for role; does
+//  nothing for roles without an entry, warns if the OS refuses
+void apply_thread_role(const std::string& role);
+
+//! fn run on a thread placed for role, with its context switches noted
+//  for print_thread_report()
+std::function<void()> with_thread_role(const std::string& role, std::function<void()> fn);
+
+//! Note the calling thread's context switches and placement under role
+void record_thread_stats(const std::string& role);
+
+//! What each recorded thread ran on and how often it was preempted
+void print_thread_report();
+
+//! cyclictest-style check: one thread per placement wakes every
+//  period_us for secs and reports how late its wakeups were
+void run_jitter_test(double secs, unsigned period_us = 1000);
@@ -0,0 +1,144 @@
+#include "trace.hpp"
+
+#ifdef ETTUS_TRACE
+
+#include <boost/format.hpp>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+thread_local trace_buffer* trace_local = nullptr;
+
+namespace {
+struct trace_thread
+{
+    trace_buffer buffer;
+    std::string name;
+};
+
+// never freed, so threads and the exit handler can use it at any time
+struct trace_registry
+{
+    std::mutex mutex;
+    std::vector<trace_thread*> threads;
+    uint64_t start_ticks;
+    std::chrono::steady_clock::time_point start_time;
+};
+
+trace_registry* registry()
+{
+    static trace_registry* reg = [] {
+        trace_registry* r = new trace_registry();
+        r->start_ticks    = trace_now();
+        r->start_time     = std::chrono::steady_clock::now();
+        return r;
+    }();
+    return reg;
+}
+
+std::string json_escape(const std::string& s)
+{
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '"' or s[i] == '\\')
+            out += '\\';
+        out += s[i];
+    }
+    return out;
+}
+
+void trace_dump()
+{
+    trace_registry* reg = registry();
+    std::lock_guard<std::mutex> lock(reg->mutex);
+
+    // ticks per microsecond over the whole run
+    const uint64_t end_ticks = trace_now();
+    const double us          = std::chrono::duration<double, std::micro>(
+                          std::chrono::steady_clock::now() - reg->start_time)
+                          .count();
+    const double ticks_per_us = us > 0 ? (end_ticks - reg->start_ticks) / us : 1.0;
+
+    const char* env  = std::getenv("ETTUS_TRACE_FILE");
+    const std::string file = env ? env : "ettus_trace.json";
+    std::ofstream out(file.c_str());
+    const int pid = int(getpid());
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    bool first      = true;
+    uint64_t events = 0, lost = 0;
+    for (size_t t = 0; t < reg->threads.size(); t++) {
+        const trace_thread& th = *reg->threads[t];
+        const uint64_t next    = __atomic_load_n(&th.buffer.next, __ATOMIC_ACQUIRE);
+        const uint64_t count   = std::min(next, th.buffer.mask + 1);
+        lost += next - count;
+        out << (first ? "" : ",\n")
+            << boost::format("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                             "\"args\":{\"name\":\"%s\"}}")
+                   % pid % t % json_escape(th.name);
+        first = false;
+        for (uint64_t i = next - count; i < next; i++) {
+            const trace_event& ev = th.buffer.events[i & th.buffer.mask];
+            const double ts       = (double(ev.begin) - double(reg->start_ticks)) / ticks_per_us;
+            if (ev.end == ev.begin) {
+                out << boost::format(",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,"
+                                     "\"tid\":%d,\"ts\":%.3f}")
+                           % ev.name % pid % t % ts;
+            } else {
+                out << boost::format(",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                                     "\"ts\":%.3f,\"dur\":%.3f}")
+                           % ev.name % pid % t % ts % ((ev.end - ev.begin) / ticks_per_us);
+            }
+            events++;
+        }
+    }
+    out << "\n]}\n";
+    std::cerr << boost::format("Trace: %d events from %d threads in %s (%d overwritten)")
+                     % events % reg->threads.size() % file % lost
+              << std::endl;
+}
+} // namespace
+
+trace_buffer* trace_register()
+{
+    trace_registry* reg = registry();
+    uint64_t size       = 1 << 18;
+    if (const char* env = std::getenv("ETTUS_TRACE_EVENTS"))
+        size = std::max<uint64_t>(2, std::strtoull(env, nullptr, 10));
+    uint64_t capacity = 1;
+    while (capacity < size)
+        capacity <<= 1;
+
+    trace_thread* th   = new trace_thread();
+    th->buffer.events  = new trace_event[capacity];
+    th->buffer.mask    = capacity - 1;
+    th->buffer.next    = 0;
+    {
+        std::lock_guard<std::mutex> lock(reg->mutex);
+        if (reg->threads.empty())
+            std::atexit(trace_dump);
+        th->name = str(boost::format("thread %d") % reg->threads.size());
+        reg->threads.push_back(th);
+    }
+    trace_local = &th->buffer;
+    return trace_local;
+}
+
+void trace_thread_name(const char* name)
+{
+    if (not trace_local)
+        trace_register();
+    trace_registry* reg = registry();
+    std::lock_guard<std::mutex> lock(reg->mutex);
+    for (size_t t = 0; t < reg->threads.size(); t++) {
+        if (&reg->threads[t]->buffer == trace_local)
+            reg->threads[t]->name = name;
+    }
+}
+
+#endif
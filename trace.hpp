@@ -0,0 +1,106 @@
+#pragma once
+
+/***********************************************************************
+ * Pipeline tracing
+ * Trace points around the calls that can stall the sample path. They
+ * compile to nothing unless the tree is configured with
+ * -DENABLE_TRACE=ON (which defines ETTUS_TRACE).
+ *
+ *   TRACE_SCOPE("recv");         a span from here to the end of scope
+ *   TRACE_INSTANT("overflow");   a point event
+ *   TRACE_THREAD_NAME("recv");   label the calling thread
+ *
+ * Each thread records into its own ring of events, timestamped with
+ * the TSC, with no locks or allocation after its first event. The most
+ * recent events of every thread are written as Chrome trace JSON (for
+ * chrome://tracing or Perfetto) when the process exits, to
+ * $ETTUS_TRACE_FILE or ettus_trace.json. $ETTUS_TRACE_EVENTS sets the
+ * ring size per thread (default 262144, rounded up to a power of two).
+ **********************************************************************/
+#ifdef ETTUS_TRACE
+
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+inline uint64_t trace_now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch())
+                        .count());
+#endif
+}
+
+struct trace_event
+{
+    const char* name; // string literal
+    uint64_t begin, end; // trace_now() ticks, equal for a point event
+};
+
+struct trace_buffer
+{
+    trace_event* events;
+    uint64_t mask;
+    uint64_t next; // events recorded so far, the ring keeps the last mask + 1
+};
+
+extern thread_local trace_buffer* trace_local;
+
+//! First event of a thread: allocate and register its ring
+trace_buffer* trace_register();
+
+inline void trace_record(const char* name, uint64_t begin, uint64_t end)
+{
+    trace_buffer* buf = trace_local ? trace_local : trace_register();
+    trace_event& ev   = buf->events[buf->next & buf->mask];
+    ev.name           = name;
+    ev.begin          = begin;
+    ev.end            = end;
+    __atomic_store_n(&buf->next, buf->next + 1, __ATOMIC_RELEASE);
+}
+
+void trace_thread_name(const char* name);
+
+class trace_scope
+{
+public:
+    explicit trace_scope(const char* name) : _name(name), _begin(trace_now()) {}
+    ~trace_scope()
+    {
+        trace_record(_name, _begin, trace_now());
+    }
+
+private:
+    const char* _name;
+    uint64_t _begin;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_INSTANT(name)                  \
+    do {                                     \
+        const uint64_t trace_t_ = trace_now(); \
+        trace_record(name, trace_t_, trace_t_); \
+    } while (0)
+#define TRACE_THREAD_NAME(name) trace_thread_name(name)
+
+#else
+
+#define TRACE_SCOPE(name) \
+    do {                  \
+    } while (0)
+#define TRACE_INSTANT(name) \
+    do {                    \
+    } while (0)
+#define TRACE_THREAD_NAME(name) \
+    do {                        \
+    } while (0)
+
+#endif
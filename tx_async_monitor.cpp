@@ -0,0 +1,194 @@
+#include "tx_async_monitor.hpp"
+#include "thread_topology.hpp"
+#include <boost/format.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <algorithm>
+#include <iostream>
+
+static const char* event_name(uhd::async_metadata_t::event_code_t code)
+{
+    switch (code) {
+        case uhd::async_metadata_t::EVENT_CODE_BURST_ACK:
+            return "burst_ack";
+        case uhd::async_metadata_t::EVENT_CODE_UNDERFLOW:
+            return "underflow";
+        case uhd::async_metadata_t::EVENT_CODE_UNDERFLOW_IN_PACKET:
+            return "underflow_in_packet";
+        case uhd::async_metadata_t::EVENT_CODE_SEQ_ERROR:
+            return "seq_error";
+        case uhd::async_metadata_t::EVENT_CODE_SEQ_ERROR_IN_BURST:
+            return "seq_error_in_burst";
+        case uhd::async_metadata_t::EVENT_CODE_TIME_ERROR:
+            return "late";
+        default:
+            return "other";
+    }
+}
+
+tx_async_monitor::tx_async_monitor(uhd::tx_streamer::sptr tx_stream, size_t max_events)
+    : _tx_stream(tx_stream)
+    , _max_events(max_events)
+    , _running(true)
+    , _unmatched_acks(0)
+    , _ack_latency_sum(0)
+    , _ack_latency_max(0)
+{
+    _thread = std::thread(&tx_async_monitor::run, this);
+}
+
+tx_async_monitor::~tx_async_monitor()
+{
+    stop(0);
+}
+
+void tx_async_monitor::begin_end_of_burst()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _bursts_sent.push_back(std::chrono::steady_clock::now());
+}
+
+bool tx_async_monitor::wait_for_acks(uint64_t num_acks, double timeout)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _cond.wait_for(lock,
+        std::chrono::duration<double>(timeout),
+        [this, num_acks] { return _acks.count >= num_acks; });
+}
+
+tx_async_monitor::totals tx_async_monitor::get_totals()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    totals t;
+    t.underflows = _underflows.count;
+    t.seq_errors = _seq_errors.count;
+    t.late       = _late.count;
+    t.acks       = _acks.count;
+    return t;
+}
+
+void tx_async_monitor::stop(double ack_timeout)
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (not _running)
+            return;
+        // the last burst may still be draining out of the device buffer
+        _cond.wait_for(lock,
+            std::chrono::duration<double>(ack_timeout),
+            [this] { return _bursts_sent.empty(); });
+        _running = false;
+    }
+    _thread.join();
+}
+
+void tx_async_monitor::run()
+{
+    apply_thread_role("monitor");
+    uhd::async_metadata_t md;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (not _running)
+                break;
+        }
+        // short timeout, so stop() is not held up for long
+        if (not _tx_stream->recv_async_msg(md, 0.1))
+            continue;
+
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(_mutex);
+        switch (md.event_code) {
+            case uhd::async_metadata_t::EVENT_CODE_BURST_ACK:
+                count(_acks, md);
+                if (_bursts_sent.empty()) {
+                    _unmatched_acks++;
+                } else {
+                    const double latency =
+                        std::chrono::duration<double>(now - _bursts_sent.front()).count();
+                    _bursts_sent.pop_front();
+                    _ack_latency_sum += latency;
+                    _ack_latency_max = std::max(_ack_latency_max, latency);
+                }
+                _cond.notify_all();
+                break;
+            case uhd::async_metadata_t::EVENT_CODE_UNDERFLOW:
+            case uhd::async_metadata_t::EVENT_CODE_UNDERFLOW_IN_PACKET:
+                count(_underflows, md);
+                break;
+            case uhd::async_metadata_t::EVENT_CODE_SEQ_ERROR:
+            case uhd::async_metadata_t::EVENT_CODE_SEQ_ERROR_IN_BURST:
+                count(_seq_errors, md);
+                break;
+            case uhd::async_metadata_t::EVENT_CODE_TIME_ERROR:
+                count(_late, md);
+                break;
+            default:
+                count(_other, md);
+                break;
+        }
+        if (_events.size() < _max_events) {
+            event_record record;
+            record.code      = md.event_code;
+            record.time_secs = md.has_time_spec ? md.time_spec.get_real_secs() : -1;
+            _events.push_back(record);
+        }
+    }
+    record_thread_stats("monitor");
+}
+
+void tx_async_monitor::count(event_counter& counter, const uhd::async_metadata_t& md)
+{
+    const double secs = md.has_time_spec ? md.time_spec.get_real_secs() : 0;
+    if (counter.count == 0)
+        counter.first_secs = secs;
+    counter.last_secs = secs;
+    counter.count++;
+}
+
+void tx_async_monitor::report(capture_metadata::sptr metadata)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    const uint64_t matched    = _acks.count - _unmatched_acks;
+    const double mean_latency = matched ? _ack_latency_sum / matched : 0;
+    std::cout << boost::format("TX async: %d underflows, %d sequence errors, %d late, "
+                               "%d burst ACKs (latency mean %.1f ms, max %.1f ms)")
+                     % _underflows.count % _seq_errors.count % _late.count % _acks.count
+                     % (mean_latency * 1e3) % (_ack_latency_max * 1e3)
+              << std::endl;
+    static const size_t num_kinds            = 3;
+    const char* const names[num_kinds]       = {"underflows", "seq_errors", "late"};
+    const event_counter* counters[num_kinds] = {&_underflows, &_seq_errors, &_late};
+    for (size_t k = 0; k < num_kinds; k++) {
+        if (counters[k]->count != 0)
+            std::cout << boost::format("  %s between %.6f s and %.6f s") % names[k]
+                             % counters[k]->first_secs % counters[k]->last_secs
+                      << std::endl;
+    }
+    if (not _bursts_sent.empty())
+        std::cout << boost::format("  %d bursts not acknowledged") % _bursts_sent.size()
+                  << std::endl;
+    if (not metadata)
+        return;
+
+    for (size_t k = 0; k < num_kinds; k++) {
+        const std::string path = std::string("tx_async.") + names[k];
+        metadata->set(path + ".count", counters[k]->count);
+        if (counters[k]->count != 0) {
+            metadata->set(path + ".first_time", counters[k]->first_secs);
+            metadata->set(path + ".last_time", counters[k]->last_secs);
+        }
+    }
+    metadata->set("tx_async.other", _other.count);
+    metadata->set("tx_async.burst_acks", _acks.count);
+    metadata->set("tx_async.bursts_unacknowledged", _bursts_sent.size());
+    metadata->set("tx_async.ack_latency_mean_secs", mean_latency);
+    metadata->set("tx_async.ack_latency_max_secs", _ack_latency_max);
+    boost::property_tree::ptree events;
+    for (size_t i = 0; i < _events.size(); i++) {
+        boost::property_tree::ptree entry;
+        entry.put("event", event_name(_events[i].code));
+        entry.put("time", _events[i].time_secs);
+        events.push_back(std::make_pair("", entry));
+    }
+    metadata->put_child("tx_async.events", events);
+}
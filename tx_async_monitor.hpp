@@ -0,0 +1,84 @@
+#pragma once
+
+#include "capture_meta.hpp"
+#include <uhd/stream.hpp>
+#include <uhd/types/metadata.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/***********************************************************************
+ * tx_async_monitor
+ * Thread draining a TX streamer's async messages, so underflows ('U'),
+ * sequence errors and late packets are counted instead of lost. Each
+ * kind keeps a count and the device times of its first and last event;
+ * the first max_events events are kept as a log for the sidecar.
+ *
+ * Burst ACK latency is host time from the end of burst send() (the
+ * sender calls begin_end_of_burst() just before it) to the ACK arriving,
+ * i.e. how long the samples buffered in the device took to drain. The
+ * burst is registered before the send so that an ACK arriving while
+ * send() is still returning finds it. stop() waits
+ * up to ack_timeout for the ACK of a burst that is still draining;
+ * wait_for_acks() does the same without stopping, for a long-lived
+ * sender that must not start its next burst early.
+ **********************************************************************/
+class tx_async_monitor
+{
+public:
+    typedef std::shared_ptr<tx_async_monitor> sptr;
+
+    tx_async_monitor(uhd::tx_streamer::sptr tx_stream, size_t max_events = 256);
+    ~tx_async_monitor();
+
+    //! Called by the sender just before a send() with end_of_burst
+    void begin_end_of_burst();
+
+    //! Wait up to timeout for num_acks burst ACKs in total
+    bool wait_for_acks(uint64_t num_acks, double timeout);
+
+    void stop(double ack_timeout = 1.0);
+
+    struct totals
+    {
+        uint64_t underflows, seq_errors, late, acks;
+    };
+    //! Counts so far, for a caller reporting per job
+    totals get_totals();
+
+    //! Print the counters, and add them to metadata as tx_async.*
+    void report(capture_metadata::sptr metadata = capture_metadata::sptr());
+
+private:
+    struct event_counter
+    {
+        uint64_t count = 0;
+        double first_secs = 0, last_secs = 0; // device time
+    };
+
+    struct event_record
+    {
+        uhd::async_metadata_t::event_code_t code;
+        double time_secs;
+    };
+
+    void run();
+    void count(event_counter& counter, const uhd::async_metadata_t& md);
+
+    uhd::tx_streamer::sptr _tx_stream;
+    const size_t _max_events;
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    bool _running;
+    event_counter _underflows, _seq_errors, _late, _acks, _other;
+    std::deque<event_record> _events;
+    std::deque<std::chrono::steady_clock::time_point> _bursts_sent; // awaiting ACK
+    uint64_t _unmatched_acks;
+    double _ack_latency_sum, _ack_latency_max;
+    std::thread _thread;
+};
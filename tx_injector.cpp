@@ -0,0 +1,269 @@
+#include "tx_injector.hpp"
+#include "thread_topology.hpp"
+#include "trace.hpp"
+#include <uhd/utils/log.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+static double host_secs(std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration<double>(t.time_since_epoch()).count();
+}
+
+/***********************************************************************
+ * latency_histogram
+ **********************************************************************/
+void latency_histogram::add(double secs)
+{
+    // bin i holds up to 1e-6 * 10^(i / 10) seconds
+    const double pos = std::ceil(10 * std::log10(std::max(secs, 1e-6) / 1e-6));
+    _bins[std::min<size_t>(num_bins - 1, size_t(std::max(0.0, pos)))]++;
+    _count++;
+    _sum += secs;
+    _max = std::max(_max, secs);
+}
+
+double latency_histogram::percentile(double q) const
+{
+    const uint64_t target = uint64_t(std::ceil(q * _count));
+    uint64_t seen         = 0;
+    for (size_t i = 0; i < num_bins; i++) {
+        seen += _bins[i];
+        if (seen >= target and seen != 0)
+            return std::min(_max, 1e-6 * std::pow(10.0, i / 10.0));
+    }
+    return _max;
+}
+
+/***********************************************************************
+ * tx_injector
+ **********************************************************************/
+tx_injector::tx_injector(uhd::tx_streamer::sptr tx_stream,
+    const tx_injector_config& config,
+    size_t samp_size,
+    double rate,
+    tx_async_monitor::sptr monitor)
+    : _tx_stream(tx_stream)
+    , _config(config)
+    , _num_channels(tx_stream->get_num_channels())
+    , _samp_size(samp_size)
+    , _row_bytes((config.block_samps * samp_size + 63) / 64 * 64)
+    , _rate(rate)
+    , _monitor(monitor)
+    // blocks in the queue, plus those being filled or sent
+    , _pool(buffer_pool::make(_row_bytes * _num_channels, 2 * config.queue_depth))
+    , _queue(config.queue_depth)
+    , _stopping(false)
+    , _synced(false)
+    , _clock_offset(0)
+    , _rejected(0)
+    , _in_burst(false)
+    , _timed_burst(false)
+    , _burst_time(0)
+    , _burst_samps(0)
+    , _blocks(0)
+    , _samps(0)
+    , _bursts(0)
+    , _late(0)
+    , _send_timeouts(0)
+    , _buffs(_num_channels)
+{
+    if (config.block_samps == 0)
+        throw std::runtime_error("tx_injector: block_samps must not be 0");
+    _thread = std::thread(&tx_injector::run, this);
+}
+
+tx_injector::~tx_injector()
+{
+    stop();
+}
+
+pool_ref tx_injector::get_block()
+{
+    return _pool->get();
+}
+
+bool tx_injector::push(const void* const* buffs, size_t num_samps, const tx_block_info& info)
+{
+    if (num_samps > _config.block_samps)
+        throw std::runtime_error("tx_injector: block larger than block_samps");
+    pool_ref block = _pool->get();
+    if (not block) {
+        _rejected++;
+        return false;
+    }
+    for (size_t c = 0; c < _num_channels; c++) {
+        std::memcpy(block.data() + c * _row_bytes, buffs[c], num_samps * _samp_size);
+    }
+    return push(std::move(block), num_samps, info);
+}
+
+bool tx_injector::push(pool_ref block, size_t num_samps, const tx_block_info& info)
+{
+    entry e;
+    e.block     = std::move(block);
+    e.num_samps = num_samps;
+    e.info      = info;
+    e.pushed    = clock::now();
+    if (_stopping or not e.block or not _queue.try_push(std::move(e))) {
+        _rejected++;
+        return false;
+    }
+    return true;
+}
+
+void tx_injector::sync_clock(const uhd::time_spec_t& device_now)
+{
+    _clock_offset = device_now.get_real_secs() - host_secs(clock::now());
+    _synced       = true;
+}
+
+double tx_injector::device_time() const
+{
+    return host_secs(clock::now()) + _clock_offset;
+}
+
+void tx_injector::stop()
+{
+    _stopping = true;
+    if (_thread.joinable())
+        _thread.join();
+}
+
+/***********************************************************************
+ * sender
+ **********************************************************************/
+void tx_injector::run()
+{
+    apply_thread_role("send");
+    entry e;
+    for (;;) {
+        if (_queue.try_pop(e)) {
+            send(e);
+            e.block.reset();
+            continue;
+        }
+        // producers stop before stop(), so empty now means drained
+        if (_stopping)
+            break;
+        if (_config.idle_sleep_secs > 0)
+            std::this_thread::sleep_for(std::chrono::duration<double>(_config.idle_sleep_secs));
+        else
+            std::this_thread::yield();
+    }
+    if (_in_burst)
+        end_burst();
+    record_thread_stats("send");
+}
+
+void tx_injector::send(entry& e)
+{
+    uhd::tx_metadata_t md;
+    md.has_time_spec  = false;
+    md.start_of_burst = false;
+    md.end_of_burst   = e.info.end_of_burst;
+    if (e.info.time_secs >= 0) {
+        if (_in_burst)
+            end_burst();
+        md.has_time_spec = true;
+        md.time_spec     = uhd::time_spec_t(e.info.time_secs);
+        _timed_burst     = true;
+        _burst_time      = e.info.time_secs;
+    } else if (not _in_burst) {
+        _timed_burst = false;
+    }
+    if (not _in_burst) {
+        md.start_of_burst = true;
+        _in_burst         = true;
+        _burst_samps      = 0;
+        _bursts++;
+    }
+    for (size_t c = 0; c < _num_channels; c++) {
+        _buffs[c] = e.block.data() + c * _row_bytes;
+    }
+
+    const clock::time_point start = clock::now();
+    _queue_latency.add(std::chrono::duration<double>(start - e.pushed).count());
+    if (_timed_burst and _synced) {
+        const double air = _burst_time + _burst_samps / _rate;
+        _air_latency.add(std::max(0.0, air - (host_secs(e.pushed) + _clock_offset)));
+        if (air < host_secs(start) + _clock_offset)
+            _late++;
+    }
+
+    if (md.end_of_burst and _monitor)
+        _monitor->begin_end_of_burst();
+    size_t sent;
+    {
+        TRACE_SCOPE("inject send");
+        sent = _tx_stream->send(_buffs, e.num_samps, md, _config.send_timeout);
+    }
+    _send_latency.add(std::chrono::duration<double>(clock::now() - start).count());
+    if (sent != e.num_samps) {
+        UHD_LOG_ERROR("TX-INJECT",
+            "The tx_stream timed out sending " << e.num_samps << " samples (" << sent
+                                               << " sent).");
+        _send_timeouts++;
+    }
+    _blocks++;
+    _samps += sent;
+    _burst_samps += e.num_samps;
+    if (md.end_of_burst)
+        _in_burst = false;
+}
+
+//! Closes the open burst with an empty end of burst packet
+void tx_injector::end_burst()
+{
+    uhd::tx_metadata_t md;
+    md.has_time_spec = false;
+    md.end_of_burst  = true;
+    if (_monitor)
+        _monitor->begin_end_of_burst();
+    _tx_stream->send(_buffs, 0, md, _config.send_timeout);
+    _in_burst = false;
+}
+
+void tx_injector::report(capture_metadata::sptr metadata)
+{
+    std::cout << boost::format("TX inject: %d blocks in %d bursts, %d rejected, %d late, "
+                               "%d send timeouts")
+                     % _blocks % _bursts % _rejected % _late % _send_timeouts
+              << std::endl;
+    const char* const names[3]               = {"queue", "send", "air"};
+    const latency_histogram* histograms[3] = {
+        &_queue_latency, &_send_latency, &_air_latency};
+    for (size_t k = 0; k < 3; k++) {
+        const latency_histogram& h = *histograms[k];
+        if (h.count() == 0)
+            continue;
+        std::cout << boost::format("  %-5s latency mean %.3f ms, p50 %.3f ms, p99 %.3f ms, "
+                                   "max %.3f ms")
+                         % names[k] % (h.mean() * 1e3) % (h.percentile(0.5) * 1e3)
+                         % (h.percentile(0.99) * 1e3) % (h.max() * 1e3)
+                  << std::endl;
+    }
+    if (not metadata)
+        return;
+
+    metadata->set("tx_inject.blocks", _blocks);
+    metadata->set("tx_inject.samps", _samps);
+    metadata->set("tx_inject.bursts", _bursts);
+    metadata->set("tx_inject.rejected", uint64_t(_rejected));
+    metadata->set("tx_inject.late", _late);
+    metadata->set("tx_inject.send_timeouts", _send_timeouts);
+    for (size_t k = 0; k < 3; k++) {
+        const latency_histogram& h = *histograms[k];
+        if (h.count() == 0)
+            continue;
+        const std::string path = std::string("tx_inject.") + names[k] + "_latency";
+        metadata->set(path + ".mean_secs", h.mean());
+        metadata->set(path + ".p50_secs", h.percentile(0.5));
+        metadata->set(path + ".p99_secs", h.percentile(0.99));
+        metadata->set(path + ".max_secs", h.max());
+    }
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "buffer_pool.hpp"
+#include "capture_meta.hpp"
+#include "mpmc_queue.hpp"
+#include "tx_async_monitor.hpp"
+#include <uhd/stream.hpp>
+#include <uhd/types/time_spec.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/***********************************************************************
+ * latency_histogram
+ * Log spaced histogram, 10 bins per decade from 1 us to 100 s, for
+ * percentiles without keeping samples. Filled by one thread.
+ **********************************************************************/
+class latency_histogram
+{
+public:
+    void add(double secs);
+
+    uint64_t count() const
+    {
+        return _count;
+    }
+    double mean() const
+    {
+        return _count ? _sum / _count : 0;
+    }
+    double max() const
+    {
+        return _max;
+    }
+    //! Upper edge of the bin holding quantile q (0..1)
+    double percentile(double q) const;
+
+private:
+    static const size_t num_bins = 81;
+    uint64_t _bins[num_bins] = {};
+    uint64_t _count = 0;
+    double _sum = 0, _max = 0;
+};
+
+/***********************************************************************
+ * tx_injector
+ * Lets components in the process supply TX samples at low latency, in
+ * place of the wave table or file senders. Producers push blocks into a
+ * lock-free queue without blocking; one sender thread ("send" role)
+ * forwards them to the streamer.
+ *
+ * A block with a time (tx_block_info::time_secs >= 0) starts a burst at
+ * that device time, ending any burst still open; a block without one
+ * continues the open burst, or starts an untimed one. end_of_burst is
+ * passed on, and stop() ends an open burst after the queue has drained.
+ *
+ * Blocks are either copied into a pool block by push(buffs, ...), or
+ * filled by the producer in a block from get_block() and queued without
+ * a copy. A push fails, and is counted, when the pool or the queue is
+ * full, so a producer never waits on the radio.
+ *
+ * Latencies, host clock:
+ *  - queue: push to the start of its send()
+ *  - send:  the send() call itself (flow control from the device)
+ *  - air:   push to the block's first sample on air, for timed bursts
+ *           (burst time + samples before it / rate) after sync_clock()
+ * plus how many blocks reached send() after their air time (late).
+ **********************************************************************/
+struct tx_injector_config
+{
+    size_t queue_depth     = 64; // blocks, a power of two
+    size_t block_samps     = 2000; // largest block, per channel
+    double send_timeout    = 0.5;
+    double idle_sleep_secs = 20e-6; // sender poll when empty, 0 to spin
+};
+
+struct tx_block_info
+{
+    double time_secs  = -1; // device time of the first sample, starts a burst
+    bool end_of_burst = false;
+};
+
+class tx_injector
+{
+public:
+    typedef std::shared_ptr<tx_injector> sptr;
+
+    tx_injector(uhd::tx_streamer::sptr tx_stream,
+        const tx_injector_config& config,
+        size_t samp_size,
+        double rate,
+        tx_async_monitor::sptr monitor = tx_async_monitor::sptr());
+    ~tx_injector();
+
+    //! Copy num_samps samples of every channel and queue them
+    bool push(const void* const* buffs,
+        size_t num_samps,
+        const tx_block_info& info = tx_block_info());
+
+    size_t num_channels() const
+    {
+        return _num_channels;
+    }
+
+    //! Block for the zero copy push; channel c starts at c * row_bytes()
+    pool_ref get_block();
+    size_t row_bytes() const
+    {
+        return _row_bytes;
+    }
+    bool push(pool_ref block, size_t num_samps, const tx_block_info& info = tx_block_info());
+
+    //! Ties the host clock to the device clock, from a device time just read
+    void sync_clock(const uhd::time_spec_t& device_now);
+
+    //! Current device time from the host clock, after sync_clock()
+    double device_time() const;
+
+    //! Send what is queued, end the burst and join the sender
+    void stop();
+
+    //! Print the latencies, and add them to metadata as tx_inject.*
+    void report(capture_metadata::sptr metadata = capture_metadata::sptr());
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct entry
+    {
+        pool_ref block;
+        size_t num_samps;
+        tx_block_info info;
+        clock::time_point pushed;
+    };
+
+    void run();
+    void send(entry& e);
+    void end_burst();
+
+    uhd::tx_streamer::sptr _tx_stream;
+    const tx_injector_config _config;
+    const size_t _num_channels;
+    const size_t _samp_size;
+    const size_t _row_bytes;
+    const double _rate;
+    tx_async_monitor::sptr _monitor;
+    buffer_pool::sptr _pool;
+    mpmc_queue<entry> _queue;
+
+    std::atomic<bool> _stopping;
+    std::atomic<bool> _synced;
+    std::atomic<double> _clock_offset; // device time - host seconds
+    std::atomic<uint64_t> _rejected;
+
+    // sender thread only
+    bool _in_burst, _timed_burst;
+    double _burst_time;
+    uint64_t _burst_samps;
+    uint64_t _blocks, _samps, _bursts, _late, _send_timeouts;
+    latency_histogram _queue_latency, _send_latency, _air_latency;
+    std::vector<const void*> _buffs;
+
+    std::thread _thread;
+};
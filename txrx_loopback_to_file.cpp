@@ -5,6 +5,32 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 //
 
+#include "block_stats.hpp"
+#include "capture_meta.hpp"
+#include "cfar_detector.hpp"
+#include "channel_config.hpp"
+#include "channelizer.hpp"
+#include "convert.hpp"
+#include "doa_estimator.hpp"
+#include "iq_correction.hpp"
+#include "mimo_calibration.hpp"
+#include "multi_device.hpp"
+#include "net_sink.hpp"
+#include "overview_pyramid.hpp"
+#include "period_integrator.hpp"
+#include "shm_sink.hpp"
+#include "recv_to_file.hpp"
+#include "replay_device.hpp"
+#include "sample_layout.hpp"
+#include "segment_sink.hpp"
+#include "sim_device.hpp"
+#include "stream_common.hpp"
+#include "stream_device.hpp"
+#include "thread_topology.hpp"
+#include "trace.hpp"
+#include "tx_async_monitor.hpp"
+#include "tx_injector.hpp"
+#include "usrp_setup.hpp"
 #include "wavetable.hpp"
 #include <uhd/exception.hpp>
 #include <uhd/types/tune_request.hpp>
@@ -27,346 +53,203 @@
 #include <time.h>
 #include <functional>
 #include <iostream>
+#include <iterator>
 #include <chrono>
+#include <thread>
 
 #include <ctime>
 
 
 namespace po = boost::program_options;
 
-/***********************************************************************
- * Signal handlers
- **********************************************************************/
-static bool stop_signal_called = false;
-void sig_int_handler(int)
-{
-    stop_signal_called = true;
-}
-
-/***********************************************************************
- * Utilities
- **********************************************************************/
-//! Change to filename, e.g. from usrp_samples.dat to usrp_samples.00.dat,
-//  but only if multiple names are to be generated.
-std::string generate_out_filename(
-    const std::string& base_fn, size_t n_names, size_t this_name)
-{
-    if (n_names == 1) {
-        return base_fn;
-    }
-
-    boost::filesystem::path base_fn_fp(base_fn);
-    base_fn_fp.replace_extension(boost::filesystem::path(
-        str(boost::format("%02d%s") % this_name % base_fn_fp.extension().string())));
-    return base_fn_fp.string();
-}
-
 /***********************************************************************
  * Read from File
  **********************************************************************/
 
 template <typename samp_type>
 void send_from_file(
-    //std::vector<std::complex<samp_type>> buff,
-    uhd::usrp::multi_usrp::sptr usrp,
     uhd::tx_streamer::sptr tx_stream,
-    const std::string& file, 
+    const std::string& file,
     size_t samps_per_buff,
-    bool repeat
-    )
-{   
-        bool first = true;
-        //this does nothing at the moment. unsure why
-        double delay = 0.2f;
-        size_t num_tx_samps;
-        
-        
-    do {
-        
-        // loop until the entire file has been read
-        //std::cout << boost::format("Reading from file : %s...") %file << std::endl;
-        std::ifstream infile(file.c_str(), std::ifstream::binary);
-        
-        uhd::tx_metadata_t md;
-        md.start_of_burst = false;
-        md.end_of_burst   = false;
-        //setting transmit command in the future
-        //is the signal delay
-        //allows time to read from file and not have buffers interfere with timing
-        md.has_time_spec = true;
-        md.time_spec = usrp->get_time_now()+ uhd::time_spec_t(delay);
-        std::vector<samp_type> buff(samps_per_buff); 
-
-        if (first)
-        {    
-            //on first run the tx command only starts at 0.2
-            //afterwards set to zero and continuously reads
-            md.time_spec = usrp->get_time_now();
-            md.has_time_spec = true;
-            md.time_spec = uhd::time_spec_t(0.8);
-            
+    double start_time,
+    bool repeat,
+    tx_async_monitor::sptr monitor)
+{
+    std::ifstream infile(file.c_str(), std::ifstream::binary);
+    std::vector<samp_type> buff(samps_per_buff);
+
+    // the burst starts at start_time, the same device time as RX; with
+    // --repeat every pass follows the last without a gap in the same
+    // burst, so period k of the file lands on RX samples k * len onwards
+    uhd::tx_metadata_t md;
+    md.start_of_burst = false;
+    md.end_of_burst   = false;
+    md.has_time_spec  = true;
+    md.time_spec      = uhd::time_spec_t(start_time);
+
+    size_t pass_samps = 0;
+    while (not stop_signal_called) {
+        {
+            TRACE_SCOPE("file read");
             infile.read((char*)&buff.front(), buff.size() * sizeof(samp_type));
-            num_tx_samps = size_t(infile.gcount() / sizeof(samp_type));
-
-            md.end_of_burst = infile.eof();
-
         }
+        const size_t num_tx_samps = size_t(infile.gcount() / sizeof(samp_type));
+        pass_samps += num_tx_samps;
+        const bool at_end = infile.eof();
+        if (at_end) {
+            if (pass_samps == 0)
+                throw std::runtime_error("No samples in " + file);
+            //moving back to start of file instead of closing
+            infile.clear();
+            infile.seekg(0);
+            pass_samps = 0;
+        }
+        md.end_of_burst = at_end and not repeat;
+        if (num_tx_samps == 0 and not md.end_of_burst)
+            continue;
 
-
-        //transmits whole file then exits loop
-        while (not md.end_of_burst and not stop_signal_called) {
-
-            const size_t samples_sent = tx_stream->send(&buff.front(), num_tx_samps, md, 0.9);
-            if (first) 
-            {
-                first = false;
-            }
-            
-            if (samples_sent != num_tx_samps) {
-                UHD_LOG_ERROR("TX-STREAM",
-                    "The tx_stream timed out sending " << num_tx_samps << " samples ("
-                                                    << samples_sent << " sent).");
-                return;
-            }
-
-            infile.read((char*)&buff.front(), buff.size() * sizeof(samp_type));
-            num_tx_samps = size_t(infile.gcount() / sizeof(samp_type));
-            md.has_time_spec = false;
-            md.end_of_burst = infile.eof();
+        if (md.end_of_burst)
+            monitor->begin_end_of_burst();
+        size_t samples_sent;
+        {
+            TRACE_SCOPE("send");
+            samples_sent = tx_stream->send(&buff.front(), num_tx_samps, md, 0.9);
         }
+        if (samples_sent != num_tx_samps) {
+            UHD_LOG_ERROR("TX-STREAM",
+                "The tx_stream timed out sending " << num_tx_samps << " samples ("
+                                                << samples_sent << " sent).");
+            return;
+        }
+        md.has_time_spec = false;
+        if (md.end_of_burst)
+            return;
+    }
 
-        //moving back to start of file instead of closing
-        infile.clear();
-        infile.seekg(0);
-        //infile.close(); //code kept as reference
-        
-    }while(repeat and not stop_signal_called); 
-    
+    // stopped during --repeat
+    md.end_of_burst = true;
+    monitor->begin_end_of_burst();
+    tx_stream->send(&buff.front(), 0, md, 0.1);
 }
 
-
-/***************************************stream_cmd********************************
- * recv_to_file function
+/***********************************************************************
+ * Inject from File
+ * The file as an in-process producer would supply it: each block is
+ * read into an injector block, held until lead_secs before it goes on
+ * air, and pushed. The burst and its timing are the same as
+ * send_from_file's; the injector's sender does the send() calls.
  **********************************************************************/
-template <typename samp_type>
-void recv_to_file(uhd::usrp::multi_usrp::sptr usrp,
-    uhd::rx_streamer::sptr rx_stream,
+void inject_from_file(tx_injector::sptr injector,
     const std::string& file,
+    size_t samp_size,
     size_t samps_per_buff,
-    int num_requested_samples,
-    double settling_time,
-    std::vector<size_t> rx_channel_nums)
+    double start_time,
+    bool repeat,
+    double rate,
+    double lead_secs)
 {
-    int num_total_samps = 0;
-
-    // Prepare buffers for received samples and metadata
-    uhd::rx_metadata_t md;
-    //md.time_spec = usrp->get_time_now();
-
-    std::vector<std::vector<samp_type>> buffs(
-        rx_channel_nums.size(), std::vector<samp_type>(samps_per_buff));
-
-    // create a vector of pointers to point to each of the channel buffers
-    std::vector<samp_type*> buff_ptrs;
-    for (size_t i = 0; i < buffs.size(); i++) {
-        buff_ptrs.push_back(&buffs[i].front());
-    }
-
-    // Create one ofstream object per channel
-    // (use shared_ptr because ofstream is non-copyable)
-    std::vector<std::shared_ptr<std::ofstream>> outfiles;
-    for (size_t i = 0; i < buffs.size(); i++) {
-        const std::string this_filename = generate_out_filename(file, buffs.size(), i);
-        outfiles.push_back(std::shared_ptr<std::ofstream>(
-            new std::ofstream(this_filename.c_str(), std::ofstream::binary)));
-    }
-
-    UHD_ASSERT_THROW(outfiles.size() == buffs.size());
-    UHD_ASSERT_THROW(buffs.size() == rx_channel_nums.size());
-    bool overflow_message = true;
-    double timeout =
-        settling_time + 0.9f; // expected settling time + padding for first recv
-
-    // setup streaming
-    uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS);
-    stream_cmd.stream_now = false;
-    stream_cmd.time_spec  = uhd::time_spec_t(0.8);
-    rx_stream->issue_stream_cmd(stream_cmd);
-
-    while (not stop_signal_called
-           and (num_requested_samples > num_total_samps or num_requested_samples == 0)) {
-        // receiving from all channels (i think)
-        size_t num_rx_samps = rx_stream->recv(buff_ptrs, samps_per_buff, md, timeout);
-        timeout             = 0.1f; // small timeout for subsequent recv
-        if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
-            std::cout << boost::format("Timeout while streaming") << std::endl;
-            break;
-        }
-        if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW) {
-            if (overflow_message) {
-                overflow_message = false;
-                std::cerr
-                    << boost::format(
-                           "Got an overflow indication. Please consider the following:\n"
-                           "  Your write medium must sustain a rate of %fMB/s.\n"
-                           "  Dropped samples will not be written to the file.\n"
-                           "  Please modify this example for your purposes.\n"
-                           "  This message will not appear again.\n")
-                           % (usrp->get_rx_rate() * sizeof(samp_type) / 1e6);
-            }
+    std::ifstream infile(file.c_str(), std::ifstream::binary);
+    uint64_t total_samps = 0;
+    size_t pass_samps    = 0;
+    bool first           = true;
+    while (not stop_signal_called) {
+        pool_ref block = injector->get_block();
+        if (not block) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
             continue;
         }
-        if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE) {
-            throw std::runtime_error(
-                str(boost::format("Receiver error %s") % md.strerror()));
-        }
-
-        num_total_samps += num_rx_samps;
-
-        for (size_t i = 0; i < outfiles.size(); i++) {
-            outfiles[i]->write(
-                (const char*)buff_ptrs[i], num_rx_samps * sizeof(samp_type));
+        infile.read(block.data(), samps_per_buff * samp_size);
+        const size_t num_samps = size_t(infile.gcount()) / samp_size;
+        pass_samps += num_samps;
+        const bool at_end = infile.eof();
+        if (at_end) {
+            if (pass_samps == 0)
+                throw std::runtime_error("No samples in " + file);
+            infile.clear();
+            infile.seekg(0);
+            pass_samps = 0;
         }
-    }
-
-    // Shut down receiver
-    stream_cmd.stream_mode = uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS;
-    rx_stream->issue_stream_cmd(stream_cmd);
-
-    // Close files
-    for (size_t i = 0; i < outfiles.size(); i++) {
-        outfiles[i]->close();
+        tx_block_info info;
+        info.time_secs    = first ? start_time : -1;
+        info.end_of_burst = at_end and not repeat;
+        if (num_samps == 0 and not info.end_of_burst)
+            continue;
+        for (size_t c = 1; c < injector->num_channels(); c++)
+            std::memcpy(block.data() + c * injector->row_bytes(), block.data(),
+                num_samps * samp_size);
+
+        const double wait =
+            start_time + total_samps / rate - lead_secs - injector->device_time();
+        if (wait > 0)
+            std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+        while (not injector->push(block, num_samps, info) and not stop_signal_called)
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        first = false;
+        total_samps += num_samps;
+        if (info.end_of_burst)
+            return;
     }
 }
 
 
 /***********************************************************************
- * Main function
+ * Board configuration
+ * TX on channel 0 (board 0), one RX channel per board
  **********************************************************************/
-int UHD_SAFE_MAIN(int argc, char* argv[])
+device_settings board_settings(const po::variables_map& vm, size_t num_rx_channels)
 {
-    // transmit variables to be set by po
-    std::string tx_args, tx_ant, tx_subdev, otw, tx_channels;
-    double tx_rate, tx_freq, tx_gain, wave_freq, tx_bw;
-    float ampl;
-
-    // receive variables to be set by po
-    std::string rx_args, file_rx,file_rx2, file_tx, type, rx_ant, rx_subdev, rx_channels;
-    size_t total_num_samps, spb;
-    double rx_rate, rx_freq, rx_gain, rx_bw;
-    double settling;
-
-    // setup the program options
-    po::options_description desc("Allowed options");
-    // clang-format off
-    desc.add_options()
-        ("help", "help message")
-        ("tx-args", po::value<std::string>(&tx_args)->default_value(""), "uhd transmit device address args")
-        ("rx-args", po::value<std::string>(&rx_args)->default_value(""), "uhd receive device address args")
-        ("file-tx", po::value<std::string>(&file_tx), "name of the file to read binary samples from")
-        ("file-write", po::value<std::string>(&file_rx)->default_value("rx.dat"), "name of the file to write binary to")
-        ("file-write", po::value<std::string>(&file_rx2)->default_value("rx2.dat"), "name of the file to write binary to")
-        ("type", po::value<std::string>(&type)->default_value("short"), "sample type in file: double, float, or short")
-        ("nsamps", po::value<size_t>(&total_num_samps)->default_value(0), "total number of samples to receive")
-        ("settling", po::value<double>(&settling)->default_value(double(0.2)), "settling time (seconds) before receiving")
-        ("spb", po::value<size_t>(&spb)->default_value(0), "samples per buffer, 0 for default")
-        ("tx-rate", po::value<double>(&tx_rate), "rate of transmit outgoing samples")
-        ("rx-rate", po::value<double>(&rx_rate), "rate of receive incoming samples")
-        ("tx-freq", po::value<double>(&tx_freq), "transmit RF center frequency in Hz")
-        ("rx-freq", po::value<double>(&rx_freq), "receive RF center frequency in Hz")
-        ("ampl", po::value<float>(&ampl)->default_value(float(0.3)), "amplitude of the waveform [0 to 0.7]")
-        ("tx-gain", po::value<double>(&tx_gain), "gain for the transmit RF chain")
-        ("rx-gain", po::value<double>(&rx_gain), "gain for the receive RF chain")
-        ("tx-ant", po::value<std::string>(&tx_ant), "transmit antenna selection")
-        ("rx-ant", po::value<std::string>(&rx_ant), "receive antenna selection")
-        ("tx-subdev", po::value<std::string>(&tx_subdev), "transmit subdevice specification")
-        ("rx-subdev", po::value<std::string>(&rx_subdev), "receive subdevice specification")
-        ("tx-bw", po::value<double>(&tx_bw), "analog transmit filter bandwidth in Hz")
-        ("rx-bw", po::value<double>(&rx_bw), "analog receive filter bandwidth in Hz")
-        ("wave-freq", po::value<double>(&wave_freq)->default_value(0), "waveform frequency in Hz")
-        ("otw", po::value<std::string>(&otw)->default_value("sc16"), "specify the over-the-wire sample mode(sc8 or sc16)")
-        ("tx-channels", po::value<std::string>(&tx_channels)->default_value("0"), "which TX channel(s) to use (specify \"A:0\" only")
-        ("rx-channels", po::value<std::string>(&rx_channels)->default_value("1"), "which RX channel(s) to use (specify \"B:0\" only")
-        ("tx-int-n", "tune USRP TX with integer-N tuning")
-        ("rx-int-n", "tune USRP RX with integer-N tuning")
-        ("repeat", "repeatedly transmit file")
-  
-    ;
-    // clang-format on
-    po::variables_map vm;
-    po::store(po::parse_command_line(argc, argv, desc), vm);
-    po::notify(vm);
-
-    // print the help message
-    if (vm.count("help")) {
-        std::cout << boost::format("UHD TXRX Loopback to File %s") % desc << std::endl;
-        return ~0;
+    device_settings settings;
+    settings.tx_subdev[0] = "A:0";
+    settings.rx_subdev[uhd::usrp::multi_usrp::ALL_MBOARDS] = "A:0";
+
+    channel_settings& tx = settings.tx[0];
+    tx.rate              = vm["tx-rate"].as<double>();
+    tx.freq              = vm["tx-freq"].as<double>();
+    tx.int_n             = vm.count("tx-int-n") > 0;
+    if (vm.count("tx-gain"))
+        tx.gain = vm["tx-gain"].as<double>();
+    if (vm.count("tx-bw"))
+        tx.bandwidth = vm["tx-bw"].as<double>();
+    if (vm.count("tx-ant"))
+        tx.antenna = vm["tx-ant"].as<std::string>();
+
+    for (size_t i = 0; i < num_rx_channels; i++) {
+        channel_settings& rx = settings.rx[i];
+        rx.rate              = vm["rx-rate"].as<double>();
+        rx.freq              = vm["rx-freq"].as<double>();
+        rx.int_n             = vm.count("rx-int-n") > 0;
+        if (vm.count("rx-gain"))
+            rx.gain = vm["rx-gain"].as<double>();
+        if (vm.count("rx-bw"))
+            rx.bandwidth = vm["rx-bw"].as<double>();
+        rx.antenna = "RX2";
     }
+    return settings;
+}
 
-    bool repeat = vm.count("repeat") > 0;
-
-
-
-     /****************************
-    * Initiate MIMMO
-    *****************************/
-
-    //selecting which board in slave
-    size_t master_index = 0;
-    size_t slave_index = 1;
-
-    uhd::device_addr_t dev_addr;
-
-    //unsure how to properly configure addr0/1
-    dev_addr["addr0"] = tx_args;
-    dev_addr["addr1"] = rx_args;
-
-    uhd::usrp::multi_usrp::sptr usrp = uhd::usrp::multi_usrp::make(dev_addr); //makig a multi usrp for rx and tx
+//! The original set/get-per-setting sequence, kept to benchmark the
+//  batched configuration against (--serial-config)
+void configure_boards_serial(uhd::usrp::multi_usrp::sptr usrp,
+    const po::variables_map& vm,
+    size_t num_rx_channels)
+{
+    const double tx_rate = vm["tx-rate"].as<double>();
+    const double tx_freq = vm["tx-freq"].as<double>();
+    const double rx_rate = vm["rx-rate"].as<double>();
+    const double rx_freq = vm["rx-freq"].as<double>();
 
-    // create a usrp device/sub devices
     std::cout << std::endl;
-    std::cout << boost::format("Creating the transmit usrp sub device with: %s...") % tx_args
+    std::cout << boost::format("Creating the transmit usrp sub device on board 0...")
               << std::endl;
-    usrp->set_tx_subdev_spec(uhd::usrp::subdev_spec_t("A:0"), master_index);
+    usrp->set_tx_subdev_spec(uhd::usrp::subdev_spec_t("A:0"), 0);
     std::cout << std::endl;
-    std::cout << boost::format("Creating the receive usrp sub device with: %s... \n") % rx_args
+    std::cout << boost::format("Creating the receive usrp sub devices... \n")
               << std::endl;
     usrp->set_rx_subdev_spec(uhd::usrp::subdev_spec_t("A:0"));
 
-     //starting time synchronisation
-    std::cout << boost::format("\nTime Synchronisation") << std::endl;
-
-    std::cout << boost::format("Configuring UHD - %f - as slave") % slave_index
-              << std::endl;
-
-    usrp->set_clock_source("internal", slave_index);
-
-    usrp->set_time_now(uhd::time_spec_t(0.0), 0); // Time zero for MB0
-    //should automatically sync with master after this line   
-    usrp->set_time_source("mimo", master_index);
-    usrp->set_clock_source("mimo", master_index);
-
-    std::this_thread::sleep_for (std::chrono::milliseconds(50));
-    
-    //checking if clock/time sources have been set correctly
-    std::cout << boost::format("Master clock source: %s") %usrp->get_clock_source(master_index)
-              << std::endl;
-    std::cout << boost::format("Slave clock source: %s") %usrp->get_clock_source(slave_index)
-              << std::endl;
-    std::cout << boost::format("Master time source: %s") %usrp->get_time_source(master_index)
-    << std::endl;
-    std::cout << boost::format("Slave time source: %s") %usrp->get_time_source(slave_index)
-              << std::endl;
-    std::cout << boost::format("\n")
-               << std::endl;
-
-    std::cout << boost::format("Channel: Usrp number ")
-               << std::endl;
-
     std::cout << boost::format("Using Devices: %s") % usrp->get_pp_string()
                << std::endl;
 
-
      /****************************
     * TX Params
     *****************************/
@@ -375,11 +258,6 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
                     << std::endl;
 
         // set the transmit sample rate
-        if (not vm.count("tx-rate")) {
-            std::cerr << "Please specify the transmit sample rate with --tx-rate"
-                    << std::endl;
-            return ~0;
-        }
         std::cout << boost::format("Setting TX Rate: %f Msps...") % (tx_rate / 1e6)
                 << std::endl;
         usrp->set_tx_rate(tx_rate,0);
@@ -388,22 +266,12 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
                 << std::endl
                 << std::endl;
 
-        // set the transmit center frequency
-        if (not vm.count("tx-freq")) {
-            std::cerr << "Please specify the transmit center frequency with --tx-freq"
-                    << std::endl;
-            return ~0;
-        }
-
         //Tx channel Config
-        std::cout << "Configuring TX Channel " << tx_channels << std::endl;
-        
+        std::cout << "Configuring TX Channel 0" << std::endl;
+
         std::cout << boost::format("Setting TX Freq: %f MHz...") % (tx_freq / 1e6)
                     << std::endl;
-        uhd::tune_request_t tx_tune_request(tx_freq);
-        if (vm.count("tx-int-n"))
-            tx_tune_request.args = uhd::device_addr_t("mode_n=integer");
-        usrp->set_tx_freq(tx_tune_request, 0);
+        usrp->set_tx_freq(make_tune_request(tx_freq, vm.count("tx-int-n") > 0), 0);
         std::cout << boost::format("Actual TX Freq: %f MHz...")
                             % (usrp->get_tx_freq(0) / 1e6)
                     << std::endl
@@ -411,9 +279,10 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
 
         // set the rf gain
         if (vm.count("tx-gain")) {
+            const double tx_gain = vm["tx-gain"].as<double>();
             std::cout << boost::format("Setting TX Gain: %f dB...") % tx_gain
                       << std::endl;
-            usrp->set_tx_gain(tx_gain, master_index);
+            usrp->set_tx_gain(tx_gain, 0);
             std::cout << boost::format("Actual TX Gain: %f dB...")
                              % usrp->get_tx_gain(0)
                       << std::endl
@@ -422,9 +291,10 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
 
         // set the analog frontend filter bandwidth
         if (vm.count("tx-bw")) {
+            const double tx_bw = vm["tx-bw"].as<double>();
             std::cout << boost::format("Setting TX Bandwidth: %f MHz...") % (tx_bw/1e6)
                       << std::endl;
-            usrp->set_tx_bandwidth(tx_bw, master_index);
+            usrp->set_tx_bandwidth(tx_bw, 0);
             std::cout << boost::format("Actual TX Bandwidth: %f MHz...")
                              % (usrp->get_tx_bandwidth(0)/1e6)
                       << std::endl
@@ -433,23 +303,19 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
 
         // set the antenna
         if (vm.count("tx-ant"))
-            usrp->set_tx_antenna(tx_ant, master_index);
-    
+            usrp->set_tx_antenna(vm["tx-ant"].as<std::string>(), 0);
+
 
     /****************************
     * RX Params
     *****************************/
-    
-    for (size_t i = 0; i <= 1 ; i++)
+
+    for (size_t i = 0; i < num_rx_channels; i++)
     {
-        std::cout << boost::format("Setting RX Rate Chanel %f") % (i)
+        std::cout << boost::format("Setting RX Rate Chanel %d") % (i)
                 << std::endl;
 
         // set the receive sample rate
-        if (not vm.count("rx-rate")) {
-            std::cerr << "Please specify the sample rate with --rx-rate" << std::endl;
-            return ~0;
-        }
         std::cout << boost::format("Setting RX Rate: %f Msps...") % (rx_rate / 1e6)
                 << std::endl;
         usrp->set_rx_rate(rx_rate,i);
@@ -459,17 +325,9 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
                 << std::endl;
 
         // set the receive center frequency
-        if (not vm.count("rx-freq")) {
-            std::cerr << "Please specify the center frequency with --rx-freq"
-                      << std::endl;
-            return ~0;
-        }
         std::cout << boost::format("Setting RX Freq: %f MHz...") % (rx_freq / 1e6)
                   << std::endl;
-        uhd::tune_request_t rx_tune_request(rx_freq);
-        if (vm.count("rx-int-n"))
-            rx_tune_request.args = uhd::device_addr_t("mode_n=integer");
-        usrp->set_rx_freq(rx_tune_request,i);
+        usrp->set_rx_freq(make_tune_request(rx_freq, vm.count("rx-int-n") > 0), i);
         std::cout << boost::format("Actual RX Freq: %f MHz...")
                          % (usrp->get_rx_freq(i) / 1e6)
                   << std::endl
@@ -477,6 +335,7 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
 
         // set the receive rf gain
         if (vm.count("rx-gain")) {
+            const double rx_gain = vm["rx-gain"].as<double>();
             std::cout << boost::format("Setting RX Gain: %f dB...") % rx_gain
                       << std::endl;
             usrp->set_rx_gain(rx_gain,i);
@@ -488,6 +347,7 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
 
         // set the receive analog frontend filter bandwidth
         if (vm.count("rx-bw")) {
+            const double rx_bw = vm["rx-bw"].as<double>();
             std::cout << boost::format("Setting RX Bandwidth: %f MHz...") % (rx_bw / 1e6)
                       << std::endl;
             usrp->set_rx_bandwidth(rx_bw,i);
@@ -496,83 +356,295 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
                       << std::endl
                       << std::endl;
         }
+
+        usrp->set_rx_antenna(std::string("RX2"), i);
     }
-    
-    usrp->set_rx_antenna(std::string("RX2"), 1);
-    usrp->set_rx_antenna(std::string("RX2"), 0);
     //TX set by PO
 
     /****************************
     * Local Oscillators
     *****************************/
 
-   // 2021/11/16
-    //this may be an issue: need to figure out if local oscillator needs to be the same?
-
     // Check Ref and LO Lock detect
-    std::vector<std::string> tx_sensor_names, rx_sensor_names;
-    tx_sensor_names = usrp->get_tx_sensor_names(0);
-    if (std::find(tx_sensor_names.begin(), tx_sensor_names.end(), "lo_locked")
-        != tx_sensor_names.end()) {
-        uhd::sensor_value_t lo_locked = usrp->get_tx_sensor("lo_locked", 0);
-        std::cout << boost::format("Checking TX: %s ...") % lo_locked.to_pp_string()
+    check_lo_locked(usrp, "TX", 0);
+    for (size_t i = 0; i < num_rx_channels; i++)
+    {
+        check_lo_locked(usrp, "RX", i);
+    }
+
+    //for coherent receival
+    uhd::time_spec_t cmd_time = usrp->get_time_now() + uhd::time_spec_t(0.1);
+    //sets command time on all devices
+    //the next commands are all timed
+    usrp->set_command_time(cmd_time);
+    //tune every channel on the same command time
+    usrp->set_tx_freq(tx_freq, 0);
+    for (size_t i = 0; i < num_rx_channels; i++)
+    {
+        usrp->set_rx_freq(rx_freq, i);
+    }
+    //end timed commands
+    usrp->clear_command_time();
+}
+
+
+/***********************************************************************
+ * Main function
+ **********************************************************************/
+int UHD_SAFE_MAIN(int argc, char* argv[])
+{
+    // transmit variables to be set by po
+    std::string tx_args, otw;
+    double tx_rate, tx_freq;
+
+    // receive variables to be set by po
+    std::string rx_args, file_rx, file_tx, type, rx_type;
+    size_t total_num_samps, spb, num_rx_streamers;
+    double rx_rate, rx_freq;
+    double settling;
+
+    // multi-board variables to be set by po
+    std::string devices, sync;
+    std::vector<std::string> net_specs;
+    std::string shm_spec;
+
+    // rolling capture variables to be set by po
+    double segment_mb, retain_gb;
+    segment_config seg_config;
+
+    // inter-board calibration variables to be set by po
+    calibration_config cal_config;
+    double sim_noise;
+    size_t sim_delay;
+    std::string sim_iq;
+    std::string replay_file;
+    iq_correction_config iq_config;
+    std::string threads_spec;
+    double jitter_secs;
+    tx_injector_config inject_config;
+    double inject_lead;
+    size_t stats_block;
+    size_t overview_base;
+    size_t integrate_periods;
+    std::string rx_layout_name;
+    size_t rx_layout_block;
+    std::string cfar_file;
+    cfar_config cfar;
+    std::string doa_file;
+    doa_config doa;
+    std::string subbands;
+    channelizer_config chan_config;
+
+    // setup the program options
+    po::options_description desc("Allowed options");
+    // clang-format off
+    desc.add_options()
+        ("help", "help message")
+        ("devices", po::value<std::string>(&devices), "comma separated board addresses, one RX channel per board, TX on the first (\"sim\" entries simulate boards)")
+        ("tx-args", po::value<std::string>(&tx_args)->default_value(""), "uhd transmit device address args (first board when --devices is not given)")
+        ("rx-args", po::value<std::string>(&rx_args)->default_value(""), "uhd receive device address args (second board when --devices is not given)")
+        ("sync", po::value<std::string>(&sync), "board synchronisation: internal (1 board), mimo (2 boards, default) or external (10 MHz + PPS, default for more)")
+        ("rx-streamers", po::value<size_t>(&num_rx_streamers)->default_value(0), "number of RX streamers/threads the channels are split across, 0 for one per two channels")
+        ("replay", po::value<std::string>(&replay_file), "receive from this earlier capture instead of boards (its .json sidecar gives the rate, format and channels); TX is simulated")
+        ("replay-fast", "replay as fast as the host allows instead of at the capture's sample rate")
+        ("sim-fast", "run simulated boards as fast as the host allows instead of in real time")
+        ("sim-noise", po::value<double>(&sim_noise)->default_value(0.0), "amplitude of broadband noise common to all simulated boards")
+        ("sim-delay", po::value<size_t>(&sim_delay)->default_value(0), "samples each simulated board's noise lags the previous board's")
+        ("sim-iq", po::value<std::string>(&sim_iq), "front end impairments of the simulated boards, DC_I:DC_Q:GAIN_DB:PHASE_DEG")
+        ("iq-correct", "estimate and correct DC offset and IQ imbalance of each RX channel while streaming")
+        ("iq-estimate", "only estimate DC offset and IQ imbalance, recorded in the metadata file")
+        ("iq-time-const", po::value<double>(&iq_config.time_const_secs)->default_value(1.0), "seconds the DC and IQ estimates are averaged over")
+        ("cal", "estimate the delay and phase of channel 1 relative to channel 0 while streaming, recorded in the metadata file")
+        ("cal-apply", "also correct channel 1's phase and the integer delay in the recorded streams")
+        ("cal-fft", po::value<size_t>(&cal_config.fft_len)->default_value(4096), "calibration cross-correlation FFT length (power of two)")
+        ("cal-decim", po::value<size_t>(&cal_config.decim)->default_value(1), "downsampling before the calibration cross-correlation")
+        ("cal-interval", po::value<double>(&cal_config.interval_secs)->default_value(1.0), "seconds per calibration estimate")
+        ("file-tx", po::value<std::string>(&file_tx), "name of the file to read binary samples from")
+        ("net", po::value<std::vector<std::string>>(&net_specs), "also stream RX samples to tcp:PORT or udp:HOST:PORT[:BYTES] (repeatable)")
+        ("shm", po::value<std::string>(&shm_spec), "also publish RX samples in shared-memory ring NAME[:SLOTS] for local readers")
+        ("file-write", po::value<std::string>(&file_rx)->default_value("rx.dat"), "name of the file to write binary to (rx.00.dat, rx.01.dat, ... per channel)")
+        ("segment-mb", po::value<double>(&segment_mb)->default_value(0), "rotate the RX files every this many MB per channel (rx.000000.00.dat, ...)")
+        ("segment-secs", po::value<double>(&seg_config.max_secs)->default_value(0), "rotate the RX files every this many seconds")
+        ("subbands", po::value<std::string>(&subbands), "split each RX channel into N subbands and write the listed ones, N:BAND,BAND,... (negative bands below the centre)")
+        ("subband-oversample", "decimate the subbands by N/2 instead of N, so their edges do not alias")
+        ("subband-taps", po::value<size_t>(&chan_config.taps_per_band)->default_value(12), "prototype filter taps per subband")
+        ("subband-threads", po::value<size_t>(&chan_config.num_threads)->default_value(2), "threads filtering the subbands")
+        ("subband-only", "write only the subband files, not the full band")
+        ("rx-layout", po::value<std::string>(&rx_layout_name)->default_value("interleaved"), "RX file layout: interleaved, planar (I and Q in separate .i/.q files) or blocked (blocks of I then Q, see --rx-layout-block)")
+        ("rx-layout-block", po::value<size_t>(&rx_layout_block)->default_value(256), "samples per block of the blocked layout")
+        ("cfar", po::value<std::string>(&cfar_file), "with --repeat, pulse compress every RX period against the TX file and write only CFAR detections to this file (binary, or text if it ends in .csv)")
+        ("cfar-pulses", po::value<size_t>(&cfar.num_pulses)->default_value(16), "periods per Doppler FFT, 1 for range only")
+        ("cfar-train", po::value<size_t>(&cfar.train_cells)->default_value(16), "CFAR training cells on each side")
+        ("cfar-guard", po::value<size_t>(&cfar.guard_cells)->default_value(2), "CFAR guard cells on each side")
+        ("cfar-pfa", po::value<double>(&cfar.pfa)->default_value(1e-6), "CFAR false alarm probability per cell")
+        ("cfar-os", "ordered statistic CFAR instead of cell averaging")
+        ("cfar-threads", po::value<size_t>(&cfar.num_threads)->default_value(2), "threads running the detector")
+        ("doa", po::value<std::string>(&doa_file), "estimate the direction of arrival per frequency band from RX channels 0 and 1 and write the angle/power time series to this file")
+        ("doa-spacing", po::value<double>(&doa.spacing_m), "distance between the two antennas in metres, needed with --doa")
+        ("doa-cal-phase", po::value<double>(&doa.cal_phase_deg)->default_value(0), "phase of channel 1 relative to channel 0 in degrees not due to the geometry, as --cal reports it (0 behind --cal-apply)")
+        ("doa-fft", po::value<size_t>(&doa.fft_len)->default_value(1024), "DOA FFT length (power of two)")
+        ("doa-avg", po::value<size_t>(&doa.ffts_per_record)->default_value(16), "FFTs averaged per DOA record")
+        ("doa-bands", po::value<size_t>(&doa.num_bands)->default_value(64), "frequency bands per DOA record, dividing the FFT length (0 for every bin)")
+        ("doa-threads", po::value<size_t>(&doa.num_threads)->default_value(1), "threads running the DOA estimate")
+        ("integrate", po::value<size_t>(&integrate_periods), "with --repeat, average every N periods of the TX file and write only the averaged period of each RX channel (rx.00.avg.dat)")
+        ("stats", "write per-block power, peak, DC and clipping statistics next to each RX file (.stats)")
+        ("stats-block", po::value<size_t>(&stats_block)->default_value(65536), "samples per statistics record")
+        ("overview", "write a min/max/mean power overview pyramid next to each RX file (.ovr)")
+        ("overview-base", po::value<size_t>(&overview_base)->default_value(256), "samples per record of the finest overview level, a power of two")
+        ("retain-gb", po::value<double>(&retain_gb)->default_value(0), "with rotation, delete the oldest segments beyond this many GB in total")
+        ("type", po::value<std::string>(&type)->default_value("short"), "sample type in file: double, float, or short")
+        ("rx-type", po::value<std::string>(&rx_type)->default_value("double"), "sample type in the RX files: double, float, short, sc8 (use with --otw sc8) or sc12 (short packed to 12 bits, 3 bytes per sample)")
+        ("nsamps", po::value<size_t>(&total_num_samps)->default_value(0), "total number of samples to receive")
+        ("settling", po::value<double>(&settling)->default_value(double(0.8)), "device time (seconds) at which TX and RX streaming start")
+        ("spb", po::value<size_t>(&spb)->default_value(0), "samples per buffer, 0 for default")
+        ("tx-rate", po::value<double>(&tx_rate), "rate of transmit outgoing samples")
+        ("rx-rate", po::value<double>(&rx_rate), "rate of receive incoming samples")
+        ("tx-freq", po::value<double>(&tx_freq), "transmit RF center frequency in Hz")
+        ("rx-freq", po::value<double>(&rx_freq), "receive RF center frequency in Hz")
+        ("tx-gain", po::value<double>(), "gain for the transmit RF chain")
+        ("rx-gain", po::value<double>(), "gain for the receive RF chain")
+        ("tx-ant", po::value<std::string>(), "transmit antenna selection")
+        ("tx-bw", po::value<double>(), "analog transmit filter bandwidth in Hz")
+        ("rx-bw", po::value<double>(), "analog receive filter bandwidth in Hz")
+        ("otw", po::value<std::string>(&otw)->default_value("sc16"), "specify the over-the-wire sample mode(sc8 or sc16)")
+        ("tx-int-n", "tune USRP TX with integer-N tuning")
+        ("rx-int-n", "tune USRP RX with integer-N tuning")
+        ("repeat", "repeatedly transmit file")
+        ("tx-inject", "send the TX file through the low-latency injection queue, as an in-process producer would, and report producer to air latency")
+        ("tx-inject-lead", po::value<double>(&inject_lead)->default_value(0.01), "with --tx-inject, push each block this many seconds before it goes on air")
+        ("tx-inject-depth", po::value<size_t>(&inject_config.queue_depth)->default_value(64), "with --tx-inject, blocks the injection queue holds (power of two)")
+        ("serial-config", "configure the boards one set/get call at a time (the original sequence) instead of in one timed batch")
+        ("threads", po::value<std::string>(&threads_spec), "thread placement role=CORES[:POLICY[:PRIO]],... for recv, send, writer, net, dsp (or @FILE)")
+        ("mlockall", "lock all current and future memory of the process")
+        ("jitter-test", po::value<double>(&jitter_secs)->default_value(0), "before streaming, measure wakeup latency on each placement for this many seconds")
+
+    ;
+    // clang-format on
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    // print the help message
+    if (vm.count("help")) {
+        std::cout << boost::format("UHD TXRX Loopback to File %s") % desc << std::endl;
+        return ~0;
+    }
+
+    bool repeat = vm.count("repeat") > 0;
+
+    thread_topology topology;
+    if (vm.count("threads"))
+        topology = thread_topology::parse(threads_spec);
+    topology.mlockall = topology.mlockall or vm.count("mlockall");
+    set_thread_topology(topology);
+    if (jitter_secs > 0)
+        run_jitter_test(jitter_secs);
+
+    if (not vm.count("tx-rate")) {
+        std::cerr << "Please specify the transmit sample rate with --tx-rate"
                   << std::endl;
-        UHD_ASSERT_THROW(lo_locked.to_bool());
-     }
-
-     for (size_t i = 0; i <= 1; i++)
-     {
-        rx_sensor_names = usrp->get_rx_sensor_names(i);
-        if (std::find(rx_sensor_names.begin(), rx_sensor_names.end(), "lo_locked")
-        != rx_sensor_names.end()) {
-        uhd::sensor_value_t lo_locked = usrp->get_rx_sensor("lo_locked", i);
-        std::cout << boost::format("Checking RX: %s ...") % lo_locked.to_pp_string()
+        return ~0;
+    }
+    if (not vm.count("tx-freq")) {
+        std::cerr << "Please specify the transmit center frequency with --tx-freq"
                   << std::endl;
-        UHD_ASSERT_THROW(lo_locked.to_bool());
+        return ~0;
     }
-     }
-     
-    /****************************
-    * Comms/Timing Params
+    if (not vm.count("rx-rate")) {
+        std::cerr << "Please specify the sample rate with --rx-rate" << std::endl;
+        return ~0;
+    }
+    if (not vm.count("rx-freq")) {
+        std::cerr << "Please specify the center frequency with --rx-freq" << std::endl;
+        return ~0;
+    }
+
+
+     /****************************
+    * Initiate boards
     *****************************/
 
-    //This check is an abriged version found in other standard files
-    tx_sensor_names = usrp->get_mboard_sensor_names(master_index);
-     if (1)
-    {
-        uhd::sensor_value_t mimo_locked = usrp->get_mboard_sensor("mimo_locked", master_index);
-        std::cout << boost::format("Checking TX: %s ...") % mimo_locked.to_pp_string()
+    std::vector<std::string> device_list;
+    if (vm.count("devices")) {
+        device_list = parse_device_list(devices);
+    } else {
+        device_list.push_back(tx_args);
+        device_list.push_back(rx_args);
+    }
+    std::shared_ptr<replay_stream_device> replay_device;
+    if (vm.count("replay")) {
+        replay_config config;
+        config.file     = replay_file;
+        config.realtime = (vm.count("replay-fast") == 0);
+        replay_device.reset(new replay_stream_device(config));
+    }
+    const size_t num_rx_channels =
+        replay_device ? replay_device->get_capture()->num_channels() : device_list.size();
+    const bool sim = is_sim_device_list(device_list);
+    if (not vm.count("sync"))
+        sync = default_sync_mode(device_list.size());
+
+    stream_device::sptr device;
+    uhd::usrp::multi_usrp::sptr usrp; // real boards only
+    if (replay_device) {
+        const replay_capture::sptr capture = replay_device->get_capture();
+        std::cout << boost::format("Replaying %d channels of %s, %d samples at %f Msps%s")
+                         % num_rx_channels % replay_file % capture->num_samps()
+                         % (capture->rate() / 1e6)
+                         % (vm.count("replay-fast") ? " (as fast as possible)" : "")
                   << std::endl;
-        UHD_ASSERT_THROW(mimo_locked.to_bool());
-     }
-
-    rx_sensor_names = usrp->get_mboard_sensor_names(slave_index);
-     if (1)
-    {
-        uhd::sensor_value_t mimo_locked = usrp->get_mboard_sensor("mimo_locked", slave_index);
-        std::cout << boost::format("Checking RX: %s ...") % mimo_locked.to_pp_string()
+        device = replay_device;
+    } else if (sim) {
+        std::cout << boost::format("Simulating %d boards") % device_list.size()
                   << std::endl;
-        UHD_ASSERT_THROW(mimo_locked.to_bool());
-     }
+        sim_config config;
+        config.num_channels = num_rx_channels;
+        config.rate         = rx_rate;
+        config.realtime     = (vm.count("sim-fast") == 0);
+        config.noise_ampl   = float(sim_noise);
+        config.chan_delay   = sim_delay;
+        if (vm.count("sim-iq")) {
+            std::vector<std::string> fields;
+            boost::split(fields, sim_iq, boost::is_any_of(":"));
+            if (fields.size() != 4)
+                throw std::runtime_error("Expected --sim-iq DC_I:DC_Q:GAIN_DB:PHASE_DEG");
+            config.dc_offset =
+                std::complex<float>(std::stof(fields[0]), std::stof(fields[1]));
+            config.iq_gain      = std::pow(10.0f, std::stof(fields[2]) / 20);
+            config.iq_phase_deg = std::stof(fields[3]);
+        }
+        device              = sim_stream_device::make(config);
+    } else {
+        usrp = uhd::usrp::multi_usrp::make(make_multi_device_addr(device_list));
+        sync_devices(usrp, sync);
+        if (vm.count("serial-config")) {
+            const std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            configure_boards_serial(usrp, vm, num_rx_channels);
+            std::cout << boost::format("Serial configuration: %.1f ms")
+                             % (std::chrono::duration<double>(
+                                    std::chrono::steady_clock::now() - start)
+                                       .count()
+                                   * 1e3)
+                      << std::endl;
+        } else {
+            print_config_report(
+                apply_device_settings(usrp, board_settings(vm, num_rx_channels)));
+        }
+
+        /****************************
+        * Comms/Timing Params
+        *****************************/
+
+        verify_device_sync(usrp, sync);
+        device = usrp_stream_device::make(usrp);
+    }
 
     if (total_num_samps == 0) {
         std::signal(SIGINT, &sig_int_handler);
         std::cout << "Press Ctrl + C to stop streaming..." << std::endl;
     }
 
-
-    //for coherent receival
-    uhd::time_spec_t cmd_time = usrp->get_time_now() + uhd::time_spec_t(0.1);
-    //sets command time on all devices
-    //the next commands are all timed
-    usrp->set_command_time(cmd_time);
-    //tune channel 0 and channel 1
-    usrp->set_tx_freq(tx_freq, 0); // Channel 0
-    usrp->set_rx_freq(rx_freq, 0); // Channel 1
-    usrp->set_rx_freq(rx_freq, 1); // Channel 1
-    //end timed commands
-    usrp->clear_command_time();
-  
    /****************************
     * TX/RX Threads
     *****************************/
@@ -587,94 +659,289 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     else if (type == "short")
         cpu_format = "sc16";
 
-    std::string rx_type = "double";
-    std::string rx_cpu_format = "fc64";
+    std::string rx_cpu_format;
+    if (rx_type == "double")
+        rx_cpu_format = "fc64";
+    else if (rx_type == "float")
+        rx_cpu_format = "fc32";
+    else if (rx_type == "short" or rx_type == "sc12")
+        rx_cpu_format = "sc16";
+    else if (rx_type == "sc8")
+        rx_cpu_format = "sc8";
+    else
+        throw std::runtime_error("Unknown RX type " + rx_type);
+    // sc12 is received as sc16 and packed by the file writers
+    const std::string rx_file_format = rx_type == "sc12" ? "sc12" : rx_cpu_format;
 
     //Tx and Rx streamer args
     uhd::stream_args_t tx_stream_args(cpu_format, otw);
-    uhd::stream_args_t rx_stream_args(rx_cpu_format, otw);
-
-    //rx recieve chanels
-    // 0 tx board, 1 rx only
-    std::vector<size_t> rx_channel_nums;
-    rx_channel_nums.push_back(0);
-    rx_channel_nums.push_back(1);
-    rx_stream_args.channels = rx_channel_nums;
-    
+
     //keep 200
     size_t tx_spb = 200;
 
-
     //setting streamer args
-    uhd::tx_streamer::sptr tx_stream = usrp->get_tx_stream(tx_stream_args);
-    uhd::rx_streamer::sptr rx_stream = usrp->get_rx_stream(rx_stream_args);
-
+    uhd::tx_streamer::sptr tx_stream = device->get_tx_stream(tx_stream_args);
 
     // allocate a buffer which we re-use for each channel
     if (spb == 0)
         spb = tx_stream->get_max_num_samps() * 10;
 
+    //rx recieve chanels, one per board, split across the RX streamers so
+    //no single streamer/thread has to carry every board
+    if (num_rx_streamers == 0)
+        num_rx_streamers = default_num_rx_streamers(num_rx_channels);
+    const std::vector<std::vector<size_t>> rx_groups =
+        partition_channels(num_rx_channels, num_rx_streamers);
+    std::vector<uhd::rx_streamer::sptr> rx_streams;
+    for (size_t g = 0; g < rx_groups.size(); g++) {
+        uhd::stream_args_t rx_stream_args(rx_cpu_format, otw);
+        rx_stream_args.channels = rx_groups[g];
+        rx_streams.push_back(device->get_rx_stream(rx_stream_args));
+    }
+    std::cout << boost::format("Receiving %d channels on %d streamers")
+                     % num_rx_channels % rx_streams.size()
+              << std::endl;
 
-    
     //send from file
     //start transmit worker thread
     boost::thread_group transmit_thread;
     boost::thread_group receive_thread;
 
-    //reset usrp time to prepare for transmit/receive
+    //reset usrp time to prepare for transmit/receive; boards are reset
+    //through their sync mode, so the alignment checked above still holds
     std::cout << boost::format("Setting device timestamp to 0...") << std::endl;
-    usrp->set_time_now(uhd::time_spec_t(0.0));
+    if (usrp) {
+        reset_device_time(usrp, sync);
+        verify_device_sync(usrp, sync);
+    } else {
+        device->set_time_now(uhd::time_spec_t(0.0));
+    }
+
+    capture_metadata::sptr metadata(new capture_metadata(file_rx));
+    metadata->set("rate", device->get_rx_rate());
+    metadata->set("freq", rx_freq);
+    metadata->set("cpu_format", rx_cpu_format);
+    metadata->set("file_format", rx_file_format);
+    const sample_layout rx_layout = parse_sample_layout(rx_layout_name);
+    metadata->set("layout", sample_layout_name(rx_layout));
+    if (rx_layout == sample_layout::blocked)
+        metadata->set("layout_block_samps", rx_layout_block);
+    metadata->set("num_channels", num_rx_channels);
+    metadata->set("start_time", settling);
+    if (replay_device) {
+        metadata->set("freq", replay_device->get_capture()->freq());
+        metadata->set("replay.source", replay_file);
+        metadata->set("replay.realtime", vm.count("replay-fast") == 0);
+    }
+
+    //statistics, network and shared-memory sinks are shared by all RX
+    //streamers, behind the correcting stages (IQ first, then calibration)
+    std::vector<rx_sink::sptr> net_sinks;
+    const size_t samp_size = (rx_type == "double") ? sizeof(std::complex<double>)
+                             : (rx_type == "float") ? sizeof(std::complex<float>)
+                             : (rx_type == "sc8")   ? sizeof(std::complex<int8_t>)
+                                                    : sizeof(std::complex<short>);
+    if (vm.count("iq-correct") or vm.count("iq-estimate")) {
+        iq_config.apply = vm.count("iq-correct") > 0;
+        net_sinks.push_back(rx_sink::sptr(new iq_correction(
+            iq_config, num_rx_channels, device->get_rx_rate(), metadata)));
+    }
+    if (vm.count("cal") or vm.count("cal-apply")) {
+        if (num_rx_channels < 2)
+            throw std::runtime_error("Calibration needs at least two RX channels");
+        cal_config.apply = vm.count("cal-apply") > 0;
+        net_sinks.push_back(rx_sink::sptr(
+            new mimo_calibration(cal_config, device->get_rx_rate(), metadata)));
+    }
+    if (vm.count("doa")) {
+        if (num_rx_channels < 2)
+            throw std::runtime_error("--doa needs at least two RX channels");
+        if (not vm.count("doa-spacing"))
+            throw std::runtime_error("--doa needs --doa-spacing");
+        doa.freq = metadata->get<double>("freq", rx_freq);
+        net_sinks.push_back(rx_sink::sptr(
+            new doa_estimator(doa, doa_file, device->get_rx_rate(), metadata)));
+    }
+    if (vm.count("stats")) {
+        net_sinks.push_back(rx_sink::sptr(new block_stats(file_rx, num_rx_channels,
+            samp_size, device->get_rx_rate(), stats_block, metadata)));
+    }
+    if (vm.count("subbands")) {
+        std::vector<std::string> fields;
+        boost::split(fields, subbands, boost::is_any_of(":,"));
+        if (fields.size() < 2)
+            throw std::runtime_error("Expected --subbands N:BAND,BAND,...");
+        chan_config.num_bands  = std::stoul(fields[0]);
+        chan_config.oversample = vm.count("subband-oversample") > 0;
+        for (size_t i = 1; i < fields.size(); i++)
+            chan_config.bands.push_back(std::stoi(fields[i]));
+        net_sinks.push_back(rx_sink::sptr(new channelizer(chan_config, file_rx,
+            num_rx_channels, samp_size, device->get_rx_rate(), rx_freq, metadata)));
+    }
+    if (vm.count("integrate")) {
+        if (not repeat)
+            throw std::runtime_error("--integrate needs --repeat");
+        // one pass of the TX file, in RX samples
+        const uint64_t file_samps = boost::filesystem::file_size(file_tx)
+                                    / sample_format_size(parse_sample_format(type));
+        const double period =
+            file_samps * device->get_rx_rate() / device->get_tx_rate();
+        const size_t period_samps = size_t(std::llround(period));
+        if (period_samps == 0 or std::abs(period - period_samps) > 1e-6)
+            throw std::runtime_error(str(boost::format("The TX file is %d samples, not a "
+                                                       "whole number of RX samples")
+                                         % file_samps));
+        net_sinks.push_back(rx_sink::sptr(new period_integrator(file_rx, num_rx_channels,
+            samp_size, device->get_rx_rate(), rx_freq, period_samps, integrate_periods,
+            metadata)));
+    }
+    if (vm.count("cfar")) {
+        if (not repeat)
+            throw std::runtime_error("--cfar needs --repeat");
+        if (device->get_rx_rate() != device->get_tx_rate())
+            throw std::runtime_error("--cfar needs the same TX and RX rates");
+        // the TX file is the pulse, one period
+        const sample_format tx_format = parse_sample_format(type);
+        std::ifstream pulse_file(file_tx.c_str(), std::ifstream::binary);
+        std::vector<char> raw((std::istreambuf_iterator<char>(pulse_file)),
+            std::istreambuf_iterator<char>());
+        std::vector<std::complex<float>> pulse(raw.size() / sample_format_size(tx_format));
+        if (pulse.empty() or (pulse.size() & (pulse.size() - 1)) != 0)
+            throw std::runtime_error(str(boost::format("--cfar needs a TX file of a power "
+                                                       "of two samples, not %d")
+                                         % pulse.size()));
+        convert_samples(&raw.front(), tx_format, &pulse.front(), sample_format::fc32,
+            pulse.size());
+        cfar.ordered = vm.count("cfar-os") > 0;
+        net_sinks.push_back(rx_sink::sptr(new cfar_detector(cfar, pulse, cfar_file,
+            num_rx_channels, samp_size, device->get_rx_rate(), metadata)));
+    }
+    for (size_t i = 0; i < net_specs.size(); i++) {
+        net_sinks.push_back(rx_sink::sptr(new net_sink(net_specs[i])));
+    }
+    if (vm.count("shm")) {
+        net_sinks.push_back(rx_sink::sptr(make_shm_sink(
+            shm_spec, num_rx_channels, samp_size, device->get_rx_rate(), spb)));
+    }
+
+    //rolling capture takes every channel in one sink, so the segments of
+    //all channels line up
+    seg_config.max_bytes    = uint64_t(segment_mb * 1e6);
+    seg_config.retain_bytes = uint64_t(retain_gb * 1e9);
+    const bool segmented    = seg_config.max_bytes != 0 or seg_config.max_secs > 0;
+    const bool full_band    = vm.count("subband-only") == 0 and vm.count("integrate") == 0;
+    if (segmented and full_band) {
+        if (rx_layout != sample_layout::interleaved)
+            throw std::runtime_error("--rx-layout is for plain files, not segments");
+        if (vm.count("overview"))
+            throw std::runtime_error("--overview is for plain files, not segments");
+        net_sinks.push_back(rx_sink::sptr(new segment_sink(file_rx, num_rx_channels,
+            samp_size, device->get_rx_rate(), seg_config, metadata, rx_file_format)));
+    }
 
-    //set Rx Thread 1
+    //one receive buffer pool for all streamers, so blocks can be held by
+    //the shared sinks without copying
+    size_t max_group_size = 0;
+    for (size_t g = 0; g < rx_groups.size(); g++)
+        max_group_size = std::max(max_group_size, rx_groups[g].size());
+    buffer_pool::sptr rx_pool;
     if (rx_type == "double")
-        receive_thread.create_thread(std::bind(&recv_to_file<std::complex<double>>,
-            usrp, rx_stream,file_rx, spb, total_num_samps, settling, rx_channel_nums));
-    else if (rx_type  == "float")
-        receive_thread.create_thread(std::bind(&recv_to_file<std::complex<float>>,
-            usrp, rx_stream,file_rx, spb, total_num_samps, settling, rx_channel_nums));
-    else if (rx_type == "short")
-        receive_thread.create_thread(std::bind(&recv_to_file<std::complex<short>>,
-            usrp, rx_stream,file_rx, spb, total_num_samps, settling, rx_channel_nums));
-    else {
-        // clean up transmit worker
-        stop_signal_called = true;
-        transmit_thread.join_all();
-        receive_thread.join_all();
-        throw std::runtime_error("Unknown type " + type);
+        rx_pool = make_recv_pool<std::complex<double>>(max_group_size, spb, rx_groups.size());
+    else if (rx_type == "float")
+        rx_pool = make_recv_pool<std::complex<float>>(max_group_size, spb, rx_groups.size());
+    else if (rx_type == "sc8")
+        rx_pool = make_recv_pool<std::complex<int8_t>>(max_group_size, spb, rx_groups.size());
+    else
+        rx_pool = make_recv_pool<std::complex<short>>(max_group_size, spb, rx_groups.size());
+
+    //set Rx Threads, every streamer starts at the same device time
+    for (size_t g = 0; g < rx_streams.size(); g++) {
+        std::vector<rx_sink::sptr> sinks(net_sinks);
+        if (not segmented and full_band) {
+            sinks.push_back(rx_sink::sptr(new file_sink(file_rx, rx_groups[g].size(),
+                rx_groups[g].front(), num_rx_channels, rx_file_format, rx_layout,
+                rx_layout_block)));
+            if (vm.count("overview"))
+                sinks.push_back(rx_sink::sptr(new overview_pyramid(file_rx,
+                    rx_groups[g].size(), rx_groups[g].front(), num_rx_channels,
+                    samp_size, device->get_rx_rate(), overview_base, metadata)));
+        }
+        if (rx_type == "double")
+            receive_thread.create_thread(with_thread_role("recv",
+                std::bind(&recv_to_sinks<std::complex<double>>, device, rx_streams[g],
+                    sinks, spb, total_num_samps, settling, rx_groups[g].front(),
+                    rx_pool)));
+        else if (rx_type  == "float")
+            receive_thread.create_thread(with_thread_role("recv",
+                std::bind(&recv_to_sinks<std::complex<float>>, device, rx_streams[g],
+                    sinks, spb, total_num_samps, settling, rx_groups[g].front(),
+                    rx_pool)));
+        else if (rx_type == "short" or rx_type == "sc12")
+            receive_thread.create_thread(with_thread_role("recv",
+                std::bind(&recv_to_sinks<std::complex<short>>, device, rx_streams[g],
+                    sinks, spb, total_num_samps, settling, rx_groups[g].front(),
+                    rx_pool)));
+        else if (rx_type == "sc8")
+            receive_thread.create_thread(with_thread_role("recv",
+                std::bind(&recv_to_sinks<std::complex<int8_t>>, device, rx_streams[g],
+                    sinks, spb, total_num_samps, settling, rx_groups[g].front(),
+                    rx_pool)));
+        else {
+            // clean up transmit worker
+            stop_signal_called = true;
+            transmit_thread.join_all();
+            receive_thread.join_all();
+            throw std::runtime_error("Unknown type " + type);
+        }
     }
 
-       //set TX Thread
-    if (type == "double"){
-        transmit_thread.create_thread(std::bind(
-        &send_from_file<std::complex<double>>, usrp,tx_stream,file_tx,tx_spb, repeat));
+       //set TX Thread, with a monitor for its async messages
+    tx_async_monitor::sptr tx_monitor(new tx_async_monitor(tx_stream));
+    tx_injector::sptr injector;
+    if (vm.count("tx-inject")) {
+        const size_t tx_samp_size = sample_format_size(parse_sample_format(type));
+        inject_config.block_samps = tx_spb;
+        injector.reset(new tx_injector(
+            tx_stream, inject_config, tx_samp_size, device->get_tx_rate(), tx_monitor));
+        injector->sync_clock(device->get_time_now());
+        transmit_thread.create_thread(with_thread_role("send",
+            std::bind(&inject_from_file, injector, file_tx, tx_samp_size, tx_spb, settling,
+                repeat, device->get_tx_rate(), inject_lead)));
+    }
+    else if (type == "double"){
+        transmit_thread.create_thread(with_thread_role("send", std::bind(
+        &send_from_file<std::complex<double>>, tx_stream, file_tx, tx_spb, settling, repeat, tx_monitor)));
     }
     else if (type == "float"){
-        transmit_thread.create_thread(std::bind(
-        &send_from_file<std::complex<float>>,usrp, tx_stream,file_tx,tx_spb,repeat));
+        transmit_thread.create_thread(with_thread_role("send", std::bind(
+        &send_from_file<std::complex<float>>, tx_stream, file_tx, tx_spb, settling, repeat, tx_monitor)));
     }
     else if (type == "short"){
-        transmit_thread.create_thread(std::bind(
-        &send_from_file<std::complex<short>>,usrp, tx_stream, file_tx,tx_spb,repeat));
+        transmit_thread.create_thread(with_thread_role("send", std::bind(
+        &send_from_file<std::complex<short>>, tx_stream, file_tx, tx_spb, settling, repeat, tx_monitor)));
     }
     else
         throw std::runtime_error("Unknown type " + type);
- 
-    while (not stop_signal_called) {
-        
-         std::this_thread::sleep_for (std::chrono::milliseconds(1));
-    }
 
-    
     /****************************
     * End Threads
     *****************************/
 
-    // clean up transmit worker
+    // the receivers run until --nsamps or Ctrl + C, then stop the transmitter
+    receive_thread.join_all();
     stop_signal_called = true;
     transmit_thread.join_all();
-    receive_thread.join_all();
+    if (injector)
+        injector->stop();
+    tx_monitor->stop();
+    tx_monitor->report(metadata);
+    if (injector)
+        injector->report(metadata);
+    net_sinks.clear();
+    metadata->write();
+    print_thread_report();
 
     // finished
     std::cout << std::endl << "Done!" << std::endl << std::endl;
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
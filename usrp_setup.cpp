@@ -0,0 +1,86 @@
+#include "usrp_setup.hpp"
+#include <uhd/exception.hpp>
+#include <uhd/types/device_addr.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+//! Poll read_sensor until it reports locked or timeout seconds pass
+static uhd::sensor_value_t wait_locked(
+    const std::function<uhd::sensor_value_t()>& read_sensor, double timeout)
+{
+    const std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now()
+        + std::chrono::microseconds(static_cast<long long>(timeout * 1e6));
+    uhd::sensor_value_t locked = read_sensor();
+    while (not locked.to_bool() and std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        locked = read_sensor();
+    }
+    return locked;
+}
+
+uhd::tune_request_t make_tune_request(double freq, bool int_n)
+{
+    uhd::tune_request_t tune_request(freq);
+    if (int_n)
+        tune_request.args = uhd::device_addr_t("mode_n=integer");
+    return tune_request;
+}
+
+void check_lo_locked(uhd::usrp::multi_usrp::sptr usrp,
+    const std::string& direction,
+    size_t chan,
+    double timeout)
+{
+    const bool tx = (direction == "TX");
+    const std::vector<std::string> sensor_names =
+        tx ? usrp->get_tx_sensor_names(chan) : usrp->get_rx_sensor_names(chan);
+    if (std::find(sensor_names.begin(), sensor_names.end(), "lo_locked")
+        == sensor_names.end()) {
+        return;
+    }
+    uhd::sensor_value_t lo_locked = wait_locked(
+        [&] {
+            return tx ? usrp->get_tx_sensor("lo_locked", chan)
+                      : usrp->get_rx_sensor("lo_locked", chan);
+        },
+        timeout);
+    std::cout << boost::format("Checking %s: %s ...") % direction
+                     % lo_locked.to_pp_string()
+              << std::endl;
+    UHD_ASSERT_THROW(lo_locked.to_bool());
+}
+
+void check_mboard_locked(uhd::usrp::multi_usrp::sptr usrp,
+    const std::string& sensor,
+    size_t mboard,
+    const std::string& label,
+    double timeout)
+{
+    const std::vector<std::string> sensor_names = usrp->get_mboard_sensor_names(mboard);
+    if (std::find(sensor_names.begin(), sensor_names.end(), sensor)
+        == sensor_names.end()) {
+        return;
+    }
+    uhd::sensor_value_t locked = wait_locked(
+        [&] { return usrp->get_mboard_sensor(sensor, mboard); }, timeout);
+    std::cout << boost::format("Checking %s: %s ...") % label % locked.to_pp_string()
+              << std::endl;
+    UHD_ASSERT_THROW(locked.to_bool());
+}
+
+void check_ref_locked(uhd::usrp::multi_usrp::sptr usrp,
+    const std::string& ref,
+    size_t mboard,
+    const std::string& label,
+    double timeout)
+{
+    if (ref == "mimo")
+        check_mboard_locked(usrp, "mimo_locked", mboard, label, timeout);
+    else if (ref == "external")
+        check_mboard_locked(usrp, "ref_locked", mboard, label, timeout);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <uhd/types/tune_request.hpp>
+#include <uhd/usrp/multi_usrp.hpp>
+#include <string>
+
+/***********************************************************************
+ * Device setup helpers shared by the record and loopback tools
+ **********************************************************************/
+//! Tune request for freq, optionally with integer-N tuning
+uhd::tune_request_t make_tune_request(double freq, bool int_n);
+
+//! Assert the "lo_locked" sensor of a TX ("TX") or RX ("RX") channel,
+//  if the frontend has one. The check* helpers poll for up to timeout
+//  seconds before giving up, so they double as readiness waits.
+void check_lo_locked(uhd::usrp::multi_usrp::sptr usrp,
+    const std::string& direction,
+    size_t chan,
+    double timeout = 0.0);
+
+//! Assert a motherboard lock sensor ("ref_locked", "mimo_locked"), if the
+//  board has it. label is only used for the console output.
+void check_mboard_locked(uhd::usrp::multi_usrp::sptr usrp,
+    const std::string& sensor,
+    size_t mboard,
+    const std::string& label,
+    double timeout = 0.0);
+
+//! Check whichever lock sensor matches the clock reference: "mimo_locked"
+//  for ref == "mimo", "ref_locked" for ref == "external", none otherwise
+void check_ref_locked(uhd::usrp::multi_usrp::sptr usrp,
+    const std::string& ref,
+    size_t mboard,
+    const std::string& label,
+    double timeout = 0.0);
@@ -6,6 +6,8 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 //
 
+#pragma once
+
 #include <cmath>
 #include <complex>
 #include <stdexcept>
@@ -14,6 +16,8 @@
 #include <algorithm>
 
 static const size_t wave_table_len = 8192;
+static_assert((wave_table_len & (wave_table_len - 1)) == 0,
+    "fill() wraps the table index with a mask");
 
 class wave_table_class
 {
@@ -71,6 +75,20 @@ public:
         return _wave_table[index % wave_table_len];
     }
 
+    //! Fill out[0..n) with the samples at index + step, index + 2 * step, ...
+    //  (the same sequence as calling operator()(index += step) n times) and
+    //  return the updated index.
+    inline size_t fill(
+        std::complex<float>* out, const size_t n, size_t index, const size_t step) const
+    {
+        const std::complex<float>* table = _wave_table.data();
+        for (size_t i = 0; i < n; i++) {
+            index += step;
+            out[i] = table[index & (wave_table_len - 1)];
+        }
+        return index;
+    }
+
     //! Return the signal power in dBFS
     inline double get_power() const
     {
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/***********************************************************************
+ * window_pairing
+ * Cuts two channels into windows of span samples and pairs window k of
+ * one channel with window k of the other, for stages that need both
+ * channels over the same samples (calibration, DOA). The channels may
+ * come from different recv threads; each calls fill() for its own side.
+ *
+ * A window is filled from its first sample only, so start and overflow
+ * gaps skip to the next boundary. When no window is free (the owner's
+ * workers are behind) the samples are skipped and the window counted as
+ * dropped. A half filled window is recycled once the other channel is
+ * more than num_windows behind, but never while a side is still filling
+ * it, so the lagging thread cannot write into a window that has become
+ * another index.
+ *
+ * Claims and submits lock the owner's mutex; on_pair(window*) runs
+ * under it once both halves are in, and the owner hands the window back
+ * with release(), also under the mutex, when it is done with it.
+ **********************************************************************/
+template <typename payload_type>
+class window_pairing
+{
+public:
+    struct window
+    {
+        uint64_t index;
+        double time_secs; // device time of the first sample
+        payload_type data;
+        bool filled[2];
+        bool held[2]; // a side is filling it
+        bool in_use;
+    };
+
+    window_pairing(size_t num_windows, uint64_t span, std::mutex& mutex)
+        : _span(span), _mutex(mutex), _windows(std::max<size_t>(1, num_windows)), _dropped(0)
+    {
+        for (window& win : _windows) {
+            win.in_use = false;
+        }
+        _current[0] = _current[1] = nullptr;
+    }
+
+    window_pairing(const window_pairing&) = delete;
+    window_pairing& operator=(const window_pairing&) = delete;
+
+    //! For sizing the payloads before streaming starts
+    std::vector<window>& windows()
+    {
+        return _windows;
+    }
+
+    //! Windows skipped for want of a free one; read under the mutex
+    uint64_t num_dropped() const
+    {
+        return _dropped;
+    }
+
+    //! Feeds samples first_samp .. of side. copy(window&, window_offset,
+    //  block_offset, count) moves count samples into the window.
+    template <typename copy_fn, typename pair_fn>
+    void fill(size_t side,
+        uint64_t first_samp,
+        size_t num_samps,
+        double time_secs,
+        double rate,
+        copy_fn copy,
+        pair_fn on_pair)
+    {
+        const uint64_t end = first_samp + num_samps;
+        uint64_t pos       = first_samp;
+        while (pos < end) {
+            const uint64_t index = pos / _span;
+            const size_t offset  = size_t(pos % _span);
+            window* win          = _current[side];
+            if (win == nullptr or win->index != index) {
+                if (win != nullptr)
+                    abandon(win, side);
+                _current[side] = win = nullptr;
+                if (offset == 0) {
+                    win = _current[side] =
+                        claim(side, index, time_secs + double(pos - first_samp) / rate);
+                }
+                if (win == nullptr) {
+                    pos = (index + 1) * _span;
+                    continue;
+                }
+            }
+            const size_t count = size_t(std::min<uint64_t>(_span - offset, end - pos));
+            copy(*win, offset, size_t(pos - first_samp), count);
+            pos += count;
+            if (offset + count == _span) {
+                submit(win, side, on_pair);
+                _current[side] = nullptr;
+            }
+        }
+    }
+
+    //! The owner is done with a paired window; call under the mutex
+    void release(window* win)
+    {
+        win->in_use = false;
+    }
+
+private:
+    window* claim(size_t side, uint64_t index, double time_secs)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        window* free_win = nullptr;
+        for (window& win : _windows) {
+            if (win.in_use and win.index == index and not win.filled[side]) {
+                win.held[side] = true;
+                return &win;
+            }
+            // the other channel never arrived for this one, recycle it
+            if (win.in_use and not(win.filled[0] and win.filled[1])
+                and not(win.held[0] or win.held[1])
+                and win.index + _windows.size() < index) {
+                win.in_use = false;
+            }
+            if (not win.in_use and free_win == nullptr) {
+                free_win = &win;
+            }
+        }
+        if (free_win == nullptr) {
+            _dropped++;
+            return nullptr;
+        }
+        free_win->index     = index;
+        free_win->time_secs = time_secs;
+        free_win->filled[0] = free_win->filled[1] = false;
+        free_win->held[0] = free_win->held[1] = false;
+        free_win->held[side] = true;
+        free_win->in_use     = true;
+        return free_win;
+    }
+
+    //! A gap cut the side's window short
+    void abandon(window* win, size_t side)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        win->held[side] = false;
+    }
+
+    template <typename pair_fn>
+    void submit(window* win, size_t side, pair_fn& on_pair)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        win->filled[side] = true;
+        win->held[side]   = false;
+        if (win->filled[0] and win->filled[1]) {
+            on_pair(win);
+        }
+    }
+
+    const uint64_t _span;
+    std::mutex& _mutex;
+    std::vector<window> _windows;
+    window* _current[2]; // only touched by the side's own thread
+    uint64_t _dropped;
+};